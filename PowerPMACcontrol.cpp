@@ -29,7 +29,12 @@
 
 //#include <sstream>
 #include <fstream>
+#include <algorithm>
+#include <stdlib.h>
+#include <ctype.h>
 #include "PowerPMACcontrol.h"
+#include "protocolHelpers.h"
+#include "replayDriver.h"
 #ifndef WIN32
 #include <errno.h>
 #endif
@@ -37,6 +42,115 @@
 namespace PowerPMACcontrol_ns
 {
 
+/// Arguments of PowerPMACcontrol_connect passed to the I/O thread
+struct ConnectContext
+{
+    PowerPMACcontrol *self;
+    const char *host;
+    const char *user;
+    const char *pwd;
+    const char *port;
+    bool nominus2;
+    bool safetyChannel;
+    Transport *transport;       ///< Transport to connect, or NULL to create one for the host. Set to NULL once taken
+};
+
+/// Results of PowerPMACcontrol_getReplayStatus filled in by the I/O thread
+struct ReplayStatusContext
+{
+    PowerPMACcontrol *self;
+    unsigned long *mismatches;
+    bool *finished;
+};
+
+/// Arguments of writeRead passed to the I/O thread
+struct WriteReadContext
+{
+    PowerPMACcontrol *self;
+    const char *cmd;
+    std::string *response;
+    int timeout;
+    int commandClass;
+    double submitTime;
+};
+
+/// Arguments of PowerPMACcontrol_progDownload and PowerPMACcontrol_progDownloadIncremental passed to the I/O thread
+struct ProgDownloadContext
+{
+    PowerPMACcontrol *self;
+    std::istream *progfile;         ///< The file of an incremental download
+    const char *program;            ///< The program of a download
+    size_t length;
+    bool incremental;
+    int blocksSent;
+    int blocksSkipped;
+    int errorLine;
+};
+
+/// Arguments of PowerPMACcontrol_progDownloadFile passed to the I/O thread
+struct FileDownloadContext
+{
+    PowerPMACcontrol *self;
+    const std::string *contents;
+    const std::string *remoteName;
+    int errorLine;
+};
+
+/// Arguments of PowerPMACcontrol_progUpload passed to the I/O thread
+struct ProgUploadContext
+{
+    PowerPMACcontrol *self;
+    const std::string *bufferName;
+    ProgramUploadSink sink;
+    void *userData;
+};
+
+/// Arguments of PowerPMACcontrol_getVariables and PowerPMACcontrol_setVariables passed to the I/O thread
+struct BatchContext
+{
+    PowerPMACcontrol *self;
+    const std::vector<std::string> *lines;
+    std::vector<std::string> *replies;
+    int commandClass;
+    void (*handler)(size_t line, const std::string& reply, int result, void *arg);
+    void *handlerArg;
+    bool stopOnError;
+};
+
+/// Arguments of the handler which passes the values of PowerPMACcontrol_getVariables to a VariableBatchSink
+struct VariableBatchContext
+{
+    const std::vector<std::string> *lines;
+    const std::vector<size_t> *firsts;
+    const std::vector<size_t> *counts;
+    VariableBatchSink sink;
+    void *userData;
+    int result;             ///< The first error of a line
+};
+
+/// Passes the values of PowerPMACcontrol_getVariables(names, values) to the vector of values
+static void collectValues(size_t first, size_t count, const std::vector<std::string>& values, int result, void *userData)
+{
+    if (result == PowerPMACcontrol::PPMACcontrolNoError)
+    {
+        std::copy(values.begin(), values.end(), ((std::vector<std::string> *)userData)->begin() + first);
+    }
+}
+
+/// Passes the listing of PowerPMACcontrol_progUpload(std::string, std::ostream&) to the stream
+static void writeToStream(const char *data, size_t length, void *userData)
+{
+    ((std::ostream *)userData)->write(data, (std::streamsize)length);
+}
+
+/// Arguments of PowerPMACcontrol_setDownloadCacheFile and PowerPMACcontrol_clearDownloadCache passed to the I/O thread
+struct DownloadCacheContext
+{
+    PowerPMACcontrol *self;
+    const char *filename;
+    bool clear;
+};
+
 
     /**
  * @brief Destructor for the PowerPMACcontrol.
@@ -45,16 +159,25 @@ namespace PowerPMACcontrol_ns
  */
 PowerPMACcontrol::~PowerPMACcontrol() {
     debugPrint_ppmaccomm("~PowerPMACcontrol() called\n");
+    // Stops the background task usage sampling before the connection is closed
+    taskCalculator->stopSampling();
     if (connected!=0)
     {
         this->PowerPMACcontrol_disconnect();
     }
+    delete taskCalculator;
+    delete ioThread;
     delete sshdriver;
-    
-#ifndef WIN32
-    sem_destroy(&sem_writeRead);
+    delete commandMetrics;
+    delete recorder;
+    delete downloadCache;
+    // Passes the last events to the sink
+    delete tracer;
+#ifdef WIN32
+    CloseHandle(ghSafetySemaphore);
+#else
+    sem_destroy(&sem_safety);
 #endif
-    
 }
 
 /**
@@ -64,27 +187,33 @@ PowerPMACcontrol::PowerPMACcontrol(){
     
     sshdriver = NULL;
     connected = 0;
+    recorder = new SessionRecorder();
+    downloadCache = new DownloadCache();
+    safetyDriver = NULL;
+    safetyConnected = 0;
+#ifdef WIN32
+    ghSafetySemaphore = CreateSemaphore(NULL, 1, 1, NULL);
+#else
+    sem_init(&sem_safety, 0, 1);
+#endif
 
     // Initialise the timeout
     common_timeout_ms = DEFAULT_TIMEOUT_MS;
+    downloadWindow = 1;
+    downloadPreprocessing = PreprocessNone;
+    downloadLineLength = (int)ProgramPreprocessor::DEFAULT_MAX_LINE_LENGTH;
 
-#ifdef WIN32    
-	ghSemaphore = CreateSemaphore(
-		NULL,
-		1,
-		1,
-		NULL);
-	if (this->ghSemaphore == NULL)
-#else
-    int semaphore_ret = sem_init(&sem_writeRead, 0,1);
-    if (semaphore_ret != 0)
-#endif
-	{
-		debugPrint_ppmaccomm("PowerPMACcontrol() : Error creating a semaphore\n");
-	}
-	else
-		debugPrint_ppmaccomm("PowerPMACcontrol() : a semaphore created\n");
+    // The connection is used only by its I/O thread, which runs the requests of the callers in turn
+    ioThread = new IOThread();
 
+    // Latency histograms and counters, always recorded
+    commandMetrics = new CommandMetrics();
+
+    // Trace of the commands, off until started by the user
+    tracer = new Tracer();
+
+    // Task usage calculator is kept for the lifetime of this object
+    taskCalculator = new TaskCalculator(this);
 }
 
 /**
@@ -94,13 +223,19 @@ PowerPMACcontrol::PowerPMACcontrol(){
  * Once the connection has
  * been established, it will start gpascii program on the Power PMAC.
  * 
- * @param host - Host name/IP address of the Power PMAC
- * @param user - User name for the SSH connection 
+ * @param host - Host name/IP address of the Power PMAC. A host name starting with "mock://", "sim://",
+ *                  "unix://<path>", "pipe://<command>" or "replay://<file>" selects another transport
+ *                  in place of SSH (see Transport::create).
+ * @param user - User name for the SSH connection
  * @param pwd - Password for the SSH connection 
  * @param port - Port number for the SSH connection (default 22)
  * @param nominus2 - If true, remove the '-2' option on the command sent to start gpascii:
  * 					'gpascii -2' (nominus2 = false, default),
  * 					'gpascii' (nominus2 = true).
+ * @param safetyChannel - If true, a second gpascii session is opened and reserved for
+ *                  PowerPMACcontrol_stopAllAxes, PowerPMACcontrol_abortAllMprogs,
+ *                  PowerPMACcontrol_axisAbort and PowerPMACcontrol_abortMprog, so that these
+ *                  commands never wait behind other traffic such as a program download (default false).
  * @return If successful, PPMACcontrolNoError(0) is returned. If not, 
  * minus value is returned. Possible error codes are :
  *      - PPMACcontrolNoError(0)
@@ -121,10 +256,12 @@ PowerPMACcontrol::PowerPMACcontrol(){
  *      - PPMACcontrolSemaphoreTimeoutError (-239)
  *      - PPMACcontrolSemaphoreError (-240)
  *      - PPMACcontrolSemaphoreReleaseError (-241)
+ *      - PPMACcontrolSoftwareError (-232) if the task usage sampling was running and could not be started again
  *      .
  */
 int PowerPMACcontrol::PowerPMACcontrol_connect(const char *host, const char *user, 
-                                                        const char *pwd, const char *port, const bool nominus2){
+                                                        const char *pwd, const char *port, const bool nominus2,
+                                                        const bool safetyChannel){
     static const char *functionName = "PowerPMACcontrol::PowerPMACcontrol_connect";
     
     if (strlen(host) > 255)
@@ -135,231 +272,460 @@ int PowerPMACcontrol::PowerPMACcontrol_connect(const char *host, const char *use
         
     }
     
-    
+    ConnectContext context;
+    context.self = this;
+    context.host = host;
+    context.user = user;
+    context.pwd = pwd;
+    context.port = port;
+    context.nominus2 = nominus2;
+    context.safetyChannel = safetyChannel;
+    context.transport = NULL;
+
+    return runConnectTask(&context);
+}
+
+/**
+ * @brief Play back a session log recorded with PowerPMACcontrol_setRecordFile instead of connecting to a Power PMAC.
+ *
+ * The log replaces the SSH connection. Each command written is checked against the bytes recorded as sent,
+ * and the bytes recorded as received after it are returned as the reply. The rest of the library runs as it
+ * would with a controller, so field problems can be reproduced and changes to the parsing and the request
+ * scheduling measured against real traffic. The replay must make the same calls in the same order as the
+ * recorded session, starting with the connection; PowerPMACcontrol_getReplayStatus reports any difference.
+ *
+ * @param filename - Session log to play back
+ * @param speed - 1.0 to return the replies with their original timing, 2.0 for twice as fast and so on,
+ * or 0 to return them as fast as possible
+ * @param nominus2 - Must be the same as when the session was recorded
+ * @return If successful, PPMACcontrolNoError(0) is returned. If not,
+ * minus value is returned. The possible error codes are the same as PowerPMACcontrol_connect.
+ * PPMACcontrolSSHDriverError (-102) is returned if the log cannot be read.
+ */
+int PowerPMACcontrol::PowerPMACcontrol_connectReplay(const char *filename, double speed, const bool nominus2){
+    if (filename == NULL || speed < 0.0)
+    {
+        return PPMACcontrolInvalidParamError;
+    }
+
+    return PowerPMACcontrol_connectTransport(new ReplayDriver( filename, speed ), nominus2);
+}
+
+/**
+ * @brief Connect through a transport created by the caller instead of one selected from a host name.
+ *
+ * PowerPMACcontrol_connect selects the transport from the host name: "mock://" for an in-process
+ * stand-in for gpascii, "sim://" for the simulated Power PMAC, "unix://<path>" for a Unix-domain socket,
+ * "pipe://<command>" for a local program, "replay://<file>" for a session log and anything else for
+ * an SSH connection.
+ * This function is for transports which need more set up, for example a MockTransport with a responder
+ * or an SSHDriver with key files. The user name, password and port set in the transport are kept.
+ * The safety channel is not available with a transport given by the caller.
+ *
+ * @param transport - Transport to connect. PowerPMACcontrol takes ownership and deletes it
+ * @param nominus2 - If true, start gpascii without the '-2' option
+ * @return If successful, PPMACcontrolNoError(0) is returned. If not,
+ * minus value is returned. The possible error codes are the same as PowerPMACcontrol_connect.
+ */
+int PowerPMACcontrol::PowerPMACcontrol_connectTransport(Transport *transport, const bool nominus2){
+    if (transport == NULL)
+    {
+        return PPMACcontrolInvalidParamError;
+    }
+
+    ConnectContext context;
+    context.self = this;
+    context.host = "transport";
+    context.user = NULL;
+    context.pwd = NULL;
+    context.port = NULL;
+    context.nominus2 = nominus2;
+    context.safetyChannel = false;
+    context.transport = transport;
+
+    int ret = runConnectTask(&context);
+    if (context.transport != NULL)
+    {
+        // The request never ran, so the transport was not taken
+        delete context.transport;
+    }
+    return ret;
+}
+
+/**
+ * @brief Record every byte sent and received on the main connection to a session log.
+ *
+ * Recording starts with the next call to PowerPMACcontrol_connect, which overwrites the file, and stops when
+ * the connection is closed. The log holds the bytes with their monotonic timestamps in a compact binary format
+ * (see sessionRecorder.h) and can be played back with PowerPMACcontrol_connectReplay. The safety channel is not recorded.
+ * This function must not be called while PowerPMACcontrol_connect is running.
+ *
+ * @param filename - Name of the session log, or NULL or an empty string to stop recording from the next connection
+ * @return Always returns PPMACcontrolNoError(0) because no communication occurs in this function
+ */
+int PowerPMACcontrol::PowerPMACcontrol_setRecordFile(const char *filename){
+    recordFile = (filename == NULL) ? "" : filename;
+    return PPMACcontrolNoError;
+}
+
+/**
+ * @brief Get the progress of the session log played back by PowerPMACcontrol_connectReplay.
+ *
+ * @param mismatches - Number of writes which differed from the bytes recorded as sent
+ * @param finished - true when every record of the log has been played back
+ * @return PPMACcontrolNoError(0), or PPMACcontrolNoSSHDriverSet (-230) if no session log is being played back
+ */
+int PowerPMACcontrol::PowerPMACcontrol_getReplayStatus(unsigned long& mismatches, bool& finished){
+    ReplayStatusContext context;
+    context.self = this;
+    context.mismatches = &mismatches;
+    context.finished = &finished;
+    return runOnIOThread(replayStatusTask, &context, RequestPriorityNormal, -1);
+}
+
+/**
+ * @brief Read the progress of the replay on the I/O thread, which owns the driver.
+ */
+int PowerPMACcontrol::replayStatusTask(void *arg){
+    ReplayStatusContext *context = (ReplayStatusContext *)arg;
+    ReplayDriver *replay = dynamic_cast<ReplayDriver *>(context->self->sshdriver);
+    if (replay == NULL)
+    {
+        return PPMACcontrolNoSSHDriverSet;
+    }
+    *context->mismatches = replay->getMismatches();
+    *context->finished = replay->isFinished();
+    return PPMACcontrolNoError;
+}
+
+/**
+ * @brief Run connectTask on the I/O thread, with the background task usage sampling stopped meanwhile.
+ *
+ * The sampler sends its commands through the I/O thread, so it cannot be stopped from there.
+ * If it was running, it is started again with the same period and history length once connected.
+ *
+ * @param context - The ConnectContext of the connection
+ * @return The same as openConnection, or PPMACcontrolSoftwareError (-232) if the sampling could not be started again
+ */
+int PowerPMACcontrol::runConnectTask(void *context){
+    static const char *functionName = "PowerPMACcontrol::runConnectTask";
+    bool wasSampling = taskCalculator->isSampling();
+    int period_ms = taskCalculator->getSamplingPeriod();
+    int historyLength = taskCalculator->getHistoryLength();
+    taskCalculator->stopSampling();
+
+    //The session is created and used only by the I/O thread. Wait for our turn, however long it takes
+    int ret = runOnIOThread(connectTask, context, RequestPriorityNormal, -1);
+    if (ret == PPMACcontrolNoError && wasSampling)
+    {
+        ret = taskCalculator->startSampling(period_ms, historyLength);
+        if (ret != PPMACcontrolNoError)
+        {
+            debugPrint_ppmaccomm("%s : Error starting the task usage sampling again (%d)\n", functionName, ret);
+        }
+    }
+    return ret;
+}
+
+/**
+ * @brief Run openConnection on the I/O thread.
+ */
+int PowerPMACcontrol::connectTask(void *arg){
+    ConnectContext *context = (ConnectContext *)arg;
+    Transport *transport = context->transport;
+    context->transport = NULL;
+    return context->self->openConnection(context->host, context->user, context->pwd,
+                                         context->port, context->nominus2, context->safetyChannel,
+                                         transport);
+}
+
+/**
+ * @brief Create the connections and start gpascii. Runs on the I/O thread.
+ *
+ * The parameters and the return value are the same as PowerPMACcontrol_connect, except transport,
+ * which is used for the main connection if not NULL. Otherwise it is created from the host name.
+ */
+int PowerPMACcontrol::openConnection(const char *host, const char *user, const char *pwd,
+                                     const char *port, const bool nominus2, const bool safetyChannel,
+                                     Transport *transport){
+    static const char *functionName = "PowerPMACcontrol::openConnection";
     int return_val = PPMACcontrolNoError;
-    //get semaphore
-#ifdef WIN32    
-	DWORD dwWaitResult = WaitForSingleObject(this->ghSemaphore, INFINITE);
-    if (dwWaitResult == WAIT_OBJECT_0)
-#else
-    int sem_return = sem_wait(&sem_writeRead);
-    if (sem_return == 0)
-#endif
+
+    // In case it's already connected
+    bool reconnect = (sshdriver != NULL);
+    if (sshdriver!=NULL)   //If sshdriver has been created
     {
-    
-    
-        // In case it's already connected
-        if (sshdriver!=NULL)   //If sshdriver has been created
+        // Already on the I/O thread, and the sampling was stopped by runConnectTask
+        closeConnection();
+        delete sshdriver;
+    }
+
+
+    if (transport != NULL)
+    {
+        sshdriver = transport;
+    }
+    else
+    {
+        sshdriver = Transport::create( host );
+    }
+    controllerName = host;
+    if (port != NULL && strcmp(port, "22") != 0)
+    {
+        controllerName = controllerName + ":" + port;
+    }
+    if (!recordFile.empty())
+    {
+        if (!recorder->open(recordFile.c_str()))
         {
-            printf("this connected is %d\n",this->connected );
-            this->PowerPMACcontrol_disconnect();
-            printf("this connected is %d\n",this->connected );
-            delete sshdriver;
+            debugPrint_ppmaccomm("%s : Error creating the session log %s\n", functionName, recordFile.c_str());
+            return PPMACcontrolFileOpenError;
         }
+        sshdriver->setRecorder(recorder);
+    }
+    return_val = connectDriver(sshdriver, user, pwd, port, nominus2);
+    if (return_val != PPMACcontrolNoError)
+    {
+        // Keep what was recorded of the failed connection
+        recorder->close();
+    }
+    else
+    {
+        this->connected = 1;
+        commandMetrics->recordConnect(reconnect);
 
+        if (safetyChannel)
+        {
+            // Open a second gpascii session reserved for stop and abort commands
+            safetyDriver = Transport::create( host );
+            int safety_return = connectDriver(safetyDriver, user, pwd, port, nominus2);
+            if (safety_return == PPMACcontrolNoError)
+            {
+                this->safetyConnected = 1;
+            }
+            else
+            {
+                debugPrint_ppmaccomm("%s : Error opening the safety channel (%d)\n", functionName, safety_return);
+                delete safetyDriver;
+                safetyDriver = NULL;
+                // The caller asked for a safety channel, so do not leave a half-made connection
+                closeConnection();
+                return_val = safety_return;
+            }
+        }
+    }
+    if (tracer->isEnabled())
+    {
+        tracer->traceEvent(TraceEventConnect, TraceChannelMain, -1, host, return_val);
+    }
+    return return_val;
+}
 
-        sshdriver = new SSHDriver( host );
-        SSHDriverStatus ret = sshdriver->setUsername(user);
+/**
+ * @brief Connect a transport to the Power PMAC and start the gpascii program on it.
+ *
+ * Used for the main connection and for the optional safety channel.
+ *
+ * @param driver - Transport created for the host
+ * @param user - User name for the SSH connection, or NULL to keep the one set in the transport
+ * @param pwd - Password for the SSH connection, or NULL to keep the one set in the transport
+ * @param port - Port number for the SSH connection, or NULL to keep the one set in the transport
+ * @param nominus2 - If true, start gpascii without the '-2' option
+ * @return If successful, PPMACcontrolNoError(0) is returned. If not,
+ * minus value is returned. The possible error codes are the same as PowerPMACcontrol_connect
+ * except for those of the request queue.
+ */
+int PowerPMACcontrol::connectDriver(Transport *driver, const char *user, const char *pwd, const char *port, const bool nominus2){
+    static const char *functionName = "PowerPMACcontrol::connectDriver";
+    int return_val = PPMACcontrolNoError;
+    // A transport given by the caller has been set up already
+    SSHDriverStatus ret = (user != NULL) ? driver->setUsername(user) : SSHDriverSuccess;
+    if (ret != SSHDriverSuccess)
+    {
+        if (ret == SSHDriverErrorInvalidParameter)
+            return_val = PPMACcontrolInvalidUserNameError;
+        else
+            return_val = PPMACcontrolSSHDriverError; //This can't happen
+    }
+    else
+    {
+        ret = (pwd != NULL) ? driver->setPassword(pwd) : SSHDriverSuccess;
         if (ret != SSHDriverSuccess)
         {
             if (ret == SSHDriverErrorInvalidParameter)
-                return_val = PPMACcontrolInvalidUserNameError;
+                return_val = PPMACcontrolInvalidPasswordError;
             else
                 return_val = PPMACcontrolSSHDriverError; //This can't happen
         }
         else
         {
-            ret = sshdriver->setPassword(pwd);
+            ret = SSHDriverSuccess;
+            if (port != NULL)
+            {
+                debugPrint_ppmaccomm("%s : Setting port to %s\n", functionName, port);
+                ret = driver->setPort(port);
+            }
             if (ret != SSHDriverSuccess)
             {
                 if (ret == SSHDriverErrorInvalidParameter)
-                    return_val = PPMACcontrolInvalidPasswordError;
+                    return_val = PPMACcontrolInvalidPortError;
                 else
                     return_val = PPMACcontrolSSHDriverError; //This can't happen
             }
             else
             {
-                debugPrint_ppmaccomm("%s : Setting port to %s\n", functionName, port);
-                ret = sshdriver->setPort(port);
+            
+
+                ret = driver->connectTransport();
                 if (ret != SSHDriverSuccess)
                 {
-                    if (ret == SSHDriverErrorInvalidParameter)
-                        return_val = PPMACcontrolInvalidPortError;
-                    else
-                        return_val = PPMACcontrolSSHDriverError; //This can't happen
+                    int estatus;
+                    switch (ret){
+                        case SSHDriverErrorUnknownHost:
+                            estatus = PPMACcontrolSSHDriverErrorUnknownHost;
+                            break;
+                        case SSHDriverErrorSshInit:
+                            estatus = PPMACcontrolSSHDriverErrorSshInit;
+                            break;
+                        case SSHDriverErrorSockfail:
+                            estatus = PPMACcontrolSSHDriverErrorSockfail;
+                            break;
+                        case SSHDriverErrorSshSession:
+                            estatus = PPMACcontrolSSHDriverErrorSshSession;
+                            break;
+                        case SSHDriverErrorPassword:
+                            estatus = PPMACcontrolSSHDriverErrorPassword;
+                            break;                
+                        case SSHDriverErrorPublicKey:
+                            estatus = PPMACcontrolSSHDriverErrorPublicKey;
+                            break;      
+                        case SSHDriverErrorPty:
+                            estatus = PPMACcontrolSSHDriverErrorPty;
+                            break;                 
+                        case SSHDriverErrorShell:
+                            estatus = PPMACcontrolSSHDriverErrorShell;
+                            break;
+                        case SSHDriverErrorInvalidParameter:
+                            estatus = PPMACcontrolSSHDriverErrorInvalidParameter;
+                            break;
+                        default:
+                            estatus = PPMACcontrolSSHDriverError;
+                    }
+                    return_val = estatus;
                 }
                 else
                 {
-                
-
-                    ret = sshdriver->connectSSH();
-                    if (ret != SSHDriverSuccess)
+                    //Start the gpascii program on the powerPmac
+                    char buff[512] = "";
+                    size_t bytes = 0;
+                    if (nominus2)
                     {
-                        int estatus;
-                        switch (ret){
-                            case SSHDriverErrorUnknownHost:
-                                estatus = PPMACcontrolSSHDriverErrorUnknownHost;
-                                break;
-                            case SSHDriverErrorSshInit:
-                                estatus = PPMACcontrolSSHDriverErrorSshInit;
-                                break;
-                            case SSHDriverErrorSockfail:
-                                estatus = PPMACcontrolSSHDriverErrorSockfail;
-                                break;
-                            case SSHDriverErrorSshSession:
-                                estatus = PPMACcontrolSSHDriverErrorSshSession;
-                                break;
-                            case SSHDriverErrorPassword:
-                                estatus = PPMACcontrolSSHDriverErrorPassword;
-                                break;                
-                            case SSHDriverErrorPublicKey:
-                                estatus = PPMACcontrolSSHDriverErrorPublicKey;
-                                break;      
-                            case SSHDriverErrorPty:
-                                estatus = PPMACcontrolSSHDriverErrorPty;
-                                break;                 
-                            case SSHDriverErrorShell:
-                                estatus = PPMACcontrolSSHDriverErrorShell;
-                                break;
-                            case SSHDriverErrorInvalidParameter:
-                                estatus = PPMACcontrolSSHDriverErrorInvalidParameter;
-                                break;
-                            default:
-                                estatus = PPMACcontrolSSHDriverError;
-                        }
-                        return_val = estatus;
+                    	// don't use the -2 option
+                    	strcpy(buff, "gpascii\n");
                     }
                     else
                     {
-                        //Start the gpascii program on the powerPmac
-                        char buff[512] = "";
-                        size_t bytes = 0;
-                        if (nominus2)
-                        {
-                        	// don't use the -2 option
-                        	strcpy(buff, "gpascii\n");
-                        }
-                        else
-                        {
-                        	// use the -2 option
-                        	strcpy(buff, "gpascii -2\n");
-                        }
+                    	// use the -2 option
+                    	strcpy(buff, "gpascii -2\n");
+                    }
 
-                        debugPrint_ppmaccomm("%s : Writing '%s' to the powerpmac\n", functionName, buff);
-                        int ret2 = this->PowerPMACcontrol_write(buff, strlen(buff), &bytes, 1000);
+                    debugPrint_ppmaccomm("%s : Writing '%s' to the powerpmac\n", functionName, buff);
+                    int ret2 = driverWrite(driver, buff, strlen(buff), &bytes, 1000);
 
+                    if (ret2 != PPMACcontrolNoError)
+                    {
+                      debugPrint_ppmaccomm("%s : Error while writing 'gpascii -2' to the powerpmac\n", functionName);
+                      return_val = ret2;
+                    }
+                    else
+                    {
+                        debugPrint_ppmaccomm("%s : Reading reply to 'gpascii -2' from the powerpmac\n", functionName);
+                        ret2 = driverRead(driver, buff, 512, &bytes, '\n', 2000);
                         if (ret2 != PPMACcontrolNoError)
                         {
-                          debugPrint_ppmaccomm("%s : Error while writing 'gpascii -2' to the powerpmac\n", functionName);
+                          debugPrint_ppmaccomm("%s : Error while reading reply to 'gpascii -2' command from the powerpmac\n", functionName);
                           return_val = ret2;
                         }
                         else
                         {
-                            debugPrint_ppmaccomm("%s : Reading reply to 'gpascii -2' from the powerpmac\n", functionName);
-                            ret2 = this->PowerPMACcontrol_read(buff, 512, &bytes, '\n', 2000);
+                            debugPrint_ppmaccomm("%s : Setting 'echo7' to the powerpmac\n", functionName);
+                            strcpy(buff, "echo7\n");
+                            debugPrint_ppmaccomm("%s : Writing 'echo7' to the powerpmac\n", functionName);
+                            ret2 = driverWrite(driver, buff, strlen(buff), &bytes, 1000);
+
                             if (ret2 != PPMACcontrolNoError)
                             {
-                              debugPrint_ppmaccomm("%s : Error while reading reply to 'gpascii -2' command from the powerpmac\n", functionName);
+                              debugPrint_ppmaccomm("%s : Error while writing 'echo7' to the powerpmac\n", functionName);
                               return_val = ret2;
                             }
                             else
                             {
-                                debugPrint_ppmaccomm("%s : Setting 'echo7' to the powerpmac\n", functionName);
-                                strcpy(buff, "echo7\n");
-                                debugPrint_ppmaccomm("%s : Writing 'echo7' to the powerpmac\n", functionName);
-                                ret2 = this->PowerPMACcontrol_write(buff, strlen(buff), &bytes, 1000);
-
+                                ret2 = driverRead(driver, buff, 512, &bytes, '\n', 2000);
                                 if (ret2 != PPMACcontrolNoError)
                                 {
-                                  debugPrint_ppmaccomm("%s : Error while writing 'echo7' to the powerpmac\n", functionName);
+                                  debugPrint_ppmaccomm("%s : Error while reading reply to 'gpascii' command from the powerpmac\n", functionName);
                                   return_val = ret2;
                                 }
-                                else
-                                {
-                                    ret2 = this->PowerPMACcontrol_read(buff, 512, &bytes, '\n', 2000);
-                                    if (ret2 != PPMACcontrolNoError)
-                                    {
-                                      debugPrint_ppmaccomm("%s : Error while reading reply to 'gpascii' command from the powerpmac\n", functionName);
-                                      return_val = ret2;
-                                    }
-                                    else
-                                        this->connected = 1;
-                                }
                             }
                         }
                     }
                 }
             }
         }
-        //Release Semaphore
-#ifdef WIN32 
-		if (!ReleaseSemaphore(ghSemaphore, 1, NULL))
-		{
-            return_val = PPMACcontrolSemaphoreReleaseError;
-			debugPrint_ppmaccomm("%s : Error releasing Semaphore\n",functionName);
-		}
-        else
-        {
-            debugPrint_ppmaccomm("%s : Released Semaphore\n",functionName);
-        }
-#else
-        if (sem_post(&sem_writeRead)!=0)
-        {
-            return_val = PPMACcontrolSemaphoreReleaseError;
-            debugPrint_ppmaccomm("%s : Error releasing Semaphore\n",functionName);
-        }
-        else
-        {
-            debugPrint_ppmaccomm("%s : Released Semaphore\n",functionName);
-        }
-#endif
-        return return_val;
-    }
-#ifdef WIN32 
-	else if (dwWaitResult == WAIT_TIMEOUT)
-	{
-        debugPrint_ppmaccomm("%s : Semaphore timed out\n",functionName);
-        return PPMACcontrolSemaphoreTimeoutError;
-	}	
-    else
-	{
-        debugPrint_ppmaccomm("%s : Error obtaining a Semaphore (%d)\n",functionName, dwWaitResult);
-        return PPMACcontrolSemaphoreError;
-	}
-#else
-    else
-	{
-        if (errno == ETIMEDOUT)
-        {
-			debugPrint_ppmaccomm("%s : Semaphore timed out\n",functionName);
-			return PPMACcontrolSemaphoreTimeoutError;
-        }
-        else
-        {	
-            debugPrint_ppmaccomm("%s : Semaphore error %d\n",functionName, errno);
-			return PPMACcontrolSemaphoreError;
-        }    
     }
-#endif
+    return return_val;
 }
 
 /**
  * @brief Close the SSH connection.
  * 
+ * The background task usage sampling is stopped first, so that it sends no more commands while the connection closes.
+ *
  * @return If successful, PPMACcontrolNoError(0) is returned. 
  * If not PPMACcontrolSSHDriverError (-102).
  */
 int PowerPMACcontrol::PowerPMACcontrol_disconnect(){
-//    static const char *functionName = "PowerPMACcontrol::PowerPMACcontrol_disconnect";
+    taskCalculator->stopSampling();
+    //Wait for any request in progress to finish, however long it takes
+    return runOnIOThread(disconnectTask, this, RequestPriorityNormal, -1);
+}
+
+/**
+ * @brief Run closeConnection on the I/O thread.
+ */
+int PowerPMACcontrol::disconnectTask(void *arg){
+    return ((PowerPMACcontrol *)arg)->closeConnection();
+}
+
+/**
+ * @brief Close the SSH connections. Runs on the I/O thread.
+ *
+ * @return The same as PowerPMACcontrol_disconnect
+ */
+int PowerPMACcontrol::closeConnection(){
+    if (this->safetyDriver != NULL)
+    {
+        lockSafetyChannel(-1);
+        this->safetyConnected = 0;
+        safetyDriver->disconnectTransport();
+        delete safetyDriver;
+        safetyDriver = NULL;
+        unlockSafetyChannel();
+    }
     if (this->sshdriver != NULL)
     {
-        int ret = sshdriver->disconnectSSH();
+        int ret = sshdriver->disconnectTransport();
+        if (tracer->isEnabled())
+        {
+            tracer->traceEvent(TraceEventDisconnect, TraceChannelMain, -1, NULL, PPMACcontrolNoError);
+        }
+        recorder->close();
         if (ret == SSHDriverSuccess)
         {
             this->connected = 0;
             return PPMACcontrolNoError;
         }
-        return PPMACcontrolSSHDriverError; //sshdriver->disconnectSSH() always return No error.
+        return PPMACcontrolSSHDriverError; //sshdriver->disconnectTransport() always return No error.
     }
     return PPMACcontrolNoError; //Not connected. No error.
 }
@@ -437,6 +803,76 @@ int PowerPMACcontrol::PowerPMACcontrol_setTimeout(int timeout_ms){
 	}
 
 }
+/**
+ * @brief Return the number of program lines kept in flight by a download
+ * @param lines Variable to receive the number of lines
+ * @return Always returns PPMACcontrolNoError(0) because no communication occurs in this function
+ */
+int PowerPMACcontrol::PowerPMACcontrol_getDownloadWindow(int & lines){
+	lines = downloadWindow;
+	return PPMACcontrolNoError;
+}
+/**
+ * @brief Set the number of program lines kept in flight by PowerPMACcontrol_progDownload
+ * and PowerPMACcontrol_progDownloadIncremental.
+ *
+ * With a window of 1, the default, each line is sent after the reply to the line before,
+ * so a download takes one round trip per line. With a larger window up to that many lines
+ * are written before their replies are read, and the replies are matched to the lines in order.
+ * The download is then limited by the bandwidth of the connection rather than its latency.
+ * Lines already in flight when a line fails are still run by gpascii.
+ *
+ * @param lines Number of lines, 1 to 256
+ * @return If successful, PPMACcontrolNoError (0) is returned.
+ * If an invalid number is entered, PPMACcontrolInvalidParamError (-242) is returned.
+ */
+int PowerPMACcontrol::PowerPMACcontrol_setDownloadWindow(int lines){
+	if (lines < 1 || lines > MAX_DOWNLOAD_WINDOW)
+	{
+		return PPMACcontrolInvalidParamError;
+	}
+	downloadWindow = lines;
+	return PPMACcontrolNoError;
+}
+/**
+ * @brief Return the preprocessing applied to programs before they are downloaded
+ * @param options Variable to receive the PreprocessOption values combined with '|'
+ * @param maxLineLength Variable to receive the longest line made by joining lines
+ * @return Always returns PPMACcontrolNoError(0) because no communication occurs in this function
+ */
+int PowerPMACcontrol::PowerPMACcontrol_getDownloadPreprocessing(int & options, int & maxLineLength){
+	options = downloadPreprocessing;
+	maxLineLength = downloadLineLength;
+	return PPMACcontrolNoError;
+}
+/**
+ * @brief Set the preprocessing applied to programs by PowerPMACcontrol_progDownload,
+ * PowerPMACcontrol_progDownloadIncremental and PowerPMACcontrol_progDownloadFile.
+ *
+ * The program is rewritten on the computer before any of it is sent: comments, indentation
+ * and blank lines, which would otherwise be sent and waited for line by line, are removed,
+ * and lines of plain assignments are joined up to maxLineLength characters, so that the
+ * download takes fewer round trips. See ProgramPreprocessor for the lines which are joined.
+ * With PreprocessCheckStructure, a program with unbalanced brackets or quotes, or an 'open'
+ * or 'close' out of place, is rejected without being sent.
+ * Line numbers reported by the downloads are those of the program before preprocessing; the
+ * error of a joined line is reported at the first line joined.
+ * No preprocessing, PreprocessNone, is the default.
+ *
+ * @param options PreprocessOption values combined with '|'
+ * @param maxLineLength Longest line made by joining lines, 1 to 1022 (MAX_LINE_LENGTH)
+ * @return If successful, PPMACcontrolNoError (0) is returned.
+ * If an invalid option or length is entered, PPMACcontrolInvalidParamError (-242) is returned.
+ */
+int PowerPMACcontrol::PowerPMACcontrol_setDownloadPreprocessing(int options, int maxLineLength){
+	if ((options & ~PreprocessAll) != 0 || maxLineLength < 1 || maxLineLength > MAX_LINE_LENGTH)
+	{
+		return PPMACcontrolInvalidParamError;
+	}
+	downloadPreprocessing = options;
+	downloadLineLength = maxLineLength;
+	return PPMACcontrolNoError;
+}
 /**
  * @brief Write data to the connected SSH channel.
  * 
@@ -457,18 +893,33 @@ int PowerPMACcontrol::PowerPMACcontrol_setTimeout(int timeout_ms){
  */
 int PowerPMACcontrol::PowerPMACcontrol_write(const char *buffer, size_t bufferSize, size_t *bytesWritten, int timeout)
 {
-    static const char *functionName = "PowerPMACcontrol::PowerPMACcontrol_write";
     //if (this->connected == 0)
     //{
     //    debugPrint_ppmaccomm("%s : PMAC is not connected\n", functionName);
     //    return PPMACcontrolNoSSHDriverSet;
     //}
-    if (sshdriver == NULL)
+    return driverWrite(sshdriver, buffer, bufferSize, bytesWritten, timeout);
+}
+
+/**
+ * @brief Write data to the SSH channel of the given driver.
+ *
+ * @param driver - The main or safety channel SSH driver
+ * @param buffer - The string buffer to be written.
+ * @param bufferSize - The number of bytes to write.
+ * @param bytesWritten - The number of bytes that were written.
+ * @param timeout - A timeout in ms for the write.
+ * @return The same as PowerPMACcontrol_write
+ */
+int PowerPMACcontrol::driverWrite(Transport *driver, const char *buffer, size_t bufferSize, size_t *bytesWritten, int timeout)
+{
+    static const char *functionName = "PowerPMACcontrol::driverWrite";
+    if (driver == NULL)
     {
         debugPrint_ppmaccomm("%s : SSH driver not set\n", functionName);
         return PPMACcontrolNoSSHDriverSet;        
     }
-    int ret = sshdriver->write(buffer, bufferSize, bytesWritten, timeout);
+    int ret = driver->write(buffer, bufferSize, bytesWritten, timeout);
     if (ret == SSHDriverSuccess)
     {
         return PPMACcontrolNoError;
@@ -519,15 +970,31 @@ int PowerPMACcontrol::PowerPMACcontrol_write(const char *buffer, size_t bufferSi
  */
 int PowerPMACcontrol::PowerPMACcontrol_read(char *buffer, size_t bufferSize, size_t *bytesRead, int readTerm, int timeout)
 {
-    static const char *functionName = "PowerPMACcontrol::powerpmac_connect";
     //if (this->connected == 0)
-    if (this->sshdriver == NULL)
+    return driverRead(sshdriver, buffer, bufferSize, bytesRead, readTerm, timeout);
+}
+
+/**
+ * @brief Read data from the SSH channel of the given driver.
+ *
+ * @param driver - The main or safety channel SSH driver
+ * @param buffer - A string buffer to hold the read data.
+ * @param bufferSize - The maximum number of bytes to read.
+ * @param bytesRead - The number of bytes that have been read.
+ * @param readTerm - A terminator to use as a check for EOM (End Of Message).
+ * @param timeout - A timeout in ms for the read.
+ * @return The same as PowerPMACcontrol_read
+ */
+int PowerPMACcontrol::driverRead(Transport *driver, char *buffer, size_t bufferSize, size_t *bytesRead, int readTerm, int timeout)
+{
+    static const char *functionName = "PowerPMACcontrol::driverRead";
+    if (driver == NULL)
     {
         debugPrint_ppmaccomm("%s : SSH driver is not set\n", functionName);
         return PPMACcontrolNoSSHDriverSet;
     }
     debugPrint_ppmaccomm("%s : buffer size is %d\n", functionName, bufferSize);
-    SSHDriverStatus ret = sshdriver->read(buffer, bufferSize, bytesRead, readTerm, timeout);
+    SSHDriverStatus ret = driver->read(buffer, bufferSize, bytesRead, readTerm, timeout);
     if (ret == SSHDriverSuccess)
     {
         return PPMACcontrolNoError;
@@ -629,14 +1096,14 @@ int PowerPMACcontrol::PowerPMACcontrol_getProgNames(int& num, std::vector<std::s
     
     std::vector<std::string> progstatus;
     
-    ret = PowerPMACcontrol::splitit(reply, "\r\n", progstatus);
+    ret = splitit(reply, "\r\n", progstatus);
     if (ret != PPMACcontrolNoError)
         return PPMACcontrolPMACUnexpectedReplyError;
     try{
         for (size_t i=0; i<progstatus.size(); i++)
         {
             std::vector<std::string> tmp;
-            ret = PowerPMACcontrol::splitit(progstatus.at(i), " ", tmp);
+            ret = splitit(progstatus.at(i), " ", tmp);
             if (ret != PPMACcontrolNoError)
             {
                 num=0;
@@ -795,10 +1262,10 @@ int PowerPMACcontrol::PowerPMACcontrol_axisSetVelocity(int axis, double velocity
     static const char *functionName = "PowerPMACcontrol::PowerPMACcontrol_axisSetVelocity";
     debugPrint_ppmaccomm("%s called", functionName);
     
-    char cmd[128] = {0};
-    sprintf( cmd, "Motor[%d].JogSpeed=%f\n", axis, velocity);
+    CommandBuilder cmd;
+    cmd.append("Motor[").append(axis).append("].JogSpeed=").append(velocity).append('\n');
   
-    return writeRead(cmd);
+    return writeRead(cmd.c_str());
 }
 
 /**
@@ -828,10 +1295,10 @@ int PowerPMACcontrol::PowerPMACcontrol_axisDefCurrentPos(int axis, double newpos
     static const char *functionName = "PowerPMACcontrol::PowerPMACcontrol_axisDefCurrentPos";
     debugPrint_ppmaccomm("%s called", functionName);
     
-    char cmd[128] = {0};
-    sprintf( cmd, "#%dk Motor[%d].Pos=%f\n", axis, axis, newpos);
+    CommandBuilder cmd;
+    cmd.append('#').append(axis).append("k Motor[").append(axis).append("].Pos=").append(newpos).append('\n');
   
-    return writeRead(cmd);
+    return writeRead(cmd.c_str());
 }
 
 /**
@@ -910,10 +1377,10 @@ int PowerPMACcontrol::PowerPMACcontrol_axisSetAcceleration(int axis, double acce
     static const char *functionName = "PowerPMACcontrol::PowerPMACcontrol_axisSetAcceleration";
     debugPrint_ppmaccomm("%s called", functionName);
     
-    char cmd[128] = {0};
-    sprintf( cmd, "Motor[%d].JogTa=%f\n", axis, acceleration);
+    CommandBuilder cmd;
+    cmd.append("Motor[").append(axis).append("].JogTa=").append(acceleration).append('\n');
   
-    return writeRead(cmd);
+    return writeRead(cmd.c_str());
 }
 
 /**
@@ -991,10 +1458,10 @@ int PowerPMACcontrol::PowerPMACcontrol_axisGetDeadband(int axis, double& deadban
 int PowerPMACcontrol::PowerPMACcontrol_axisSetDeadband(int axis, double deadband){
     static const char *functionName = "PowerPMACcontrol::PowerPMACcontrol_axisSetDeadband";
     debugPrint_ppmaccomm("%s called", functionName);
-    char cmd[128] = {0};
-    sprintf( cmd, "Motor[%d].Servo.OutDbOn=%f\n", axis, deadband);
+    CommandBuilder cmd;
+    cmd.append("Motor[").append(axis).append("].Servo.OutDbOn=").append(deadband).append('\n');
   
-    return writeRead(cmd);
+    return writeRead(cmd.c_str());
 }
 
 /**
@@ -1038,7 +1505,7 @@ int PowerPMACcontrol::PowerPMACcontrol_axisGetSoftwareLimits(int axis, double& m
         return ret;
 
     std::vector<std::string> ss;
-    ret = PowerPMACcontrol::splitit(reply, "\n", ss);
+    ret = splitit(reply, "\n", ss);
     if (ret != PPMACcontrolNoError)
         return PPMACcontrolPMACUnexpectedReplyError;
     if (ss.size() != 2)
@@ -1093,10 +1560,11 @@ int PowerPMACcontrol::PowerPMACcontrol_axisGetSoftwareLimits(int axis, double& m
 int PowerPMACcontrol::PowerPMACcontrol_axisSetSoftwareLimits(int axis, double maxpos, double minpos){
     static const char *functionName = "PowerPMACcontrol::PowerPMACcontrol_axisSetSoftwareLimits";
     debugPrint_ppmaccomm("%s called", functionName);
-    char cmd[128] = {0};
-    sprintf( cmd, "Motor[%d].MaxPos=%f Motor[%d].MinPos=%f\n", axis, maxpos, axis, minpos);
+    CommandBuilder cmd;
+    cmd.append("Motor[").append(axis).append("].MaxPos=").append(maxpos);
+    cmd.append(" Motor[").append(axis).append("].MinPos=").append(minpos).append('\n');
   
-    return writeRead(cmd);
+    return writeRead(cmd.c_str());
 }
 
 
@@ -1177,10 +1645,10 @@ int PowerPMACcontrol::PowerPMACcontrol_axisMoveAbs(int axis, double position){
     static const char *functionName = "PowerPMACcontrol::PowerPMACcontrol_axisMoveAbs";
     debugPrint_ppmaccomm("%s called", functionName);
 
-    char cmd[128] = {0};
-    sprintf( cmd, "#%dj=%.2f\n", axis, position);
+    CommandBuilder cmd;
+    cmd.append('#').append(axis).append("j=").append(position).append('\n');
   
-    return writeRead(cmd);
+    return writeRead(cmd.c_str());
 }
 
 /**
@@ -1209,10 +1677,10 @@ int PowerPMACcontrol::PowerPMACcontrol_axisMoveRel(int axis, double relposition)
     static const char *functionName = "PowerPMACcontrol::PowerPMACcontrol_axisMoveRel";
     debugPrint_ppmaccomm("%s called", functionName);
     
-    char cmd[128] = {0};
-    sprintf( cmd, "#%dj^%.2f\n", axis, relposition);
+    CommandBuilder cmd;
+    cmd.append('#').append(axis).append("j^").append(relposition).append('\n');
   
-    return writeRead(cmd);
+    return writeRead(cmd.c_str());
 }
 
 /**
@@ -1345,6 +1813,10 @@ int PowerPMACcontrol::PowerPMACcontrol_axisStop(int axis){
  * 
  * Power PMAC command string sent = "#<axis index>k"
  *
+ * The command is sent on the safety channel if it is open, so it does not wait behind other traffic.
+ * Without the safety channel it goes ahead of the queued requests, but waits for the one in progress,
+ * such as a program download, to finish.
+ *
  * @param axis - Index of axis.
  * @return If the command is sent to Power PMAC successfully, 
  * PPMACcontrolNoError(0) is returned. If not, 
@@ -1368,7 +1840,8 @@ int PowerPMACcontrol::PowerPMACcontrol_axisAbort(int axis){
     char cmd[128] = {0};
     sprintf( cmd, "#%dk\n", axis);
   
-    return writeRead(cmd);
+    // Stop commands never wait behind other traffic
+    return writeRead_Safety(cmd);
 }
 
 /**
@@ -1588,6 +2061,10 @@ int PowerPMACcontrol::PowerPMACcontrol_runMprog(int ncoord){
  * 
  * Power PMAC command string sent = "&<cs number>a"
  *
+ * The command is sent on the safety channel if it is open, so it does not wait behind other traffic.
+ * Without the safety channel it goes ahead of the queued requests, but waits for the one in progress,
+ * such as a program download, to finish.
+ *
  * @param ncoord - Coordinate system number
  * @return If the command to abort the motion program is sent to Power PMAC successfully, 
  * PPMACcontrolNoError(0) is returned. If not, 
@@ -1611,7 +2088,8 @@ int PowerPMACcontrol::PowerPMACcontrol_abortMprog(int ncoord){
     char cmd[128] = {0};
     sprintf( cmd, "&%da\n", ncoord);
   
-    return writeRead(cmd);
+    // Stop commands never wait behind other traffic
+    return writeRead_Safety(cmd);
 }
 
 /**
@@ -1655,6 +2133,10 @@ int PowerPMACcontrol::PowerPMACcontrol_reset(){
  * 
  * Power PMAC command string sent = "#*k"
  *
+ * The command is sent on the safety channel if it is open, so it does not wait behind other traffic.
+ * Without the safety channel it goes ahead of the queued requests, but waits for the one in progress,
+ * such as a program download, to finish.
+ *
  * @return If the command to stop all axis is sent to Power PMAC successfully, 
  * PPMACcontrolNoError(0) is returned. If not, 
  * minus value is returned. Possible error codes are :
@@ -1677,7 +2159,43 @@ int PowerPMACcontrol::PowerPMACcontrol_stopAllAxes(){
     char cmd[128] = {0};
     sprintf( cmd, "#*k\n");
   
-    return writeRead(cmd);
+    // Stop commands never wait behind other traffic
+    return writeRead_Safety(cmd);
+}
+
+/**
+ * @brief Abort the motion programs in all coordinate systems
+ * 
+ * Power PMAC command string sent = "&*a"
+ *
+ * The command is sent on the safety channel if it is open, so it does not wait behind other traffic.
+ * Without the safety channel it goes ahead of the queued requests, but waits for the one in progress,
+ * such as a program download, to finish.
+ *
+ * @return If the abort command is sent to Power PMAC successfully, 
+ * PPMACcontrolNoError(0) is returned. If not, 
+ * minus value is returned. Possible error codes are :
+ *      - PPMACcontrolNoError(0)
+ *      - Error reported from Power PMAC (-1 to -99) -1*(Power PMAC error number)
+ *      - PPMACcontrolNoSSHDriverSet (-230)
+ *      - PPMACcontrolSSHDriverError (-102)
+ *      - PPMACcontrolSSHDriverErrorNoconn (-104)
+ *      - PPMACcontrolSSHDriverErrorNobytes (-103)
+ *      - PPMACcontrolSSHDriverErrorReadTimeout (-112)
+ *      - PPMACcontrolSSHDriverErrorWriteTimeout (-113) 
+ *      - PPMACcontrolSemaphoreTimeoutError = (-239)
+ *      - PPMACcontrolSemaphoreError = (-240)
+ *      - PPMACcontrolSemaphoreReleaseError = (-241)
+ */
+int PowerPMACcontrol::PowerPMACcontrol_abortAllMprogs(){
+    static const char *functionName = "PowerPMACcontrol::PowerPMACcontrol_abortAllMprogs";
+    debugPrint_ppmaccomm("%s called", functionName);
+    
+    char cmd[128] = {0};
+    sprintf( cmd, "&*a\n");
+  
+    // Stop commands never wait behind other traffic
+    return writeRead_Safety(cmd);
 }
 
 /**
@@ -1712,15 +2230,7 @@ int PowerPMACcontrol::PowerPMACcontrol_getGlobalStatus(uint32_t& status){
     int ret = writeRead(cmd, reply);
     if (ret != PPMACcontrolNoError)
         return ret;
-    if (reply.length() != 9)
-    {
-        return PPMACcontrolPMACUnexpectedReplyError;
-    }
-    char cstatus[16] = "";
-    reply.copy(cstatus, 8, 1);
-    if (sscanf(cstatus, "%8x", &status) != 1 )
-        return PPMACcontrolPMACUnexpectedReplyError;
-    return PPMACcontrolNoError;
+    return decodeStatus32(reply, status);
     
 }
 
@@ -1759,28 +2269,7 @@ int PowerPMACcontrol::PowerPMACcontrol_getMotorStatus(int motor, uint64_t& statu
     int ret = writeRead(cmd, reply);
     if (ret != PPMACcontrolNoError)
         return ret;
-    if (reply.length() != 17)
-    {
-        return PPMACcontrolPMACUnexpectedReplyError;
-    }
-    char cstatus_h[16] = "";
-    char cstatus_l[16] = "";
-    
-    reply.copy(cstatus_h, 8, 1);
-    reply.copy(cstatus_l, 8, 9);
-    
-    uint32_t h;
-    uint32_t l;
-    
-    if (sscanf(cstatus_h, "%8x", &h) != 1 )
-        return PPMACcontrolPMACUnexpectedReplyError;
-    
-    if (sscanf(cstatus_l, "%8x", &l) != 1 )
-        return PPMACcontrolPMACUnexpectedReplyError;
-    
-    status = (((uint64_t)h)<<32) | ((uint64_t)l);
-
-    return PPMACcontrolNoError;
+    return decodeStatus64(reply, status);
     
 }
 
@@ -1819,28 +2308,7 @@ int PowerPMACcontrol::PowerPMACcontrol_getCoordStatus(int Cs, uint64_t& status){
     int ret = writeRead(cmd, reply);
     if (ret != PPMACcontrolNoError)
         return ret;
-    if (reply.length() != 17)
-    {
-        return PPMACcontrolPMACUnexpectedReplyError;
-    }
-    char cstatus_h[16] = "";
-    char cstatus_l[16] = "";
-    
-    reply.copy(cstatus_h, 8, 1);
-    reply.copy(cstatus_l, 8, 9);
-    
-    uint32_t h;
-    uint32_t l;
-    
-    if (sscanf(cstatus_h, "%8x", &h) != 1 )
-        return PPMACcontrolPMACUnexpectedReplyError;
-    
-    if (sscanf(cstatus_l, "%8x", &l) != 1 )
-        return PPMACcontrolPMACUnexpectedReplyError;
-    
-    status = (((uint64_t)h)<<32) | ((uint64_t)l);
-
-    return PPMACcontrolNoError;
+    return decodeStatus64(reply, status);
     
 }
 
@@ -1912,7 +2380,7 @@ int PowerPMACcontrol::PowerPMACcontrol_axesGetVelocities(int firstAxis, int last
     int axis_nums = lastAxis-firstAxis+1;
     std::vector<std::string> statusstrings;
     
-    ret = PowerPMACcontrol::splitit(reply, " \n\r", statusstrings);
+    ret = splitit(reply, " \n\r", statusstrings);
     
     // Check if it was split correctly
     if (ret != PPMACcontrolNoError)
@@ -1997,7 +2465,7 @@ int PowerPMACcontrol::PowerPMACcontrol_axesGetCurrentPositions(int firstAxis, in
     int axis_nums = lastAxis-firstAxis+1;
     std::vector<std::string> positionstrings;
     
-    ret = PowerPMACcontrol::splitit(reply, " \n\r", positionstrings);
+    ret = splitit(reply, " \n\r", positionstrings);
     
     // Check if it was split correctly
     if (ret != PPMACcontrolNoError)
@@ -2077,7 +2545,7 @@ int PowerPMACcontrol::PowerPMACcontrol_getMultiMotorStatus(int firstMotor, int l
     int axis_nums = lastMotor-firstMotor+1;
     std::vector<std::string> statusstrings;
     
-    ret = PowerPMACcontrol::splitit(reply, " ", statusstrings);
+    ret = splitit(reply, " ", statusstrings);
     if (ret != PPMACcontrolNoError)
         return PPMACcontrolPMACUnexpectedReplyError;
     if ((int)statusstrings.size() != axis_nums)
@@ -2086,27 +2554,9 @@ int PowerPMACcontrol::PowerPMACcontrol_getMultiMotorStatus(int firstMotor, int l
     try{
         for (size_t i=0; i<statusstrings.size(); i++)
         {
-            std::string axisstatus = statusstrings.at(i);
-            if (axisstatus.length() != 17)
-            {
-                return PPMACcontrolPMACUnexpectedReplyError;
-            }
-            char cstatus_h[16] = "";
-            char cstatus_l[16] = "";
-
-            axisstatus.copy(cstatus_h, 8, 1);
-            axisstatus.copy(cstatus_l, 8, 9);
-
-            uint32_t h;
-            uint32_t l;
-
-            if (sscanf(cstatus_h, "%8x", &h) != 1 )
+            uint64_t uintstatus;
+            if (decodeStatus64(statusstrings.at(i), uintstatus) != PPMACcontrolNoError)
                 return PPMACcontrolPMACUnexpectedReplyError;
-
-            if (sscanf(cstatus_l, "%8x", &l) != 1 )
-                return PPMACcontrolPMACUnexpectedReplyError;
-
-            uint64_t uintstatus = (((uint64_t)h)<<32) | ((uint64_t)l);
             status.push_back(uintstatus);
         }
     }
@@ -2166,7 +2616,7 @@ int PowerPMACcontrol::PowerPMACcontrol_getMultiCoordStatus(int firstCs, int last
     int axis_nums = lastCs-firstCs+1;
     std::vector<std::string> statusstrings;
     
-    ret = PowerPMACcontrol::splitit(reply, " ", statusstrings);
+    ret = splitit(reply, " ", statusstrings);
     if (ret != PPMACcontrolNoError)
         return PPMACcontrolPMACUnexpectedReplyError;
     if ((int)statusstrings.size() != axis_nums)
@@ -2175,27 +2625,9 @@ int PowerPMACcontrol::PowerPMACcontrol_getMultiCoordStatus(int firstCs, int last
     try{
         for (size_t i=0; i<statusstrings.size(); i++)
         {
-            std::string coordstatus = statusstrings.at(i);
-            if (coordstatus.length() != 17)
-            {
-                return PPMACcontrolPMACUnexpectedReplyError;
-            }
-            char cstatus_h[16] = "";
-            char cstatus_l[16] = "";
-
-            coordstatus.copy(cstatus_h, 8, 1);
-            coordstatus.copy(cstatus_l, 8, 9);
-
-            uint32_t h;
-            uint32_t l;
-
-            if (sscanf(cstatus_h, "%8x", &h) != 1 )
-                return PPMACcontrolPMACUnexpectedReplyError;
-
-            if (sscanf(cstatus_l, "%8x", &l) != 1 )
+            uint64_t uintstatus;
+            if (decodeStatus64(statusstrings.at(i), uintstatus) != PPMACcontrolNoError)
                 return PPMACcontrolPMACUnexpectedReplyError;
-
-            uint64_t uintstatus = (((uint64_t)h)<<32) | ((uint64_t)l);
             status.push_back(uintstatus);
         }
     }
@@ -2218,7 +2650,10 @@ int PowerPMACcontrol::PowerPMACcontrol_getMultiCoordStatus(int firstCs, int last
  * always send 'close' command before returning if the function has attempted to write
  * to Power PMAC. \n
  * Comments in the source program can only be in the form of line beginning "//". 
- * It does not support '/' followed by '*' style comments.
+ * It does not support '/' followed by '*' style comments, unless they are removed with
+ * PowerPMACcontrol_setDownloadPreprocessing.
+ * Each line waits for the reply to the line before, unless more lines are allowed in flight
+ * with PowerPMACcontrol_setDownloadWindow.
  *
  * @param filepath - Path to the program file to be downloaded to Power PMAC.
  * @return If the program file is successfully downloaded,
@@ -2241,7 +2676,23 @@ int PowerPMACcontrol::PowerPMACcontrol_getMultiCoordStatus(int firstCs, int last
  *      - PPMACcontrolSemaphoreReleaseError = (-241)
  */
 int PowerPMACcontrol::PowerPMACcontrol_progDownload(std::string filepath){
+    int errorLine;
+    return PowerPMACcontrol_progDownload(filepath, errorLine);
+}
+
+/**
+ * @brief Remote download a motion/plc program, and report which line failed.
+ *
+ * The same as PowerPMACcontrol_progDownload(std::string).
+ *
+ * @param filepath - Path to the program file to be downloaded to Power PMAC.
+ * @param errorLine - The number of the line in the file, from 1, which failed or whose reply did
+ * not arrive, or 0 if none did.
+ * @return The same as PowerPMACcontrol_progDownload(std::string)
+ */
+int PowerPMACcontrol::PowerPMACcontrol_progDownload(std::string filepath, int& errorLine){
     static const char *functionName = "PowerPMACcontrol::PowerPMACcontrol_progDownload";
+    errorLine = 0;
     if (this->connected == 0)
     {
         debugPrint_ppmaccomm("%s : PMAC is not connected", functionName);
@@ -2249,118 +2700,86 @@ int PowerPMACcontrol::PowerPMACcontrol_progDownload(std::string filepath){
     }
     std::ifstream progfile;
     progfile.open(filepath.c_str());
-    std::string line;
-    std::string towrite;
-    std::string reply;
-    int ret = 0;
-    bool written = false;
-    if (progfile.is_open())
+    if (!progfile.is_open())    //Program file open failed.
     {
-#ifdef WIN32
-		DWORD dwWaitResult = WaitForSingleObject(this->ghSemaphore, SEMAPHORE_WAIT_MSEC);
-        if (dwWaitResult == WAIT_OBJECT_0)
+        debugPrint_ppmaccomm("%s : unable to open the file %s\n", functionName, filepath.c_str());
+        return PPMACcontrolFileOpenError;
+    }
+    int ret = PowerPMACcontrol_progDownload(progfile, errorLine);
+    progfile.close();
+    return ret;
+}
 
-#else
-        struct timespec ts = getAbsTimeout(SEMAPHORE_WAIT_MSEC);
-        int sem_return = sem_timedwait(&sem_writeRead, &ts);
-        if (sem_return == 0)
-#endif	
-       {
-			getline(progfile, line);
-			while (!progfile.eof())
-			//while (progfile.good())
-			{
-				if (progfile.fail())
-				{
-					//Error while reading 
-					ret = PPMACcontrolFileReadError;
-					break;
-				}
-				else
-				{
-					towrite = line;
-					getline(progfile,line);
-					size_t length = towrite.length();
-					if (length > 0)
-					{
-
-						const char * carray = towrite.c_str();
-						if (carray[length-1] != '\n')
-						{
-							debugPrint_ppmaccomm("%s : adding cr to %s\n", functionName, towrite.c_str());
-							towrite = towrite + "\n";
-
-						}
-						written = true;
-						ret = writeRead_WithoutSemaphore(towrite.c_str(), reply);
-						if (ret != PPMACcontrolNoError)
-						{
-							break;
-						}
-					}
-				}
-			}
-            if (written)
-            {
-                //Always call 'close' command
-                int ret2 = writeRead_WithoutSemaphore("close\n",reply);
-                if ( ret2 != PPMACcontrolNoError)
-                {
-                    debugPrint_ppmaccomm("%s : Error while writing 'close'. error number %d\n", functionName, ret2);
-                    ret = PPMACcontrolProgramCloseError;
-                }
-            }
-#ifdef WIN32
-            if (!ReleaseSemaphore(ghSemaphore, 1, NULL))
-            {
-                debugPrint_ppmaccomm("%s : Error releasing Semaphore\n",functionName);
-                ret = PPMACcontrolSemaphoreReleaseError;
-            }
-#else
-            if (sem_post(&sem_writeRead)!=0)    //Releasing semaphore
-            {
-                debugPrint_ppmaccomm("%s : Error releasing Semaphore\n",functionName);
-                ret = PPMACcontrolSemaphoreReleaseError;
-            }
-            else
-            {
-                debugPrint_ppmaccomm("%s : Released Semaphore\n",functionName);
-            }
-#endif
-       }
-#ifdef WIN32
-        else if (dwWaitResult == WAIT_TIMEOUT)
-		{
-            debugPrint_ppmaccomm("%s : Semaphore timed out\n",functionName);
-			ret = PPMACcontrolSemaphoreTimeoutError;
-		}
-		else
-		{
-			debugPrint_ppmaccomm("%s : Semaphore error (%d)\n",functionName, dwWaitResult);
-			ret = PPMACcontrolSemaphoreError;
-		}
-#else
-        else    //Semaphore error
-        {
-            if (errno == ETIMEDOUT)
-            {
-                debugPrint_ppmaccomm("%s : Semaphore timed out\n",functionName);
-                ret = PPMACcontrolSemaphoreTimeoutError;
-            }
-            else
-            {	
-                debugPrint_ppmaccomm("%s : Semaphore error (%d)\n",functionName, errno);
-                ret = PPMACcontrolSemaphoreError;
-            }
-        }
-#endif
-        progfile.close();
+/**
+ * @brief Remote download a motion/plc program read from a stream.
+ *
+ * The same as PowerPMACcontrol_progDownload(std::string), for a program generated in memory or
+ * received from elsewhere. The stream is read to its end before the download starts.
+ *
+ * @param program - The program, as it would be in a file.
+ * @param errorLine - The number of the line in the program, from 1, which failed or whose reply did
+ * not arrive, or 0 if none did.
+ * @return The same as PowerPMACcontrol_progDownload(std::string)
+ */
+int PowerPMACcontrol::PowerPMACcontrol_progDownload(std::istream& program, int& errorLine){
+    errorLine = 0;
+    // Read the whole program into one buffer, so that no line needs a string of its own
+    std::string contents;
+    char chunk[4096];
+    while (program.read(chunk, sizeof(chunk)) || program.gcount() > 0)
+    {
+        contents.append(chunk, (size_t)program.gcount());
     }
-    else    //Program file open failed.
+    if (program.bad())
     {
-        debugPrint_ppmaccomm("%s : unable to open the file %s\n", functionName, filepath.c_str());
-        return PPMACcontrolFileOpenError;
+        return PPMACcontrolFileReadError;
+    }
+    return PowerPMACcontrol_progDownload(contents.data(), contents.length(), errorLine);
+}
+
+/**
+ * @brief Remote download a motion/plc program held in memory.
+ *
+ * The same as PowerPMACcontrol_progDownload(std::string). The lines are sent straight from the
+ * buffer, which may for example be a memory-mapped file, without being copied one by one.
+ * The buffer must not change until the function returns.
+ *
+ * @param program - The program, as it would be in a file. It need not end with a null character.
+ * @param length - The number of characters in the program.
+ * @param errorLine - The number of the line in the program, from 1, which failed or whose reply did
+ * not arrive, or 0 if none did.
+ * @return The same as PowerPMACcontrol_progDownload(std::string), and
+ *      - PPMACcontrolInvalidParamError (-242) if program is NULL
+ *      - PPMACcontrolProgramSyntaxError (-250) if the program is rejected by PowerPMACcontrol_setDownloadPreprocessing
+ */
+int PowerPMACcontrol::PowerPMACcontrol_progDownload(const char *program, size_t length, int& errorLine){
+    static const char *functionName = "PowerPMACcontrol::PowerPMACcontrol_progDownload";
+    errorLine = 0;
+    if (this->connected == 0)
+    {
+        debugPrint_ppmaccomm("%s : PMAC is not connected", functionName);
+        return PPMACcontrolNoSSHDriverSet;
+    }
+    if (program == NULL)
+    {
+        return PPMACcontrolInvalidParamError;
+    }
+    std::string processed;
+    std::vector<int> lineNumbers;
+    int ret = preprocessProgram(program, length, processed, lineNumbers, errorLine);
+    if (ret != PPMACcontrolNoError)
+    {
+        return ret;
     }
+    ProgDownloadContext context;
+    context.self = this;
+    context.progfile = NULL;
+    context.program = program;
+    context.length = length;
+    context.incremental = false;
+    context.errorLine = 0;
+    ret = runBulk(progDownloadTask, &context);
+    errorLine = sourceLine(lineNumbers, context.errorLine);
     if (ret < 0 && ret > -100 ) //This is a pmac error
     {
         debugPrint_ppmaccomm("%s : Error while sending program. error number %d\n", functionName, ret);
@@ -2368,203 +2787,1582 @@ int PowerPMACcontrol::PowerPMACcontrol_progDownload(std::string filepath){
     
     return ret;
 }
+
 /**
- * @brief Write data to the connected SSH channel and read the reply. 
- * Caller of this function must obtain semaphore before calling this function.
- * 
- * A timeout should be specified in milliseconds.
- * @param cmd - The string buffer to be written.
- * @param response - The response read from the SSH channel
- * @param timeout - A timeout in ms for the write. The default value is 1000 and may be updated using PowerPMACcontrol_setTimeout.
- * @return If successful, PPMACcontrolNoError(0) is returned. If not, 
- * minus value is returned. Possible error codes are :
- *      - PPMACcontrolNoError(0)
- *      - Error reported from Power PMAC (-1 to -99) -1*(Power PMAC error number)
- *      - PPMACcontrolNoSSHDriverSet (-230)
- *      - PPMACcontrolSSHDriverError (-102)
- *      - PPMACcontrolSSHDriverErrorNoconn (-104)
- *      - PPMACcontrolSSHDriverErrorNobytes (-103)
- *      - PPMACcontrolSSHDriverErrorReadTimeout (-112)
- *      - PPMACcontrolSSHDriverErrorWriteTimeout (-113)
+ * @brief Download only the program and PLC blocks of a file which have changed since they were last downloaded.
+ *
+ * The file is split into blocks, each from an 'open' line to its 'close' line. A hash (64 bit FNV-1a) of the
+ * lines of each block is compared with the hash of the block of the same name as last downloaded to this
+ * controller, and the block is sent only if they differ. Lines outside any open/close block are always sent.
+ * As with PowerPMACcontrol_progDownload, 'close' is always sent after the last line written.
+ * Redeploying a project of many files after a small edit therefore costs the round trips of the changed
+ * blocks only.
+ *
+ * The hashes are remembered per controller, by host name and port, and kept in memory unless a file is
+ * set with PowerPMACcontrol_setDownloadCacheFile. Blocks downloaded by PowerPMACcontrol_progDownload
+ * are forgotten. The hashes cannot see programs changed by other means, such as the IDE or a reset with
+ * $$$***: call PowerPMACcontrol_clearDownloadCache after such a change.
+ *
+ * @param filepath - Path to the program file to be downloaded to Power PMAC.
+ * @param blocksSent - Number of blocks sent, including runs of lines outside any block
+ * @param blocksSkipped - Number of blocks skipped because they had not changed
+ * @return The same as PowerPMACcontrol_progDownload
  */
-int PowerPMACcontrol::writeRead_WithoutSemaphore(const char *cmd, std::string& response, int timeout){
-    static const char *functionName = "PowerPMACcontrol::writeRead(char, string, int)";
-    debugPrint_ppmaccomm("%s writing %s\n", functionName, cmd);
+int PowerPMACcontrol::PowerPMACcontrol_progDownloadIncremental(std::string filepath, int& blocksSent, int& blocksSkipped){
+    static const char *functionName = "PowerPMACcontrol::PowerPMACcontrol_progDownloadIncremental";
+    blocksSent = 0;
+    blocksSkipped = 0;
     if (this->connected == 0)
     {
         debugPrint_ppmaccomm("%s : PMAC is not connected", functionName);
         return PPMACcontrolNoSSHDriverSet;
     }
-    // If no timeout specified, use the common value
-    if (timeout == TIMEOUT_NOT_SPECIFIED)
-    {
-    	timeout = common_timeout_ms;
-    }
-
-    size_t bytes = 0;
-	int return_num = PPMACcontrolNoError;
-	char buff[5120] = "";
-    int ret = this->PowerPMACcontrol_write(cmd, strlen(cmd), &bytes, timeout);
-    if (ret != PPMACcontrolNoError)
+    std::ifstream progfile;
+    progfile.open(filepath.c_str());
+    if (!progfile.is_open())
     {
-        debugPrint_ppmaccomm("%s : Failed to write to powerPmac command (%s)\n", functionName, cmd);
-        return_num = ret;
+        debugPrint_ppmaccomm("%s : unable to open the file %s\n", functionName, filepath.c_str());
+        return PPMACcontrolFileOpenError;
     }
-    else
+    // A preprocessed program is downloaded from memory, split into blocks as the file would be
+    std::istringstream processedfile;
+    if (downloadPreprocessing != PreprocessNone)
     {
-        ret = this->PowerPMACcontrol_read(buff, 5120, &bytes, 0x06, timeout);
-        if (ret != PPMACcontrolNoError)
+        std::ostringstream buffer;
+        buffer << progfile.rdbuf();
+        if (progfile.bad())
         {
-            debugPrint_ppmaccomm("%s : Failed to read from powerPmac\n", functionName);
-            return_num=ret;
+            return PPMACcontrolFileReadError;
         }
-        else
+        std::string contents = buffer.str();
+        const char *program = contents.data();
+        size_t length = contents.length();
+        std::string processed;
+        std::vector<int> lineNumbers;
+        int errorLine;
+        int ret = preprocessProgram(program, length, processed, lineNumbers, errorLine);
+        if (ret != PPMACcontrolNoError)
         {
-            debugPrint_ppmaccomm("%s : The reply from PowerPMAC for %s is [%s]\n", functionName,cmd, buff);
-            std::string trimmed = trim_right_copy(std::string(buff));
-            response = trimmed;
-            int pmac_err_num = PowerPMACcontrol::check_PowerPMAC_error( trimmed );
-            if ( pmac_err_num != 0 )
-            {
-                return_num = (-1)*pmac_err_num;
-            }
+            debugPrint_ppmaccomm("%s : program rejected at line %d\n", functionName, errorLine);
+            return ret;
         }
+        processedfile.str(processed);
     }
-	return return_num;
+    ProgDownloadContext context;
+    context.self = this;
+    context.progfile = (downloadPreprocessing != PreprocessNone) ? (std::istream *)&processedfile : &progfile;
+    context.program = NULL;
+    context.length = 0;
+    context.incremental = true;
+    context.blocksSent = 0;
+    context.blocksSkipped = 0;
+    context.errorLine = 0;
+    int ret = runBulk(progDownloadTask, &context);
+    progfile.close();
+    blocksSent = context.blocksSent;
+    blocksSkipped = context.blocksSkipped;
+    return ret;
 }
 
+/**
+ * @brief Download a motion/plc program by copying the file to Power PMAC and loading it there in one command.
+ *
+ * Instead of writing each line to gpascii and waiting for its reply, as PowerPMACcontrol_progDownload does,
+ * the file is copied with SCP over the SSH session of the connection to a new file in /tmp on Power PMAC,
+ * made by mktemp, followed by a 'close' line, and loaded with "gpascii -i" on a channel of its own. The copy
+ * is then removed, so downloads from several connections at once do not disturb each other. The whole
+ * download takes a few round trips however long the program is, so it is the fastest way to deploy large
+ * programs. The rules for the file are those of PowerPMACcontrol_progDownload.
+ *
+ * gpascii carries on after a line fails, so lines after the first failed line are loaded too; the error
+ * of the first one is returned. The copy is not recorded by PowerPMACcontrol_setRecordFile.
+ * Connections which are not over SSH, except the simulator, cannot copy files.
+ *
+ * @param filepath - Path to the program file to be downloaded to Power PMAC.
+ * @return The same as PowerPMACcontrol_progDownload, and
+ *      - PPMACcontrolFileTransferError (-247) if the file cannot be copied or loaded
+ *      - PPMACcontrolProgramSyntaxError (-250) if the program is rejected by PowerPMACcontrol_setDownloadPreprocessing
+ */
+int PowerPMACcontrol::PowerPMACcontrol_progDownloadFile(std::string filepath){
+    int errorLine;
+    return PowerPMACcontrol_progDownloadFile(filepath, errorLine);
+}
 
 /**
- * @brief Write data to the connected SSH channel and read the reply.
- * 
- * A timeout should be specified in milliseconds.
- * @param cmd - The string buffer to be written.
- * @param response - The response read from the SSH channel
- * @param timeout - A timeout in ms for the write. The default value is 1000 and may be updated using PowerPMACcontrol_setTimeout.
- * @return If successful, PPMACcontrolNoError(0) is returned. If not, 
- * minus value is returned. Possible error codes are :
- *      - PPMACcontrolNoError(0)
- *      - Error reported from Power PMAC (-1 to -99) -1*(Power PMAC error number)
- *      - PPMACcontrolNoSSHDriverSet (-230)
- *      - PPMACcontrolSSHDriverError (-102)
- *      - PPMACcontrolSSHDriverErrorNoconn (-104)
- *      - PPMACcontrolSSHDriverErrorNobytes (-103)
- *      - PPMACcontrolSSHDriverErrorReadTimeout (-112)
- *      - PPMACcontrolSSHDriverErrorWriteTimeout (-113)
- *      - PPMACcontrolSemaphoreTimeoutError = (-239)
- *      - PPMACcontrolSemaphoreError = (-240)
- *      - PPMACcontrolSemaphoreReleaseError = (-241)
+ * @brief Download a motion/plc program by copying the file to Power PMAC, and report which line failed.
+ *
+ * The same as PowerPMACcontrol_progDownloadFile(std::string).
+ *
+ * @param filepath - Path to the program file to be downloaded to Power PMAC.
+ * @param errorLine - The number of the first line in the file, from 1, which failed, or 0 if none did.
+ * @return The same as PowerPMACcontrol_progDownloadFile(std::string)
  */
-int PowerPMACcontrol::writeRead(const char *cmd, std::string& response, int timeout){
-    static const char *functionName = "PowerPMACcontrol::writeRead(char, string, int)";
-    debugPrint_ppmaccomm("%s writing %s\n", functionName, cmd);
+int PowerPMACcontrol::PowerPMACcontrol_progDownloadFile(std::string filepath, int& errorLine){
+    static const char *functionName = "PowerPMACcontrol::PowerPMACcontrol_progDownloadFile";
+    errorLine = 0;
     if (this->connected == 0)
     {
         debugPrint_ppmaccomm("%s : PMAC is not connected", functionName);
         return PPMACcontrolNoSSHDriverSet;
     }
-    // If no timeout specified, use the common value
-    if (timeout == TIMEOUT_NOT_SPECIFIED)
+    std::ifstream progfile;
+    progfile.open(filepath.c_str(), std::ios::in | std::ios::binary);
+    if (!progfile.is_open())
     {
-    	timeout = common_timeout_ms;
+        debugPrint_ppmaccomm("%s : unable to open the file %s\n", functionName, filepath.c_str());
+        return PPMACcontrolFileOpenError;
     }
-
-    size_t bytes = 0;
-    
-    //Get semaphore
-#ifdef WIN32    
-	DWORD dwWaitResult = WaitForSingleObject(this->ghSemaphore, SEMAPHORE_WAIT_MSEC);
-#else
-    struct timespec ts = getAbsTimeout(SEMAPHORE_WAIT_MSEC);
-    int sem_return = sem_timedwait(&sem_writeRead, &ts);
-#endif
-	int return_num = PPMACcontrolNoError;   //initialisation
+    std::ostringstream buffer;
+    buffer << progfile.rdbuf();
+    if (progfile.bad())
+    {
+        return PPMACcontrolFileReadError;
+    }
+    progfile.close();
+    std::string contents = buffer.str();
+    std::vector<int> lineNumbers;
+    if (downloadPreprocessing != PreprocessNone)
+    {
+        const char *program = contents.data();
+        size_t length = contents.length();
+        std::string processed;
+        int ret = preprocessProgram(program, length, processed, lineNumbers, errorLine);
+        if (ret != PPMACcontrolNoError)
+        {
+            return ret;
+        }
+        contents.swap(processed);
+    }
+    if (!contents.empty() && contents[contents.length()-1] != '\n')
+    {
+        contents += '\n';
+    }
+    //Always end with 'close', as PowerPMACcontrol_progDownload does
+    contents += "close\n";
+
+    // The copy is named after the file, with only characters which need no quoting in the shell,
+    // and made unique on Power PMAC by transferProgramFile
+    size_t slash = filepath.find_last_of("/\\");
+    std::string name = (slash == std::string::npos) ? filepath : filepath.substr(slash + 1);
+    for (size_t i = 0; i < name.length(); i++)
+    {
+        if (!isalnum((unsigned char)name[i]) && name[i] != '.' && name[i] != '-')
+        {
+            name[i] = '_';
+        }
+    }
+
+    FileDownloadContext context;
+    context.self = this;
+    context.contents = &contents;
+    context.remoteName = &name;
+    context.errorLine = 0;
+    int ret = runBulk(fileDownloadTask, &context);
+    errorLine = sourceLine(lineNumbers, context.errorLine);
+    if (ret < 0 && ret > -100 ) //This is a pmac error
+    {
+        debugPrint_ppmaccomm("%s : Error while loading program at line %d. error number %d\n", functionName, errorLine, ret);
+    }
+    return ret;
+}
+
+/**
+ * @brief Read a motion/plc program back from Power PMAC into a file.
+ *
+ * The listing is written to the file as it arrives, so a program of any length is read with
+ * one command and without being held in memory. See PowerPMACcontrol_progUpload(std::string,
+ * ProgramUploadSink, void *).
+ *
+ * @param bufferName - The program, as it follows "list" in gpascii, for example "prog 1", "plc 3" or "subprog Helper".
+ * @param filepath - Path to the file, replaced if it exists.
+ * @return The same as PowerPMACcontrol_progUpload(std::string, ProgramUploadSink, void *), and
+ *      - PPMACcontrolFileOpenError (-234) if the file cannot be created
+ *      - PPMACcontrolFileWriteError (-251) if the file cannot be written
+ */
+int PowerPMACcontrol::PowerPMACcontrol_progUpload(std::string bufferName, std::string filepath){
+    static const char *functionName = "PowerPMACcontrol::PowerPMACcontrol_progUpload";
+    if (this->connected == 0)
+    {
+        debugPrint_ppmaccomm("%s : PMAC is not connected", functionName);
+        return PPMACcontrolNoSSHDriverSet;
+    }
+    std::ofstream progfile;
+    progfile.open(filepath.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!progfile.is_open())
+    {
+        debugPrint_ppmaccomm("%s : unable to create the file %s\n", functionName, filepath.c_str());
+        return PPMACcontrolFileOpenError;
+    }
+    int ret = PowerPMACcontrol_progUpload(bufferName, progfile);
+    progfile.close();
+    if (ret == PPMACcontrolNoError && progfile.fail())
+    {
+        ret = PPMACcontrolFileWriteError;
+    }
+    return ret;
+}
+
+/**
+ * @brief Read a motion/plc program back from Power PMAC into a stream.
+ *
+ * See PowerPMACcontrol_progUpload(std::string, ProgramUploadSink, void *).
+ *
+ * @param bufferName - The program, as it follows "list" in gpascii, for example "prog 1".
+ * @param program - The stream which receives the listing.
+ * @return The same as PowerPMACcontrol_progUpload(std::string, ProgramUploadSink, void *), and
+ *      - PPMACcontrolFileWriteError (-251) if the stream fails
+ */
+int PowerPMACcontrol::PowerPMACcontrol_progUpload(std::string bufferName, std::ostream& program){
+    int ret = PowerPMACcontrol_progUpload(bufferName, writeToStream, &program);
+    if (ret == PPMACcontrolNoError && program.fail())
+    {
+        ret = PPMACcontrolFileWriteError;
+    }
+    return ret;
+}
+
+/**
+ * @brief Read a motion/plc program back from Power PMAC, passing it to a callback as it arrives.
+ *
+ * "list" followed by the name of the program is sent, and the listing is passed to the sink a
+ * few lines at a time as it is read, without the 5120 character limit of the replies to other
+ * commands. The lines end with a newline only. The listing is the program as Power PMAC holds
+ * it, without the 'open' and 'close' lines, so it can be compared with the source of a program
+ * or written back between them.
+ * The timeout set with PowerPMACcontrol_setTimeout limits each wait for more of the listing
+ * rather than the whole of it.
+ *
+ * @param bufferName - The program, as it follows "list" in gpascii, for example "prog 1", "plc 3" or "subprog Helper".
+ * @param sink - The function which receives the listing, on the I/O thread.
+ * @param userData - Passed to the sink.
+ * @return If the program is read, PPMACcontrolNoError(0) is returned. If not,
+ * minus value is returned. Possible error codes are :
+ *      - PPMACcontrolNoError(0)
+ *      - Error reported from Power PMAC (-1 to -99) -1*(Power PMAC error number), such as for a program which does not exist
+ *      - PPMACcontrolNoSSHDriverSet (-230)
+ *      - PPMACcontrolSSHDriverErrorNoconn (-104)
+ *      - PPMACcontrolSSHDriverErrorNobytes (-103)
+ *      - PPMACcontrolSSHDriverErrorReadTimeout (-112)
+ *      - PPMACcontrolSSHDriverErrorWriteTimeout (-113)
+ *      - PPMACcontrolSemaphoreTimeoutError = (-239)
+ *      - PPMACcontrolInvalidParamError (-242) if the name is empty or has more than one line, or sink is NULL
+ */
+int PowerPMACcontrol::PowerPMACcontrol_progUpload(std::string bufferName, ProgramUploadSink sink, void *userData){
+    static const char *functionName = "PowerPMACcontrol::PowerPMACcontrol_progUpload";
+    if (this->connected == 0)
+    {
+        debugPrint_ppmaccomm("%s : PMAC is not connected", functionName);
+        return PPMACcontrolNoSSHDriverSet;
+    }
+    if (sink == NULL || bufferName.find_first_not_of(" \t") == std::string::npos ||
+        bufferName.find_first_of("\r\n") != std::string::npos)
+    {
+        return PPMACcontrolInvalidParamError;
+    }
+    ProgUploadContext context;
+    context.self = this;
+    context.bufferName = &bufferName;
+    context.sink = sink;
+    context.userData = userData;
+    int ret = runBulk(progUploadTask, &context);
+    if (ret < 0 && ret > -100 ) //This is a pmac error
+    {
+        debugPrint_ppmaccomm("%s : Error while listing %s. error number %d\n", functionName, bufferName.c_str(), ret);
+    }
+    return ret;
+}
+
+/**
+ * @brief Set the file which keeps the hashes of PowerPMACcontrol_progDownloadIncremental between processes.
+ *
+ * The hashes saved in the file replace those in memory, and the file is rewritten each time a block is
+ * downloaded. The file may be shared by the connections to several controllers, but not by processes
+ * which download at the same time.
+ *
+ * @param filename - Name of the file, or NULL or an empty string to keep the hashes in memory only
+ * @return PPMACcontrolNoError(0), or PPMACcontrolFileReadError (-235) if the file exists but cannot be read
+ */
+int PowerPMACcontrol::PowerPMACcontrol_setDownloadCacheFile(const char *filename){
+    DownloadCacheContext context;
+    context.self = this;
+    context.filename = filename;
+    context.clear = false;
+    return runOnIOThread(downloadCacheTask, &context, RequestPriorityNormal, -1);
+}
+
+/**
+ * @brief Forget the hashes of the blocks downloaded to the connected controller,
+ * so that the next PowerPMACcontrol_progDownloadIncremental sends every block.
+ *
+ * @return PPMACcontrolNoError(0), or PPMACcontrolNoSSHDriverSet (-230) if not connected
+ */
+int PowerPMACcontrol::PowerPMACcontrol_clearDownloadCache(){
+    if (this->connected == 0)
+    {
+        return PPMACcontrolNoSSHDriverSet;
+    }
+    DownloadCacheContext context;
+    context.self = this;
+    context.filename = NULL;
+    context.clear = true;
+    return runOnIOThread(downloadCacheTask, &context, RequestPriorityNormal, -1);
+}
+
+/**
+ * @brief Change the download cache on the I/O thread, which uses it while downloading.
+ */
+int PowerPMACcontrol::downloadCacheTask(void *arg){
+    DownloadCacheContext *context = (DownloadCacheContext *)arg;
+    PowerPMACcontrol *self = context->self;
+    if (context->clear)
+    {
+        self->downloadCache->clear(self->controllerName);
+        return PPMACcontrolNoError;
+    }
+    return self->downloadCache->setFile(context->filename) ? PPMACcontrolNoError : PPMACcontrolFileReadError;
+}
+
+/**
+ * @brief Preprocess a program as set by PowerPMACcontrol_setDownloadPreprocessing, if it is set.
+ *
+ * @param program - The program, replaced by the processed program if it is preprocessed
+ * @param length - The number of characters in the program, replaced as the program is
+ * @param processed - Holds the processed program
+ * @param lineNumbers - The line in the program of each line of the processed program, or empty if it is not preprocessed
+ * @param errorLine - The line rejected by PreprocessCheckStructure, or 0
+ * @return PPMACcontrolNoError (0) or PPMACcontrolProgramSyntaxError (-250)
+ */
+int PowerPMACcontrol::preprocessProgram(const char *&program, size_t& length, std::string& processed,
+                                        std::vector<int>& lineNumbers, int& errorLine){
+    static const char *functionName = "PowerPMACcontrol::preprocessProgram";
+    lineNumbers.clear();
+    errorLine = 0;
+    if (downloadPreprocessing == PreprocessNone)
+    {
+        return PPMACcontrolNoError;
+    }
+    ProgramPreprocessor preprocessor(downloadPreprocessing, (size_t)downloadLineLength);
+    int ret = preprocessor.process(program, length, processed, lineNumbers, errorLine);
+    if (ret != PPMACcontrolNoError)
+    {
+        debugPrint_ppmaccomm("%s : program rejected at line %d\n", functionName, errorLine);
+        return ret;
+    }
+    debugPrint_ppmaccomm("%s : %lu lines of %lu characters preprocessed to %lu lines of %lu characters\n", functionName,
+                         (unsigned long)std::count(program, program + length, '\n'), (unsigned long)length,
+                         (unsigned long)lineNumbers.size(), (unsigned long)processed.length());
+    program = processed.data();
+    length = processed.length();
+    return PPMACcontrolNoError;
+}
+
+/**
+ * @brief Convert the number of a line of a preprocessed program to the number of the line in the program.
+ *
+ * @param lineNumbers - The numbers from preprocessProgram, empty if the program was not preprocessed
+ * @param errorLine - The number of a line of the preprocessed program, from 1, or 0
+ * @return The number of the line in the program, or errorLine if it is not in lineNumbers
+ */
+int PowerPMACcontrol::sourceLine(const std::vector<int>& lineNumbers, int errorLine){
+    if (errorLine < 1 || (size_t)errorLine > lineNumbers.size())
+    {
+        return errorLine;
+    }
+    return lineNumbers[errorLine - 1];
+}
+
+/**
+ * @brief Run downloadProgram, or downloadChangedBlocks for an incremental download, on the I/O thread.
+ */
+int PowerPMACcontrol::progDownloadTask(void *arg){
+    ProgDownloadContext *context = (ProgDownloadContext *)arg;
+    if (context->incremental)
+    {
+        return context->self->downloadChangedBlocks(*context->progfile, context->blocksSent, context->blocksSkipped,
+                                                    context->errorLine);
+    }
+    return context->self->downloadProgram(context->program, context->length, context->errorLine);
+}
+
+/**
+ * @brief Run transferProgramFile on the I/O thread.
+ */
+int PowerPMACcontrol::fileDownloadTask(void *arg){
+    FileDownloadContext *context = (FileDownloadContext *)arg;
+    return context->self->transferProgramFile(*context->contents, *context->remoteName, context->errorLine);
+}
+
+/**
+ * @brief Run uploadProgram on the I/O thread.
+ */
+int PowerPMACcontrol::progUploadTask(void *arg){
+    ProgUploadContext *context = (ProgUploadContext *)arg;
+    return context->self->uploadProgram(*context->bufferName, context->sink, context->userData);
+}
+
+/**
+ * @brief Run writeReadBatch on the I/O thread.
+ */
+int PowerPMACcontrol::batchTask(void *arg){
+    BatchContext *context = (BatchContext *)arg;
+    return context->self->writeReadBatch(*context->lines, *context->replies, context->commandClass, context->handler,
+                                         context->handlerArg, context->stopOnError);
+}
+
+/**
+ * @brief Split the reply to a line of PowerPMACcontrol_getVariables into values and pass them to the sink.
+ * Runs on the I/O thread.
+ */
+void PowerPMACcontrol::variableReplyHandler(size_t line, const std::string& reply, int result, void *arg){
+    static const char *functionName = "PowerPMACcontrol::variableReplyHandler";
+    VariableBatchContext *context = (VariableBatchContext *)arg;
+    size_t count = (*context->counts)[line];
+
+    // Each name is answered by a value on a line of its own, and an error ends the reply
+    std::vector<std::string> values;
+    std::istringstream lines(reply);
+    std::string value;
+    while (std::getline(lines, value))
+    {
+        values.push_back(value);
+    }
+    if (result != PPMACcontrolNoError && !values.empty())
+    {
+        values.pop_back();
+    }
+    if ((result == PPMACcontrolNoError && values.size() != count) || values.size() > count)
+    {
+        debugPrint_ppmaccomm("%s : %lu values in the reply to %s\n", functionName, (unsigned long)values.size(),
+                             (*context->lines)[line].c_str());
+        result = PPMACcontrolPMACUnexpectedReplyError;
+        values.clear();
+    }
+    if (result != PPMACcontrolNoError && context->result == PPMACcontrolNoError)
+    {
+        context->result = result;
+    }
+    context->sink((*context->firsts)[line], count, values, result, context->userData);
+}
+
+/**
+ * @brief Check that a name or value can be packed with others on a line.
+ */
+bool PowerPMACcontrol::isBatchItem(const std::string& item){
+    return !item.empty() && item.find_first_of(" \t\r\n") == std::string::npos;
+}
+
+/**
+ * @brief Check that a letter names an array of variables read and written by range: P, Q, M or L.
+ */
+bool PowerPMACcontrol::isRangeBase(char base){
+    return base != '\0' && strchr("PQMLpqml", base) != NULL;
+}
+
+/**
+ * @brief Pack statements, separated by spaces, into lines of up to MAX_LINE_LENGTH characters.
+ *
+ * @param items - The statements
+ * @param lines - The lines, without newlines
+ * @param itemCounts - The number of statements on each line
+ */
+void PowerPMACcontrol::packBatchLines(const std::vector<std::string>& items, std::vector<std::string>& lines,
+                                      std::vector<size_t>& itemCounts){
+    lines.clear();
+    itemCounts.clear();
+    for (size_t i = 0; i < items.size(); i++)
+    {
+        if (lines.empty() || lines.back().length() + 1 + items[i].length() > (size_t)MAX_LINE_LENGTH)
+        {
+            lines.push_back(items[i]);
+            itemCounts.push_back(1);
+        }
+        else
+        {
+            lines.back() += ' ';
+            lines.back() += items[i];
+            itemCounts.back()++;
+        }
+    }
+}
+
+/**
+ * @brief Send packed lines and read their replies on the I/O thread.
+ *
+ * @param lines - The lines, without newlines
+ * @param replies - The reply to each line
+ * @param commandClass - Class of the lines (CommandClass) under which their latencies are recorded
+ * @param handler - Called with the reply to each line as it arrives, or NULL
+ * @param handlerArg - Passed to the handler
+ * @param stopOnError - If true, no more lines are sent once a line fails
+ * @return The same as writeReadBatch
+ */
+int PowerPMACcontrol::runBatch(const std::vector<std::string>& lines, std::vector<std::string>& replies, int commandClass,
+                               BatchReplyHandler handler, void *handlerArg, bool stopOnError){
+    static const char *functionName = "PowerPMACcontrol::runBatch";
+    replies.assign(lines.size(), std::string());
+    if (this->connected == 0)
+    {
+        debugPrint_ppmaccomm("%s : PMAC is not connected", functionName);
+        return PPMACcontrolNoSSHDriverSet;
+    }
+    if (lines.empty())
+    {
+        return PPMACcontrolNoError;
+    }
+    BatchContext context;
+    context.self = this;
+    context.lines = &lines;
+    context.replies = &replies;
+    context.commandClass = commandClass;
+    context.handler = handler;
+    context.handlerArg = handlerArg;
+    context.stopOnError = stopOnError;
+    return runBulk(batchTask, &context);
+}
+
+/**
+ * @brief Split a program into lines, without copying them.
+ *
+ * @param program - The program
+ * @param length - The number of characters in the program
+ * @param lines - The lines which are not empty, pointing into the program
+ */
+void PowerPMACcontrol::splitProgramLines(const char *program, size_t length, std::vector<ProgramLine>& lines){
+    const char *start = program;
+    const char *end = program + length;
+    int lineNumber = 1;
+    lines.clear();
+    while (start < end)
+    {
+        const char *newline = (const char *)memchr(start, '\n', end - start);
+        size_t lineLength = (newline == NULL) ? end - start : newline - start;
+        if (lineLength > 0)
+        {
+            ProgramLine line;
+            line.text = start;
+            line.length = lineLength;
+            line.lineNumber = lineNumber;
+            lines.push_back(line);
+        }
+        start += lineLength + 1;
+        lineNumber++;
+    }
+}
+
+/**
+ * @brief Send each line of a program, followed by 'close'. Runs on the I/O thread.
+ *
+ * @param program - The program given to PowerPMACcontrol_progDownload
+ * @param length - The number of characters in the program
+ * @param errorLine - The number of the line which failed, or 0
+ * @return The same as PowerPMACcontrol_progDownload
+ */
+int PowerPMACcontrol::downloadProgram(const char *program, size_t length, int& errorLine){
+    static const char *functionName = "PowerPMACcontrol::downloadProgram";
+    std::string reply;
+    std::vector<ProgramLine> lines;
+    int ret = PPMACcontrolNoError;
+    splitProgramLines(program, length, lines);
+    for (size_t i = 0; i < lines.size(); i++)
+    {
+        // The block may differ from the one remembered by an incremental download
+        const char *text = lines[i].text;
+        size_t skip = 0;
+        while (skip < lines[i].length && isspace((unsigned char)text[skip]))
+        {
+            skip++;
+        }
+        // Only an 'open' line has a key, so the others are not copied to look for one
+        if (skip < lines[i].length && tolower((unsigned char)text[skip]) == 'o')
+        {
+            std::string key = DownloadCache::blockKey(std::string(text, lines[i].length));
+            if (!key.empty())
+            {
+                downloadCache->erase(controllerName, key);
+            }
+        }
+    }
+    if (!lines.empty())
+    {
+        ret = sendDownloadLines(lines, errorLine);
+        //Always call 'close' command
+        int ret2 = writeRead_WithoutSemaphore("close\n",reply, TIMEOUT_NOT_SPECIFIED, CommandClassDownload);
+        if ( ret2 != PPMACcontrolNoError)
+        {
+            debugPrint_ppmaccomm("%s : Error while writing 'close'. error number %d\n", functionName, ret2);
+            ret = PPMACcontrolProgramCloseError;
+        }
+    }
+    return ret;
+}
+
+/**
+ * @brief Send lines of a program, one at a time or several in flight as set by PowerPMACcontrol_setDownloadWindow.
+ * Stops at the first line which fails. Runs on the I/O thread.
+ *
+ * @param lines - The lines, without newlines, and their numbers in the file
+ * @param errorLine - The number of the line which failed, or 0
+ * @return The same as PowerPMACcontrol_progDownload
+ */
+int PowerPMACcontrol::sendDownloadLines(const std::vector<ProgramLine>& lines, int& errorLine){
+    if (downloadWindow > 1)
+    {
+        return sendDownloadLinesWindowed(lines, errorLine);
+    }
+    std::string reply;
+    // Reused for every line, so that its buffer is allocated once
+    std::string command;
+    for (size_t i = 0; i < lines.size(); i++)
+    {
+        command.assign(lines[i].text, lines[i].length);
+        command += '\n';
+        int ret = writeRead_WithoutSemaphore(command.c_str(), reply, TIMEOUT_NOT_SPECIFIED, CommandClassDownload);
+        if (ret != PPMACcontrolNoError)
+        {
+            errorLine = lines[i].lineNumber;
+            return ret;
+        }
+    }
+    return PPMACcontrolNoError;
+}
+
+/**
+ * @brief Send lines of a program keeping up to downloadWindow of them in flight. Runs on the I/O thread.
+ *
+ * The lines are written without waiting for their echo. Every line is answered by an ACK (0x06),
+ * so the replies are matched to the lines in order by counting ACKs, and the text before each ACK
+ * is checked for an error, leaving out the echoes of the lines in flight. After a line fails no more
+ * lines are written, but the replies to those already written are read so that the channel is left
+ * ready for the next command.
+ *
+ * @param lines - The lines, without newlines, and their numbers in the file
+ * @param errorLine - The number of the first line which failed or was not answered, or 0
+ * @return The same as PowerPMACcontrol_progDownload
+ */
+int PowerPMACcontrol::sendDownloadLinesWindowed(const std::vector<ProgramLine>& lines, int& errorLine){
+    static const char *functionName = "PowerPMACcontrol::sendDownloadLinesWindowed";
+    int ret = PPMACcontrolNoError;
+    size_t next = 0;     // The next line to write
+    size_t acked = 0;    // The number of lines answered
+    std::vector<double> writeTimes(lines.size());
+    std::string batch;
+    std::string replies;
+    char buff[5120];
+    if (sshdriver == NULL)
+    {
+        return PPMACcontrolNoSSHDriverSet;
+    }
+    sshdriver->flush();
+    while (acked < next || (next < lines.size() && ret == PPMACcontrolNoError))
+    {
+        // Fill the window, unless a line has failed
+        batch.clear();
+        double now = getMonotonicTimeSecs();
+        while (ret == PPMACcontrolNoError && next < lines.size() && next - acked < (size_t)downloadWindow)
+        {
+            batch.append(lines[next].text, lines[next].length);
+            batch += '\n';
+            writeTimes[next++] = now;
+        }
+        if (!batch.empty())
+        {
+            SSHDriverStatus status = sshdriver->writeNoEcho(batch.data(), batch.length(), common_timeout_ms);
+            if (status != SSHDriverSuccess)
+            {
+                debugPrint_ppmaccomm("%s : Failed to write lines (%d)\n", functionName, status);
+                ret = (status == SSHDriverErrorNoconn) ? PPMACcontrolSSHDriverErrorNoconn :
+                      (status == SSHDriverErrorWriteTimeout) ? PPMACcontrolSSHDriverErrorWriteTimeout :
+                      PPMACcontrolSSHDriverErrorNobytes;
+                break;
+            }
+        }
+
+        size_t bytes = 0;
+        SSHDriverStatus status = sshdriver->readAvailable(buff, sizeof(buff), &bytes, common_timeout_ms);
+        if (status != SSHDriverSuccess)
+        {
+            debugPrint_ppmaccomm("%s : No reply to line %d\n", functionName, lines[acked].lineNumber);
+            ret = (status == SSHDriverErrorNoconn) ? PPMACcontrolSSHDriverErrorNoconn : PPMACcontrolSSHDriverErrorReadTimeout;
+            break;
+        }
+        replies.append(buff, bytes);
+
+        size_t ack;
+        while (acked < next && (ack = replies.find('\x06')) != std::string::npos)
+        {
+            int pmac_err_num = findDownloadError(replies, ack, lines, acked, next);
+            int result = (pmac_err_num != 0) ? -pmac_err_num : PPMACcontrolNoError;
+            commandMetrics->recordLatency(CommandClassDownload, CommandPhaseTotal, getMonotonicTimeSecs() - writeTimes[acked]);
+            commandMetrics->recordResult(CommandClassDownload, result);
+            if (result != PPMACcontrolNoError && ret == PPMACcontrolNoError)
+            {
+                debugPrint_ppmaccomm("%s : Error %d at line %d\n", functionName, pmac_err_num, lines[acked].lineNumber);
+                ret = result;
+                errorLine = lines[acked].lineNumber;
+            }
+            replies.erase(0, ack + 1);
+            acked++;
+        }
+    }
+    if (ret != PPMACcontrolNoError && errorLine == 0 && acked < lines.size())
+    {
+        errorLine = lines[acked].lineNumber;
+    }
+    return ret;
+}
+
+/**
+ * @brief Send lines of statements keeping up to BATCH_WINDOW of them in flight, and collect their replies.
+ * Runs on the I/O thread.
+ *
+ * The text before the ACK of a line holds its reply and the echoes of the lines in flight, each
+ * on a line of its own. The echoes, which come in the order of the lines, are left out of the replies.
+ * If stopOnError is set, no more lines are written once a line fails; the replies of those in flight are still read.
+ *
+ * @param lines - The lines, without newlines
+ * @param replies - The reply to each line, its text lines separated by newlines, without the ACK
+ * @param commandClass - Class of the lines (CommandClass) under which their latencies are recorded
+ * @param handler - Called with the reply to each line and its result as soon as it is read, or NULL
+ * @param handlerArg - Passed to the handler
+ * @param stopOnError - If true, no more lines are written once a line fails
+ * @return PPMACcontrolNoError (0), the error replied to the first line which failed, or an SSH driver error
+ */
+int PowerPMACcontrol::writeReadBatch(const std::vector<std::string>& lines, std::vector<std::string>& replies,
+                                     int commandClass, BatchReplyHandler handler, void *handlerArg, bool stopOnError){
+    static const char *functionName = "PowerPMACcontrol::writeReadBatch";
+    int ret = PPMACcontrolNoError;
+    size_t next = 0;     // The next line to write
+    size_t acked = 0;    // The number of lines answered
+    size_t echoed = 0;   // The number of lines whose echo has been read
+    std::vector<double> writeTimes(lines.size());
+    std::string batch;
+    std::string received;
+    char buff[5120];
+    if (sshdriver == NULL)
+    {
+        return PPMACcontrolNoSSHDriverSet;
+    }
+    sshdriver->flush();
+    bool writing = true;
+    while (acked < next || (next < lines.size() && writing))
+    {
+        batch.clear();
+        double now = getMonotonicTimeSecs();
+        while (writing && next < lines.size() && next - acked < (size_t)BATCH_WINDOW)
+        {
+            batch += lines[next];
+            batch += '\n';
+            writeTimes[next++] = now;
+        }
+        if (!batch.empty())
+        {
+            SSHDriverStatus status = sshdriver->writeNoEcho(batch.data(), batch.length(), common_timeout_ms);
+            if (status != SSHDriverSuccess)
+            {
+                debugPrint_ppmaccomm("%s : Failed to write lines (%d)\n", functionName, status);
+                ret = (status == SSHDriverErrorNoconn) ? PPMACcontrolSSHDriverErrorNoconn :
+                      (status == SSHDriverErrorWriteTimeout) ? PPMACcontrolSSHDriverErrorWriteTimeout :
+                      PPMACcontrolSSHDriverErrorNobytes;
+                break;
+            }
+        }
+
+        size_t bytes = 0;
+        SSHDriverStatus status = sshdriver->readAvailable(buff, sizeof(buff), &bytes, common_timeout_ms);
+        if (status != SSHDriverSuccess)
+        {
+            debugPrint_ppmaccomm("%s : No reply to %s\n", functionName, lines[acked].c_str());
+            ret = (status == SSHDriverErrorNoconn) ? PPMACcontrolSSHDriverErrorNoconn : PPMACcontrolSSHDriverErrorReadTimeout;
+            break;
+        }
+        received.append(buff, bytes);
+
+        size_t ack;
+        while (acked < next && (ack = received.find('\x06')) != std::string::npos)
+        {
+            std::string& reply = replies[acked];
+            size_t start = 0;
+            while (start < ack)
+            {
+                size_t end = received.find_first_of("\r\n", start);
+                if (end == std::string::npos || end > ack)
+                {
+                    end = ack;
+                }
+                // gpascii rings the bell before an error
+                size_t textStart = (start < end && received[start] == '\x07') ? start + 1 : start;
+                if (end > textStart)
+                {
+                    if (echoed < next && received.compare(textStart, end - textStart, lines[echoed]) == 0)
+                    {
+                        echoed++;
+                    }
+                    else
+                    {
+                        if (!reply.empty())
+                        {
+                            reply += '\n';
+                        }
+                        reply.append(received, textStart, end - textStart);
+                    }
+                }
+                start = end + 1;
+            }
+            received.erase(0, ack + 1);
+            if (echoed <= acked)
+            {
+                // The echo of the line did not come
+                echoed = acked + 1;
+            }
+            int pmac_err_num = check_PowerPMAC_error(reply);
+            int result = (pmac_err_num != 0) ? -pmac_err_num : PPMACcontrolNoError;
+            commandMetrics->recordLatency(commandClass, CommandPhaseTotal, getMonotonicTimeSecs() - writeTimes[acked]);
+            commandMetrics->recordResult(commandClass, result);
+            if (result != PPMACcontrolNoError && ret == PPMACcontrolNoError)
+            {
+                debugPrint_ppmaccomm("%s : Error %d in the reply to %s\n", functionName, pmac_err_num, lines[acked].c_str());
+                ret = result;
+                writing = !stopOnError;
+            }
+            if (handler != NULL)
+            {
+                handler(acked, reply, result, handlerArg);
+            }
+            acked++;
+        }
+    }
+    return ret;
+}
+
+/**
+ * @brief Send the blocks of an open program file which differ from those last downloaded,
+ * followed by 'close'. Runs on the I/O thread.
+ *
+ * @param progfile - The program file opened by PowerPMACcontrol_progDownloadIncremental
+ * @param blocksSent - Incremented for each block sent
+ * @param blocksSkipped - Incremented for each block skipped
+ * @param errorLine - The number of the line which failed, or 0
+ * @return The same as PowerPMACcontrol_progDownload
+ */
+int PowerPMACcontrol::downloadChangedBlocks(std::istream& progfile, int& blocksSent, int& blocksSkipped,
+                                            int& errorLine){
+    static const char *functionName = "PowerPMACcontrol::downloadChangedBlocks";
+    std::vector<ProgramBlock> blocks;
+    if (!DownloadCache::readBlocks(progfile, blocks))
+    {
+        return PPMACcontrolFileReadError;
+    }
+    std::string reply;
+    int ret = PPMACcontrolNoError;
+    bool written = false;
+    // Blocks without their own 'close' are remembered once the final 'close' succeeds
+    std::vector<size_t> unclosed;
+    for (size_t i = 0; i < blocks.size() && ret == PPMACcontrolNoError; i++)
+    {
+        const ProgramBlock& block = blocks[i];
+        uint64_t hash;
+        if (!block.key.empty() && downloadCache->find(controllerName, block.key, hash) && hash == block.hash)
+        {
+            debugPrint_ppmaccomm("%s : %s has not changed\n", functionName, block.key.c_str());
+            blocksSkipped++;
+            continue;
+        }
+        if (!block.key.empty())
+        {
+            // Until it is sent in full, the controller may hold part of the block
+            downloadCache->erase(controllerName, block.key);
+        }
+        blocksSent++;
+        written = true;
+        std::vector<ProgramLine> lines(block.lines.size());
+        for (size_t j = 0; j < lines.size(); j++)
+        {
+            lines[j].text = block.lines[j].data();
+            lines[j].length = block.lines[j].length();
+            lines[j].lineNumber = block.lineNumbers[j];
+        }
+        ret = sendDownloadLines(lines, errorLine);
+        if (ret == PPMACcontrolNoError && !block.key.empty())
+        {
+            if (block.closed)
+                downloadCache->store(controllerName, block.key, block.hash);
+            else
+                unclosed.push_back(i);
+        }
+    }
+    if (written)
+    {
+        //Always call 'close' command
+        int ret2 = writeRead_WithoutSemaphore("close\n",reply, TIMEOUT_NOT_SPECIFIED, CommandClassDownload);
+        if ( ret2 != PPMACcontrolNoError)
+        {
+            debugPrint_ppmaccomm("%s : Error while writing 'close'. error number %d\n", functionName, ret2);
+            ret = PPMACcontrolProgramCloseError;
+        }
+    }
+    if (ret == PPMACcontrolNoError)
+    {
+        for (size_t i = 0; i < unclosed.size(); i++)
+        {
+            downloadCache->store(controllerName, blocks[unclosed[i]].key, blocks[unclosed[i]].hash);
+        }
+    }
+    return ret;
+}
+
+/**
+ * @brief Copy a program to Power PMAC, load it with gpascii and remove the copy. Runs on the I/O thread.
+ *
+ * The copy is a file created by mktemp in /tmp, so downloads of files of the same name, from this
+ * connection or any other, do not overwrite or remove each other's copies.
+ *
+ * @param contents - The program, ending with 'close'
+ * @param remoteName - Name of the program file, which needs no quoting in the shell
+ * @param errorLine - The number of the first line which failed, from the "file:line:column: error #N" of gpascii, or 0
+ * @return The same as PowerPMACcontrol_progDownloadFile
+ */
+int PowerPMACcontrol::transferProgramFile(const std::string& contents, const std::string& remoteName, int& errorLine){
+    static const char *functionName = "PowerPMACcontrol::transferProgramFile";
+    if (sshdriver == NULL)
+    {
+        return PPMACcontrolNoSSHDriverSet;
+    }
+    // The blocks may differ from those remembered by an incremental download
+    std::istringstream lines(contents);
+    std::string line;
+    while (getline(lines, line))
+    {
+        std::string key = DownloadCache::blockKey(line);
+        if (!key.empty())
+        {
+            downloadCache->erase(controllerName, key);
+        }
+    }
+
+    double start = getMonotonicTimeSecs();
+    std::string prefix = "/tmp/ppmac_" + remoteName + ".";
+    std::string output;
+    int exitStatus;
+    SSHDriverStatus status = sshdriver->execCommand(("mktemp " + prefix + "XXXXXX").c_str(), output, exitStatus,
+                                                    common_timeout_ms);
+    std::string remotePath = trim_right_copy(output);
+    if (status != SSHDriverSuccess || exitStatus != 0 || remotePath.length() <= prefix.length() ||
+        remotePath.compare(0, prefix.length(), prefix) != 0 ||
+        remotePath.find_first_of(" \t\r\n'\"\\$`;&|<>") != std::string::npos)
+    {
+        debugPrint_ppmaccomm("%s : Failed to create a file for the program (%d): %s\n", functionName, status, output.c_str());
+        commandMetrics->recordResult(CommandClassDownload, PPMACcontrolFileTransferError);
+        return (status == SSHDriverErrorNoconn) ? PPMACcontrolSSHDriverErrorNoconn : PPMACcontrolFileTransferError;
+    }
+    std::string command = "gpascii -i" + remotePath + " 2>&1";
+    status = sshdriver->uploadData(remotePath.c_str(), contents.data(), contents.length(), FILE_TRANSFER_TIMEOUT_MS);
+    if (status == SSHDriverSuccess)
+    {
+        status = sshdriver->execCommand(command.c_str(), output, exitStatus, FILE_TRANSFER_TIMEOUT_MS);
+    }
+    else
+    {
+        debugPrint_ppmaccomm("%s : Failed to copy the program to %s (%d)\n", functionName, remotePath.c_str(), status);
+    }
+    // The copy is removed whether or not it loaded
+    std::string removeOutput;
+    int removeStatus;
+    sshdriver->execCommand(("rm -f " + remotePath).c_str(), removeOutput, removeStatus, common_timeout_ms);
+    if (status != SSHDriverSuccess)
+    {
+        debugPrint_ppmaccomm("%s : Failed to run %s (%d)\n", functionName, command.c_str(), status);
+        commandMetrics->recordResult(CommandClassDownload, PPMACcontrolFileTransferError);
+        return (status == SSHDriverErrorNoconn) ? PPMACcontrolSSHDriverErrorNoconn : PPMACcontrolFileTransferError;
+    }
+    debugPrint_ppmaccomm("%s : gpascii exited with %d: %s\n", functionName, exitStatus, output.c_str());
+
+    int ret = PPMACcontrolNoError;
+    int pmac_err_num = check_PowerPMAC_error(output);
+    if (pmac_err_num != 0)
+    {
+        ret = -pmac_err_num;
+        // The location of the error precedes it: "file:line:column: error #N"
+        size_t error = output.find("error #");
+        size_t lineStart = output.rfind('\n', error);
+        lineStart = (lineStart == std::string::npos) ? 0 : lineStart + 1;
+        size_t colon = output.find(':', lineStart);
+        if (colon != std::string::npos && colon < error)
+        {
+            errorLine = atoi(output.c_str() + colon + 1);
+        }
+    }
+    else if (exitStatus != 0)
+    {
+        // gpascii could not be run or could not open the copy
+        debugPrint_ppmaccomm("%s : %s exited with %d\n", functionName, command.c_str(), exitStatus);
+        ret = PPMACcontrolFileTransferError;
+    }
+    commandMetrics->recordLatency(CommandClassDownload, CommandPhaseTotal, getMonotonicTimeSecs() - start);
+    commandMetrics->recordResult(CommandClassDownload, ret);
+    return ret;
+}
+
+/**
+ * @brief List a program and pass the listing to a sink as it is read. Runs on the I/O thread.
+ *
+ * @param bufferName - The program, as it follows "list"
+ * @param sink - The function which receives whole lines of the listing
+ * @param userData - Passed to the sink
+ * @return The same as PowerPMACcontrol_progUpload(std::string, ProgramUploadSink, void *)
+ */
+int PowerPMACcontrol::uploadProgram(const std::string& bufferName, ProgramUploadSink sink, void *userData){
+    static const char *functionName = "PowerPMACcontrol::uploadProgram";
+    if (sshdriver == NULL)
+    {
+        return PPMACcontrolNoSSHDriverSet;
+    }
+    std::string cmd = "list " + bufferName + "\n";
+    size_t bytes = 0;
+    double start = getMonotonicTimeSecs();
+    int ret = driverWrite(sshdriver, cmd.c_str(), cmd.length(), &bytes, common_timeout_ms);
+    if (ret != PPMACcontrolNoError)
+    {
+        debugPrint_ppmaccomm("%s : Failed to write %s", functionName, cmd.c_str());
+        commandMetrics->recordResult(CommandClassQuery, ret);
+        return ret;
+    }
+
+    // Whole lines are passed on as they arrive; the rest waits for the next read
+    std::string pending;
+    std::string lines;
+    char buff[5120];
+    bool firstLine = true;
+    bool finished = false;
+    while (!finished)
+    {
+        SSHDriverStatus status = sshdriver->readAvailable(buff, sizeof(buff), &bytes, common_timeout_ms);
+        if (status != SSHDriverSuccess)
+        {
+            debugPrint_ppmaccomm("%s : Listing of %s stopped (%d)\n", functionName, bufferName.c_str(), status);
+            if (ret == PPMACcontrolNoError)
+            {
+                ret = (status == SSHDriverErrorNoconn) ? PPMACcontrolSSHDriverErrorNoconn : PPMACcontrolSSHDriverErrorReadTimeout;
+            }
+            break;
+        }
+        pending.append(buff, bytes);
+        size_t ack = pending.find('\x06');
+        finished = (ack != std::string::npos);
+        if (finished)
+        {
+            // The last line may not have a newline before the ACK
+            pending.erase(ack);
+            if (!pending.empty() && pending[pending.length()-1] != '\n')
+            {
+                pending += '\n';
+            }
+        }
+        lines.clear();
+        size_t lineStart = 0;
+        size_t newline;
+        while ((newline = pending.find('\n', lineStart)) != std::string::npos)
+        {
+            size_t lineEnd = newline;
+            if (lineEnd > lineStart && pending[lineEnd-1] == '\r')
+            {
+                lineEnd--;
+            }
+            if (firstLine)
+            {
+                // A program which cannot be listed gives an error instead, after the bell
+                firstLine = false;
+                if (pending[lineStart] == '\x07')
+                {
+                    lineStart++;
+                }
+                int pmac_err_num = check_PowerPMAC_error(pending.substr(lineStart, lineEnd - lineStart));
+                if (pmac_err_num != 0)
+                {
+                    ret = -pmac_err_num;
+                }
+            }
+            lines.append(pending, lineStart, lineEnd - lineStart);
+            lines += '\n';
+            lineStart = newline + 1;
+        }
+        pending.erase(0, lineStart);
+        if (ret != PPMACcontrolNoError)
+        {
+            // Read the rest of the reply, so the next command gets its own
+            continue;
+        }
+        if (!lines.empty())
+        {
+            sink(lines.data(), lines.length(), userData);
+        }
+    }
+    commandMetrics->recordLatency(CommandClassQuery, CommandPhaseTotal, getMonotonicTimeSecs() - start);
+    commandMetrics->recordResult(CommandClassQuery, ret);
+    return ret;
+}
+
+/**
+ * @brief Write data to the connected SSH channel and read the reply. 
+ * This function must only be called on the I/O thread.
+ * 
+ * A timeout should be specified in milliseconds.
+ * @param cmd - The string buffer to be written.
+ * @param response - The response read from the SSH channel
+ * @param timeout - A timeout in ms for the write. The default value is 1000 and may be updated using PowerPMACcontrol_setTimeout.
+ * @param commandClass - Class of the command (CommandClass) under which its latencies are recorded. The default is CommandClassQuery.
+ * @return If successful, PPMACcontrolNoError(0) is returned. If not, 
+ * minus value is returned. Possible error codes are :
+ *      - PPMACcontrolNoError(0)
+ *      - Error reported from Power PMAC (-1 to -99) -1*(Power PMAC error number)
+ *      - PPMACcontrolNoSSHDriverSet (-230)
+ *      - PPMACcontrolSSHDriverError (-102)
+ *      - PPMACcontrolSSHDriverErrorNoconn (-104)
+ *      - PPMACcontrolSSHDriverErrorNobytes (-103)
+ *      - PPMACcontrolSSHDriverErrorReadTimeout (-112)
+ *      - PPMACcontrolSSHDriverErrorWriteTimeout (-113)
+ */
+int PowerPMACcontrol::writeRead_WithoutSemaphore(const char *cmd, std::string& response, int timeout, int commandClass){
+    static const char *functionName = "PowerPMACcontrol::writeRead(char, string, int)";
+    debugPrint_ppmaccomm("%s writing %s\n", functionName, cmd);
+    if (this->connected == 0)
+    {
+        debugPrint_ppmaccomm("%s : PMAC is not connected", functionName);
+        return PPMACcontrolNoSSHDriverSet;
+    }
+    // If no timeout specified, use the common value
+    if (timeout == TIMEOUT_NOT_SPECIFIED)
+    {
+    	timeout = common_timeout_ms;
+    }
+    return driverWriteRead(sshdriver, cmd, response, timeout, commandClass);
+}
+
+/**
+ * @brief Write a command to the SSH channel of the given driver and read the reply.
+ *
+ * The caller must already have exclusive use of the driver.
+ *
+ * @param driver - The main or safety channel SSH driver
+ * @param cmd - The string buffer to be written.
+ * @param response - The response read from the SSH channel
+ * @param timeout - A timeout in ms for the write and the read.
+ * @param commandClass - Class of the command (CommandClass) under which its latencies are recorded
+ * @return The same as writeRead_WithoutSemaphore
+ */
+int PowerPMACcontrol::driverWriteRead(Transport *driver, const char *cmd, std::string& response, int timeout, int commandClass){
+    static const char *functionName = "PowerPMACcontrol::driverWriteRead";
+    size_t bytes = 0;
+    size_t bytesWritten = 0;
+	int return_num = PPMACcontrolNoError;
 	char buff[5120] = "";
-    
-    //Check semaphore error
-#ifdef WIN32 
+    int ret = driverWrite(driver, cmd, strlen(cmd), &bytes, timeout);
+    bytesWritten = bytes;
+    bytes = 0;
+    if (ret != PPMACcontrolNoError)
+    {
+        debugPrint_ppmaccomm("%s : Failed to write to powerPmac command (%s)\n", functionName, cmd);
+        return_num = ret;
+    }
+    else
+    {
+        const SSHDriverTiming& timing = driver->getTiming();
+        commandMetrics->recordLatency(commandClass, CommandPhaseWrite, timing.writeEnd - timing.writeStart);
+        commandMetrics->recordLatency(commandClass, CommandPhaseEcho, timing.echoEnd - timing.writeEnd);
+
+        ret = driverRead(driver, buff, 5120, &bytes, 0x06, timeout);
+        if (timing.firstByte > 0.0)
+        {
+            commandMetrics->recordLatency(commandClass, CommandPhaseFirstByte, timing.firstByte - timing.readStart);
+            if (ret == PPMACcontrolNoError)
+            {
+                commandMetrics->recordLatency(commandClass, CommandPhaseAck, timing.readEnd - timing.firstByte);
+            }
+        }
+        if (ret != PPMACcontrolNoError)
+        {
+            debugPrint_ppmaccomm("%s : Failed to read from powerPmac\n", functionName);
+            return_num=ret;
+        }
+        else
+        {
+            debugPrint_ppmaccomm("%s : The reply from PowerPMAC for %s is [%s]\n", functionName,cmd, buff);
+            std::string trimmed = trim_right_copy(std::string(buff));
+            response = trimmed;
+            int pmac_err_num = check_PowerPMAC_error( trimmed );
+            if ( pmac_err_num != 0 )
+            {
+                return_num = (-1)*pmac_err_num;
+            }
+        }
+    }
+    if (driver != NULL)
+    {
+        commandMetrics->recordResult(commandClass, return_num);
+        if (tracer->isEnabled())
+        {
+            tracer->traceCommand((driver == safetyDriver) ? TraceChannelSafety : TraceChannelMain, commandClass, cmd,
+                                 bytesWritten, bytes, driver->getTiming(), return_num);
+        }
+    }
+	return return_num;
+}
+
+
+/**
+ * @brief Write data to the connected SSH channel and read the reply.
+ * 
+ * The command is written and the reply read by the I/O thread of the connection.
+ * A timeout should be specified in milliseconds.
+ * @param cmd - The string buffer to be written.
+ * @param response - The response read from the SSH channel
+ * @param timeout - A timeout in ms for the write. The default value is 1000 and may be updated using PowerPMACcontrol_setTimeout.
+ * The same timeout limits the time spent waiting in the request queue for the I/O thread, except in the safety lane.
+ * @param priority - Priority lane of the request queue (RequestPriority). The default is RequestPriorityNormal.
+ * A request in the safety lane waits as long as it takes for the request in progress to finish, so that a stop
+ * is not dropped while a long transfer is running.
+ * @return If successful, PPMACcontrolNoError(0) is returned. If not, 
+ * minus value is returned. Possible error codes are :
+ *      - PPMACcontrolNoError(0)
+ *      - Error reported from Power PMAC (-1 to -99) -1*(Power PMAC error number)
+ *      - PPMACcontrolNoSSHDriverSet (-230)
+ *      - PPMACcontrolSSHDriverError (-102)
+ *      - PPMACcontrolSSHDriverErrorNoconn (-104)
+ *      - PPMACcontrolSSHDriverErrorNobytes (-103)
+ *      - PPMACcontrolSSHDriverErrorReadTimeout (-112)
+ *      - PPMACcontrolSSHDriverErrorWriteTimeout (-113)
+ *      - PPMACcontrolSemaphoreTimeoutError = (-239)
+ *      - PPMACcontrolSemaphoreError = (-240)
+ *      - PPMACcontrolSemaphoreReleaseError = (-241)
+ */
+int PowerPMACcontrol::writeRead(const char *cmd, std::string& response, int timeout, int priority){
+    static const char *functionName = "PowerPMACcontrol::writeRead(char, string, int, int)";
+    debugPrint_ppmaccomm("%s writing %s\n", functionName, cmd);
+    if (this->connected == 0)
+    {
+        debugPrint_ppmaccomm("%s : PMAC is not connected", functionName);
+        return PPMACcontrolNoSSHDriverSet;
+    }
+    // If no timeout specified, use the common value
+    if (timeout == TIMEOUT_NOT_SPECIFIED)
+    {
+    	timeout = common_timeout_ms;
+    }
+
+    WriteReadContext context;
+    context.self = this;
+    context.cmd = cmd;
+    context.response = &response;
+    context.timeout = timeout;
+    context.commandClass = (priority == RequestPrioritySafety) ? (int)CommandClassSafety : CommandMetrics::classifyCommand(cmd);
+    context.submitTime = getMonotonicTimeSecs();
+    int return_num = runOnIOThread(writeReadTask, &context, priority, (priority == RequestPrioritySafety) ? -1 : timeout);
+
+    commandMetrics->recordLatency(context.commandClass, CommandPhaseTotal, getMonotonicTimeSecs() - context.submitTime);
+    if (return_num == PPMACcontrolSemaphoreTimeoutError || return_num == PPMACcontrolSemaphoreError)
+    {
+        // Never reached the I/O thread, so it has not been counted yet
+        commandMetrics->recordResult(context.commandClass, return_num);
+        if (tracer->isEnabled())
+        {
+            tracer->traceEvent(TraceEventQueueTimeout, TraceChannelMain, context.commandClass, cmd, return_num);
+        }
+    }
+    return return_num;
+}
+
+/**
+ * @brief Run writeRead_WithoutSemaphore on the I/O thread.
+ */
+int PowerPMACcontrol::writeReadTask(void *arg){
+    WriteReadContext *context = (WriteReadContext *)arg;
+    context->self->commandMetrics->recordLatency(context->commandClass, CommandPhaseQueueWait,
+                                                 getMonotonicTimeSecs() - context->submitTime);
+    return context->self->writeRead_WithoutSemaphore(context->cmd, *context->response, context->timeout,
+                                                     context->commandClass);
+}
+
+/**
+ * @brief Run a function on the I/O thread of the connection and wait for it to complete.
+ *
+ * @param task - Function to be run on the I/O thread
+ * @param context - Argument of the function
+ * @param priority - Priority lane of the request queue (RequestPriority)
+ * @param timeout - Maximum time to wait in ms for the function to start. A negative value waits forever.
+ * @return The return value of the function if it was run. If not,
+ * minus value is returned. Possible error codes are :
+ *      - PPMACcontrolSemaphoreTimeoutError = (-239)
+ *      - PPMACcontrolSemaphoreError = (-240)
+ */
+int PowerPMACcontrol::runOnIOThread(IOTask task, void *context, int priority, int timeout){
+    static const char *functionName = "PowerPMACcontrol::runOnIOThread";
+    int result = PPMACcontrolNoError;
+    RequestQueueStatus ret = ioThread->run(task, context, priority, timeout, result);
+    switch (ret){
+        case RequestQueueSuccess:
+            return result;
+        case RequestQueueTimeout:
+            debugPrint_ppmaccomm("%s : Request queue timed out\n",functionName);
+            return PPMACcontrolSemaphoreTimeoutError;
+        default:
+            debugPrint_ppmaccomm("%s : Error running the request on the I/O thread\n",functionName);
+            return PPMACcontrolSemaphoreError;
+    }
+}
+
+/**
+ * @brief Run a long transfer, such as a program download or upload or a batch of statements, on the I/O thread.
+ *
+ * It queues in the bulk lane, so that ordinary commands waiting at the same time are served first,
+ * within the limit set by RequestQueue to keep transfers from being starved.
+ * It waits up to the common timeout for its turn; once started it runs to the end.
+ *
+ * @param task - Function to be run on the I/O thread
+ * @param context - Argument of the function
+ * @return The same as runOnIOThread
+ */
+int PowerPMACcontrol::runBulk(IOTask task, void *context){
+    return runOnIOThread(task, context, RequestPriorityBulk, common_timeout_ms);
+}
+
+/**
+ * @brief Get the latency histograms and counters of the commands sent to the Power PMAC.
+ *
+ * The time of each command is split into phases (CommandPhase): waiting in the request queue,
+ * writing, reading back the echo, waiting for the first byte of the reply, receiving the rest of
+ * the reply up to the ACK, and the total. Each phase has a latency histogram per command class
+ * (CommandClass). The counters include the requests, timeouts and errors of each class and the
+ * number of connections and reconnections.
+ *
+ * The metrics are recorded all the time without locks. Commands in progress during the copy
+ * may be partly included.
+ *
+ * @param snapshot - Copy of the metrics
+ * @return Always returns PPMACcontrolNoError(0) because no communication occurs in this function
+ */
+int PowerPMACcontrol::PowerPMACcontrol_getCommandMetrics(CommandMetricsSnapshot& snapshot){
+    commandMetrics->getSnapshot(snapshot);
+    return PPMACcontrolNoError;
+}
+
+/**
+ * @brief Clear the latency histograms and counters of the commands.
+ *
+ * @return Always returns PPMACcontrolNoError(0) because no communication occurs in this function
+ */
+int PowerPMACcontrol::PowerPMACcontrol_resetCommandMetrics(){
+    commandMetrics->reset();
+    return PPMACcontrolNoError;
+}
+
+/**
+ * @brief Start recording a trace of the commands sent to the Power PMAC.
+ *
+ * Each command written, with the bytes written and read, the timestamps of the write and read
+ * (SSHDriverTiming) and the result, is recorded as a binary TraceEvent. Connections, disconnections,
+ * request queue timeouts and failures of the safety channel are recorded too. The events are kept in
+ * a lock-free ring buffer and passed to the sink, in order, by a background thread.
+ * The sink must not call functions of this object which communicate with the Power PMAC.
+ * traceToFile may be used as the sink to write the events as text to a FILE.
+ *
+ * When tracing is off, each trace point costs a single test of a flag, so tracing can be
+ * switched on and off in production without rebuilding with DEBUG_PowerPMACcontrol.
+ *
+ * Calling this while tracing is on stops the trace first. It must not be called from two threads at once,
+ * nor at the same time as PowerPMACcontrol_stopTrace.
+ *
+ * @param sink - Function called with each event on the trace thread
+ * @param userData - Passed to the sink with each event, for example a FILE pointer for traceToFile
+ * @param bufferLength - Number of events the buffer holds, rounded up to a power of two. The default is 4096.
+ * Events recorded while the buffer is full are dropped and counted.
+ * @param period_ms - Interval in ms at which the trace thread passes events to the sink. The default is 100.
+ * @return If successful, PPMACcontrolNoError(0) is returned. If not,
+ * minus value is returned. Possible error codes are :
+ *      - PPMACcontrolInvalidParamError (-242)
+ *      - PPMACcontrolSoftwareError (-232)
+ */
+int PowerPMACcontrol::PowerPMACcontrol_startTrace(TraceSink sink, void *userData, int bufferLength, int period_ms){
+    return tracer->start(sink, userData, bufferLength, period_ms);
+}
+
+/**
+ * @brief Stop recording the trace of the commands.
+ *
+ * Events already recorded are passed to the sink before this function returns.
+ *
+ * @return Always returns PPMACcontrolNoError(0) because no communication occurs in this function
+ */
+int PowerPMACcontrol::PowerPMACcontrol_stopTrace(){
+    tracer->stop();
+    return PPMACcontrolNoError;
+}
+
+/**
+ * @brief Check whether the trace of the commands is being recorded.
+ *
+ * @return true if PowerPMACcontrol_startTrace has been called and the trace has not been stopped
+ */
+bool PowerPMACcontrol::PowerPMACcontrol_isTracing(){
+    return tracer->isEnabled();
+}
+
+/**
+ * @brief Get the number of trace events dropped because the buffer was full.
+ *
+ * A larger buffer or a shorter period passed to PowerPMACcontrol_startTrace reduces the number dropped.
+ *
+ * @param dropped - Events dropped since the trace was started
+ * @return Always returns PPMACcontrolNoError(0) because no communication occurs in this function
+ */
+int PowerPMACcontrol::PowerPMACcontrol_getTraceDropped(unsigned long& dropped){
+    dropped = tracer->getDropped();
+    return PPMACcontrolNoError;
+}
+
+/**
+ * @brief Wait for exclusive use of the safety channel.
+ *
+ * @param timeout - Maximum time to wait in ms. A negative value waits forever.
+ * @return If successful, PPMACcontrolNoError(0) is returned. If not,
+ * minus value is returned. Possible error codes are :
+ *      - PPMACcontrolSemaphoreTimeoutError = (-239)
+ *      - PPMACcontrolSemaphoreError = (-240)
+ */
+int PowerPMACcontrol::lockSafetyChannel(int timeout){
+    static const char *functionName = "PowerPMACcontrol::lockSafetyChannel";
+#ifdef WIN32
+	DWORD dwWaitResult = WaitForSingleObject(ghSafetySemaphore, (timeout < 0) ? INFINITE : (DWORD)timeout);
 	if (dwWaitResult == WAIT_OBJECT_0)
+		return PPMACcontrolNoError;
+	else if (dwWaitResult == WAIT_TIMEOUT)
+	{
+		debugPrint_ppmaccomm("%s : Semaphore timed out\n",functionName);
+		return PPMACcontrolSemaphoreTimeoutError;
+	}
+	debugPrint_ppmaccomm("%s : Semaphore error (%d)\n",functionName, dwWaitResult);
+	return PPMACcontrolSemaphoreError;
 #else
-    if (sem_return == 0)    
-#endif
-    {   //Semaphore OK
-		int ret = this->PowerPMACcontrol_write(cmd, strlen(cmd), &bytes, timeout);
-		if (ret != PPMACcontrolNoError)
-		{
-			debugPrint_ppmaccomm("%s : Failed to write to powerPmac command (%s)\n", functionName, cmd);
-			return_num = ret;
-		}
-		else
-		{
-			ret = this->PowerPMACcontrol_read(buff, 5120, &bytes, 0x06, timeout);
-			if (ret != PPMACcontrolNoError)
-			{
-				debugPrint_ppmaccomm("%s : Failed to read from powerPmac\n", functionName);
-				return_num=ret;
-			}
-			else
-			{
-				debugPrint_ppmaccomm("%s : The reply from PowerPMAC for %s is [%s]\n", functionName,cmd, buff);
-				std::string trimmed = trim_right_copy(std::string(buff));
-				response = trimmed;
-				int pmac_err_num = PowerPMACcontrol::check_PowerPMAC_error( trimmed );
-				if ( pmac_err_num != 0 )
-				{
-					return_num = (-1)*pmac_err_num;
-				}
-			}
-		}
-        
-        //Releasing the semaphore
-#ifdef WIN32 
-		if (!ReleaseSemaphore(ghSemaphore, 1, NULL))
-		{
-			debugPrint_ppmaccomm("%s : Error releasing Semaphore\n",functionName);
-            return_num = PPMACcontrolSemaphoreReleaseError;
-		}
-        else
-        {
-            debugPrint_ppmaccomm("%s : Released Semaphore\n",functionName);
-        }
-#else
-        if (sem_post(&sem_writeRead)!=0)
-        {
-            debugPrint_ppmaccomm("%s : Error releasing Semaphore\n",functionName);
-            return_num = PPMACcontrolSemaphoreReleaseError;
-        }
-        else
-        {
-            debugPrint_ppmaccomm("%s : Released Semaphore\n",functionName);
-        }
-#endif
-		return return_num;
+	int sem_return;
+	if (timeout < 0)
+	{
+		while ((sem_return = sem_wait(&sem_safety)) != 0 && errno == EINTR)
+			;
 	}
-#ifdef WIN32 
-	else if (dwWaitResult == WAIT_TIMEOUT)
+	else
 	{
-        debugPrint_ppmaccomm("%s : Semaphore timed out\n",functionName);
-        return PPMACcontrolSemaphoreTimeoutError;
-	}	
-    else
+		struct timespec ts = getAbsTimeout(timeout);
+		while ((sem_return = sem_timedwait(&sem_safety, &ts)) != 0 && errno == EINTR)
+			;
+	}
+	if (sem_return == 0)
+		return PPMACcontrolNoError;
+	else if (errno == ETIMEDOUT)
 	{
-        debugPrint_ppmaccomm("%s : Error obtaining a Semaphore (%d)\n",functionName, dwWaitResult);
-        return PPMACcontrolSemaphoreError;
+		debugPrint_ppmaccomm("%s : Semaphore timed out\n",functionName);
+		return PPMACcontrolSemaphoreTimeoutError;
 	}
+	debugPrint_ppmaccomm("%s : Semaphore error (%d)\n",functionName, errno);
+	return PPMACcontrolSemaphoreError;
+#endif
+}
+
+/**
+ * @brief Release the safety channel.
+ */
+void PowerPMACcontrol::unlockSafetyChannel(){
+#ifdef WIN32
+	ReleaseSemaphore(ghSafetySemaphore, 1, NULL);
 #else
-    else
-	{
-        if (errno == ETIMEDOUT)
+	sem_post(&sem_safety);
+#endif
+}
+
+/**
+ * @brief Send a stop or abort command by the quickest route available.
+ *
+ * If the safety channel was opened by PowerPMACcontrol_connect, the command is written to it
+ * and does not wait behind any other traffic. Otherwise, or if the safety channel fails,
+ * the command is sent on the main connection through the safety lane of the request queue,
+ * which puts it ahead of all queued requests. A request already running on the I/O thread, such as
+ * a program download, is not interrupted, since a command written between its lines would go into the open buffer,
+ * so the command waits for it to finish without the common timeout.
+ *
+ * @param cmd - The stop or abort command to be written.
+ * @return If successful, PPMACcontrolNoError(0) is returned. If not,
+ * minus value is returned. The possible error codes are the same as writeRead.
+ */
+int PowerPMACcontrol::writeRead_Safety(const char *cmd){
+    static const char *functionName = "PowerPMACcontrol::writeRead_Safety";
+    if (this->safetyConnected != 0)
+    {
+        int ret = lockSafetyChannel(common_timeout_ms);
+        if (ret == PPMACcontrolNoError)
+        {
+            if (this->safetyConnected != 0)
+            {
+                std::string reply;
+                double start = getMonotonicTimeSecs();
+                ret = driverWriteRead(safetyDriver, cmd, reply, common_timeout_ms, CommandClassSafety);
+                commandMetrics->recordLatency(CommandClassSafety, CommandPhaseTotal, getMonotonicTimeSecs() - start);
+                if (ret <= PPMACcontrolError)
+                {
+                    // Discard any late reply so that the next command reads its own
+                    safetyDriver->flush();
+                }
+            }
+            else
+            {
+                ret = PPMACcontrolNoSSHDriverSet;
+            }
+            unlockSafetyChannel();
+        }
+        // Errors from -1 to -99 are reported by Power PMAC, so the command got there
+        if (ret > PPMACcontrolError)
         {
-			debugPrint_ppmaccomm("%s : Semaphore timed out\n",functionName);
-			return PPMACcontrolSemaphoreTimeoutError;
+            return ret;
         }
-        else
-        {	
-            debugPrint_ppmaccomm("%s : Semaphore error %d\n",functionName, errno);
-			return PPMACcontrolSemaphoreError;
+        debugPrint_ppmaccomm("%s : Safety channel failed (%d), using the main connection\n", functionName, ret);
+        if (tracer->isEnabled())
+        {
+            tracer->traceEvent(TraceEventSafetyFallback, TraceChannelSafety, CommandClassSafety, cmd, ret);
         }
-	}
-#endif
+    }
+    return writeRead(cmd, TIMEOUT_NOT_SPECIFIED, RequestPrioritySafety);
+}
+
+/**
+ * @brief Check whether the safety channel reserved for stop and abort commands is open.
+ *
+ * The safety channel is opened by PowerPMACcontrol_connect when its safetyChannel parameter is true.
+ *
+ * @return true if the safety channel is open
+ */
+bool PowerPMACcontrol::PowerPMACcontrol_isSafetyChannelOpen(){
+    return (this->safetyConnected != 0);
+}
+
+/**
+ * @brief Get the statistics of the request queue of the I/O thread which owns the connection.
+ *
+ * For each priority lane, the statistics include the number of requests waiting,
+ * the largest number waiting at once, the number of requests served and timed out,
+ * and the total and maximum time spent waiting.
+ *
+ * @param statistics - Statistics of the request queue, indexed by RequestPriority
+ * @return Always returns PPMACcontrolNoError(0) because no communication occurs in this function
+ */
+int PowerPMACcontrol::PowerPMACcontrol_getQueueStatistics(RequestQueueStatistics& statistics){
+    ioThread->getStatistics(statistics);
+    return PPMACcontrolNoError;
+}
+
+/**
+ * @brief Clear the accumulated statistics of the request queue.
+ *
+ * @return Always returns PPMACcontrolNoError(0) because no communication occurs in this function
+ */
+int PowerPMACcontrol::PowerPMACcontrol_resetQueueStatistics(){
+    ioThread->resetStatistics();
+    return PPMACcontrolNoError;
 }
 
 /**
@@ -2573,6 +4371,7 @@ int PowerPMACcontrol::writeRead(const char *cmd, std::string& response, int time
  * A timeout should be specified in milliseconds.
  * @param cmd - The string buffer to be written.
  * @param timeout - A timeout in ms for the write. The default value is 1000 and may be updated using PowerPMACcontrol_setTimeout.
+ * @param priority - Priority lane of the request queue (RequestPriority). The default is RequestPriorityNormal.
  * @return If successful, PPMACcontrolNoError(0) is returned. If not, 
  * minus value is returned. Possible error codes are :
  *      - PPMACcontrolNoError(0)
@@ -2587,8 +4386,8 @@ int PowerPMACcontrol::writeRead(const char *cmd, std::string& response, int time
  *      - PPMACcontrolSemaphoreError = (-240)
  *      - PPMACcontrolSemaphoreReleaseError = (-241)
  */
-int PowerPMACcontrol::writeRead(const char *cmd, int timeout){
-    static const char *functionName = "PowerPMACcontrol::writeRead(char*, int)";
+int PowerPMACcontrol::writeRead(const char *cmd, int timeout, int priority){
+    static const char *functionName = "PowerPMACcontrol::writeRead(char*, int, int)";
     debugPrint_ppmaccomm("%s called", functionName);
     // If no timeout specified, use the common value
     if (timeout == TIMEOUT_NOT_SPECIFIED)
@@ -2596,7 +4395,7 @@ int PowerPMACcontrol::writeRead(const char *cmd, int timeout){
     	timeout = common_timeout_ms;
     }
     std::string reply = "";
-    return this->writeRead(cmd, reply, timeout);
+    return this->writeRead(cmd, reply, timeout, priority);
 }
 
 
@@ -2641,99 +4440,391 @@ int PowerPMACcontrol::PowerPMACcontrol_sendCommand(const std::string command, st
 }
 
 /**
- * @brief Checks if a string has a "error #". 
- * 
- * This function can be used to check a reply string from the Power PMAC if it reports any error. 
- * 
- * @param s - The string to be checked.
- * @return Error number found in the string. If no error is found in the string, 0.
+ * @brief Read many variables or data structure elements with few commands.
+ *
+ * The names are packed, separated by spaces, into lines of up to 512 characters, and up to 8
+ * of these lines are in flight at once, so thousands of settings are read in a few round trips
+ * instead of one each. The values are returned as the text replied by Power PMAC, which writes
+ * them back unchanged with PowerPMACcontrol_setVariables.\n
+ * Power PMAC command string sent = "<name1> <name2> ..."
+ *
+ * @param names - The names, such as "Motor[1].JogSpeed" or "P100", without spaces or '='.
+ * @param values - The values in the order of the names. If an error occurs, the values of the lines
+ * which were answered in full are set and the others are empty.
+ * @return If all the values are read, PPMACcontrolNoError(0) is returned. If not,
+ * minus value is returned. Possible error codes are :
+ *      - PPMACcontrolNoError (0)
+ *      - Error reported from Power PMAC (-1 to -99) -1*(Power PMAC error number) for the first name which failed
+ *      - PPMACcontrolNoSSHDriverSet (-230)
+ *      - PPMACcontrolSSHDriverErrorNoconn (-104)
+ *      - PPMACcontrolSSHDriverErrorNobytes (-103)
+ *      - PPMACcontrolSSHDriverErrorReadTimeout (-112)
+ *      - PPMACcontrolSSHDriverErrorWriteTimeout (-113)
+ *      - PPMACcontrolPMACUnexpectedReplyError (-231)
+ *      - PPMACcontrolSemaphoreTimeoutError = (-239)
+ *      - PPMACcontrolInvalidParamError (-242) if a name is empty or contains a space or '='
  */
-int PowerPMACcontrol::check_PowerPMAC_error(const std::string s){
-    static const char *functionName = "PowerPMACcontrol::check_PowerPMAC_error";
-    
-    
-    std::string error_str("error #");
-    size_t index = s.find(error_str);
-    if (index == std::string::npos)
+int PowerPMACcontrol::PowerPMACcontrol_getVariables(const std::vector<std::string>& names, std::vector<std::string>& values){
+    values.assign(names.size(), std::string());
+    return PowerPMACcontrol_getVariables(names, collectValues, &values);
+}
+
+/**
+ * @brief Read many variables or data structure elements with few commands, passing the values
+ * of each packed line to a sink as soon as it is answered.
+ *
+ * The names are packed and sent as by PowerPMACcontrol_getVariables(names, values), but the
+ * values do not wait for the others, so a caller can act on the first of thousands of values
+ * while the rest are in flight. All the lines are sent even if some fail, so that a name which
+ * does not exist only stops the reading of the names after it on its line.\n
+ * Power PMAC command string sent = "<name1> <name2> ..."
+ *
+ * @param names - The names, such as "Motor[1].JogSpeed" or "P100", without spaces or '='.
+ * @param sink - Called on the I/O thread with the values of each line, in the order of the names.
+ * Lines which are not answered, because of an SSH driver error, are not passed to it.
+ * @param userData - Passed to the sink
+ * @return If all the values are read, PPMACcontrolNoError(0) is returned. If not,
+ * minus value is returned. Possible error codes are :
+ *      - PPMACcontrolNoError (0)
+ *      - Error reported from Power PMAC (-1 to -99) -1*(Power PMAC error number) for the first name which failed
+ *      - PPMACcontrolNoSSHDriverSet (-230)
+ *      - PPMACcontrolSSHDriverErrorNoconn (-104)
+ *      - PPMACcontrolSSHDriverErrorNobytes (-103)
+ *      - PPMACcontrolSSHDriverErrorReadTimeout (-112)
+ *      - PPMACcontrolSSHDriverErrorWriteTimeout (-113)
+ *      - PPMACcontrolPMACUnexpectedReplyError (-231)
+ *      - PPMACcontrolSemaphoreTimeoutError = (-239)
+ *      - PPMACcontrolInvalidParamError (-242) if a name is empty or contains a space or '=', or sink is NULL
+ */
+int PowerPMACcontrol::PowerPMACcontrol_getVariables(const std::vector<std::string>& names, VariableBatchSink sink,
+                                                    void *userData){
+    static const char *functionName = "PowerPMACcontrol::PowerPMACcontrol_getVariables";
+    if (sink == NULL)
+    {
+        return PPMACcontrolInvalidParamError;
+    }
+    for (size_t i = 0; i < names.size(); i++)
     {
-        debugPrint_ppmaccomm("%s : No error\n", functionName);
-        return 0;       //No error
+        if (!isBatchItem(names[i]) || names[i].find('=') != std::string::npos)
+        {
+            debugPrint_ppmaccomm("%s : invalid name [%s]\n", functionName, names[i].c_str());
+            return PPMACcontrolInvalidParamError;
+        }
     }
-    
-    //get error number
-    std::string s2 = s.substr(index + error_str.length());
-    size_t index2 = s2.find(":");      //get index of ':'
-    
-    if (index2 == std::string::npos)
+    std::vector<std::string> lines;
+    std::vector<size_t> itemCounts;
+    packBatchLines(names, lines, itemCounts);
+    std::vector<size_t> firsts(lines.size());
+    for (size_t i = 1; i < lines.size(); i++)
     {
-        debugPrint_ppmaccomm("%s : No error (couldn't find ':').\n", functionName);
-        return 0;       //No error
+        firsts[i] = firsts[i-1] + itemCounts[i-1];
     }
-    
-    std::string numstring = s2.substr(0, index2);
-    debugPrint_ppmaccomm("%s : numstring is %s\n", functionName, numstring.c_str());
+    VariableBatchContext context;
+    context.lines = &lines;
+    context.firsts = &firsts;
+    context.counts = &itemCounts;
+    context.sink = sink;
+    context.userData = userData;
+    context.result = PPMACcontrolNoError;
+    std::vector<std::string> replies;
+    int ret = runBatch(lines, replies, CommandClassQuery, variableReplyHandler, &context, false);
+    return (context.result != PPMACcontrolNoError) ? context.result : ret;
+}
 
-    int error_number;
-    
-    std::istringstream(numstring) >> error_number;
-   
-    return error_number;
-    
+/**
+ * @brief Write many variables or data structure elements with few commands.
+ *
+ * The assignments are packed as by PowerPMACcontrol_getVariables. The writes stop at the first
+ * assignment which fails, but the lines already in flight, up to 8 lines of 512 characters,
+ * are still run by Power PMAC.\n
+ * Power PMAC command string sent = "<name1>=<value1> <name2>=<value2> ..."
+ *
+ * @param names - The names, such as "Motor[1].JogSpeed" or "P100", without spaces or '='.
+ * @param values - The values, as text without spaces, in the order of the names.
+ * @return If all the values are written, PPMACcontrolNoError(0) is returned. If not,
+ * minus value is returned. Possible error codes are :
+ *      - PPMACcontrolNoError (0)
+ *      - Error reported from Power PMAC (-1 to -99) -1*(Power PMAC error number) for the first assignment which failed
+ *      - PPMACcontrolNoSSHDriverSet (-230)
+ *      - PPMACcontrolSSHDriverErrorNoconn (-104)
+ *      - PPMACcontrolSSHDriverErrorNobytes (-103)
+ *      - PPMACcontrolSSHDriverErrorReadTimeout (-112)
+ *      - PPMACcontrolSSHDriverErrorWriteTimeout (-113)
+ *      - PPMACcontrolSemaphoreTimeoutError = (-239)
+ *      - PPMACcontrolInvalidParamError (-242) if there are not as many values as names, or one is empty or contains a space
+ */
+int PowerPMACcontrol::PowerPMACcontrol_setVariables(const std::vector<std::string>& names, const std::vector<std::string>& values){
+    static const char *functionName = "PowerPMACcontrol::PowerPMACcontrol_setVariables";
+    if (names.size() != values.size())
+    {
+        return PPMACcontrolInvalidParamError;
+    }
+    std::vector<std::string> assignments(names.size());
+    for (size_t i = 0; i < names.size(); i++)
+    {
+        if (!isBatchItem(names[i]) || names[i].find('=') != std::string::npos || !isBatchItem(values[i]))
+        {
+            debugPrint_ppmaccomm("%s : invalid assignment [%s=%s]\n", functionName, names[i].c_str(), values[i].c_str());
+            return PPMACcontrolInvalidParamError;
+        }
+        assignments[i] = names[i] + "=" + values[i];
+    }
+    std::vector<std::string> lines;
+    std::vector<size_t> itemCounts;
+    packBatchLines(assignments, lines, itemCounts);
+    std::vector<std::string> replies;
+    return runBatch(lines, replies, CommandClassSet);
 }
 
+/**
+ * @brief Read a range of P, Q, M or L variables with few commands.
+ *
+ * The range is read with the range syntax of Power PMAC, split into queries whose replies
+ * fit in MAX_RANGE_REPLY_LENGTH (4096) characters, about 150 variables each, and up to 8
+ * of these queries are in flight at once, so blocks of thousands of variables are read in
+ * a few round trips.\n
+ * Power PMAC command string sent = "<base><first>..<last>"
+ *
+ * @param base - The letter of the variables: 'P', 'Q', 'M' or 'L'.
+ * @param first - The number of the first variable.
+ * @param count - The number of variables.
+ * @param values - The values of the variables first to first + count - 1. If an error occurs,
+ * the values of the queries which were answered in full are set and the others are 0.
+ * @return If all the values are read, PPMACcontrolNoError(0) is returned. If not,
+ * minus value is returned. Possible error codes are :
+ *      - PPMACcontrolNoError (0)
+ *      - Error reported from Power PMAC (-1 to -99) -1*(Power PMAC error number), for example for a variable out of range
+ *      - PPMACcontrolNoSSHDriverSet (-230)
+ *      - PPMACcontrolSSHDriverErrorNoconn (-104)
+ *      - PPMACcontrolSSHDriverErrorNobytes (-103)
+ *      - PPMACcontrolSSHDriverErrorReadTimeout (-112)
+ *      - PPMACcontrolSSHDriverErrorWriteTimeout (-113)
+ *      - PPMACcontrolPMACUnexpectedReplyError (-231)
+ *      - PPMACcontrolSemaphoreTimeoutError = (-239)
+ *      - PPMACcontrolInvalidParamError (-242) if base is not a variable letter, or first or count is negative
+ */
+int PowerPMACcontrol::PowerPMACcontrol_getVariableRange(char base, int first, int count, std::vector<double>& values){
+    static const char *functionName = "PowerPMACcontrol::PowerPMACcontrol_getVariableRange";
+    values.assign(count > 0 ? count : 0, 0.0);
+    if (!isRangeBase(base) || first < 0 || count < 0)
+    {
+        debugPrint_ppmaccomm("%s : invalid range %c%d, %d variables\n", functionName, base, first, count);
+        return PPMACcontrolInvalidParamError;
+    }
+    const int perQuery = MAX_RANGE_REPLY_LENGTH / RANGE_VALUE_LENGTH;
+    std::vector<std::string> lines;
+    char query[64];
+    for (int start = 0; start < count; start += perQuery)
+    {
+        int last = (count - start < perQuery) ? count - 1 : start + perQuery - 1;
+        sprintf(query, "%c%d..%d", base, first + start, first + last);
+        lines.push_back(query);
+    }
+    std::vector<std::string> replies;
+    int ret = runBatch(lines, replies, CommandClassQuery);
+
+    // Each query is answered by a value per variable, on lines of their own
+    for (size_t i = 0; i < lines.size(); i++)
+    {
+        size_t start = i * perQuery;
+        size_t expected = ((size_t)count - start < (size_t)perQuery) ? count - start : perQuery;
+        std::vector<double> parsed;
+        std::istringstream reply(replies[i]);
+        std::string item;
+        while (std::getline(reply, item))
+        {
+            char *end;
+            double value = strtod(item.c_str(), &end);
+            if (end == item.c_str() || *end != '\0')
+            {
+                break;
+            }
+            parsed.push_back(value);
+        }
+        if (parsed.size() == expected && check_PowerPMAC_error(replies[i]) == 0)
+        {
+            std::copy(parsed.begin(), parsed.end(), values.begin() + start);
+        }
+        else if (ret == PPMACcontrolNoError)
+        {
+            debugPrint_ppmaccomm("%s : %lu values in the reply to %s\n", functionName, (unsigned long)parsed.size(),
+                                 lines[i].c_str());
+            ret = PPMACcontrolPMACUnexpectedReplyError;
+        }
+    }
+    return ret;
+}
 
 /**
- * @brief Split a string by a specified separator. 
- * 
- * The split strings are set in the strings parameter. 
- * 
- * @param s - The string to be split.
- * @param separator - Separator to be used to split the string
- * @param strings - String items after the input string s is split
- * @return If successful, PPMACcontrolNoError(0), if not, PPMACcontrolSplitterError(-237).
+ * @brief Write a range of P, Q, M or L variables with few commands.
+ *
+ * The values are written as assignments packed into lines as by PowerPMACcontrol_setVariables,
+ * with as few digits as give back the same doubles. A run of three or more equal values is set
+ * by one assignment to the range, such as "P100..199=0". The writes stop at the first assignment
+ * which fails, but the lines already in flight are still run by Power PMAC.\n
+ * Power PMAC command string sent = "<base><first>=<value1> <base><first+1>=<value2> ..."
+ *
+ * @param base - The letter of the variables: 'P', 'Q', 'M' or 'L'.
+ * @param first - The number of the first variable.
+ * @param values - The values of the variables first to first + values.size() - 1.
+ * @return If all the values are written, PPMACcontrolNoError(0) is returned. If not,
+ * minus value is returned. Possible error codes are :
+ *      - PPMACcontrolNoError (0)
+ *      - Error reported from Power PMAC (-1 to -99) -1*(Power PMAC error number) for the first assignment which failed
+ *      - PPMACcontrolNoSSHDriverSet (-230)
+ *      - PPMACcontrolSSHDriverErrorNoconn (-104)
+ *      - PPMACcontrolSSHDriverErrorNobytes (-103)
+ *      - PPMACcontrolSSHDriverErrorReadTimeout (-112)
+ *      - PPMACcontrolSSHDriverErrorWriteTimeout (-113)
+ *      - PPMACcontrolSemaphoreTimeoutError = (-239)
+ *      - PPMACcontrolInvalidParamError (-242) if base is not a variable letter or first is negative
  */
-int PowerPMACcontrol::splitit(std::string s, std::string separator, std::vector<std::string> &strings){
-    static const char *functionName = "PowerPMACcontrol::splitit";
-    if (strings.size() > 0)
-        strings.clear();
-    
-    if (s.length() < 1)
-        return PPMACcontrolNoError;
-    
-    size_t start_index;
-    size_t end_index;
-    
-    start_index = s.find_first_not_of(separator);
-    end_index = s.find_first_of(separator, start_index);
-    debugPrint_ppmaccomm("%s : start_index = %d\n", functionName, start_index);
-    debugPrint_ppmaccomm("%s : end_index = %d\n", functionName, end_index);
-    try{
-    while(start_index != std::string::npos)
+int PowerPMACcontrol::PowerPMACcontrol_setVariableRange(char base, int first, const std::vector<double>& values){
+    static const char *functionName = "PowerPMACcontrol::PowerPMACcontrol_setVariableRange";
+    if (!isRangeBase(base) || first < 0)
+    {
+        debugPrint_ppmaccomm("%s : invalid range %c%d\n", functionName, base, first);
+        return PPMACcontrolInvalidParamError;
+    }
+    std::vector<std::string> assignments;
+    char assignment[96];
+    for (size_t i = 0; i < values.size(); )
     {
-        if (end_index != std::string::npos)
+        size_t run = 1;
+        while (i + run < values.size() && values[i + run] == values[i])
         {
-            debugPrint_ppmaccomm("%s : item (%s) found\n", functionName, s.substr(start_index, end_index-start_index).c_str());
-            strings.push_back(s.substr(start_index, end_index-start_index));
+            run++;
         }
-        else
+        int length = (run >= 3) ? sprintf(assignment, "%c%d..%d=", base, first + (int)i, first + (int)(i + run - 1)) :
+                     sprintf(assignment, "%c%d=", base, first + (int)i);
+        CommandBuilder::formatDouble(assignment + length, values[i]);
+        assignments.push_back(assignment);
+        i += (run >= 3) ? run : 1;
+    }
+    std::vector<std::string> lines;
+    std::vector<size_t> itemCounts;
+    packBatchLines(assignments, lines, itemCounts);
+    std::vector<std::string> replies;
+    return runBatch(lines, replies, CommandClassSet);
+}
+
+/**
+ * @brief Write consecutive elements of an array, such as a compensation table, from host memory.
+ *
+ * Each value is written with as few digits as give back the same double, and the assignments
+ * are packed into lines of up to MAX_LINE_LENGTH (1022) characters, which are sent with
+ * up to 8 of them in flight, so a table of 100000 entries is written in a few thousand lines
+ * rather than one round trip per entry. The writes stop at the first assignment which fails,
+ * but the lines already in flight are still run by Power PMAC.\n
+ * Power PMAC command string sent = "<array>[<first>]=<value1> <array>[<first+1>]=<value2> ..."
+ *
+ * @param array - The array, such as "CompTable[0].Data" or "Sys.Ddata", without spaces or '='.
+ * @param first - The index of the first element written.
+ * @param values - The values of the elements first to first + count - 1.
+ * @param count - The number of values.
+ * @return If all the values are written, PPMACcontrolNoError(0) is returned. If not,
+ * minus value is returned. Possible error codes are :
+ *      - PPMACcontrolNoError (0)
+ *      - Error reported from Power PMAC (-1 to -99) -1*(Power PMAC error number) for the first assignment which failed
+ *      - PPMACcontrolNoSSHDriverSet (-230)
+ *      - PPMACcontrolSSHDriverErrorNoconn (-104)
+ *      - PPMACcontrolSSHDriverErrorNobytes (-103)
+ *      - PPMACcontrolSSHDriverErrorReadTimeout (-112)
+ *      - PPMACcontrolSSHDriverErrorWriteTimeout (-113)
+ *      - PPMACcontrolSemaphoreTimeoutError = (-239)
+ *      - PPMACcontrolInvalidParamError (-242) if the array is not a valid name, first is negative or values is NULL
+ */
+int PowerPMACcontrol::PowerPMACcontrol_setArray(const std::string& array, int first, const double *values, size_t count){
+    static const char *functionName = "PowerPMACcontrol::PowerPMACcontrol_setArray";
+    if (!isBatchItem(array) || array.find('=') != std::string::npos || array.length() > (size_t)MAX_LINE_LENGTH / 2 ||
+        first < 0 || (values == NULL && count > 0))
+    {
+        debugPrint_ppmaccomm("%s : invalid array [%s] or index %d\n", functionName, array.c_str(), first);
+        return PPMACcontrolInvalidParamError;
+    }
+    std::vector<std::string> lines;
+    std::string line;
+    char assignment[64];
+    for (size_t i = 0; i < count; i++)
+    {
+        int length = sprintf(assignment, "[%lu]=", (unsigned long)first + i);
+        length += CommandBuilder::formatDouble(assignment + length, values[i]);
+        if (!line.empty() && line.length() + 1 + array.length() + length > (size_t)MAX_LINE_LENGTH)
+        {
+            lines.push_back(line);
+            line.clear();
+        }
+        if (!line.empty())
+        {
+            line += ' ';
+        }
+        line += array;
+        line.append(assignment, length);
+    }
+    if (!line.empty())
+    {
+        lines.push_back(line);
+    }
+    std::vector<std::string> replies;
+    return runBatch(lines, replies, CommandClassSet);
+}
+
+/**
+ * @brief Write consecutive elements of an array from a vector.
+ *
+ * @return The same as PowerPMACcontrol_setArray(const std::string&, int, const double *, size_t)
+ */
+int PowerPMACcontrol::PowerPMACcontrol_setArray(const std::string& array, int first, const std::vector<double>& values){
+    return PowerPMACcontrol_setArray(array, first, values.empty() ? NULL : &values[0], values.size());
+}
+
+/**
+ * @brief Find the error in the reply to a line of a windowed download.
+ *
+ * The text before the ACK of a line holds its reply and the echoes of lines written since,
+ * each echo on a line of its own. A text line containing "error #" is reported unless it is
+ * the echo of one of the lines in flight.
+ *
+ * @param replies - The text received
+ * @param length - The number of characters of replies before the ACK of the line
+ * @param lines - The lines of the download
+ * @param first - Index of the line answered by the ACK
+ * @param last - Index after the last line written
+ * @return Error number found in the reply. If no error is found, 0.
+ */
+int PowerPMACcontrol::findDownloadError(const std::string& replies, size_t length, const std::vector<ProgramLine>& lines,
+                                        size_t first, size_t last){
+    size_t index = replies.find("error #");
+    while (index != std::string::npos && index < length)
+    {
+        size_t start = replies.find_last_of("\r\n", index);
+        start = (start == std::string::npos) ? 0 : start + 1;
+        size_t end = replies.find_first_of("\r\n", index);
+        if (end == std::string::npos || end > length)
+        {
+            end = length;
+        }
+        bool echo = false;
+        for (size_t i = first; i < last && !echo; i++)
+        {
+            // The echo is the line without its trailing carriage return
+            size_t lineLength = lines[i].length;
+            while (lineLength > 0 && (lines[i].text[lineLength-1] == '\r' || lines[i].text[lineLength-1] == '\n'))
+            {
+                lineLength--;
+            }
+            echo = (end - start == lineLength && replies.compare(start, lineLength, lines[i].text, lineLength) == 0);
+        }
+        if (!echo)
         {
-            strings.push_back(s.substr(start_index, std::string::npos));
-            debugPrint_ppmaccomm("%s : item (%s) found\n", functionName, s.substr(start_index, end_index-start_index).c_str());
-            break;
+            return check_PowerPMAC_error(replies.substr(start, end - start));
         }
-        start_index = s.find_first_not_of(separator, end_index);
-        end_index = s.find_first_of(separator, start_index);
-        
-    }
-    }
-    catch(...)
-    {
-        strings.clear();
-        return PPMACcontrolSplitterError;
+        index = replies.find("error #", index + 1);
     }
-    return PPMACcontrolNoError;
+    return 0;
 }
 
+
 /**
  * @brief Get the current CPU operational temperature
  *
@@ -2807,10 +4898,8 @@ int PowerPMACcontrol::PowerPMACcontrol_getRunningTime(double& runningTime){
  *      - PPMACcontrolSemaphoreReleaseError = (-241)
  */
 int PowerPMACcontrol::PowerPMACcontrol_getCPUUsage(double& CPUUsage){
-    TaskCalculator tasks(this);
-    CPUUsage = tasks.getCPUUsageByPmacTasks();
-
-    return tasks.getErrorStatus();
+    double phase, servo, rtInt, bg;
+    return taskCalculator->getUsage(phase, servo, rtInt, bg, CPUUsage);
 }
 
 /**
@@ -2834,10 +4923,8 @@ int PowerPMACcontrol::PowerPMACcontrol_getPhaseTaskUsage(double& phaseTaskUsage)
 	static const char *functionName = "PowerPMACcontrol_getPhaseTime";
     debugPrint_ppmaccomm("%s called\n", functionName);
 
-    TaskCalculator tasks(this);
-    phaseTaskUsage = tasks.getPhaseTaskUsage();
-
-    return tasks.getErrorStatus();
+    double servo, rtInt, bg, cpu;
+    return taskCalculator->getUsage(phaseTaskUsage, servo, rtInt, bg, cpu);
 
 }
 
@@ -2862,10 +4949,8 @@ int PowerPMACcontrol::PowerPMACcontrol_getServoTaskUsage(double& servoTaskUsage)
 	static const char *functionName = "PowerPMACcontrol_getServoTime";
     debugPrint_ppmaccomm("%s called\n", functionName);
 
-    TaskCalculator tasks(this);
-    servoTaskUsage = tasks.getServoTaskUsage();
-
-    return tasks.getErrorStatus();
+    double phase, rtInt, bg, cpu;
+    return taskCalculator->getUsage(phase, servoTaskUsage, rtInt, bg, cpu);
 
 }
 
@@ -2890,10 +4975,8 @@ int PowerPMACcontrol::PowerPMACcontrol_getRtIntTaskUsage(double& rtIntTaskUsage)
 	static const char *functionName = "PowerPMACcontrol_getRtIntTime";
     debugPrint_ppmaccomm("%s called\n", functionName);
 
-    TaskCalculator tasks(this);
-    rtIntTaskUsage = tasks.getRtIntTaskUsage();
-
-    return tasks.getErrorStatus();
+    double phase, servo, bg, cpu;
+    return taskCalculator->getUsage(phase, servo, rtIntTaskUsage, bg, cpu);
 }
 
 /**
@@ -2917,13 +5000,134 @@ int PowerPMACcontrol::PowerPMACcontrol_getBgTaskUsage(double& bgTaskUsage){
 	static const char *functionName = "PowerPMACcontrol_getBgTime";
     debugPrint_ppmaccomm("%s called\n", functionName);
 
-    TaskCalculator tasks(this);
-    bgTaskUsage = tasks.getBgTaskUsage();
+    double phase, servo, rtInt, cpu;
+    return taskCalculator->getUsage(phase, servo, rtInt, bgTaskUsage, cpu);
+}
+/**
+ * @brief Get the percentage of CPU time used by each of the PMAC tasks from a single snapshot
+ *
+ * All the values are calculated from the same reply from the Power PMAC, so reading them all
+ * costs a single round trip. If background sampling has been started with
+ * PowerPMACcontrol_startTaskUsageSampling, the values of the most recent sample are returned
+ * and no command is sent to the Power PMAC.
+ *
+ * @param phaseTaskUsage - The averaged fraction of total CPU time used by phase tasks in percent
+ * @param servoTaskUsage - The averaged fraction of total CPU time used by servo tasks in percent
+ * @param rtIntTaskUsage - The averaged fraction of total CPU time used by real-time interrupt tasks in percent
+ * @param bgTaskUsage - The averaged fraction of total CPU time used by background task scans in percent
+ * @param CPUUsage - The averaged fraction of available CPU time used by all PMAC tasks in percent
+ * @return If values are successfully received, PPMACcontrolNoError(0) is returned. If not,
+ * minus value is returned. Possible error codes are :
+ *      - PPMACcontrolNoError(0)
+ *      - PPMACcontrolNoSSHDriverSet (-230)
+ *      - PPMACcontrolSSHDriverError (-102)
+ *      - PPMACcontrolSSHDriverErrorNoconn (-104)
+ *      - PPMACcontrolSSHDriverErrorNobytes (-103)
+ *      - PPMACcontrolSSHDriverErrorReadTimeout (-112)
+ *      - PPMACcontrolSSHDriverErrorWriteTimeout (-113)
+ *      - PPMACcontrolPMACUnexpectedReplyError (-231)
+ *      - PPMACcontrolSemaphoreTimeoutError = (-239)
+ *      - PPMACcontrolSemaphoreError = (-240)
+ *      - PPMACcontrolSemaphoreReleaseError = (-241)
+ */
+int PowerPMACcontrol::PowerPMACcontrol_getTaskUsage(double& phaseTaskUsage, double& servoTaskUsage,
+		double& rtIntTaskUsage, double& bgTaskUsage, double& CPUUsage){
+	static const char *functionName = "PowerPMACcontrol_getTaskUsage";
+    debugPrint_ppmaccomm("%s called\n", functionName);
+
+    return taskCalculator->getUsage(phaseTaskUsage, servoTaskUsage, rtIntTaskUsage, bgTaskUsage, CPUUsage);
+}
+
+/**
+ * @brief Start sampling the CPU usage of the PMAC tasks in the background
+ *
+ * A background thread reads the task timing variables from the Power PMAC at the requested rate.
+ * While sampling is running, PowerPMACcontrol_getTaskUsage, PowerPMACcontrol_getCPUUsage and the
+ * PowerPMACcontrol_get*TaskUsage functions return the most recent sample without sending a command.
+ * If sampling is already running, the sampling period is updated.
+ *
+ * Each sample, including the CPU temperature, is also recorded in a fixed-size history
+ * which can be read with PowerPMACcontrol_getTaskUsageHistory and summarised with
+ * PowerPMACcontrol_getTaskUsageStatistics. The history is cleared when sampling is started.
+ *
+ * @param period_ms - Sampling period in milliseconds (minimum 10 ms)
+ * @param historyLength - Number of samples kept in the history (default 1000).
+ * When the history is full the oldest sample is overwritten.
+ * @return If sampling is started, PPMACcontrolNoError(0) is returned. If not,
+ * minus value is returned. Possible error codes are :
+ *      - PPMACcontrolNoError(0)
+ *      - PPMACcontrolSoftwareError (-232)
+ *      - PPMACcontrolInvalidParamError (-242)
+ */
+int PowerPMACcontrol::PowerPMACcontrol_startTaskUsageSampling(int period_ms, int historyLength){
+	static const char *functionName = "PowerPMACcontrol_startTaskUsageSampling";
+    debugPrint_ppmaccomm("%s called\n", functionName);
+
+    if (period_ms < MIN_SAMPLING_PERIOD_MS || historyLength < 1)
+    	return PPMACcontrolInvalidParamError;
+
+    return taskCalculator->startSampling(period_ms, historyLength);
+}
+
+/**
+ * @brief Stop the background sampling of the CPU usage of the PMAC tasks
+ *
+ * After this call, the task usage functions send a command to the Power PMAC again each time they are called.
+ *
+ * @return Always returns PPMACcontrolNoError(0)
+ */
+int PowerPMACcontrol::PowerPMACcontrol_stopTaskUsageSampling(){
+	static const char *functionName = "PowerPMACcontrol_stopTaskUsageSampling";
+    debugPrint_ppmaccomm("%s called\n", functionName);
+
+    return taskCalculator->stopSampling();
+}
+
+/**
+ * @brief Get the recorded history of task usage samples
+ *
+ * Samples are recorded by the background sampling started with PowerPMACcontrol_startTaskUsageSampling,
+ * and by each call to the task usage functions when sampling is not running.
+ * No command is sent to the Power PMAC.
+ *
+ * @param history - The samples, oldest first. This parameter is cleared first.
+ * @return Always returns PPMACcontrolNoError(0)
+ */
+int PowerPMACcontrol::PowerPMACcontrol_getTaskUsageHistory(std::vector<TaskUsageSample>& history){
+	static const char *functionName = "PowerPMACcontrol_getTaskUsageHistory";
+    debugPrint_ppmaccomm("%s called\n", functionName);
+
+    taskCalculator->getHistory(history);
+    return PPMACcontrolNoError;
+}
+
+/**
+ * @brief Get the minimum, maximum, mean and 99th percentile of the task usage over a sliding window
+ *
+ * The statistics are calculated from the recorded samples whose time is within window_ms of the
+ * most recent sample, so intermittent overruns of the servo task can be seen without polling
+ * the Power PMAC from the application. No command is sent to the Power PMAC.
+ *
+ * @param window_ms - Length of the window in milliseconds, ending at the most recent sample
+ * @param statistics - Statistics of each quantity over the window
+ * @return If statistics are calculated, PPMACcontrolNoError(0) is returned. If not,
+ * minus value is returned. Possible error codes are :
+ *      - PPMACcontrolNoError(0)
+ *      - PPMACcontrolError (-101) no samples have been recorded
+ *      - PPMACcontrolInvalidParamError (-242)
+ */
+int PowerPMACcontrol::PowerPMACcontrol_getTaskUsageStatistics(int window_ms, TaskUsageStatistics& statistics){
+	static const char *functionName = "PowerPMACcontrol_getTaskUsageStatistics";
+    debugPrint_ppmaccomm("%s called\n", functionName);
+
+    if (window_ms <= 0)
+    	return PPMACcontrolInvalidParamError;
 
-    return tasks.getErrorStatus();
+    return taskCalculator->getStatistics(window_ms / 1000.0, statistics);
 }
+
 /**
- * @brief Perform calculations for the CPU usage by different PMAC tasks.
+ * @brief Constructor for the calculator of the CPU usage by different PMAC tasks.
  *
  * Calculations adapted from source code for Power PMAC IDE Task Manager, provided by Delta Tau
  *
@@ -2934,26 +5138,117 @@ PowerPMACcontrol::TaskCalculator::TaskCalculator(PowerPMACcontrol * parent_in)
 	myParent = parent_in;
 
 	// Initialise members
-	Sys_FltrPhaseTime = 0;
-	Sys_FltrServoTime = 0;
-	Sys_FltrRtIntTime = 0;
-	Sys_FltrBgTime = 0;
-	Sys_BgSleepTime = 0;
-	Sys_PhaseDeltaTime = 0;
-	Sys_ServoDeltaTime = 0;
-	Sys_RtIntDeltaTime = 0;
-	Sys_BgDeltaTime = 0;
+	last_positive_servoTaskTime = 0;
+	last_positive_rtIntTaskTime = 0;
 
 	phaseTaskUsage = 0;
 	servoTaskUsage = 0;
 	rtIntTaskUsage = 0;
 	bgTaskUsage = 0;
 	CPUUsageByPmacTasks = 0;
+	CPUTemperature = 0;
+
+	history.resize(DEFAULT_TASK_HISTORY_LENGTH);
+	historyNext = 0;
+	historyCount = 0;
 
 	errorStatus = 0;
+	snapshotValid = false;
+
+	sampling = false;
+	sampling_period_ms = 0;
+
+#ifdef WIN32
+	ghSnapshotSemaphore = CreateSemaphore(NULL, 1, 1, NULL);
+	ghSamplingControl = CreateSemaphore(NULL, 1, 1, NULL);
+	ghStopSampling = CreateSemaphore(NULL, 0, 1, NULL);
+	ghSamplingThread = NULL;
+	if (ghSnapshotSemaphore == NULL || ghSamplingControl == NULL || ghStopSampling == NULL)
+#else
+	if (sem_init(&sem_snapshot, 0, 1) != 0 || sem_init(&sem_samplingControl, 0, 1) != 0 ||
+		sem_init(&sem_stopSampling, 0, 0) != 0)
+#endif
+	{
+		debugPrint_ppmaccomm("TaskCalculator() : Error creating a semaphore\n");
+	}
+}
+
+/**
+ * @brief Destructor for the task usage calculator. Stops the background sampling if it is running.
+ */
+PowerPMACcontrol::TaskCalculator::~TaskCalculator()
+{
+	stopSampling();
+#ifdef WIN32
+	CloseHandle(ghSnapshotSemaphore);
+	CloseHandle(ghSamplingControl);
+	CloseHandle(ghStopSampling);
+#else
+	sem_destroy(&sem_snapshot);
+	sem_destroy(&sem_samplingControl);
+	sem_destroy(&sem_stopSampling);
+#endif
+}
+
+/// Take the semaphore protecting the results of the last snapshot
+void PowerPMACcontrol::TaskCalculator::lockSnapshot()
+{
+#ifdef WIN32
+	WaitForSingleObject(ghSnapshotSemaphore, INFINITE);
+#else
+	while (sem_wait(&sem_snapshot) != 0 && errno == EINTR)
+		;
+#endif
+}
+
+/// Release the semaphore protecting the results of the last snapshot
+void PowerPMACcontrol::TaskCalculator::unlockSnapshot()
+{
+#ifdef WIN32
+	ReleaseSemaphore(ghSnapshotSemaphore, 1, NULL);
+#else
+	sem_post(&sem_snapshot);
+#endif
+}
+
+/// Take the semaphore which keeps a start and a stop of the sampling from overlapping
+void PowerPMACcontrol::TaskCalculator::lockSamplingControl()
+{
+#ifdef WIN32
+	WaitForSingleObject(ghSamplingControl, INFINITE);
+#else
+	while (sem_wait(&sem_samplingControl) != 0 && errno == EINTR)
+		;
+#endif
+}
+
+/// Release the semaphore which keeps a start and a stop of the sampling from overlapping
+void PowerPMACcontrol::TaskCalculator::unlockSamplingControl()
+{
+#ifdef WIN32
+	ReleaseSemaphore(ghSamplingControl, 1, NULL);
+#else
+	sem_post(&sem_samplingControl);
+#endif
+}
+
+/**
+ * @brief Read the task timing variables from the Power PMAC and recalculate the CPU usage by each task.
+ *
+ * All the Sys.* variables, including the CPU temperature, are requested with a single command.
+ * A successful snapshot is added to the history.
+ *
+ * @return PPMACcontrolNoError(0) if the snapshot was taken, otherwise the error from the Power PMAC communication.
+ */
+int PowerPMACcontrol::TaskCalculator::update()
+{
+	double Sys_FltrPhaseTime = 0, Sys_FltrRtIntTime = 0, Sys_FltrServoTime = 0, Sys_FltrBgTime = 0, Sys_BgSleepTime = 0;
+	double Sys_PhaseDeltaTime = 0, Sys_ServoDeltaTime = 0, Sys_RtIntDeltaTime = 0, Sys_BgDeltaTime = 0;
+	double Sys_CpuTemp = 0;
+	double phaseTaskTime_usec, servoTaskTime_usec, rtIntTaskTime_usec, bgTaskTime_usec;
 
 	// Build single request string
-	std::string request_string = "Sys.FltrPhaseTime "
+	static const char *request_string = "Sys.FltrPhaseTime "
 			"Sys.FltrServoTime "
 			"Sys.FltrRtIntTime "
 			"Sys.FltrBgTime "
@@ -2961,115 +5256,403 @@ PowerPMACcontrol::TaskCalculator::TaskCalculator(PowerPMACcontrol * parent_in)
 			"Sys.PhaseDeltaTime "
 			"Sys.ServoDeltaTime "
 			"Sys.RtIntDeltaTime "
-			"Sys.BgDeltaTime\n";
+			"Sys.BgDeltaTime "
+			"Sys.CpuTemp\n";
 
 	// Send command and read response
 	std::string reply;
-	errorStatus = myParent->writeRead(request_string.c_str(),reply);
+	int status = myParent->writeRead(request_string, reply);
+	double sampleTime = getMonotonicTimeSecs();
 
 	// Only proceed with calculations if no error
-	if (errorStatus == PPMACcontrolNoError)
+	if (status != PPMACcontrolNoError)
 	{
-		std::stringstream extract(reply);
-
-		// Extract responses
-		extract >> Sys_FltrPhaseTime;
-		extract >> Sys_FltrServoTime;
-		extract >> Sys_FltrRtIntTime;
-		extract >> Sys_FltrBgTime;
-		extract >> Sys_BgSleepTime;
-		extract >> Sys_PhaseDeltaTime;
-		extract >> Sys_ServoDeltaTime;
-		extract >> Sys_RtIntDeltaTime;
-		extract >> Sys_BgDeltaTime;
-
-		// Phase task time
-		phaseTaskTime_usec = Sys_FltrPhaseTime;
-
-		// Servo task time
-		servoTaskTime_usec = Sys_FltrServoTime
-				- ( (int) (Sys_FltrServoTime / Sys_PhaseDeltaTime) + 1 ) * phaseTaskTime_usec;
-		if (servoTaskTime_usec > 0.0)
-		{
-			last_positive_servoTaskTime = servoTaskTime_usec;
-		}
-		else
-		{
-			servoTaskTime_usec = last_positive_servoTaskTime;
-		}
+		lockSnapshot();
+		errorStatus = status;
+		unlockSnapshot();
+		return status;
+	}
+
+	std::stringstream extract(reply);
+
+	// Extract responses
+	extract >> Sys_FltrPhaseTime;
+	extract >> Sys_FltrServoTime;
+	extract >> Sys_FltrRtIntTime;
+	extract >> Sys_FltrBgTime;
+	extract >> Sys_BgSleepTime;
+	extract >> Sys_PhaseDeltaTime;
+	extract >> Sys_ServoDeltaTime;
+	extract >> Sys_RtIntDeltaTime;
+	extract >> Sys_BgDeltaTime;
+	extract >> Sys_CpuTemp;
+	if (extract.fail() || Sys_PhaseDeltaTime <= 0 || Sys_ServoDeltaTime <= 0 || Sys_RtIntDeltaTime <= 0)
+	{
+		lockSnapshot();
+		errorStatus = PPMACcontrolPMACUnexpectedReplyError;
+		unlockSnapshot();
+		return PPMACcontrolPMACUnexpectedReplyError;
+	}
 
-		// RT Interrupt Task Time
-		rtIntTaskTime_usec = Sys_FltrRtIntTime
-				- ( (int)(Sys_FltrRtIntTime / Sys_PhaseDeltaTime) + 1 ) * phaseTaskTime_usec
-				- ( (int)(Sys_FltrRtIntTime / Sys_ServoDeltaTime) + 1 ) * servoTaskTime_usec;
+	// The fallback values are shared with other callers and the sampling thread
+	lockSnapshot();
 
-		if (rtIntTaskTime_usec > 0.0)
-		{
-			last_positive_rtIntTaskTime = rtIntTaskTime_usec;
-		}
-		else
-		{
-			rtIntTaskTime_usec = last_positive_rtIntTaskTime;
-		}
+	// Phase task time
+	phaseTaskTime_usec = Sys_FltrPhaseTime;
 
-		// Background Task Time
-		double temp_bgDeltaTime = Sys_FltrBgTime + Sys_FltrRtIntTime;
-		bgTaskTime_usec = temp_bgDeltaTime;
+	// Servo task time
+	servoTaskTime_usec = Sys_FltrServoTime
+			- ( (int) (Sys_FltrServoTime / Sys_PhaseDeltaTime) + 1 ) * phaseTaskTime_usec;
+	if (servoTaskTime_usec > 0.0)
+	{
+		last_positive_servoTaskTime = servoTaskTime_usec;
+	}
+	else
+	{
+		servoTaskTime_usec = last_positive_servoTaskTime;
+	}
 
-		double difference_bg_rti = ((int)(temp_bgDeltaTime / Sys_RtIntDeltaTime) + 1)
-				* rtIntTaskTime_usec;
+	// RT Interrupt Task Time
+	rtIntTaskTime_usec = Sys_FltrRtIntTime
+			- ( (int)(Sys_FltrRtIntTime / Sys_PhaseDeltaTime) + 1 ) * phaseTaskTime_usec
+			- ( (int)(Sys_FltrRtIntTime / Sys_ServoDeltaTime) + 1 ) * servoTaskTime_usec;
 
-		if ( bgTaskTime_usec > difference_bg_rti)
-		{
-			bgTaskTime_usec = bgTaskTime_usec - difference_bg_rti;
-		}
+	if (rtIntTaskTime_usec > 0.0)
+	{
+		last_positive_rtIntTaskTime = rtIntTaskTime_usec;
+	}
+	else
+	{
+		rtIntTaskTime_usec = last_positive_rtIntTaskTime;
+	}
 
-		double difference_bg_servo
-				= ((int)(temp_bgDeltaTime / Sys_ServoDeltaTime) + 1) * servoTaskTime_usec;
+	// Background Task Time
+	double temp_bgDeltaTime = Sys_FltrBgTime + Sys_FltrRtIntTime;
+	bgTaskTime_usec = temp_bgDeltaTime;
 
-		if ( bgTaskTime_usec > difference_bg_servo)
-		{
-			bgTaskTime_usec = bgTaskTime_usec - difference_bg_servo;
-		}
+	double difference_bg_rti = ((int)(temp_bgDeltaTime / Sys_RtIntDeltaTime) + 1)
+			* rtIntTaskTime_usec;
 
-		double difference_bg_phase
-				= ((int)(temp_bgDeltaTime / Sys_PhaseDeltaTime) + 1) * phaseTaskTime_usec;
+	if ( bgTaskTime_usec > difference_bg_rti)
+	{
+		bgTaskTime_usec = bgTaskTime_usec - difference_bg_rti;
+	}
 
-		if (bgTaskTime_usec > difference_bg_phase)
-		{
-			bgTaskTime_usec = bgTaskTime_usec - difference_bg_phase;
-		}
+	double difference_bg_servo
+			= ((int)(temp_bgDeltaTime / Sys_ServoDeltaTime) + 1) * servoTaskTime_usec;
 
-		// If Sys.BgSleepTime is set to 0, it means use a value of 1000 us.
-		if (Sys_BgSleepTime == 0)
-		{
-			Sys_BgSleepTime = 1000;
-		}
-		double temp_overallTime_usec = Sys_FltrRtIntTime + Sys_FltrBgTime + Sys_BgSleepTime;
-
-		// Phase task usage %
-		phaseTaskUsage
-			= ((int)(temp_overallTime_usec / Sys_PhaseDeltaTime) + 1)
-			* phaseTaskTime_usec / temp_overallTime_usec * 100;
-
-		// Servo task usage %
-		servoTaskUsage
-			= ((int)(temp_overallTime_usec / Sys_ServoDeltaTime) + 1)
-			* servoTaskTime_usec / temp_overallTime_usec * 100;
-
-		// RT interrupt task usage
-		rtIntTaskUsage
-			= ((int)(temp_overallTime_usec / Sys_RtIntDeltaTime) + 1)
-			* rtIntTaskTime_usec / temp_overallTime_usec * 100;
-
-		// Background task usage
-		bgTaskUsage
-			= bgTaskTime_usec / temp_overallTime_usec * 100;
-
-		// Total CPU usage therefore
-		CPUUsageByPmacTasks
-			= phaseTaskUsage + servoTaskUsage + rtIntTaskUsage + bgTaskUsage;
+	if ( bgTaskTime_usec > difference_bg_servo)
+	{
+		bgTaskTime_usec = bgTaskTime_usec - difference_bg_servo;
+	}
+
+	double difference_bg_phase
+			= ((int)(temp_bgDeltaTime / Sys_PhaseDeltaTime) + 1) * phaseTaskTime_usec;
+
+	if (bgTaskTime_usec > difference_bg_phase)
+	{
+		bgTaskTime_usec = bgTaskTime_usec - difference_bg_phase;
+	}
+
+	// If Sys.BgSleepTime is set to 0, it means use a value of 1000 us.
+	if (Sys_BgSleepTime == 0)
+	{
+		Sys_BgSleepTime = 1000;
+	}
+	double temp_overallTime_usec = Sys_FltrRtIntTime + Sys_FltrBgTime + Sys_BgSleepTime;
+
+	// Phase task usage %
+	phaseTaskUsage
+		= ((int)(temp_overallTime_usec / Sys_PhaseDeltaTime) + 1)
+		* phaseTaskTime_usec / temp_overallTime_usec * 100;
+
+	// Servo task usage %
+	servoTaskUsage
+		= ((int)(temp_overallTime_usec / Sys_ServoDeltaTime) + 1)
+		* servoTaskTime_usec / temp_overallTime_usec * 100;
+
+	// RT interrupt task usage
+	rtIntTaskUsage
+		= ((int)(temp_overallTime_usec / Sys_RtIntDeltaTime) + 1)
+		* rtIntTaskTime_usec / temp_overallTime_usec * 100;
+
+	// Background task usage
+	bgTaskUsage
+		= bgTaskTime_usec / temp_overallTime_usec * 100;
+
+	// Total CPU usage therefore
+	CPUUsageByPmacTasks
+		= phaseTaskUsage + servoTaskUsage + rtIntTaskUsage + bgTaskUsage;
+
+	CPUTemperature = Sys_CpuTemp;
+
+	TaskUsageSample sample;
+	sample.time = sampleTime;
+	sample.phaseTaskUsage = phaseTaskUsage;
+	sample.servoTaskUsage = servoTaskUsage;
+	sample.rtIntTaskUsage = rtIntTaskUsage;
+	sample.bgTaskUsage = bgTaskUsage;
+	sample.CPUUsage = CPUUsageByPmacTasks;
+	sample.CPUTemperature = CPUTemperature;
+	addToHistory(sample);
+
+	errorStatus = PPMACcontrolNoError;
+	snapshotValid = true;
+	unlockSnapshot();
+
+	return PPMACcontrolNoError;
+}
+
+/**
+ * @brief Get all the CPU usage figures from the same snapshot.
+ *
+ * If background sampling is running, the last sample is returned. Otherwise a new snapshot is taken first.
+ *
+ * @return Error status of the snapshot the values were taken from.
+ */
+int PowerPMACcontrol::TaskCalculator::getUsage(double& phase, double& servo, double& rtInt, double& bg, double& CPUUsage)
+{
+	lockSnapshot();
+	bool useCached = sampling && snapshotValid;
+	unlockSnapshot();
+
+	if (!useCached)
+	{
+		int status = update();
+		if (status != PPMACcontrolNoError)
+			return status;
+	}
+
+	lockSnapshot();
+	phase = phaseTaskUsage;
+	servo = servoTaskUsage;
+	rtInt = rtIntTaskUsage;
+	bg = bgTaskUsage;
+	CPUUsage = CPUUsageByPmacTasks;
+	int status = errorStatus;
+	unlockSnapshot();
+
+	return status;
+}
+
+/**
+ * @brief Start the background thread which takes a snapshot at the requested rate.
+ *
+ * @param period_ms - Sampling period in milliseconds
+ * @param historyLength - Number of samples kept in the history
+ * @return PPMACcontrolNoError(0), or PPMACcontrolSoftwareError(-232) if the thread could not be created.
+ */
+int PowerPMACcontrol::TaskCalculator::startSampling(int period_ms, int historyLength)
+{
+	// A stop in progress finishes first, so a thread which is shutting down is not reported as running
+	lockSamplingControl();
+	lockSnapshot();
+	sampling_period_ms = period_ms;
+	if ((size_t)historyLength != history.size())
+	{
+		history.resize(historyLength);
+		historyNext = 0;
+		historyCount = 0;
+	}
+	if (sampling)
+	{
+		unlockSnapshot();
+		unlockSamplingControl();
+		return PPMACcontrolNoError;		// The new period is used from the next sample
+	}
+	// Results from before sampling started are not reused
+	snapshotValid = false;
+	historyNext = 0;
+	historyCount = 0;
+
+	// The thread waits for the snapshot semaphore before its first sample
+	int ret = PPMACcontrolNoError;
+#ifdef WIN32
+	ghSamplingThread = CreateThread(NULL, 0, samplingThread, this, 0, NULL);
+	if (ghSamplingThread == NULL)
+#else
+	if (pthread_create(&samplingThreadId, NULL, samplingThread, this) != 0)
+#endif
+	{
+		debugPrint_ppmaccomm("TaskCalculator::startSampling : Error creating the sampling thread\n");
+		ret = PPMACcontrolSoftwareError;
+	}
+	else
+	{
+		sampling = true;
+	}
+	unlockSnapshot();
+	unlockSamplingControl();
+	return ret;
+}
+
+/**
+ * @brief Stop the background sampling thread and wait for it to finish.
+ *
+ * @return Always returns PPMACcontrolNoError(0)
+ */
+int PowerPMACcontrol::TaskCalculator::stopSampling()
+{
+	// Only the caller which clears sampling owns the thread, so it is signalled and joined once
+	lockSamplingControl();
+	lockSnapshot();
+	bool running = sampling;
+	sampling = false;
+#ifdef WIN32
+	HANDLE thread = ghSamplingThread;
+	ghSamplingThread = NULL;
+#else
+	pthread_t thread = samplingThreadId;
+#endif
+	unlockSnapshot();
+
+	if (running)
+	{
+#ifdef WIN32
+		ReleaseSemaphore(ghStopSampling, 1, NULL);
+		WaitForSingleObject(thread, INFINITE);
+		CloseHandle(thread);
+#else
+		sem_post(&sem_stopSampling);
+		pthread_join(thread, NULL);
+#endif
+	}
+	unlockSamplingControl();
+	return PPMACcontrolNoError;
+}
+
+/**
+ * @brief Add a sample to the history, overwriting the oldest one if the history is full.
+ * The caller must hold the snapshot semaphore.
+ */
+void PowerPMACcontrol::TaskCalculator::addToHistory(const TaskUsageSample& sample)
+{
+	history[historyNext] = sample;
+	historyNext = (historyNext + 1) % history.size();
+	if (historyCount < history.size())
+		historyCount++;
+}
+
+/**
+ * @brief Copy the history of samples, oldest first.
+ */
+void PowerPMACcontrol::TaskCalculator::getHistory(std::vector<TaskUsageSample>& samples)
+{
+	samples.clear();
+	lockSnapshot();
+	samples.reserve(historyCount);
+	size_t first = (historyNext + history.size() - historyCount) % history.size();
+	for (size_t i = 0; i < historyCount; i++)
+	{
+		samples.push_back(history[(first + i) % history.size()]);
+	}
+	unlockSnapshot();
+}
+
+/// Calculate the statistics of a set of values. The values are reordered.
+static void calculateStatistic(std::vector<double>& values, TaskUsageStatistic& statistic)
+{
+	double sum = 0;
+	statistic.min = values[0];
+	statistic.max = values[0];
+	for (size_t i = 0; i < values.size(); i++)
+	{
+		sum += values[i];
+		if (values[i] < statistic.min)
+			statistic.min = values[i];
+		if (values[i] > statistic.max)
+			statistic.max = values[i];
+	}
+	statistic.mean = sum / values.size();
+
+	// Nearest-rank 99th percentile
+	size_t rank = (size_t)(0.99 * values.size() + 0.999999);
+	if (rank < 1)
+		rank = 1;
+	std::nth_element(values.begin(), values.begin() + (rank - 1), values.end());
+	statistic.p99 = values[rank - 1];
+}
+
+/**
+ * @brief Calculate the statistics of the samples within a window ending at the most recent sample.
+ *
+ * @param window_secs - Length of the window in seconds
+ * @param statistics - Statistics of each quantity over the window
+ * @return PPMACcontrolNoError(0), or PPMACcontrolError(-101) if no samples have been recorded.
+ */
+int PowerPMACcontrol::TaskCalculator::getStatistics(double window_secs, TaskUsageStatistics& statistics)
+{
+	std::vector<TaskUsageSample> samples;
+	getHistory(samples);
+	if (samples.empty())
+		return PPMACcontrolError;
+
+	double windowEnd = samples.back().time;
+	size_t first = samples.size() - 1;
+	while (first > 0 && samples[first - 1].time >= windowEnd - window_secs)
+		first--;
+
+	size_t count = samples.size() - first;
+	std::vector<double> phase(count), servo(count), rtInt(count), bg(count), cpu(count), temp(count);
+	for (size_t i = 0; i < count; i++)
+	{
+		const TaskUsageSample& sample = samples[first + i];
+		phase[i] = sample.phaseTaskUsage;
+		servo[i] = sample.servoTaskUsage;
+		rtInt[i] = sample.rtIntTaskUsage;
+		bg[i] = sample.bgTaskUsage;
+		cpu[i] = sample.CPUUsage;
+		temp[i] = sample.CPUTemperature;
+	}
+
+	statistics.numSamples = (int)count;
+	statistics.windowStart = samples[first].time;
+	statistics.windowEnd = windowEnd;
+	calculateStatistic(phase, statistics.phaseTaskUsage);
+	calculateStatistic(servo, statistics.servoTaskUsage);
+	calculateStatistic(rtInt, statistics.rtIntTaskUsage);
+	calculateStatistic(bg, statistics.bgTaskUsage);
+	calculateStatistic(cpu, statistics.CPUUsage);
+	calculateStatistic(temp, statistics.CPUTemperature);
+
+	return PPMACcontrolNoError;
+}
+
+/**
+ * @brief Body of the background sampling thread.
+ *
+ * Takes a snapshot, then waits for the sampling period or for the stop semaphore to be posted.
+ *
+ * @param arg Pointer to the TaskCalculator which started the thread
+ */
+#ifdef WIN32
+DWORD WINAPI PowerPMACcontrol::TaskCalculator::samplingThread(LPVOID arg)
+#else
+void *PowerPMACcontrol::TaskCalculator::samplingThread(void *arg)
+#endif
+{
+	TaskCalculator *calculator = (TaskCalculator *)arg;
+	while (true)
+	{
+		calculator->update();
+
+		calculator->lockSnapshot();
+		int period_ms = calculator->sampling_period_ms;
+		calculator->unlockSnapshot();
+
+#ifdef WIN32
+		if (WaitForSingleObject(calculator->ghStopSampling, period_ms) == WAIT_OBJECT_0)
+			break;
+#else
+		struct timespec ts = getAbsTimeout(period_ms);
+		int ret;
+		while ((ret = sem_timedwait(&calculator->sem_stopSampling, &ts)) != 0 && errno == EINTR)
+			;
+		if (ret == 0)
+			break;
+#endif
 	}
+	return 0;
 }
 
 }
@@ -24,8 +24,16 @@
 
 #include <string>
 #include "libssh2Driver.h"
+#include "sessionRecorder.h"
+#include "ioThread.h"
+#include "commandMetrics.h"
+#include "trace.h"
+#include "downloadCache.h"
+#include "programPreprocessor.h"
+#include "commandBuilder.h"
 #include <vector>
 #include <sstream>
+#include <fstream>
 
 /* Some versions of MS Visual Studio don't have stdint.h,
    so define uint32_t and uint64_t here */
@@ -41,6 +49,7 @@ typedef unsigned __int64 uint64_t;
 
 #ifndef WIN32
 #include <semaphore.h>
+#include <pthread.h>
 #endif
 
 
@@ -125,6 +134,86 @@ inline struct timespec getAbsTimeout( long milliseconds)
 
 #endif
 
+/** Get a monotonic time in seconds, used to timestamp samples and measure intervals */
+inline double getMonotonicTimeSecs()
+{
+#ifdef WIN32
+    LARGE_INTEGER timeNow;
+    LARGE_INTEGER proc_freq;
+    QueryPerformanceFrequency(&proc_freq);
+    QueryPerformanceCounter(&timeNow);
+    return((double) (((double)timeNow.QuadPart)/((double)proc_freq.QuadPart)));
+#else
+    struct timespec timeNow;
+    clock_gettime(CLOCK_MONOTONIC, &timeNow);
+    return((double)(timeNow.tv_sec + timeNow.tv_nsec/1E9));
+#endif
+}
+
+/// Default number of samples kept in the task usage history
+#define DEFAULT_TASK_HISTORY_LENGTH 1000
+
+/**
+ * @brief One sample of the CPU usage by the PMAC tasks and the CPU temperature
+ */
+struct TaskUsageSample
+{
+    double time;                ///< Time of the sample in seconds (monotonic clock of the host)
+    double phaseTaskUsage;      ///< Fraction of total CPU time used by phase tasks in percent
+    double servoTaskUsage;      ///< Fraction of total CPU time used by servo tasks in percent
+    double rtIntTaskUsage;      ///< Fraction of total CPU time used by real-time interrupt tasks in percent
+    double bgTaskUsage;         ///< Fraction of total CPU time used by background task scans in percent
+    double CPUUsage;            ///< Fraction of available CPU time used by all PMAC tasks in percent
+    double CPUTemperature;      ///< CPU temperature in Celsius
+};
+
+/**
+ * @brief Minimum, maximum, mean and 99th percentile of one quantity over a window of samples
+ */
+struct TaskUsageStatistic
+{
+    double min;     ///< Minimum value in the window
+    double max;     ///< Maximum value in the window
+    double mean;    ///< Mean value in the window
+    double p99;     ///< 99th percentile of the values in the window
+};
+
+/**
+ * @brief Statistics of the task usage samples over a sliding window
+ */
+struct TaskUsageStatistics
+{
+    int numSamples;                         ///< Number of samples in the window
+    double windowStart;                     ///< Time of the oldest sample in the window (seconds)
+    double windowEnd;                       ///< Time of the newest sample in the window (seconds)
+    TaskUsageStatistic phaseTaskUsage;      ///< Phase task usage in percent
+    TaskUsageStatistic servoTaskUsage;      ///< Servo task usage in percent
+    TaskUsageStatistic rtIntTaskUsage;      ///< Real-time interrupt task usage in percent
+    TaskUsageStatistic bgTaskUsage;         ///< Background task usage in percent
+    TaskUsageStatistic CPUUsage;            ///< Total CPU usage by PMAC tasks in percent
+    TaskUsageStatistic CPUTemperature;      ///< CPU temperature in Celsius
+};
+
+/**
+ * @brief Receives the listing of a program from PowerPMACcontrol_progUpload as it arrives.
+ *
+ * Called on the I/O thread of the connection with one or more whole lines, each ended by a
+ * newline, so it should not block for long.
+ */
+typedef void (*ProgramUploadSink)(const char *data, size_t length, void *userData);
+
+/**
+ * @brief Receives the values read by PowerPMACcontrol_getVariables as each packed line is answered.
+ *
+ * Called on the I/O thread of the connection, in the order of the names, so it should not block for long.
+ * first and count give the names of the line. If result is PPMACcontrolNoError (0), values holds a value
+ * for each of them. If it is an error reported from Power PMAC (-1 to -99), values holds the values of
+ * the names before the one which failed, names[first + values.size()]; the names after it were not read.
+ * Otherwise values is empty.
+ */
+typedef void (*VariableBatchSink)(size_t first, size_t count, const std::vector<std::string>& values, int result,
+                                  void *userData);
+
 /**
  * @class PowerPMACcontrol
  * @brief Main class for the Power PMAC SSH communications library.
@@ -140,12 +229,39 @@ public:
     DLLDECL PowerPMACcontrol();
     DLLDECL virtual ~PowerPMACcontrol();
     
-   DLLDECL int PowerPMACcontrol_connect(const char *host, const char *user, const char *pwd, const char *port="22", const bool nominus2 = false);
+   DLLDECL int PowerPMACcontrol_connect(const char *host, const char *user, const char *pwd, const char *port="22", const bool nominus2 = false,
+                                        const bool safetyChannel = false);
+   DLLDECL int PowerPMACcontrol_connectReplay(const char *filename, double speed = 1.0, const bool nominus2 = false);
+   DLLDECL int PowerPMACcontrol_connectTransport(Transport *transport, const bool nominus2 = false);
    DLLDECL int PowerPMACcontrol_disconnect();
+   DLLDECL int PowerPMACcontrol_setRecordFile(const char *filename);
+   DLLDECL int PowerPMACcontrol_getReplayStatus(unsigned long& mismatches, bool& finished);
    DLLDECL bool PowerPMACcontrol_isConnected(int timeout = TIMEOUT_NOT_SPECIFIED);
+   DLLDECL bool PowerPMACcontrol_isSafetyChannelOpen();
    DLLDECL int PowerPMACcontrol_sendCommand(const std::string command, std::string& reply);
+   DLLDECL int PowerPMACcontrol_getVariables(const std::vector<std::string>& names, std::vector<std::string>& values);
+   DLLDECL int PowerPMACcontrol_getVariables(const std::vector<std::string>& names, VariableBatchSink sink, void *userData);
+   DLLDECL int PowerPMACcontrol_setVariables(const std::vector<std::string>& names, const std::vector<std::string>& values);
+   DLLDECL int PowerPMACcontrol_getVariableRange(char base, int first, int count, std::vector<double>& values);
+   DLLDECL int PowerPMACcontrol_setVariableRange(char base, int first, const std::vector<double>& values);
+   DLLDECL int PowerPMACcontrol_setArray(const std::string& array, int first, const double *values, size_t count);
+   DLLDECL int PowerPMACcontrol_setArray(const std::string& array, int first, const std::vector<double>& values);
    DLLDECL int PowerPMACcontrol_getTimeout(int & timeout_ms);
    DLLDECL int PowerPMACcontrol_setTimeout(int timeout_ms);
+   DLLDECL int PowerPMACcontrol_getDownloadWindow(int& lines);
+   DLLDECL int PowerPMACcontrol_setDownloadWindow(int lines);
+   DLLDECL int PowerPMACcontrol_getDownloadPreprocessing(int& options, int& maxLineLength);
+   DLLDECL int PowerPMACcontrol_setDownloadPreprocessing(int options,
+                                                        int maxLineLength = (int)ProgramPreprocessor::DEFAULT_MAX_LINE_LENGTH);
+   DLLDECL int PowerPMACcontrol_getQueueStatistics(RequestQueueStatistics& statistics);
+   DLLDECL int PowerPMACcontrol_resetQueueStatistics();
+   DLLDECL int PowerPMACcontrol_getCommandMetrics(CommandMetricsSnapshot& snapshot);
+   DLLDECL int PowerPMACcontrol_resetCommandMetrics();
+   DLLDECL int PowerPMACcontrol_startTrace(TraceSink sink, void *userData, int bufferLength = DEFAULT_TRACE_BUFFER_LENGTH,
+                                           int period_ms = DEFAULT_TRACE_PERIOD_MS);
+   DLLDECL int PowerPMACcontrol_stopTrace();
+   DLLDECL bool PowerPMACcontrol_isTracing();
+   DLLDECL int PowerPMACcontrol_getTraceDropped(unsigned long& dropped);
 
 
     //PowerPMAC Controller oriented functions
@@ -160,7 +276,19 @@ public:
    DLLDECL int PowerPMACcontrol_abortMprog(int ncoord);
    DLLDECL int PowerPMACcontrol_reset();
    DLLDECL int PowerPMACcontrol_stopAllAxes();
+   DLLDECL int PowerPMACcontrol_abortAllMprogs();
    DLLDECL int PowerPMACcontrol_progDownload(std::string filepath);
+   DLLDECL int PowerPMACcontrol_progDownload(std::string filepath, int& errorLine);
+   DLLDECL int PowerPMACcontrol_progDownload(std::istream& program, int& errorLine);
+   DLLDECL int PowerPMACcontrol_progDownload(const char *program, size_t length, int& errorLine);
+   DLLDECL int PowerPMACcontrol_progDownloadIncremental(std::string filepath, int& blocksSent, int& blocksSkipped);
+   DLLDECL int PowerPMACcontrol_progDownloadFile(std::string filepath);
+   DLLDECL int PowerPMACcontrol_progDownloadFile(std::string filepath, int& errorLine);
+   DLLDECL int PowerPMACcontrol_progUpload(std::string bufferName, std::string filepath);
+   DLLDECL int PowerPMACcontrol_progUpload(std::string bufferName, std::ostream& program);
+   DLLDECL int PowerPMACcontrol_progUpload(std::string bufferName, ProgramUploadSink sink, void *userData);
+   DLLDECL int PowerPMACcontrol_setDownloadCacheFile(const char *filename);
+   DLLDECL int PowerPMACcontrol_clearDownloadCache();
    DLLDECL int PowerPMACcontrol_getCPUTemperature(double& temperature);
    DLLDECL int PowerPMACcontrol_getRunningTime(double& runningTime);
    DLLDECL int PowerPMACcontrol_getCPUUsage(double& CPUUsage);
@@ -168,6 +296,11 @@ public:
    DLLDECL int PowerPMACcontrol_getServoTaskUsage(double& servoTaskUsage);
    DLLDECL int PowerPMACcontrol_getRtIntTaskUsage(double& rtIntTaskUsage);
    DLLDECL int PowerPMACcontrol_getBgTaskUsage(double& bgTaskUsage);
+   DLLDECL int PowerPMACcontrol_getTaskUsage(double& phaseTaskUsage, double& servoTaskUsage, double& rtIntTaskUsage, double& bgTaskUsage, double& CPUUsage);
+   DLLDECL int PowerPMACcontrol_startTaskUsageSampling(int period_ms, int historyLength = DEFAULT_TASK_HISTORY_LENGTH);
+   DLLDECL int PowerPMACcontrol_stopTaskUsageSampling();
+   DLLDECL int PowerPMACcontrol_getTaskUsageHistory(std::vector<TaskUsageSample>& history);
+   DLLDECL int PowerPMACcontrol_getTaskUsageStatistics(int window_ms, TaskUsageStatistics& statistics);
 
 
     //Axis oriented functions
@@ -225,6 +358,7 @@ public:
        *      - PPMACcontrolSemaphoreTimeoutError = (-239)
        *      - PPMACcontrolSemaphoreError = (-240)
        *      - PPMACcontrolSemaphoreReleaseError = (-241)
+       *      - PPMACcontrolCommandTooLongError (-252) if the command is longer than CommandBuilder::CAPACITY
        *
        */
       template <typename T> int PowerPMACcontrol_getVariable(const std::string name, T& value){
@@ -236,12 +370,14 @@ public:
    		   return PPMACcontrolUnexpectedParamError;
 
    	   // Build the buffer to send
-   	   char cmd[SEND_BUFFER_LENGTH] = "";
-   	   this->buildSendBuffer(cmd, name);
+   	   CommandBuilder cmd;
+   	   cmd.append(name).append('\n');
+   	   if (cmd.overflowed())
+   		   return PPMACcontrolCommandTooLongError;
 
    	   // Send command and read reply
    	   std::string reply;
-   	   int ret = this->writeRead(cmd,reply);
+   	   int ret = this->writeRead(cmd.c_str(),reply);
    	   if (ret != PPMACcontrolNoError)
    		   return ret;
 
@@ -284,6 +420,7 @@ public:
        *      - PPMACcontrolSemaphoreTimeoutError = (-239)
        *      - PPMACcontrolSemaphoreError = (-240)
        *      - PPMACcontrolSemaphoreReleaseError = (-241)
+       *      - PPMACcontrolCommandTooLongError (-252) if the command is longer than CommandBuilder::CAPACITY
        */
       template <typename T> int PowerPMACcontrol_setVariable(const std::string name, T value){
    	   static const char *functionName = "PowerPMACcontrol::PowerPMACcontrol_setVariable";
@@ -293,12 +430,37 @@ public:
    	   	   if (name.length() < 1)
    	           return PPMACcontrolUnexpectedParamError;
 
-   	   	   // Build the buffer to send
-   	   	   char cmd[SEND_BUFFER_LENGTH] = {0};
-   	       this->buildSendBuffer(cmd, name, value);
+   	   	   // Build the buffer to send, with numbers written exactly
+   	   	   CommandBuilder cmd;
+   	       cmd.append(name).append('=').append(value).append('\n');
+   	       if (cmd.overflowed())
+   	           return PPMACcontrolCommandTooLongError;
 
    	       // Send command and read reply
-   	       return this->writeRead(cmd);
+   	       return this->writeRead(cmd.c_str());
+      };
+
+      /**
+       * @brief Remote download a motion/plc program given as a sequence of lines.
+       *
+       * This is a template method: the iterators may be those of any sequence of std::string or
+       * const char * lines without their newlines, such as a std::vector or a std::list of lines,
+       * or an input iterator of a program generator. The lines are joined in one buffer and
+       * downloaded as by PowerPMACcontrol_progDownload(const char *, size_t, int&).
+       *
+       * @param first - The first line
+       * @param last - The end of the lines
+       * @param errorLine - The number of the line, from 1, which failed or whose reply did not arrive, or 0 if none did.
+       * @return The same as PowerPMACcontrol_progDownload(std::string)
+       */
+      template <class InputIterator> int PowerPMACcontrol_progDownloadLines(InputIterator first, InputIterator last, int& errorLine){
+   	   std::string program;
+   	   for (; first != last; ++first)
+   	   {
+   		   program += *first;
+   		   program += '\n';
+   	   }
+   	   return PowerPMACcontrol_progDownload(program.data(), program.length(), errorLine);
       };
 
     
@@ -336,95 +498,208 @@ public:
     DLLDECL static const int  PPMACcontrolInvalidUserNameError = -244;			///< Invalid user name
     DLLDECL static const int  PPMACcontrolInvalidPasswordError = -245;			///< Invalid password
     DLLDECL static const int  PPMACcontrolInvalidPortError = -246;			///< Invalid port number
+    DLLDECL static const int  PPMACcontrolFileTransferError = -247;			///< Error copying a file to Power PMAC or running the command which loads it
+    DLLDECL static const int  PPMACcontrolManifestError = -248;			///< Error in a project manifest, such as an unknown file or a dependency cycle
+    DLLDECL static const int  PPMACcontrolDependencyError = -249;			///< A file was not downloaded because a file it depends on failed
+    DLLDECL static const int  PPMACcontrolProgramSyntaxError = -250;			///< A program has unbalanced brackets or quotes, or misplaced open or close
+    DLLDECL static const int  PPMACcontrolFileWriteError = -251;			///< Error writing a file
+    DLLDECL static const int  PPMACcontrolCommandTooLongError = -252;			///< A command is longer than the command buffer of gpascii
 
 private:
-    SSHDriver *sshdriver;
+    Transport *sshdriver;
     int connected;
 
+    /// Records the main connection to recordFile while connected, if recordFile is set
+    SessionRecorder *recorder;
+    std::string recordFile;
+
+    /// Hashes of the program blocks downloaded by PowerPMACcontrol_progDownloadIncremental
+    DownloadCache *downloadCache;
+    /// Name of the connected controller in the download cache: the host name, and the port if not 22
+    std::string controllerName;
+
     int common_timeout_ms;
+    /// Number of program lines in flight during a download, 1 to wait for the reply to each line
+    int downloadWindow;
+    /// PreprocessOption values applied to programs before they are downloaded, and the longest line made by joining lines
+    int downloadPreprocessing;
+    int downloadLineLength;
+
+    /// A line of a program in a buffer, without its newline
+    struct ProgramLine
+    {
+        const char *text;
+        size_t length;
+        int lineNumber;     ///< The number of the line in its file, from 1
+    };
 
-    static int splitit(std::string s, std::string separator, std::vector<std::string> &strings);
-    static int check_PowerPMAC_error(const std::string s);
+    static int findDownloadError(const std::string& replies, size_t length, const std::vector<ProgramLine>& lines,
+                                 size_t first, size_t last);
+    static void splitProgramLines(const char *program, size_t length, std::vector<ProgramLine>& lines);
     
     int PowerPMACcontrol_write(const char *buffer, size_t bufferSize, size_t *bytesWritten, int timeout);
     int PowerPMACcontrol_read(char *buffer, size_t bufferSize, size_t *bytesRead, int readTerm, int timeout);
 
+    int connectDriver(Transport *driver, const char *user, const char *pwd, const char *port, const bool nominus2);
+    int driverWrite(Transport *driver, const char *buffer, size_t bufferSize, size_t *bytesWritten, int timeout);
+    int driverRead(Transport *driver, char *buffer, size_t bufferSize, size_t *bytesRead, int readTerm, int timeout);
+    int driverWriteRead(Transport *driver, const char *cmd, std::string& response, int timeout, int commandClass);
+
     // These methods included in the DLL because they are used in the template methods
     // getVariable and setVarible, which are inserted inline by the compiler where they are used
-    DLLDECL int writeRead(const char *cmd, int timeout = TIMEOUT_NOT_SPECIFIED);
-    DLLDECL int writeRead(const char *cmd, std::string& response, int timeout = TIMEOUT_NOT_SPECIFIED);
-
+    DLLDECL int writeRead(const char *cmd, int timeout = TIMEOUT_NOT_SPECIFIED, int priority = RequestPriorityNormal);
+    DLLDECL int writeRead(const char *cmd, std::string& response, int timeout = TIMEOUT_NOT_SPECIFIED, int priority = RequestPriorityNormal);
+
+
+    int writeRead_WithoutSemaphore(const char *cmd, std::string& response, int timeout = TIMEOUT_NOT_SPECIFIED,
+                                   int commandClass = CommandClassQuery);
+
+    int runOnIOThread(IOTask task, void *context, int priority, int timeout);
+    int runBulk(IOTask task, void *context);
+    int runConnectTask(void *context);
+    static int connectTask(void *arg);
+    static int disconnectTask(void *arg);
+    static int replayStatusTask(void *arg);
+    static int writeReadTask(void *arg);
+    static int progDownloadTask(void *arg);
+    static int downloadCacheTask(void *arg);
+    static int fileDownloadTask(void *arg);
+    static int progUploadTask(void *arg);
+    static int batchTask(void *arg);
+    static void variableReplyHandler(size_t line, const std::string& reply, int result, void *arg);
+    int openConnection(const char *host, const char *user, const char *pwd,
+                       const char *port, const bool nominus2, const bool safetyChannel,
+                       Transport *transport);
+    int closeConnection();
+    int preprocessProgram(const char *&program, size_t& length, std::string& processed, std::vector<int>& lineNumbers,
+                          int& errorLine);
+    static int sourceLine(const std::vector<int>& lineNumbers, int errorLine);
+    int downloadProgram(const char *program, size_t length, int& errorLine);
+    int sendDownloadLines(const std::vector<ProgramLine>& lines, int& errorLine);
+    int sendDownloadLinesWindowed(const std::vector<ProgramLine>& lines, int& errorLine);
+    int downloadChangedBlocks(std::istream& progfile, int& blocksSent, int& blocksSkipped, int& errorLine);
+    int transferProgramFile(const std::string& contents, const std::string& remoteName, int& errorLine);
+    int uploadProgram(const std::string& bufferName, ProgramUploadSink sink, void *userData);
+    static bool isBatchItem(const std::string& item);
+    static bool isRangeBase(char base);
+    static void packBatchLines(const std::vector<std::string>& items, std::vector<std::string>& lines,
+                               std::vector<size_t>& itemCounts);
+    /// Called on the I/O thread with the reply to each packed line and its result
+    typedef void (*BatchReplyHandler)(size_t line, const std::string& reply, int result, void *arg);
+    int runBatch(const std::vector<std::string>& lines, std::vector<std::string>& replies, int commandClass,
+                 BatchReplyHandler handler = NULL, void *handlerArg = NULL, bool stopOnError = true);
+    int writeReadBatch(const std::vector<std::string>& lines, std::vector<std::string>& replies, int commandClass,
+                       BatchReplyHandler handler, void *handlerArg, bool stopOnError);
+
+    int writeRead_Safety(const char *cmd);
+    int lockSafetyChannel(int timeout);
+    void unlockSafetyChannel();
 
-    int writeRead_WithoutSemaphore(const char *cmd, std::string& response, int timeout = TIMEOUT_NOT_SPECIFIED);
-
-    static const long SEMAPHORE_WAIT_MSEC = 200L;
     static const int MAX_ITEM_NUM = 32;
+    static const int MIN_SAMPLING_PERIOD_MS = 10;
     
-    static const int SEND_BUFFER_LENGTH = 128;
+    static const int MAX_DOWNLOAD_WINDOW = 256;
+    /// Longest line, without its newline, which fits the command buffer of gpascii. It bounds the lines joined by
+    /// the preprocessing and the statements packed together by PowerPMACcontrol_getVariables,
+    /// PowerPMACcontrol_setVariables and PowerPMACcontrol_setArray
+    static const int MAX_LINE_LENGTH = GPASCII_COMMAND_BUFFER_LENGTH - 2;
+    /// Number of packed lines in flight during PowerPMACcontrol_getVariables and PowerPMACcontrol_setVariables
+    static const int BATCH_WINDOW = 8;
+    /// Longest reply to a range query of PowerPMACcontrol_getVariableRange, which sets the number of variables per query
+    static const int MAX_RANGE_REPLY_LENGTH = 4096;
+    /// Longest reply of one variable: a value of 17 significant digits with its sign, point and exponent, and "\r\n"
+    static const int RANGE_VALUE_LENGTH = 26;
+    /// Timeout of each step of PowerPMACcontrol_progDownloadFile, long enough for gpascii to load a large project
+    static const int FILE_TRANSFER_TIMEOUT_MS = 60000;
 
-    inline static int buildSendBuffer(char * buffer, std::string name)
-    {
-    	return sprintf( buffer, "%s\n", name.c_str());
-    }
-    inline static int buildSendBuffer(char * buffer, std::string name, float value)
-    {
-    	return sprintf( buffer, "%s=%f\n", name.c_str(), value);
-    }
-    inline static int buildSendBuffer(char * buffer, std::string name, double value)
-    {
-    	return sprintf( buffer, "%s=%f\n", name.c_str(), value);
-    }
-    inline static int buildSendBuffer(char * buffer, std::string name, int value)
-    {
-    	return sprintf( buffer, "%s=%d\n", name.c_str(), value);
-    }
-    inline static int buildSendBuffer(char * buffer, std::string name, unsigned int value)
-	{
-		return sprintf( buffer, "%s=%d\n", name.c_str(), value);
-	}
-    inline static int buildSendBuffer(char * buffer, std::string name, std::string value)
-    {
-    	return sprintf( buffer, "%s=%s\n", name.c_str(), value.c_str());
-    }
 
     /**
      * Handle calculation of CPU usage by different PMAC tasks
      * Calculations adapted from source code for Power PMAC IDE Task Manager, provided by Delta Tau
+     *
+     * One instance is kept for the lifetime of the PowerPMACcontrol object so that the
+     * last positive servo and RT interrupt task times survive between queries.
+     * All the usage figures are calculated from the same snapshot of the Sys.* variables,
+     * which can optionally be refreshed by a background thread at a fixed rate.
      */
     class TaskCalculator{
     public:
     	TaskCalculator(PowerPMACcontrol *);
-    	inline double getPhaseTaskUsage()	{return phaseTaskUsage;};
-    	inline double getServoTaskUsage()	{return servoTaskUsage;};
-    	inline double getRtIntTaskUsage()	{return rtIntTaskUsage;};
-    	inline double getBgTaskUsage()		{return bgTaskUsage;};
-    	inline double getCPUUsageByPmacTasks()	{return CPUUsageByPmacTasks;};
-    	inline int getErrorStatus()			{return errorStatus;};
+    	~TaskCalculator();
+    	int update();
+    	int getUsage(double& phase, double& servo, double& rtInt, double& bg, double& CPUUsage);
+    	int startSampling(int period_ms, int historyLength);
+    	void getHistory(std::vector<TaskUsageSample>& samples);
+    	int getStatistics(double window_secs, TaskUsageStatistics& statistics);
+    	int stopSampling();
+    	inline bool isSampling()			{return sampling;};
+    	inline int getSamplingPeriod()		{return sampling_period_ms;};
+    	inline int getHistoryLength()		{return (int)history.size();};
 
     private:
     	PowerPMACcontrol * myParent;
 
-        double Sys_FltrPhaseTime, Sys_FltrRtIntTime, Sys_FltrServoTime, Sys_FltrBgTime, Sys_BgSleepTime;
-        double Sys_PhaseDeltaTime, Sys_ServoDeltaTime, Sys_RtIntDeltaTime, Sys_BgDeltaTime;
-        double phaseTaskTime_usec, servoTaskTime_usec, rtIntTaskTime_usec, bgTaskTime_usec;
         double last_positive_servoTaskTime;
         double last_positive_rtIntTaskTime;
 
-        // Hold results
+        // Hold results of the last snapshot
     	double phaseTaskUsage;
     	double servoTaskUsage;
     	double rtIntTaskUsage;
     	double bgTaskUsage;
     	double CPUUsageByPmacTasks;
+    	double CPUTemperature;
+
+    	// Fixed-size history of snapshots, oldest overwritten first
+    	std::vector<TaskUsageSample> history;
+    	size_t historyNext;
+    	size_t historyCount;
+    	void addToHistory(const TaskUsageSample& sample);
 
     	int errorStatus;
+    	bool snapshotValid;
 
+    	// Background sampling
+    	bool sampling;
+    	int sampling_period_ms;
+
+    	void lockSnapshot();
+    	void unlockSnapshot();
+    	void lockSamplingControl();
+    	void unlockSamplingControl();
+#ifdef WIN32
+    	static DWORD WINAPI samplingThread(LPVOID arg);
+    	HANDLE ghSnapshotSemaphore;
+    	HANDLE ghSamplingControl;		// Held by startSampling and stopSampling, so that they do not overlap
+    	HANDLE ghStopSampling;
+    	HANDLE ghSamplingThread;
+#else
+    	static void *samplingThread(void *arg);
+    	sem_t sem_snapshot;
+    	sem_t sem_samplingControl;		// Held by startSampling and stopSampling, so that they do not overlap
+    	sem_t sem_stopSampling;
+    	pthread_t samplingThreadId;
+#endif
     };
 
+    TaskCalculator *taskCalculator;
+
+    /// Owns the main connection and runs the requests of all the caller threads
+    IOThread *ioThread;
+
+    /// Latency histograms and counters of the commands
+    CommandMetrics *commandMetrics;
+
+    /// Runtime trace of the commands, off until PowerPMACcontrol_startTrace is called
+    Tracer *tracer;
+
+    /// Optional second gpascii session reserved for stop and abort commands
+    Transport *safetyDriver;
+    int safetyConnected;
 #ifdef WIN32
-	HANDLE ghSemaphore;
+    HANDLE ghSafetySemaphore;
 #else
-	sem_t sem_writeRead;
+    sem_t sem_safety;
 #endif
 };
 
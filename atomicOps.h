@@ -0,0 +1,79 @@
+/**
+ * @file atomicOps.h
+ * @brief Atomic operations used by the lock-free request queue, the command metrics and the trace buffer
+ *
+ * The GCC __sync builtins are used on Linux and the Interlocked functions on Windows.
+ * All the operations are full memory barriers.
+ */
+
+#ifndef ATOMICOPS_H
+#define ATOMICOPS_H
+
+/* Might need to define WIN32 for MinGW */
+#if defined(_WIN32) && !defined(WIN32)
+#define WIN32
+#endif
+
+#ifdef WIN32
+# include <winsock2.h>
+#endif
+
+namespace PowerPMACcontrol_ns
+{
+
+#ifdef WIN32
+inline void *atomicExchangePointer(void *volatile *target, void *value)
+{
+  return InterlockedExchangePointer(target, value);
+}
+inline bool atomicCompareAndSwapPointer(void *volatile *target, void *oldValue, void *newValue)
+{
+  return InterlockedCompareExchangePointer(target, newValue, oldValue) == oldValue;
+}
+inline bool atomicCompareAndSwapLong(volatile long *target, long oldValue, long newValue)
+{
+  return InterlockedCompareExchange(target, newValue, oldValue) == oldValue;
+}
+inline long atomicIncrement(volatile long *target)
+{
+  return InterlockedIncrement(target);
+}
+inline long atomicDecrement(volatile long *target)
+{
+  return InterlockedDecrement(target);
+}
+inline long atomicLoadLong(volatile long *target)
+{
+  return InterlockedCompareExchange(target, 0, 0);
+}
+#else
+inline void *atomicExchangePointer(void *volatile *target, void *value)
+{
+  __sync_synchronize();
+  return __sync_lock_test_and_set(target, value);
+}
+inline bool atomicCompareAndSwapPointer(void *volatile *target, void *oldValue, void *newValue)
+{
+  return __sync_bool_compare_and_swap(target, oldValue, newValue);
+}
+inline bool atomicCompareAndSwapLong(volatile long *target, long oldValue, long newValue)
+{
+  return __sync_bool_compare_and_swap(target, oldValue, newValue);
+}
+inline long atomicIncrement(volatile long *target)
+{
+  return __sync_add_and_fetch(target, 1);
+}
+inline long atomicDecrement(volatile long *target)
+{
+  return __sync_sub_and_fetch(target, 1);
+}
+inline long atomicLoadLong(volatile long *target)
+{
+  return __sync_fetch_and_add(target, 0);
+}
+#endif
+
+}
+
+#endif
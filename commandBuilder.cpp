@@ -0,0 +1,203 @@
+/********************************************
+ *  commandBuilder.cpp
+ *
+ *  Building of commands in a fixed buffer,
+ *  with numbers written exactly in as few
+ *  digits as possible.
+ *
+ ********************************************/
+
+/**
+ * @file commandBuilder.cpp
+ * @brief C++ source file for the PowerPMACcontrol_ns::CommandBuilder class.
+ */
+
+#include "commandBuilder.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* std::to_chars of floating point needs C++17 and a library which provides it */
+#if __cplusplus >= 201703L && defined(__has_include)
+# if __has_include(<charconv>)
+#  include <charconv>
+# endif
+#endif
+#if defined(__cpp_lib_to_chars) && __cpp_lib_to_chars >= 201611L
+# define COMMANDBUILDER_TO_CHARS
+#endif
+
+namespace PowerPMACcontrol_ns
+{
+
+#ifdef COMMANDBUILDER_TO_CHARS
+/**
+ * Check if a number is written without an exponent, as printf("%g") does for numbers of
+ * moderate size, so that 1000000 is sent as "1000000" rather than the shorter "1e+06".
+ */
+static bool fixedFormat(double value)
+{
+  double magnitude = (value < 0) ? -value : value;
+  return magnitude == 0 || (magnitude >= 1e-4 && magnitude < 1e15);
+}
+#endif
+
+/**
+ * Constructor for an empty command.
+ */
+CommandBuilder::CommandBuilder()
+{
+  clear();
+}
+
+/**
+ * Empty the command, so that the builder can be used for another.
+ */
+void CommandBuilder::clear()
+{
+  buffer_[0] = '\0';
+  length_ = 0;
+  overflowed_ = false;
+}
+
+/**
+ * Append characters if they fit, or set overflowed.
+ */
+CommandBuilder& CommandBuilder::append(const char *text, size_t length)
+{
+  if (overflowed_ || length > CAPACITY - length_)
+  {
+    overflowed_ = true;
+    return *this;
+  }
+  memcpy(buffer_ + length_, text, length);
+  length_ += length;
+  buffer_[length_] = '\0';
+  return *this;
+}
+
+/**
+ * Append text, such as a variable name.
+ */
+CommandBuilder& CommandBuilder::append(const char *text)
+{
+  return append(text, strlen(text));
+}
+
+/**
+ * Append text, such as a variable name.
+ */
+CommandBuilder& CommandBuilder::append(const std::string& text)
+{
+  return append(text.data(), text.length());
+}
+
+/**
+ * Append a character, such as '=' or the newline which ends the command.
+ */
+CommandBuilder& CommandBuilder::append(char c)
+{
+  return append(&c, 1);
+}
+
+/**
+ * Append an integer in decimal.
+ */
+CommandBuilder& CommandBuilder::append(int value)
+{
+  char number[NUMBER_LENGTH];
+#ifdef COMMANDBUILDER_TO_CHARS
+  return append(number, std::to_chars(number, number + sizeof(number), value).ptr - number);
+#else
+  return append(number, sprintf(number, "%d", value));
+#endif
+}
+
+/**
+ * Append an unsigned integer in decimal.
+ */
+CommandBuilder& CommandBuilder::append(unsigned int value)
+{
+  char number[NUMBER_LENGTH];
+#ifdef COMMANDBUILDER_TO_CHARS
+  return append(number, std::to_chars(number, number + sizeof(number), value).ptr - number);
+#else
+  return append(number, sprintf(number, "%u", value));
+#endif
+}
+
+/**
+ * Append a double with the shortest text which reads back as the same double.
+ */
+CommandBuilder& CommandBuilder::append(double value)
+{
+  char number[NUMBER_LENGTH];
+  return append(number, formatDouble(number, value));
+}
+
+/**
+ * Append a float with the shortest text which reads back as the same float.
+ */
+CommandBuilder& CommandBuilder::append(float value)
+{
+  char number[NUMBER_LENGTH];
+  return append(number, formatFloat(number, value));
+}
+
+/**
+ * Write a double with the shortest text which reads back as the same double.
+ *
+ * @param buffer - At least NUMBER_LENGTH characters, terminated by '\0'.
+ * @param value - The number.
+ * @return - The number of characters written, without the terminator.
+ */
+int CommandBuilder::formatDouble(char *buffer, double value)
+{
+#ifdef COMMANDBUILDER_TO_CHARS
+  char *end = std::to_chars(buffer, buffer + NUMBER_LENGTH - 1, value, fixedFormat(value) ? std::chars_format::fixed :
+                            std::chars_format::general).ptr;
+  *end = '\0';
+  return (int)(end - buffer);
+#else
+  int length = 0;
+  for (int precision = 15; precision <= 17; precision++)
+  {
+    length = sprintf(buffer, "%.*g", precision, value);
+    if (strtod(buffer, NULL) == value)
+    {
+      break;
+    }
+  }
+  return length;
+#endif
+}
+
+/**
+ * Write a float with the shortest text which reads back as the same float.
+ *
+ * @param buffer - At least NUMBER_LENGTH characters, terminated by '\0'.
+ * @param value - The number.
+ * @return - The number of characters written, without the terminator.
+ */
+int CommandBuilder::formatFloat(char *buffer, float value)
+{
+#ifdef COMMANDBUILDER_TO_CHARS
+  char *end = std::to_chars(buffer, buffer + NUMBER_LENGTH - 1, value, fixedFormat(value) ? std::chars_format::fixed :
+                            std::chars_format::general).ptr;
+  *end = '\0';
+  return (int)(end - buffer);
+#else
+  int length = 0;
+  for (int precision = 6; precision <= 9; precision++)
+  {
+    length = sprintf(buffer, "%.*g", precision, value);
+    if ((float)strtod(buffer, NULL) == value)
+    {
+      break;
+    }
+  }
+  return length;
+#endif
+}
+
+}
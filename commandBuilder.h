@@ -0,0 +1,78 @@
+/**
+ * @file commandBuilder.h
+ * @brief Header file for the PowerPMACcontrol_ns::CommandBuilder class
+ *
+ * CommandBuilder builds the text of a command sent to the Power PMAC in a buffer of
+ * fixed size, writing numbers with as few digits as give back the same value.
+ */
+
+#ifndef COMMANDBUILDER_H
+#define COMMANDBUILDER_H
+
+/* Might need to define WIN32 for MinGW */
+#if defined(_WIN32) && !defined(WIN32)
+#define WIN32
+#endif
+
+#include <string>
+#include <stddef.h>
+
+/**
+ * Size of the command buffer of gpascii, which holds a line with its newline and terminator.
+ * Every limit on the length of a line sent to the Power PMAC is derived from it.
+ */
+#define GPASCII_COMMAND_BUFFER_LENGTH 1024
+
+namespace PowerPMACcontrol_ns
+{
+
+/**
+ * Appends text and numbers to a command in a buffer of CAPACITY characters, without
+ * allocating memory, so that one builder can be cleared and reused for many commands.
+ *
+ * Doubles and floats are written with the shortest text which reads back as the same
+ * number, by std::to_chars when the compiler provides it for floating point (C++17),
+ * and otherwise by printf with increasing precision up to 17 digits for a double or
+ * 9 for a float. So a position of 0.001 counts is sent as "0.001", not rounded away.
+ *
+ * Text which does not fit is not appended: the command is left as it was, overflowed()
+ * becomes true and the appends which follow are ignored until clear().
+ */
+class CommandBuilder
+{
+public:
+  static const size_t CAPACITY = GPASCII_COMMAND_BUFFER_LENGTH - 1;   ///< Longest command with its newline, less the terminator
+  static const size_t NUMBER_LENGTH = 32;  ///< Space enough for any number written by the builder
+
+  CommandBuilder();
+
+  void clear();
+  CommandBuilder& append(const char *text);
+  CommandBuilder& append(const std::string& text);
+  CommandBuilder& append(char c);
+  CommandBuilder& append(int value);
+  CommandBuilder& append(unsigned int value);
+  CommandBuilder& append(double value);
+  CommandBuilder& append(float value);
+
+  /// The command, always terminated by '\0'
+  const char *c_str() const { return buffer_; }
+  /// The number of characters in the command
+  size_t length() const { return length_; }
+  /// true if some text did not fit and was left out
+  bool overflowed() const { return overflowed_; }
+
+  static int formatDouble(char *buffer, double value);
+  static int formatFloat(char *buffer, float value);
+
+private:
+  char buffer_[CAPACITY + 1];
+  size_t length_;
+  bool overflowed_;
+
+  CommandBuilder& append(const char *text, size_t length);
+};
+
+}
+
+#endif
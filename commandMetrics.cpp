@@ -0,0 +1,301 @@
+/********************************************
+ *  commandMetrics.cpp
+ *
+ *  Latency histograms and counters of the
+ *  commands sent to the Power PMAC.
+ *
+ ********************************************/
+
+/**
+ * @file commandMetrics.cpp
+ * @brief C++ source file for the PowerPMACcontrol_ns::CommandMetrics class.
+ */
+
+#include "commandMetrics.h"
+#include "PowerPMACcontrol.h"
+#include <string.h>
+
+namespace PowerPMACcontrol_ns
+{
+
+/**
+ * Get the bucket which counts a latency.
+ *
+ * @param micros - Latency in us
+ * @return Index of the bucket
+ */
+int LatencyHistogramSnapshot::bucketIndex(unsigned long micros)
+{
+  if (micros < (unsigned long)SUB_BUCKETS)
+    return (int)micros;
+
+  // Position of the most significant bit
+  int magnitude = 0;
+  for (unsigned long v = micros; v > 1; v >>= 1)
+    magnitude++;
+  if (magnitude > MAX_MAGNITUDE)
+    return NUM_BUCKETS - 1;
+
+  int subBucket = (int)((micros >> (magnitude - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1));
+  return (magnitude - SUB_BUCKET_BITS + 1) * SUB_BUCKETS + subBucket;
+}
+
+/**
+ * Get the smallest latency in us counted by a bucket.
+ */
+unsigned long LatencyHistogramSnapshot::bucketLowerMicros(int index)
+{
+  if (index < SUB_BUCKETS)
+    return (unsigned long)index;
+  int magnitude = index / SUB_BUCKETS + SUB_BUCKET_BITS - 1;
+  int subBucket = index % SUB_BUCKETS;
+  return (unsigned long)(SUB_BUCKETS + subBucket) << (magnitude - SUB_BUCKET_BITS);
+}
+
+/**
+ * Get the largest latency in us counted by a bucket.
+ */
+unsigned long LatencyHistogramSnapshot::bucketUpperMicros(int index)
+{
+  if (index < SUB_BUCKETS)
+    return (unsigned long)index;
+  int magnitude = index / SUB_BUCKETS + SUB_BUCKET_BITS - 1;
+  return bucketLowerMicros(index) + (1UL << (magnitude - SUB_BUCKET_BITS)) - 1;
+}
+
+/**
+ * Get the mean latency in seconds, taking the middle of each bucket.
+ *
+ * @return The mean latency, or 0 if nothing was recorded
+ */
+double LatencyHistogramSnapshot::getMeanSecs() const
+{
+  if (count == 0)
+    return 0.0;
+  double total = 0.0;
+  for (int index = 0; index < NUM_BUCKETS; index++)
+  {
+    if (buckets[index] != 0)
+      total += buckets[index] * 0.5 * (bucketLowerMicros(index) + bucketUpperMicros(index));
+  }
+  return total / count / 1e6;
+}
+
+/**
+ * Get the largest latency recorded in seconds.
+ */
+double LatencyHistogramSnapshot::getMaxSecs() const
+{
+  return maxMicros / 1e6;
+}
+
+/**
+ * Get the latency in seconds which the given percentage of the latencies do not exceed.
+ *
+ * The value is the upper limit of the bucket, so it is at most 1/8 higher than the real latency.
+ *
+ * @param percent - Percentage from 0 to 100, for example 99 for the 99th percentile
+ * @return The latency, or 0 if nothing was recorded
+ */
+double LatencyHistogramSnapshot::getPercentileSecs(double percent) const
+{
+  if (count == 0)
+    return 0.0;
+  unsigned long rank = (unsigned long)(percent / 100.0 * count + 0.999999);
+  if (rank < 1)
+    rank = 1;
+  unsigned long seen = 0;
+  for (int index = 0; index < NUM_BUCKETS; index++)
+  {
+    seen += buckets[index];
+    if (seen >= rank)
+    {
+      unsigned long upper = bucketUpperMicros(index);
+      return ((upper < maxMicros) ? upper : maxMicros) / 1e6;
+    }
+  }
+  return getMaxSecs();
+}
+
+/**
+ * Constructor for the latency histogram. The histogram is initially empty.
+ */
+LatencyHistogram::LatencyHistogram()
+{
+  reset();
+}
+
+/**
+ * Count a latency. May be called from any thread.
+ *
+ * @param secs - Latency in seconds. Negative values are counted as 0.
+ */
+void LatencyHistogram::record(double secs)
+{
+  long micros;
+  if (secs <= 0.0)
+    micros = 0;
+  else if (secs >= 2147.0)
+    micros = 2147000000L;
+  else
+    micros = (long)(secs * 1e6);
+
+  atomicIncrement(&buckets_[LatencyHistogramSnapshot::bucketIndex((unsigned long)micros)]);
+  atomicIncrement(&count_);
+  long currentMax = maxMicros_;
+  while (micros > currentMax)
+  {
+    if (atomicCompareAndSwapLong(&maxMicros_, currentMax, micros))
+      break;
+    currentMax = maxMicros_;
+  }
+}
+
+/**
+ * Copy the histogram. Latencies recorded during the copy may be partly included.
+ */
+void LatencyHistogram::getSnapshot(LatencyHistogramSnapshot& snapshot) const
+{
+  snapshot.count = (unsigned long)count_;
+  snapshot.maxMicros = (unsigned long)maxMicros_;
+  for (int index = 0; index < LatencyHistogramSnapshot::NUM_BUCKETS; index++)
+  {
+    snapshot.buckets[index] = (unsigned long)buckets_[index];
+  }
+}
+
+/**
+ * Empty the histogram.
+ */
+void LatencyHistogram::reset()
+{
+  for (int index = 0; index < LatencyHistogramSnapshot::NUM_BUCKETS; index++)
+  {
+    buckets_[index] = 0;
+  }
+  count_ = 0;
+  maxMicros_ = 0;
+}
+
+/**
+ * Constructor for the command metrics. All the histograms and counters are initially empty.
+ */
+CommandMetrics::CommandMetrics()
+{
+  reset();
+}
+
+/**
+ * Get the class of a command from its text.
+ *
+ * @param cmd - Command as written to gpascii
+ * @return One of CommandClassQuery, CommandClassSet and CommandClassMotor
+ */
+int CommandMetrics::classifyCommand(const char *cmd)
+{
+  if (strchr(cmd, '=') != NULL)
+    return CommandClassSet;
+  while (*cmd == ' ' || *cmd == '\t')
+    cmd++;
+  if (*cmd == '#' || *cmd == '&')
+    return CommandClassMotor;
+  return CommandClassQuery;
+}
+
+/**
+ * Count the latency of one phase of a command. May be called from any thread.
+ *
+ * @param commandClass - One of the CommandClass values
+ * @param phase - One of the CommandPhase values
+ * @param secs - Latency in seconds
+ */
+void CommandMetrics::recordLatency(int commandClass, int phase, double secs)
+{
+  if (commandClass < 0 || commandClass >= CommandClassCount || phase < 0 || phase >= CommandPhaseCount)
+    return;
+  histograms_[commandClass][phase].record(secs);
+}
+
+/**
+ * Count a command and the result it returned. May be called from any thread.
+ *
+ * @param commandClass - One of the CommandClass values
+ * @param status - Return value of the command, PPMACcontrolNoError or an error code
+ */
+void CommandMetrics::recordResult(int commandClass, int status)
+{
+  if (commandClass < 0 || commandClass >= CommandClassCount)
+    return;
+  Counters& counters = counters_[commandClass];
+  atomicIncrement(&counters.requests);
+  if (status == PowerPMACcontrol::PPMACcontrolNoError)
+    return;
+  if (status == PowerPMACcontrol::PPMACcontrolSemaphoreTimeoutError)
+    atomicIncrement(&counters.queueTimeouts);
+  else if (status == PowerPMACcontrol::PPMACcontrolSSHDriverErrorReadTimeout
+           || status == PowerPMACcontrol::PPMACcontrolSSHDriverErrorWriteTimeout)
+    atomicIncrement(&counters.ioTimeouts);
+  else if (status < 0 && status > PowerPMACcontrol::PPMACcontrolError)
+    atomicIncrement(&counters.pmacErrors);
+  else
+    atomicIncrement(&counters.otherErrors);
+}
+
+/**
+ * Count a successful connection.
+ *
+ * @param reconnect - true if the connection replaced an earlier one
+ */
+void CommandMetrics::recordConnect(bool reconnect)
+{
+  atomicIncrement(&connects_);
+  if (reconnect)
+    atomicIncrement(&reconnects_);
+}
+
+/**
+ * Copy all the histograms and counters.
+ *
+ * @param snapshot - Copy of the metrics
+ */
+void CommandMetrics::getSnapshot(CommandMetricsSnapshot& snapshot) const
+{
+  for (int commandClass = 0; commandClass < CommandClassCount; commandClass++)
+  {
+    for (int phase = 0; phase < CommandPhaseCount; phase++)
+    {
+      histograms_[commandClass][phase].getSnapshot(snapshot.histograms[commandClass][phase]);
+    }
+    const Counters& counters = counters_[commandClass];
+    snapshot.counters[commandClass].requests = (unsigned long)counters.requests;
+    snapshot.counters[commandClass].queueTimeouts = (unsigned long)counters.queueTimeouts;
+    snapshot.counters[commandClass].ioTimeouts = (unsigned long)counters.ioTimeouts;
+    snapshot.counters[commandClass].pmacErrors = (unsigned long)counters.pmacErrors;
+    snapshot.counters[commandClass].otherErrors = (unsigned long)counters.otherErrors;
+  }
+  snapshot.connects = (unsigned long)connects_;
+  snapshot.reconnects = (unsigned long)reconnects_;
+}
+
+/**
+ * Empty all the histograms and counters.
+ */
+void CommandMetrics::reset()
+{
+  for (int commandClass = 0; commandClass < CommandClassCount; commandClass++)
+  {
+    for (int phase = 0; phase < CommandPhaseCount; phase++)
+    {
+      histograms_[commandClass][phase].reset();
+    }
+    counters_[commandClass].requests = 0;
+    counters_[commandClass].queueTimeouts = 0;
+    counters_[commandClass].ioTimeouts = 0;
+    counters_[commandClass].pmacErrors = 0;
+    counters_[commandClass].otherErrors = 0;
+  }
+  connects_ = 0;
+  reconnects_ = 0;
+}
+
+}
@@ -0,0 +1,149 @@
+/**
+ * @file commandMetrics.h
+ * @brief Header file for the PowerPMACcontrol_ns::CommandMetrics class
+ *
+ * CommandMetrics records how long each phase of a command takes, in a latency
+ * histogram per command class and phase, together with counters of the requests,
+ * timeouts and errors. Recording is lock-free so that it can be left enabled.
+ */
+
+#ifndef COMMANDMETRICS_H
+#define COMMANDMETRICS_H
+
+/* Might need to define WIN32 for MinGW */
+#if defined(_WIN32) && !defined(WIN32)
+#define WIN32
+#endif
+
+#include "atomicOps.h"
+
+namespace PowerPMACcontrol_ns
+{
+
+/**
+ * Classes of command which are measured separately.
+ */
+enum CommandClass
+{
+  CommandClassQuery = 0,        ///< Queries of variables and status
+  CommandClassSet = 1,          ///< Assignments, containing '='
+  CommandClassMotor = 2,        ///< Motor and coordinate system commands, starting with '#' or '&'
+  CommandClassSafety = 3,       ///< Stop and abort commands
+  CommandClassDownload = 4,     ///< Lines of a program download
+  CommandClassCount = 5         ///< Number of command classes
+};
+
+/**
+ * Phases of a command which are measured separately.
+ */
+enum CommandPhase
+{
+  CommandPhaseQueueWait = 0,    ///< Waiting in the request queue for the I/O thread
+  CommandPhaseWrite = 1,        ///< Writing the command to the SSH channel
+  CommandPhaseEcho = 2,         ///< Reading back the echo of the command
+  CommandPhaseFirstByte = 3,    ///< From the start of the read to the first byte of the reply
+  CommandPhaseAck = 4,          ///< From the first byte of the reply to the ACK
+  CommandPhaseTotal = 5,        ///< Whole command, from submission to the reply
+  CommandPhaseCount = 6         ///< Number of phases
+};
+
+/**
+ * @brief Copy of a latency histogram taken by LatencyHistogram::getSnapshot
+ *
+ * Latencies are counted in microseconds in log-linear buckets: each power of two
+ * is split into SUB_BUCKETS buckets, so a bucket is never wider than 1/8 of its value.
+ */
+struct LatencyHistogramSnapshot
+{
+  static const int SUB_BUCKET_BITS = 3;
+  static const int SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+  static const int MAX_MAGNITUDE = 30;   ///< Latencies up to 2^31 us (about 35 minutes)
+  static const int NUM_BUCKETS = (MAX_MAGNITUDE - SUB_BUCKET_BITS + 2) * SUB_BUCKETS;
+
+  unsigned long count;                  ///< Number of latencies recorded
+  unsigned long maxMicros;              ///< Largest latency recorded in us
+  unsigned long buckets[NUM_BUCKETS];   ///< Number of latencies in each bucket
+
+  double getMeanSecs() const;
+  double getMaxSecs() const;
+  double getPercentileSecs(double percent) const;
+
+  static int bucketIndex(unsigned long micros);
+  static unsigned long bucketLowerMicros(int index);
+  static unsigned long bucketUpperMicros(int index);
+};
+
+/**
+ * @class LatencyHistogram
+ * @brief Histogram of latencies which any thread can record into without a lock.
+ */
+class LatencyHistogram {
+  public:
+    LatencyHistogram();
+    void record(double secs);
+    void getSnapshot(LatencyHistogramSnapshot& snapshot) const;
+    void reset();
+
+  private:
+    volatile long count_;
+    volatile long maxMicros_;
+    volatile long buckets_[LatencyHistogramSnapshot::NUM_BUCKETS];
+};
+
+/**
+ * @brief Counters of the requests of one command class
+ */
+struct CommandClassCounters
+{
+  unsigned long requests;       ///< Commands sent
+  unsigned long queueTimeouts;  ///< Commands which timed out waiting for the I/O thread
+  unsigned long ioTimeouts;     ///< Commands which timed out writing or reading
+  unsigned long pmacErrors;     ///< Commands which Power PMAC replied to with an error
+  unsigned long otherErrors;    ///< Commands which failed for any other reason
+};
+
+/**
+ * @brief Copy of all the command metrics taken by CommandMetrics::getSnapshot
+ */
+struct CommandMetricsSnapshot
+{
+  LatencyHistogramSnapshot histograms[CommandClassCount][CommandPhaseCount];  ///< Indexed by CommandClass and CommandPhase
+  CommandClassCounters counters[CommandClassCount];                           ///< Indexed by CommandClass
+  unsigned long connects;       ///< Successful connections
+  unsigned long reconnects;     ///< Successful connections which replaced an earlier connection
+};
+
+/**
+ * @class CommandMetrics
+ * @brief Latency histograms and counters of the commands sent to the Power PMAC.
+ */
+class CommandMetrics {
+  public:
+    CommandMetrics();
+    void recordLatency(int commandClass, int phase, double secs);
+    void recordResult(int commandClass, int status);
+    void recordConnect(bool reconnect);
+    void getSnapshot(CommandMetricsSnapshot& snapshot) const;
+    void reset();
+
+    static int classifyCommand(const char *cmd);
+
+  private:
+    LatencyHistogram histograms_[CommandClassCount][CommandPhaseCount];
+
+    struct Counters
+    {
+      volatile long requests;
+      volatile long queueTimeouts;
+      volatile long ioTimeouts;
+      volatile long pmacErrors;
+      volatile long otherErrors;
+    };
+    Counters counters_[CommandClassCount];
+    volatile long connects_;
+    volatile long reconnects_;
+};
+
+}
+
+#endif
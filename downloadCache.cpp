@@ -0,0 +1,268 @@
+/********************************************
+ *  downloadCache.cpp
+ *
+ *  Hashes of the program blocks downloaded
+ *  to each controller, used to skip the
+ *  blocks which have not changed.
+ *
+ ********************************************/
+
+/**
+ * @file downloadCache.cpp
+ * @brief C++ source file for the PowerPMACcontrol_ns::DownloadCache class.
+ */
+
+#include "downloadCache.h"
+#include <stdio.h>
+#include <ctype.h>
+
+namespace PowerPMACcontrol_ns
+{
+
+/**
+ * Constructor for the cache. It is empty and kept in memory only.
+ */
+DownloadCache::DownloadCache()
+{
+}
+
+/**
+ * Set the file which keeps the hashes between processes, and load the hashes saved in it.
+ * The hashes already in memory are replaced by those in the file.
+ *
+ * @param filename - Name of the file, or NULL or an empty string to keep the hashes in memory only.
+ * A file which does not exist yet is created when the first hash is stored.
+ * @return - false if the file exists but cannot be read.
+ */
+bool DownloadCache::setFile(const char *filename)
+{
+  filename_ = (filename == NULL) ? "" : filename;
+  if (filename_.empty()){
+    return true;
+  }
+  hashes_.clear();
+  FILE *file = fopen(filename_.c_str(), "r");
+  if (file == NULL){
+    return true;
+  }
+  char line[1024];
+  while (fgets(line, sizeof(line), file) != NULL){
+    std::string text(line);
+    size_t tab1 = text.find('\t');
+    size_t tab2 = (tab1 == std::string::npos) ? std::string::npos : text.find('\t', tab1 + 1);
+    if (tab2 == std::string::npos){
+      continue;
+    }
+    unsigned long long value;
+    if (sscanf(text.c_str() + tab2 + 1, "%llx", &value) == 1){
+      hashes_[text.substr(0, tab2)] = (uint64_t)value;
+    }
+  }
+  bool ok = (ferror(file) == 0);
+  fclose(file);
+  return ok;
+}
+
+/**
+ * Get the hash of a block as last downloaded to a controller.
+ *
+ * @param controller - Host name of the controller.
+ * @param block - Key of the block, from blockKey.
+ * @param hash - The hash, if found.
+ * @return - true if the block is known.
+ */
+bool DownloadCache::find(const std::string& controller, const std::string& block, uint64_t& hash) const
+{
+  std::map<std::string, uint64_t>::const_iterator it = hashes_.find(controller + "\t" + block);
+  if (it == hashes_.end()){
+    return false;
+  }
+  hash = it->second;
+  return true;
+}
+
+/**
+ * Remember the hash of a block which has been downloaded to a controller.
+ *
+ * @param controller - Host name of the controller.
+ * @param block - Key of the block, from blockKey.
+ * @param hash - Hash of the lines of the block.
+ */
+void DownloadCache::store(const std::string& controller, const std::string& block, uint64_t hash)
+{
+  hashes_[controller + "\t" + block] = hash;
+  save();
+}
+
+/**
+ * Forget a block, for example because its download failed and the controller may hold part of it.
+ *
+ * @param controller - Host name of the controller.
+ * @param block - Key of the block, from blockKey.
+ */
+void DownloadCache::erase(const std::string& controller, const std::string& block)
+{
+  if (hashes_.erase(controller + "\t" + block) > 0){
+    save();
+  }
+}
+
+/**
+ * Forget every block of a controller, or of all controllers.
+ *
+ * @param controller - Host name of the controller, or an empty string for all controllers.
+ */
+void DownloadCache::clear(const std::string& controller)
+{
+  if (controller.empty()){
+    hashes_.clear();
+  }
+  else {
+    std::string prefix = controller + "\t";
+    std::map<std::string, uint64_t>::iterator it = hashes_.lower_bound(prefix);
+    while (it != hashes_.end() && it->first.compare(0, prefix.length(), prefix) == 0){
+      hashes_.erase(it++);
+    }
+  }
+  save();
+}
+
+/**
+ * Write every hash to the file, if one is set.
+ *
+ * @return - false if the file cannot be written.
+ */
+bool DownloadCache::save() const
+{
+  if (filename_.empty()){
+    return true;
+  }
+  FILE *file = fopen(filename_.c_str(), "w");
+  if (file == NULL){
+    return false;
+  }
+  std::map<std::string, uint64_t>::const_iterator it;
+  for (it = hashes_.begin(); it != hashes_.end(); ++it){
+    fprintf(file, "%s\t%016llx\n", it->first.c_str(), (unsigned long long)it->second);
+  }
+  return (fclose(file) == 0);
+}
+
+/**
+ * 64 bit FNV-1a hash of a string.
+ *
+ * @param data - The bytes to hash.
+ * @param seed - The hash of the data before, to hash several strings as one.
+ * @return - The hash.
+ */
+uint64_t DownloadCache::hash(const std::string& data, uint64_t seed)
+{
+  uint64_t h = seed;
+  for (size_t i = 0; i < data.length(); i++){
+    h ^= (unsigned char)data[i];
+    h *= FNV_PRIME;
+  }
+  return h;
+}
+
+/**
+ * Get the key of the block started by a line.
+ *
+ * @param line - A line of a program file.
+ * @return - The words of the line in lower case separated by single spaces, up to any "//" comment,
+ * if the line is an "open" command, or an empty string if it is not.
+ */
+std::string DownloadCache::blockKey(const std::string& line)
+{
+  std::string key;
+  size_t end = line.find("//");
+  if (end == std::string::npos){
+    end = line.length();
+  }
+  bool space = false;
+  for (size_t i = 0; i < end; i++){
+    char c = line[i];
+    if (isspace((unsigned char)c)){
+      space = !key.empty();
+    }
+    else {
+      if (space){
+        key += ' ';
+        space = false;
+      }
+      key += (char)tolower((unsigned char)c);
+    }
+  }
+  if (key.compare(0, 5, "open ") != 0){
+    return "";
+  }
+  return key;
+}
+
+/**
+ * Check if a line of a program file is a "close" command.
+ *
+ * @param line - A line of a program file.
+ * @return - true if the first word of the line is "close".
+ */
+bool DownloadCache::isCloseLine(const std::string& line)
+{
+  size_t start = line.find_first_not_of(" \t");
+  if (start == std::string::npos || line.length() - start < 5){
+    return false;
+  }
+  for (size_t i = 0; i < 5; i++){
+    if (tolower((unsigned char)line[start + i]) != "close"[i]){
+      return false;
+    }
+  }
+  return (line.length() - start == 5) || !isalnum((unsigned char)line[start + 5]);
+}
+
+/**
+ * Split a program file into blocks. Empty lines are left out, as they are not downloaded.
+ * The hash of each block covers its lines with any trailing carriage return removed,
+ * so it does not depend on the line endings of the file.
+ *
+ * @param stream - The program file.
+ * @param blocks - The blocks, in the order of the file.
+ * @return - false if the file cannot be read.
+ */
+bool DownloadCache::readBlocks(std::istream& stream, std::vector<ProgramBlock>& blocks)
+{
+  blocks.clear();
+  std::string line;
+  bool inBlock = false;
+  int lineNumber = 0;
+  while (getline(stream, line)){
+    lineNumber++;
+    if (line.empty()){
+      continue;
+    }
+    std::string key = blockKey(line);
+    // An open line starts a block, and so does the first line after the end of one
+    if (!key.empty() || blocks.empty() || (!inBlock && !blocks.back().key.empty())){
+      ProgramBlock block;
+      block.key = key;
+      block.closed = false;
+      block.hash = FNV_OFFSET_BASIS;
+      blocks.push_back(block);
+      inBlock = !key.empty();
+    }
+    ProgramBlock& block = blocks.back();
+    block.lines.push_back(line);
+    block.lineNumbers.push_back(lineNumber);
+    size_t length = line.length();
+    if (line[length-1] == '\r'){
+      length--;
+    }
+    block.hash = hash(line.substr(0, length) + "\n", block.hash);
+    if (inBlock && isCloseLine(line)){
+      block.closed = true;
+      inBlock = false;
+    }
+  }
+  return !stream.bad();
+}
+
+}
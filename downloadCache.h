@@ -0,0 +1,85 @@
+/**
+ * @file downloadCache.h
+ * @brief Header file for the PowerPMACcontrol_ns::DownloadCache class
+ *
+ * DownloadCache remembers a hash of each program or PLC block last downloaded
+ * to each controller, so that PowerPMACcontrol_progDownloadIncremental can skip
+ * the blocks which have not changed since.
+ */
+
+#ifndef DOWNLOADCACHE_H
+#define DOWNLOADCACHE_H
+
+/* Might need to define WIN32 for MinGW */
+#if defined(_WIN32) && !defined(WIN32)
+#define WIN32
+#endif
+
+#include <string>
+#include <vector>
+#include <map>
+#include <istream>
+
+/* Some versions of MS Visual Studio don't have stdint.h */
+#ifdef _MSC_VER
+typedef unsigned __int64 uint64_t;
+#else
+#include <stdint.h>
+#endif
+
+namespace PowerPMACcontrol_ns
+{
+
+/**
+ * A block of a program file: the lines from an "open" line to the matching "close" line,
+ * or a run of lines outside any open/close pair, which have an empty key.
+ */
+struct ProgramBlock
+{
+  std::string key;                  ///< The open line, lower case with single spaces, e.g. "open plc 3"
+  std::vector<std::string> lines;   ///< The lines as read from the file, without the newline
+  std::vector<int> lineNumbers;     ///< The number of each line in the file, from 1
+  bool closed;                      ///< true if the block ends with its own "close" line
+  uint64_t hash;                    ///< FNV-1a hash of the lines
+};
+
+/**
+ * Hashes of the program blocks downloaded to each controller.
+ *
+ * The hashes are kept in memory and, if a file is set, saved to it after every change so
+ * that they survive the process. The file is text, one "controller TAB block TAB hash" line
+ * per block. A controller is known by its host name, so the cache goes out of date if the
+ * programs are changed by other means, for example by the IDE or a reset with $$$***;
+ * clear it when that happens.
+ *
+ * The cache is used by the I/O thread and is not locked.
+ */
+class DownloadCache
+{
+public:
+  DownloadCache();
+
+  bool setFile(const char *filename);
+  bool find(const std::string& controller, const std::string& block, uint64_t& hash) const;
+  void store(const std::string& controller, const std::string& block, uint64_t hash);
+  void erase(const std::string& controller, const std::string& block);
+  void clear(const std::string& controller);
+
+  static uint64_t hash(const std::string& data, uint64_t seed = FNV_OFFSET_BASIS);
+  static std::string blockKey(const std::string& line);
+  static bool isCloseLine(const std::string& line);
+  static bool readBlocks(std::istream& stream, std::vector<ProgramBlock>& blocks);
+
+  static const uint64_t FNV_OFFSET_BASIS = 14695981039346656037ULL;  ///< 64 bit FNV-1a offset basis
+  static const uint64_t FNV_PRIME = 1099511628211ULL;                ///< 64 bit FNV-1a prime
+
+private:
+  std::string filename_;
+  std::map<std::string, uint64_t> hashes_;  ///< Keyed by controller, TAB and block key
+
+  bool save() const;
+};
+
+}
+
+#endif
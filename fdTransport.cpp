@@ -0,0 +1,222 @@
+/********************************************
+ *  fdTransport.cpp
+ *
+ *  Transport over a Unix-domain socket or a
+ *  pipe to a local program.
+ *
+ ********************************************/
+
+#include "fdTransport.h"
+#include <string.h>
+
+#ifndef WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#endif
+
+/*
+ * Uncomment the DEBUG define and recompile for lots of
+ * driver debug messages.
+ */
+/* #define DEBUG 1 */
+
+#ifdef DEBUG
+#define debugPrint printf
+#else
+static void debugPrint(...){}
+#endif
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+/* Time channelRead waits for bytes before returning none */
+#define FD_TRANSPORT_POLL_MS 1
+
+/**
+ * Constructor for the transport.
+ *
+ * @param type - FdTransportUnixSocket or FdTransportPipe.
+ * @param target - Path of the socket, or the command to run.
+ */
+FdTransport::FdTransport(FdTransportType type, const char *target)
+{
+  type_ = type;
+  strncpy(target_, target, sizeof(target_) - 1);
+  target_[sizeof(target_) - 1] = '\0';
+  fd_ = -1;
+  pid_ = -1;
+  lastReadEmpty_ = false;
+}
+
+/**
+ * Connect to the socket or start the program, then read the welcome lines.
+ *
+ * @return - Success, or SSHDriverErrorSockfail if the connection could not be made.
+ */
+SSHDriverStatus FdTransport::connectTransport()
+{
+  static const char *functionName = "FdTransport::connectTransport";
+#ifdef WIN32
+  debugPrint("%s : Not available on Windows\n", functionName);
+  return SSHDriverErrorSockfail;
+#else
+  if (type_ == FdTransportUnixSocket){
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(target_) >= sizeof(address.sun_path)){
+      debugPrint("%s : Socket path too long\n", functionName);
+      return SSHDriverErrorInvalidParameter;
+    }
+    strcpy(address.sun_path, target_);
+    fd_ = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd_ < 0){
+      return SSHDriverErrorSockfail;
+    }
+    if (connect(fd_, (struct sockaddr *)&address, sizeof(address)) != 0){
+      debugPrint("%s : Failed to connect to %s (%d)\n", functionName, target_, errno);
+      close(fd_);
+      fd_ = -1;
+      return SSHDriverErrorSockfail;
+    }
+  } else {
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0){
+      return SSHDriverErrorSockfail;
+    }
+    pid_t pid = fork();
+    if (pid < 0){
+      close(fds[0]);
+      close(fds[1]);
+      return SSHDriverErrorSockfail;
+    }
+    if (pid == 0){
+      // The program reads and writes the other end of the socket pair
+      close(fds[0]);
+      dup2(fds[1], STDIN_FILENO);
+      dup2(fds[1], STDOUT_FILENO);
+      if (fds[1] > STDERR_FILENO){
+        close(fds[1]);
+      }
+      execl("/bin/sh", "sh", "-c", target_, (char *)NULL);
+      _exit(127);
+    }
+    close(fds[1]);
+    fd_ = fds[0];
+    pid_ = (int)pid;
+  }
+  fcntl(fd_, F_SETFL, fcntl(fd_, F_GETFL, 0) | O_NONBLOCK);
+  connected_ = 1;
+  readWelcome();
+  return SSHDriverSuccess;
+#endif
+}
+
+/**
+ * Close the descriptor and stop the program, if one was started.
+ *
+ * @return - Success.
+ */
+SSHDriverStatus FdTransport::disconnectTransport()
+{
+#ifndef WIN32
+  if (fd_ >= 0){
+    close(fd_);
+    fd_ = -1;
+  }
+  if (pid_ > 0){
+    kill((pid_t)pid_, SIGTERM);
+    waitpid((pid_t)pid_, NULL, 0);
+    pid_ = -1;
+  }
+#endif
+  connected_ = 0;
+  return SSHDriverSuccess;
+}
+
+/**
+ * Destructor, cleanup.
+ */
+FdTransport::~FdTransport()
+{
+  disconnectTransport();
+}
+
+/**
+ * Write all the bytes, waiting while the descriptor is full.
+ *
+ * @param buffer - The bytes to write.
+ * @param bufferSize - The number of bytes to write.
+ * @return - The number of bytes written, or -1 on error.
+ */
+ssize_t FdTransport::channelWrite(const char *buffer, size_t bufferSize)
+{
+#ifdef WIN32
+  return -1;
+#else
+  size_t written = 0;
+  while (written < bufferSize){
+    ssize_t rc = send(fd_, buffer + written, bufferSize - written, MSG_NOSIGNAL);
+    if (rc > 0){
+      written += rc;
+    } else if (rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)){
+      struct pollfd pfd;
+      pfd.fd = fd_;
+      pfd.events = POLLOUT;
+      poll(&pfd, 1, FD_TRANSPORT_POLL_MS);
+    } else {
+      return -1;
+    }
+  }
+  return (ssize_t)written;
+#endif
+}
+
+/**
+ * Read the bytes available, waiting up to FD_TRANSPORT_POLL_MS for some to arrive.
+ * The first read after bytes were received does not wait, so the read made by
+ * Transport::flush before each command costs nothing when there is nothing to flush.
+ *
+ * @param buffer - A buffer to hold the bytes.
+ * @param bufferSize - The maximum number of bytes to read.
+ * @return - The number of bytes read, 0 if none arrived or -1 if the other end has closed.
+ */
+ssize_t FdTransport::channelRead(char *buffer, size_t bufferSize)
+{
+#ifdef WIN32
+  return -1;
+#else
+  struct pollfd pfd;
+  pfd.fd = fd_;
+  pfd.events = POLLIN;
+  if (poll(&pfd, 1, lastReadEmpty_ ? FD_TRANSPORT_POLL_MS : 0) <= 0){
+    lastReadEmpty_ = true;
+    return 0;
+  }
+  lastReadEmpty_ = false;
+  ssize_t rc = recv(fd_, buffer, bufferSize, 0);
+  if (rc == 0){
+    return -1;
+  }
+  if (rc < 0){
+    return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+  }
+  return rc;
+#endif
+}
+
+/**
+ * Nothing is held back from the reads, so there is nothing to flush.
+ * Bytes waiting on the descriptor are drained by the read in Transport::flush.
+ */
+int FdTransport::channelFlush()
+{
+  return 0;
+}
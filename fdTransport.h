@@ -0,0 +1,47 @@
+/* Might need to define WIN32 for MinGW */
+#if defined(_WIN32) && !defined(WIN32)
+#define WIN32
+#endif
+
+#ifndef fdTransport_H
+#define fdTransport_H
+
+#include "transport.h"
+
+/**
+ * The FdTransport class talks to gpascii, or a stand-in for it, through a file descriptor
+ * on the local machine: a connected Unix-domain socket, or a socket pair to the standard
+ * input and output of a program run with /bin/sh. The other end must behave like the
+ * shell on the Power PMAC: send a welcome line and a prompt, echo what is written and
+ * start gpascii when asked to.
+ *
+ * It is not available on Windows, where connectTransport returns SSHDriverErrorSockfail.
+ */
+class FdTransport : public Transport {
+
+  public:
+    typedef enum e_FdTransportType
+    {
+      FdTransportUnixSocket,  /* Connect to the Unix-domain socket at the target path */
+      FdTransportPipe         /* Run the target command and talk to its standard input and output */
+    } FdTransportType;
+
+    FdTransport(FdTransportType type, const char *target);
+    virtual SSHDriverStatus connectTransport();
+    virtual SSHDriverStatus disconnectTransport();
+    virtual ~FdTransport();
+
+  protected:
+    virtual ssize_t channelWrite(const char *buffer, size_t bufferSize);
+    virtual ssize_t channelRead(char *buffer, size_t bufferSize);
+    virtual int channelFlush();
+
+  private:
+    FdTransportType type_;
+    char target_[1024];
+    int fd_;
+    int pid_;
+    bool lastReadEmpty_;
+};
+
+#endif
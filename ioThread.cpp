@@ -0,0 +1,292 @@
+/********************************************
+ *  ioThread.cpp
+ *
+ *  Thread which owns the connection to the
+ *  Power PMAC and runs the requests submitted
+ *  by the caller threads.
+ *
+ ********************************************/
+
+/**
+ * @file ioThread.cpp
+ * @brief C++ source file for the PowerPMACcontrol_ns::IOThread class.
+ */
+
+#include "ioThread.h"
+#include "PowerPMACcontrol.h"
+#ifndef WIN32
+#include <errno.h>
+#endif
+
+namespace PowerPMACcontrol_ns
+{
+
+/**
+ * Constructor for the I/O thread. The thread is started immediately.
+ */
+IOThread::IOThread()
+{
+  static const char *functionName = "IOThread::IOThread";
+  stopping_ = false;
+  started_ = false;
+#ifdef WIN32
+  ghWork_ = CreateSemaphore(NULL, 0, LONG_MAX, NULL);
+  if (ghWork_ != NULL)
+  {
+    ghThread_ = CreateThread(NULL, 0, threadFunction, this, 0, &threadId_);
+    started_ = (ghThread_ != NULL);
+  }
+#else
+  if (sem_init(&sem_work_, 0, 0) == 0)
+  {
+    started_ = (pthread_create(&threadId_, NULL, threadFunction, this) == 0);
+  }
+#endif
+  if (!started_)
+  {
+    debugPrint_ppmaccomm("%s : Error starting the I/O thread\n", functionName);
+  }
+}
+
+/**
+ * Destructor for the I/O thread. Requests already submitted are run before the thread exits.
+ */
+IOThread::~IOThread()
+{
+  if (started_)
+  {
+    stopping_ = true;
+#ifdef WIN32
+    ReleaseSemaphore(ghWork_, 1, NULL);
+    WaitForSingleObject(ghThread_, INFINITE);
+    CloseHandle(ghThread_);
+#else
+    sem_post(&sem_work_);
+    pthread_join(threadId_, NULL);
+#endif
+  }
+#ifdef WIN32
+  if (ghWork_ != NULL)
+    CloseHandle(ghWork_);
+#else
+  sem_destroy(&sem_work_);
+#endif
+}
+
+/**
+ * Check whether the calling thread is the I/O thread.
+ */
+bool IOThread::isCurrentThread()
+{
+  if (!started_)
+    return false;
+#ifdef WIN32
+  return GetCurrentThreadId() == threadId_;
+#else
+  return pthread_equal(pthread_self(), threadId_) != 0;
+#endif
+}
+
+/**
+ * Run a function on the I/O thread and wait for it to complete.
+ *
+ * If called from the I/O thread itself, the function is run immediately.
+ *
+ * @param task - Function to be run on the I/O thread
+ * @param context - Argument of the function
+ * @param priority - One of the RequestPriority values
+ * @param timeout - Maximum time in ms to wait for the function to start. A negative value waits forever.
+ * Once the function has started, the caller always waits for it to complete.
+ * @param result - Return value of the function
+ * @return RequestQueueSuccess if the function was run, RequestQueueTimeout if it did not
+ * start before the timeout expired, RequestQueueError otherwise.
+ */
+RequestQueueStatus IOThread::run(IOTask task, void *context, int priority, int timeout, int& result)
+{
+  static const char *functionName = "IOThread::run";
+
+  if (isCurrentThread())
+  {
+    result = task(context);
+    return RequestQueueSuccess;
+  }
+  if (!started_ || stopping_)
+  {
+    debugPrint_ppmaccomm("%s : The I/O thread is not running\n", functionName);
+    return RequestQueueError;
+  }
+
+  IORequest *request = new IORequest;
+  request->priority = priority;
+  request->task = task;
+  request->context = context;
+  request->result = 0;
+  request->status = RequestQueueError;
+  request->state = IORequestPending;
+  request->refCount = 2;
+#ifdef WIN32
+  request->ghCompleted = CreateSemaphore(NULL, 0, 1, NULL);
+  if (request->ghCompleted == NULL)
+#else
+  if (sem_init(&request->sem_completed, 0, 0) != 0)
+#endif
+  {
+    debugPrint_ppmaccomm("%s : Error creating a semaphore\n", functionName);
+    delete request;
+    return RequestQueueError;
+  }
+
+  request->enqueueTime = getMonotonicTimeSecs();
+  queue_.push(request);
+#ifdef WIN32
+  ReleaseSemaphore(ghWork_, 1, NULL);
+#else
+  sem_post(&sem_work_);
+#endif
+
+  // Wait for the request to complete
+  bool waitOK;
+#ifdef WIN32
+  DWORD dwWaitResult = WaitForSingleObject(request->ghCompleted, (timeout < 0) ? INFINITE : (DWORD)timeout);
+  waitOK = (dwWaitResult == WAIT_OBJECT_0);
+#else
+  int sem_return;
+  if (timeout < 0)
+  {
+    while ((sem_return = sem_wait(&request->sem_completed)) != 0 && errno == EINTR)
+      ;
+  }
+  else
+  {
+    struct timespec ts = getAbsTimeout(timeout);
+    while ((sem_return = sem_timedwait(&request->sem_completed, &ts)) != 0 && errno == EINTR)
+      ;
+  }
+  waitOK = (sem_return == 0);
+#endif
+
+  RequestQueueStatus status;
+  if (!waitOK && atomicCompareAndSwapLong(&request->state, IORequestPending, IORequestAbandoned))
+  {
+    // Not started yet, so the I/O thread will drop it
+    debugPrint_ppmaccomm("%s : Timed out waiting in lane %d\n", functionName, priority);
+    status = RequestQueueTimeout;
+  }
+  else
+  {
+    if (!waitOK)
+    {
+      // Already running, so wait for the result. The function has its own I/O timeouts.
+#ifdef WIN32
+      WaitForSingleObject(request->ghCompleted, INFINITE);
+#else
+      while (sem_wait(&request->sem_completed) != 0 && errno == EINTR)
+        ;
+#endif
+    }
+    status = request->status;
+    result = request->result;
+  }
+  releaseRequest(request);
+  return status;
+}
+
+/**
+ * Entry point of the I/O thread.
+ */
+#ifdef WIN32
+DWORD WINAPI IOThread::threadFunction(LPVOID arg)
+#else
+void *IOThread::threadFunction(void *arg)
+#endif
+{
+  IOThread *ioThread = (IOThread *)arg;
+  ioThread->processRequests();
+  return 0;
+}
+
+/**
+ * Take requests from the queue and run them until the thread is stopped and the queue is empty.
+ */
+void IOThread::processRequests()
+{
+  while (true)
+  {
+    IORequest *request = static_cast<IORequest *>(queue_.pop());
+    if (request != NULL)
+    {
+      if (atomicCompareAndSwapLong(&request->state, IORequestPending, IORequestRunning))
+      {
+        queue_.recordTurn(request->priority, getMonotonicTimeSecs() - request->enqueueTime);
+        request->result = request->task(request->context);
+        request->status = RequestQueueSuccess;
+        complete(request);
+      }
+      else
+      {
+        queue_.recordTimeout(request->priority);
+      }
+      releaseRequest(request);
+      continue;
+    }
+
+    if (stopping_)
+      break;
+
+    // Sleep until a request is submitted
+#ifdef WIN32
+    WaitForSingleObject(ghWork_, INFINITE);
+#else
+    while (sem_wait(&sem_work_) != 0 && errno == EINTR)
+      ;
+#endif
+  }
+}
+
+/**
+ * Wake the caller waiting for a request.
+ */
+void IOThread::complete(IORequest *request)
+{
+#ifdef WIN32
+  ReleaseSemaphore(request->ghCompleted, 1, NULL);
+#else
+  sem_post(&request->sem_completed);
+#endif
+}
+
+/**
+ * Give up one reference to a request, deleting it when neither the caller nor the I/O thread needs it.
+ */
+void IOThread::releaseRequest(IORequest *request)
+{
+  if (atomicDecrement(&request->refCount) == 0)
+  {
+#ifdef WIN32
+    CloseHandle(request->ghCompleted);
+#else
+    sem_destroy(&request->sem_completed);
+#endif
+    delete request;
+  }
+}
+
+/**
+ * Get the statistics of each lane of the request queue.
+ *
+ * @param statistics - Copy of the statistics
+ */
+void IOThread::getStatistics(RequestQueueStatistics& statistics)
+{
+  queue_.getStatistics(statistics);
+}
+
+/**
+ * Clear the accumulated statistics of the request queue.
+ */
+void IOThread::resetStatistics()
+{
+  queue_.resetStatistics();
+}
+
+}
@@ -0,0 +1,107 @@
+/**
+ * @file ioThread.h
+ * @brief Header file for the PowerPMACcontrol_ns::IOThread class
+ *
+ * Each connection to the Power PMAC is owned by one IOThread. Caller threads
+ * submit requests to it and wait for them to complete, so the libssh2 session
+ * is only ever used by the I/O thread.
+ */
+
+#ifndef IOTHREAD_H
+#define IOTHREAD_H
+
+/* Might need to define WIN32 for MinGW */
+#if defined(_WIN32) && !defined(WIN32)
+#define WIN32
+#endif
+
+#include "requestQueue.h"
+
+#ifdef WIN32
+# include <winsock2.h>
+#else
+# include <pthread.h>
+# include <semaphore.h>
+#endif
+
+namespace PowerPMACcontrol_ns
+{
+
+/**
+ * Function run on the I/O thread for a request. The return value is passed back to the caller.
+ */
+typedef int (*IOTask)(void *context);
+
+/**
+ * @brief A request submitted to the I/O thread
+ *
+ * The request is shared by the caller and the I/O thread and is deleted by whichever
+ * of them releases it last, so a caller may stop waiting for a request which has not
+ * started yet.
+ */
+struct IORequest : public QueuedRequest
+{
+  IOTask task;                  ///< Function to run on the I/O thread
+  void *context;                ///< Argument of the function
+  int result;                   ///< Return value of the function
+  RequestQueueStatus status;    ///< RequestQueueSuccess if the function was run
+  volatile long state;          ///< One of the IORequestState values
+  volatile long refCount;       ///< Number of owners, the caller and the I/O thread
+#ifdef WIN32
+  HANDLE ghCompleted;
+#else
+  sem_t sem_completed;
+#endif
+};
+
+/**
+ * States of a request submitted to the I/O thread
+ */
+enum IORequestState
+{
+  IORequestPending = 0,         ///< Waiting in the queue
+  IORequestRunning = 1,         ///< Taken by the I/O thread
+  IORequestAbandoned = 2        ///< The caller stopped waiting before it was taken
+};
+
+/**
+ * @class IOThread
+ * @brief Thread which runs the requests for one connection, one at a time.
+ *
+ * Requests are pushed onto a lock-free RequestQueue and the caller waits on a
+ * completion semaphore of its own. The I/O thread takes the requests in priority
+ * order and runs them, so no lock is handed between the caller threads.
+ */
+class IOThread {
+  public:
+    IOThread();
+    virtual ~IOThread();
+    RequestQueueStatus run(IOTask task, void *context, int priority, int timeout, int& result);
+    bool isCurrentThread();
+    void getStatistics(RequestQueueStatistics& statistics);
+    void resetStatistics();
+
+  private:
+    RequestQueue queue_;
+    volatile bool stopping_;
+    bool started_;
+
+#ifdef WIN32
+    static DWORD WINAPI threadFunction(LPVOID arg);
+    HANDLE ghWork_;
+    HANDLE ghThread_;
+    DWORD threadId_;
+#else
+    static void *threadFunction(void *arg);
+    sem_t sem_work_;
+    pthread_t threadId_;
+#endif
+
+    void processRequests();
+    void complete(IORequest *request);
+    static void releaseRequest(IORequest *request);
+};
+
+}
+
+#endif
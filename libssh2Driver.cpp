@@ -41,7 +41,6 @@ SSHDriver::SSHDriver(const char *host)
   // Initialize internal SSH parameters
   auth_pw_ = 0;
   got_ = 0;
-  connected_ = 0;
   // Username and password currently set to empty strings
   strncpy(username_, "", 256);
   strncpy(password_, "", 256);
@@ -50,6 +49,10 @@ SSHDriver::SSHDriver(const char *host)
   
   //set the default port number 
   strncpy(port_, "22", 256);
+
+  // No key files, the keys of the user are used for key based authorization
+  strncpy(publicKeyFile_, "", 256);
+  strncpy(privateKeyFile_, "", 256);
   
   debugPrint("SSHDriver using libssh2 version: %s \n", libssh2_version(0));
 }
@@ -123,6 +126,28 @@ SSHDriverStatus SSHDriver::setPort(const char *port)
   return SSHDriverSuccess;
 }
 
+/**
+ * Setup the key files for key based authorization. When they are set,
+ * the keys are used instead of the password, which is the passphrase
+ * of the private key.
+ *
+ * @param publicKeyFile - Public key file.
+ * @param privateKeyFile - Private key file.
+ * @return - Success(SSHDriverSuccess) or failure(SSHDriverErrorInvalidParameter).
+ */
+SSHDriverStatus SSHDriver::setKeyFiles(const char *publicKeyFile, const char *privateKeyFile)
+{
+  static const char *functionName = "SSHDriver::setKeyFiles";
+  debugPrint("%s : Method called with key file %s\n", functionName, privateKeyFile);
+
+  if (strlen(publicKeyFile) > 255 || strlen(privateKeyFile) > 255)
+      return SSHDriverErrorInvalidParameter;    //Too long file name
+  strncpy(publicKeyFile_, publicKeyFile, 256);
+  strncpy(privateKeyFile_, privateKeyFile, 256);
+
+  return SSHDriverSuccess;
+}
+
 /**
  * Attempt to create a connection and authorize the username
  * with the password (or by keys).  Once the connection has
@@ -195,7 +220,7 @@ SSHDriverStatus SSHDriver::connectSSH()
   }
   debugPrint("\n");
 
-  if (auth_pw_ == 1){
+  if (auth_pw_ == 1 && privateKeyFile_[0] == '\0'){
     // Authenticate via password
     if (libssh2_userauth_password(session_, username_, password_)) {
       debugPrint("%s : SSH authentication by password failed.\n", functionName);
@@ -208,8 +233,13 @@ SSHDriverStatus SSHDriver::connectSSH()
     /* Or by public key */
     char rsapubbuff[256];
     char rsabuff[256];
-    sprintf(rsapubbuff, "/home/%s/.ssh/id_rsa.pub", username_);
-    sprintf(rsabuff, "/home/%s/.ssh/id_rsa", username_);
+    if (privateKeyFile_[0] != '\0'){
+      strcpy(rsapubbuff, publicKeyFile_);
+      strcpy(rsabuff, privateKeyFile_);
+    } else {
+      sprintf(rsapubbuff, "/home/%s/.ssh/id_rsa.pub", username_);
+      sprintf(rsabuff, "/home/%s/.ssh/id_rsa", username_);
+    }
     if (libssh2_userauth_publickey_fromfile(session_, username_, rsapubbuff, rsabuff, password_)){
       debugPrint("%s : SSH authentication by public key failed\n", functionName);
       disconnectSSH();
@@ -238,17 +268,28 @@ SSHDriverStatus SSHDriver::connectSSH()
 
   setBlocking(0);
 
-  // Here we should wait for the initial welcome line
-  char buffer[1024];
-  size_t bytes = 0;
-  read(buffer, 1024, &bytes, '\n', 1000);
-  // And the command line
-  read(buffer, 1024, &bytes, 0x20, 1000);
+  readWelcome();
   debugPrint("%s : Connection ready...\n", functionName);
 
   return SSHDriverSuccess;
 }
 
+/**
+ * Connect to the SSH server and open a shell, as connectSSH.
+ */
+SSHDriverStatus SSHDriver::connectTransport()
+{
+  return connectSSH();
+}
+
+/**
+ * Close the connection, as disconnectSSH.
+ */
+SSHDriverStatus SSHDriver::disconnectTransport()
+{
+  return disconnectSSH();
+}
+
 /**
  * Set the connection to a blocking or non-blocking connection.
  *
@@ -267,257 +308,195 @@ SSHDriverStatus SSHDriver::setBlocking(int blocking)
 }
 
 /**
- * Flush the connection as best as possible.
+ * Close the connection.
  *
  * @return - Success or failure.
  */
-SSHDriverStatus SSHDriver::flush()
+SSHDriverStatus SSHDriver::disconnectSSH()
 {
-  char buff[2048];
-  static const char *functionName = "SSHDriver::flush";
+  static const char *functionName = "SSHDriver::disconnect";
   debugPrint("%s : Method called\n", functionName);
 
-  if (connected_ == 0){
-    debugPrint("%s : Not connected\n", functionName);
-    return SSHDriverErrorNoconn;
-  }
+  if (connected_ == 1){
+    connected_ = 0;
+    libssh2_session_disconnect(session_, "Normal Shutdown");
+    libssh2_session_free(session_);
 
-  ssize_t rc = libssh2_channel_flush_ex(channel_, 0);
-  rc |= libssh2_channel_flush_ex(channel_, 1);
-  rc |= libssh2_channel_flush_ex(channel_, 2);
-  rc = libssh2_channel_read(channel_, buff, 2048);
-  if (rc < 0){
-    return SSHDriverErrorNoconn;
+#ifdef WIN32
+    closesocket(sock_);
+#else
+    close(sock_);
+#endif
+    debugPrint("%s : Completed disconnect\n", functionName);
+
+    libssh2_exit();
+  
+  } else {
+    debugPrint("%s : Connection was never established\n", functionName);
   }
   return SSHDriverSuccess;
 }
 
 /**
- * Write data to the connected channel.  A timeout should be
- * specified in milliseconds.
+ * Destructor, cleanup.
+ */
+SSHDriver::~SSHDriver()
+{
+  static const char *functionName = "SSHDriver::~SSHDriver";
+  debugPrint("%s : Method called\n", functionName);
+}
+
+/**
+ * Write a file on the controller with SCP, on a channel of its own in the session
+ * of the gpascii channel. The session is made blocking for the transfer, with the
+ * timeout applied to each libssh2 call. The transfer is not recorded.
  *
- * @param buffer - The string buffer to be written.
- * @param bufferSize - The number of bytes to write.
- * @param bytesWritten - The number of bytes that were written.
- * @param timeout - A timeout in ms for the write.
- * @return - Success(SSHDriverSuccess) if it succeeds to write. The possible error numbers are
- *      - SSHDriverErrorNoconn if there is no connection. 
- *      - SSHDriverErrorInvalidParameter if bufferSize is too large.
- *      - SSHDriverErrorNobytes if no bytes were written.
+ * @param remotePath - Path of the file on the controller, overwritten if it exists.
+ * @param data - The contents of the file.
+ * @param length - The number of bytes.
+ * @param timeout - A timeout in ms for each step of the transfer.
+ * @return - Success(SSHDriverSuccess) if the whole file was written. The possible error numbers are
+ *      - SSHDriverErrorNoconn if there is no connection.
+ *      - SSHDriverError if the SCP channel cannot be opened or fails.
  *      - SSHDriverErrorWriteTimeout if timeout occurs
  */
-SSHDriverStatus SSHDriver::write(const char *buffer, size_t bufferSize, size_t *bytesWritten, int timeout)
+SSHDriverStatus SSHDriver::uploadData(const char *remotePath, const char *data, size_t length, int timeout)
 {
-  static const int CHAR_SIZE = 5120;
-  char input[CHAR_SIZE];
-  static const char *functionName = "SSHDriver::write";
-  double stimesecs, ctimesecs, time_at_timeout;
-  
-  debugPrint("%s : Method called\n", functionName);
-  *bytesWritten = 0;
+  static const char *functionName = "SSHDriver::uploadData";
+  debugPrint("%s : Sending %lu bytes to %s\n", functionName, (unsigned long)length, remotePath);
 
   if (connected_ == 0){
-    debugPrint("%s : Not connected\n", functionName);
     return SSHDriverErrorNoconn;
   }
-
-  if (bufferSize > (CHAR_SIZE-1))
-  {
-      debugPrint("%s : Buffer size too large\n", functionName);
-      return SSHDriverErrorInvalidParameter;
-  }
-  
-  strncpy(input, buffer, bufferSize);
-  input[bufferSize] = 0;
-  flush();
-  debugPrint("%s : Writing => %s\n", functionName, input);
-
-  stimesecs = SSHDriverCurrentTimeSecs ();
-  time_at_timeout = stimesecs + timeout/1000.0;
-  ssize_t rc = libssh2_channel_write(channel_, buffer, bufferSize);
-  if (rc > 0){
-    debugPrint("%s : %d bytes written\n", functionName, rc);
-    *bytesWritten = rc;
+  SSHDriverStatus status = SSHDriverSuccess;
+  libssh2_session_set_timeout(session_, timeout);
+  libssh2_session_set_blocking(session_, 1);
+  LIBSSH2_CHANNEL *scp = libssh2_scp_send64(session_, remotePath, 0644, (libssh2_int64_t)length, 0, 0);
+  if (scp == NULL){
+    debugPrint("%s : Unable to open the SCP channel (%d)\n", functionName, libssh2_session_last_errno(session_));
+    status = (libssh2_session_last_errno(session_) == LIBSSH2_ERROR_TIMEOUT) ? SSHDriverErrorWriteTimeout : SSHDriverError;
   } else {
-    debugPrint("%s : No bytes were written, libssh2 error (%d)\n", functionName, rc);
-    bytesWritten = 0;
-    return SSHDriverErrorNobytes;
-  }
-
-  // Now we need to read back the same number of bytes, to remove the written string from the buffer
-  int bytesToRead = *bytesWritten;
-  int bytes = 0;
-  char buff[CHAR_SIZE];
-  rc = 0;
-  int crCount = 0;
-    
-  // Count the number of \n characters sent
-  for (int index = 0; index < (int)*bytesWritten; index++){
-    if (buffer[index] == '\n'){
-      // CR, need to read back 1 extra character
-      crCount++;
-    }
-  }
-  ctimesecs = 0.0;
-  bytesToRead += crCount;
-  while ((bytesToRead > 0) && (ctimesecs < time_at_timeout)){
-    rc = libssh2_channel_read(channel_, &buff[bytes], bytesToRead);
-    if (rc > 0){
-      bytes+=rc;
-      bytesToRead-=rc;
-    }
-    if (bytesToRead > 0){
-      ctimesecs = SSHDriverCurrentTimeSecs ();
+    size_t sent = 0;
+    while (sent < length){
+      ssize_t rc = libssh2_channel_write(scp, &data[sent], length - sent);
+      if (rc < 0){
+        debugPrint("%s : SCP write failed (%d)\n", functionName, (int)rc);
+        status = (rc == LIBSSH2_ERROR_TIMEOUT) ? SSHDriverErrorWriteTimeout : SSHDriverError;
+        break;
+      }
+      sent += rc;
     }
+    libssh2_channel_send_eof(scp);
+    libssh2_channel_wait_eof(scp);
+    closeChannel(scp);
+    libssh2_channel_free(scp);
   }
-
-  buff[bytes] = '\0';
-  debugPrint("%s : Bytes =>\n", functionName);
-  for (int j = 0; j < bytes; j++){
-    debugPrint("[%d] ", buff[j]);
-  }
-  debugPrint("\n");
-
-  ctimesecs = SSHDriverCurrentTimeSecs ();
-  debugPrint("%s : Time taken for write => %ld ms\n", functionName, (long)((ctimesecs - stimesecs) * 1000) );
-  if (ctimesecs >= time_at_timeout){
-    return SSHDriverErrorWriteTimeout;
-  }
-
-  return SSHDriverSuccess;
+  libssh2_session_set_timeout(session_, 0);
+  setBlocking(0);
+  return status;
 }
 
 /**
- * Read data from the connected channel.  A timeout should be
- * specified in milliseconds.  The read method will continue to
- * read data from the channel until either the specified 
- * terminator is read or the timeout is reached.
+ * Run a shell command on the controller, on an exec channel of its own in the session
+ * of the gpascii channel, and wait for it to finish. The session is made blocking while
+ * the command runs, with the timeout applied to each read of its output.
  *
- * @param buffer - A string buffer to hold the read data.
- * @param bufferSize - The maximum number of bytes to read.
- * @param bytesWritten - The number of bytes that have been read.
- * @param readTerm - A terminator to use as a check for EOM (End Of Message).
- * @param timeout - A timeout in ms for the read.
- * @return - Success or failure.
+ * @param command - The command line, run by the shell of the user.
+ * @param output - The standard output of the command.
+ * @param exitStatus - The exit status of the command.
+ * @param timeout - A timeout in ms for each part of the output.
+ * @return - Success(SSHDriverSuccess) if the command ran to its end. The possible error numbers are
+ *      - SSHDriverErrorNoconn if there is no connection.
+ *      - SSHDriverError if the command cannot be started.
+ *      - SSHDriverErrorReadTimeout if timeout occurs
  */
-SSHDriverStatus SSHDriver::read(char *buffer, size_t bufferSize, size_t *bytesRead, int readTerm, int timeout)
+SSHDriverStatus SSHDriver::execCommand(const char *command, std::string& output, int& exitStatus, int timeout)
 {
-  static const char *functionName = "SSHDriver::read";
-  double stimesecs, ctimesecs, time_at_timeout;  
-  
-  debugPrint("%s : Method called\n", functionName);
-  debugPrint("%s : Read terminator %d\n", functionName, readTerm);
+  static const char *functionName = "SSHDriver::execCommand";
+  debugPrint("%s : Running %s\n", functionName, command);
 
+  output.clear();
+  exitStatus = -1;
   if (connected_ == 0){
-    debugPrint("%s : Not connected\n", functionName);
     return SSHDriverErrorNoconn;
   }
-
-  ssize_t rc = 0;
-  int matched = 0;
-  int matchedindex = 0;
-  int lastCount = 0;
-  *bytesRead = 0;
-  ctimesecs = 0.0;
-  
-  stimesecs = SSHDriverCurrentTimeSecs ();
-  time_at_timeout = stimesecs + timeout/1000.0;
-  while ((matched == 0) && (ctimesecs < time_at_timeout)){
-    rc = libssh2_channel_read(channel_, &buffer[*bytesRead], (bufferSize-*bytesRead));
-    if (rc > 0){
-      *bytesRead+=rc;
-    }
-    for (int index = lastCount; index < (int)*bytesRead; index++){
-      // Match against output terminator
-      if (buffer[index] == readTerm){
-        matched = 1;
-        matchedindex = index;
-      }
+  SSHDriverStatus status = SSHDriverSuccess;
+  libssh2_session_set_timeout(session_, timeout);
+  libssh2_session_set_blocking(session_, 1);
+  LIBSSH2_CHANNEL *exec = libssh2_channel_open_session(session_);
+  if (exec == NULL || libssh2_channel_exec(exec, command) != 0){
+    debugPrint("%s : Unable to start the command (%d)\n", functionName, libssh2_session_last_errno(session_));
+    status = SSHDriverError;
+  } else {
+    char buffer[4096];
+    ssize_t rc;
+    while ((rc = libssh2_channel_read(exec, buffer, sizeof(buffer))) > 0){
+      output.append(buffer, rc);
     }
-    lastCount = *bytesRead;
-    if (matched == 0){
-      ctimesecs = SSHDriverCurrentTimeSecs ();
+    if (rc < 0){
+      debugPrint("%s : Reading the output failed (%d)\n", functionName, (int)rc);
+      status = (rc == LIBSSH2_ERROR_TIMEOUT) ? SSHDriverErrorReadTimeout : SSHDriverError;
     }
   }
-
-  buffer[matchedindex] = '\0';
-  debugPrint("%s : Bytes =>\n", functionName);
-  for (int j = 0; j < lastCount; j++){
-    debugPrint("[%d] ", buffer[j]);
-  }
-  debugPrint("\n");
-  debugPrint("%s : Matched %d\n", functionName, matched);
-
-  *bytesRead = lastCount;
-  debugPrint("%s : Line => %s", functionName, buffer);
-
-  ctimesecs = SSHDriverCurrentTimeSecs ();
-  debugPrint("%s : Time taken for read => %ld ms\n", functionName,  (long)((ctimesecs - stimesecs) * 1000) );
-  if (ctimesecs >= time_at_timeout){
-    return SSHDriverErrorReadTimeout;
+  if (exec != NULL){
+    closeChannel(exec);
+    if (status == SSHDriverSuccess){
+      exitStatus = libssh2_channel_get_exit_status(exec);
+    }
+    libssh2_channel_free(exec);
   }
+  libssh2_session_set_timeout(session_, 0);
+  setBlocking(0);
+  return status;
+}
 
-  return SSHDriverSuccess;
+/**
+ * Close a channel opened for a transfer or a command and wait for the server to close it.
+ * The caller frees the channel, after reading its exit status if it needs it.
+ */
+void SSHDriver::closeChannel(LIBSSH2_CHANNEL *channel)
+{
+  libssh2_channel_close(channel);
+  libssh2_channel_wait_closed(channel);
 }
 
 /**
- * Close the connection.
+ * Write bytes to the libssh2 channel.
  *
- * @return - Success or failure.
+ * @param buffer - The bytes to write.
+ * @param bufferSize - The number of bytes to write.
+ * @return - The number of bytes written, 0 if the send window is full, or a libssh2 error code.
  */
-SSHDriverStatus SSHDriver::disconnectSSH()
+ssize_t SSHDriver::channelWrite(const char *buffer, size_t bufferSize)
 {
-  static const char *functionName = "SSHDriver::disconnect";
-  debugPrint("%s : Method called\n", functionName);
-
-  if (connected_ == 1){
-    connected_ = 0;
-    libssh2_session_disconnect(session_, "Normal Shutdown");
-    libssh2_session_free(session_);
-
-#ifdef WIN32
-    closesocket(sock_);
-#else
-    close(sock_);
-#endif
-    debugPrint("%s : Completed disconnect\n", functionName);
-
-    libssh2_exit();
-  
-  } else {
-    debugPrint("%s : Connection was never established\n", functionName);
-  }
-  return SSHDriverSuccess;
+  ssize_t rc = libssh2_channel_write(channel_, buffer, bufferSize);
+  // The channel is non-blocking, so a full send window is not an error
+  return (rc == LIBSSH2_ERROR_EAGAIN) ? 0 : rc;
 }
 
 /**
- * Destructor, cleanup.
+ * Read the bytes available from the libssh2 channel without waiting.
+ *
+ * @param buffer - A buffer to hold the bytes.
+ * @param bufferSize - The maximum number of bytes to read.
+ * @return - The number of bytes read, 0 or LIBSSH2_ERROR_EAGAIN if none were available, or a libssh2 error code.
  */
-SSHDriver::~SSHDriver()
+ssize_t SSHDriver::channelRead(char *buffer, size_t bufferSize)
 {
-  static const char *functionName = "SSHDriver::~SSHDriver";
-  debugPrint("%s : Method called\n", functionName);
+  return libssh2_channel_read(channel_, buffer, bufferSize);
 }
 
-double SSHDriver::SSHDriverCurrentTimeSecs ()
+/**
+ * Flush the streams of the libssh2 channel.
+ *
+ * @return - 0, or a libssh2 error code.
+ */
+int SSHDriver::channelFlush()
 {
-#ifdef WIN32
-  static BOOL initialized = FALSE;
-  LARGE_INTEGER timeNow;
-  static LARGE_INTEGER proc_freq;
-
-  if (! initialized)
-  {
-    if (QueryPerformanceFrequency(&proc_freq)!=TRUE) printf("QueryPerformanceFrequency() failed\n");
-    initialized = TRUE;
-  }
-  QueryPerformanceCounter(&timeNow);
-  return((double) (((double)timeNow.QuadPart)/((double)proc_freq.QuadPart)));
-#else
-  struct timespec timeNow;
-  clock_gettime(CLOCK_MONOTONIC, &timeNow);
-  return((double)(timeNow.tv_sec + timeNow.tv_nsec/1E9));
-#endif
+  int rc = libssh2_channel_flush_ex(channel_, 0);
+  rc |= libssh2_channel_flush_ex(channel_, 1);
+  rc |= libssh2_channel_flush_ex(channel_, 2);
+  return rc;
 }
 
 
@@ -21,26 +21,7 @@
 # include <arpa/inet.h>
 #endif
 
-#include <stdio.h>
-
-typedef enum e_SSHDriverStatus
-{
-  SSHDriverSuccess,
-  SSHDriverError,           /* SSH Generic error */
-  SSHDriverErrorNobytes,    /* SSH Zero bytes written */
-  SSHDriverErrorNoconn,     /* SSH Not connected */
-  SSHDriverErrorPassword,   /* SSH Authentication by password failed */
-  SSHDriverErrorPty,        /* SSH Failed requesting dumb pty */
-  SSHDriverErrorPublicKey,  /* SSH Authentication by public key failed */
-  SSHDriverErrorShell,      /* SSH Unable to request shell on allocated pty\ */
-  SSHDriverErrorSockfail,   /* SSH socket failed to connect */
-  SSHDriverErrorSshInit,    /* libssh2 initialization failed */
-  SSHDriverErrorSshSession, /* libssh2 failed to create a session instance */
-  SSHDriverErrorReadTimeout,  /* SSH read timed out */
-  SSHDriverErrorWriteTimeout, /* SSH write Timed out */
-  SSHDriverErrorUnknownHost,   /* Host unknown */
-  SSHDriverErrorInvalidParameter   /* Parameter Invalid */
-} SSHDriverStatus;
+#include "transport.h"
 
 /**
  * The SSHDriver class provides a wrapper around the libssh2 library.
@@ -50,24 +31,30 @@ typedef enum e_SSHDriverStatus
  *
  * @author Alan Greer (ajg@observatorysciences.co.uk)
  */
-class SSHDriver {
+class SSHDriver : public Transport {
 
   public:
     SSHDriver(const char *host);
-    SSHDriverStatus setUsername(const char *username);
-    SSHDriverStatus setPassword(const char *password);
-    SSHDriverStatus setPort(const char *port);
+    virtual SSHDriverStatus setUsername(const char *username);
+    virtual SSHDriverStatus setPassword(const char *password);
+    virtual SSHDriverStatus setPort(const char *port);
+    SSHDriverStatus setKeyFiles(const char *publicKeyFile, const char *privateKeyFile);
     SSHDriverStatus connectSSH();
-    SSHDriverStatus flush();
-    SSHDriverStatus write(const char *buffer, size_t bufferSize, size_t *bytesWritten, int timeout);
-    SSHDriverStatus read(char *buffer, size_t bufferSize, size_t *bytesRead, int readTerm, int timeout);
     SSHDriverStatus disconnectSSH();
+    virtual SSHDriverStatus connectTransport();
+    virtual SSHDriverStatus disconnectTransport();
+    virtual SSHDriverStatus uploadData(const char *remotePath, const char *data, size_t length, int timeout);
+    virtual SSHDriverStatus execCommand(const char *command, std::string& output, int& exitStatus, int timeout);
     virtual ~SSHDriver();
 
+  protected:
+    virtual ssize_t channelWrite(const char *buffer, size_t bufferSize);
+    virtual ssize_t channelRead(char *buffer, size_t bufferSize);
+    virtual int channelFlush();
+
   private:
     int sock_;
     int auth_pw_;
-    int connected_;
     struct sockaddr_in sin_;
     LIBSSH2_SESSION *session_;
     LIBSSH2_CHANNEL *channel_;
@@ -75,10 +62,12 @@ class SSHDriver {
     char username_[256];
     char password_[256];
     char port_[256];
+    char publicKeyFile_[256];
+    char privateKeyFile_[256];
     off_t got_;
 
     SSHDriverStatus setBlocking(int blocking);
-    double SSHDriverCurrentTimeSecs ();
+    void closeChannel(LIBSSH2_CHANNEL *channel);
 
 };
 
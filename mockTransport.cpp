@@ -0,0 +1,359 @@
+/********************************************
+ *  mockTransport.cpp
+ *
+ *  In-process stand-in for the shell and
+ *  gpascii on the Power PMAC.
+ *
+ ********************************************/
+
+#include "mockTransport.h"
+#include <string.h>
+#include <stdio.h>
+#include <vector>
+#ifndef WIN32
+#include <sched.h>
+#endif
+
+#define MOCK_WELCOME      "Welcome to the Power PMAC mock transport\r\n"
+#define MOCK_PROMPT       "root@mock:/opt/ppmac# "
+#define MOCK_GPASCII_OPEN "STDIN Open for ASCII Input\r\n"
+#define MOCK_ACK          "\x06"
+
+/**
+ * Constructor for the mock transport.
+ *
+ * @param responder - Function giving the reply to each command, or NULL to reply to every command with nothing.
+ * @param userData - Pointer passed to the responder.
+ * @param latencySecs - Time from a command being written to its reply being readable.
+ */
+MockTransport::MockTransport(MockResponder responder, void *userData, double latencySecs)
+{
+  responder_ = responder;
+  userData_ = userData;
+  latencySecs_ = latencySecs;
+  gpascii_ = false;
+  tempFiles_ = 0;
+}
+
+/**
+ * Set the time from a command being written to its reply being readable.
+ */
+void MockTransport::setLatency(double latencySecs)
+{
+  latencySecs_ = latencySecs;
+}
+
+/**
+ * Start a new session at the shell prompt and read the welcome lines, as SSHDriver does.
+ *
+ * @return - Success.
+ */
+SSHDriverStatus MockTransport::connectTransport()
+{
+  gpascii_ = false;
+  line_.clear();
+  output_.clear();
+  double now = currentTimeSecs();
+  send(MOCK_WELCOME, now);
+  send(MOCK_PROMPT, now);
+  connected_ = 1;
+  readWelcome();
+  return SSHDriverSuccess;
+}
+
+/**
+ * End the session.
+ *
+ * @return - Success.
+ */
+SSHDriverStatus MockTransport::disconnectTransport()
+{
+  connected_ = 0;
+  output_.clear();
+  return SSHDriverSuccess;
+}
+
+/**
+ * Keep a file uploaded to the controller in memory.
+ *
+ * @param remotePath - Path of the file, replaced if it exists.
+ * @param data - The contents of the file.
+ * @param length - The number of bytes.
+ * @param timeout - Not used.
+ * @return - Success, or SSHDriverErrorNoconn if not connected.
+ */
+SSHDriverStatus MockTransport::uploadData(const char *remotePath, const char *data, size_t length, int timeout)
+{
+  if (!connected_){
+    return SSHDriverErrorNoconn;
+  }
+  files_[remotePath] = std::string(data, length);
+  return SSHDriverSuccess;
+}
+
+/**
+ * Run the commands of a command line, separated by ';'. "mktemp <template>" makes an empty file
+ * named by replacing the trailing X's of the template and outputs its name; "gpascii -i<file>"
+ * passes each line of an uploaded file to the responder and outputs the errors in the form of
+ * gpascii, with the file name and line number; "rm -f <file>" forgets a file. Any other command
+ * is not found.
+ * Redirections such as "2>&1" are ignored, as the mock has a single output.
+ *
+ * @param command - The command line.
+ * @param output - The output of the commands.
+ * @param exitStatus - The exit status of the last command.
+ * @param timeout - Not used.
+ * @return - Success, or SSHDriverErrorNoconn if not connected.
+ */
+SSHDriverStatus MockTransport::execCommand(const char *command, std::string& output, int& exitStatus, int timeout)
+{
+  output.clear();
+  exitStatus = -1;
+  if (!connected_){
+    return SSHDriverErrorNoconn;
+  }
+  std::string line(command);
+  size_t start = 0;
+  while (start <= line.length()){
+    size_t end = line.find(';', start);
+    if (end == std::string::npos){
+      end = line.length();
+    }
+    // Split the command into words, leaving out the redirections
+    std::vector<std::string> words;
+    size_t pos = start;
+    while (pos < end){
+      size_t wordStart = line.find_first_not_of(" \t", pos);
+      if (wordStart == std::string::npos || wordStart >= end){
+        break;
+      }
+      size_t wordEnd = line.find_first_of(" \t;", wordStart);
+      if (wordEnd == std::string::npos || wordEnd > end){
+        wordEnd = end;
+      }
+      std::string word = line.substr(wordStart, wordEnd - wordStart);
+      if (word.find('>') == std::string::npos){
+        words.push_back(word);
+      }
+      pos = wordEnd;
+    }
+    if (!words.empty()){
+      if (words[0] == "gpascii" && words.size() == 2 && words[1].compare(0, 2, "-i") == 0){
+        exitStatus = loadFile(words[1].substr(2), output);
+      } else if (words[0] == "mktemp" && words.size() == 2){
+        exitStatus = makeTempFile(words[1], output);
+      } else if (words[0] == "rm" && words.size() == 3 && words[1] == "-f"){
+        files_.erase(words[2]);
+        exitStatus = 0;
+      } else {
+        output += "sh: " + words[0] + ": not found\n";
+        exitStatus = 127;
+      }
+    }
+    start = end + 1;
+  }
+  return SSHDriverSuccess;
+}
+
+/**
+ * Make an empty file with a name not used by another, as mktemp does.
+ *
+ * @param pattern - The name of the file, ending with at least 3 X's which are replaced.
+ * @param output - The name of the file, or the error, followed by a newline, is added to it.
+ * @return - The exit status: 0, or 1 if the pattern has too few X's.
+ */
+int MockTransport::makeTempFile(const std::string& pattern, std::string& output)
+{
+  static const char letters[] = "0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ";
+  size_t last = pattern.find_last_not_of('X');
+  size_t first = (last == std::string::npos) ? 0 : last + 1;
+  if (pattern.length() - first < 3){
+    output += "mktemp: too few X's in template '" + pattern + "'\n";
+    return 1;
+  }
+  std::string path;
+  do {
+    path = pattern;
+    unsigned long number = tempFiles_++;
+    for (size_t i = pattern.length(); i > first; i--){
+      path[i-1] = letters[number % (sizeof(letters) - 1)];
+      number /= sizeof(letters) - 1;
+    }
+  } while (files_.find(path) != files_.end());
+  files_[path] = "";
+  output += path + "\n";
+  return 0;
+}
+
+/**
+ * Pass each line of an uploaded file to the responder, as gpascii -i does.
+ *
+ * @param path - Path of the file.
+ * @param output - The errors are added to it, each on a line of its own.
+ * @return - The exit status: 0, or 1 if the file does not exist.
+ */
+int MockTransport::loadFile(const std::string& path, std::string& output)
+{
+  std::map<std::string, std::string>::const_iterator file = files_.find(path);
+  if (file == files_.end()){
+    output += "gpascii: cannot open " + path + "\n";
+    return 1;
+  }
+  const std::string& data = file->second;
+  size_t start = 0;
+  int lineNumber = 0;
+  while (start < data.length()){
+    size_t end = data.find('\n', start);
+    if (end == std::string::npos){
+      end = data.length();
+    }
+    std::string line = data.substr(start, end - start);
+    if (!line.empty() && line[line.length()-1] == '\r'){
+      line.erase(line.length()-1);
+    }
+    lineNumber++;
+    start = end + 1;
+    reply_.clear();
+    if (line.empty() || responder_ == NULL){
+      continue;
+    }
+    responder_(line, reply_, userData_);
+    size_t error = reply_.find("error #");
+    if (error == std::string::npos){
+      continue;
+    }
+    // gpascii names the file and line in place of "stdin:1:"
+    char location[32];
+    sprintf(location, ":%d:1: ", lineNumber);
+    output += path + location + reply_.substr(error) + "\n";
+  }
+  return 0;
+}
+
+/**
+ * Destructor, cleanup.
+ */
+MockTransport::~MockTransport()
+{
+}
+
+/**
+ * Echo the bytes written and reply to each complete line.
+ *
+ * @param buffer - The bytes to write.
+ * @param bufferSize - The number of bytes to write.
+ * @return - bufferSize, or -1 if not connected.
+ */
+ssize_t MockTransport::channelWrite(const char *buffer, size_t bufferSize)
+{
+  if (!connected_){
+    return -1;
+  }
+  double now = currentTimeSecs();
+  std::string echo;
+  for (size_t i = 0; i < bufferSize; i++){
+    if (buffer[i] == '\n'){
+      echo += "\r\n";
+    } else {
+      echo += buffer[i];
+    }
+  }
+  send(echo, now);
+  for (size_t i = 0; i < bufferSize; i++){
+    if (buffer[i] == '\n'){
+      processLine(now + latencySecs_);
+      line_.clear();
+    } else if (buffer[i] != '\r'){
+      line_ += buffer[i];
+    }
+  }
+  return (ssize_t)bufferSize;
+}
+
+/**
+ * Return the bytes of the oldest output, once it is due. Only one reply is
+ * returned per call, so a read stops where the reply from gpascii would.
+ *
+ * @param buffer - A buffer to hold the bytes.
+ * @param bufferSize - The maximum number of bytes to read.
+ * @return - The number of bytes read, or 0 if nothing is due.
+ */
+ssize_t MockTransport::channelRead(char *buffer, size_t bufferSize)
+{
+  if (output_.empty() || output_.front().due > currentTimeSecs()){
+    // The reader polls until the reply is due; let the other sessions run meanwhile,
+    // as the controller would be running beside them
+#ifdef WIN32
+    SwitchToThread();
+#else
+    sched_yield();
+#endif
+    return 0;
+  }
+  MockChunk& chunk = output_.front();
+  size_t bytes = chunk.bytes.size();
+  if (bytes > bufferSize){
+    bytes = bufferSize;
+  }
+  memcpy(buffer, chunk.bytes.data(), bytes);
+  if (bytes == chunk.bytes.size()){
+    output_.pop_front();
+  } else {
+    chunk.bytes.erase(0, bytes);
+  }
+  return (ssize_t)bytes;
+}
+
+/**
+ * Nothing is held back from the reads, so there is nothing to flush.
+ */
+int MockTransport::channelFlush()
+{
+  return 0;
+}
+
+/**
+ * Queue output to be readable at the given time.
+ */
+void MockTransport::send(const std::string& bytes, double due)
+{
+  if (bytes.empty()){
+    return;
+  }
+  MockChunk chunk;
+  chunk.due = due;
+  chunk.bytes = bytes;
+  output_.push_back(chunk);
+}
+
+/**
+ * Reply to the line in line_. At the shell prompt only gpascii can be started;
+ * in gpascii the line is passed to the responder and the reply ended with an ACK.
+ */
+void MockTransport::processLine(double due)
+{
+  if (!gpascii_){
+    if (line_.compare(0, 7, "gpascii") == 0){
+      gpascii_ = true;
+      send(MOCK_GPASCII_OPEN, due);
+    } else {
+      send(MOCK_PROMPT, due);
+    }
+    return;
+  }
+  if (line_ == "echo7"){
+    send("\r\n", due);
+    return;
+  }
+  reply_.clear();
+  if (responder_ != NULL){
+    responder_(line_, reply_, userData_);
+  }
+  if (reply_.empty()){
+    send(MOCK_ACK, due);
+  } else {
+    // gpascii rings the bell before an error
+    bool error = reply_.find("error #") != std::string::npos;
+    send((error ? "\x07" : "") + reply_ + "\r\n" MOCK_ACK, due);
+  }
+}
@@ -0,0 +1,77 @@
+/* Might need to define WIN32 for MinGW */
+#if defined(_WIN32) && !defined(WIN32)
+#define WIN32
+#endif
+
+#ifndef mockTransport_H
+#define mockTransport_H
+
+#include "transport.h"
+#include <string>
+#include <deque>
+#include <map>
+
+/**
+ * Function which gives the reply of the MockTransport to a line written to gpascii.
+ *
+ * @param line - The line written, without the newline.
+ * @param reply - Set to the reply, without the newline and the ACK which end it.
+ * Errors are replied in the same form as gpascii, for example "stdin:1:1: error #20: ILLEGAL CMD".
+ * @param userData - The pointer given to the MockTransport.
+ */
+typedef void (*MockResponder)(const std::string& line, std::string& reply, void *userData);
+
+/**
+ * The MockTransport class is an in-process stand-in for the shell and gpascii on the
+ * Power PMAC. It sends a welcome line and a prompt, echoes every byte written as the
+ * pty does, answers the gpascii start up commands, and passes every other line to a
+ * responder. Each reply is followed by a newline and an ACK (0x06) and is delivered
+ * after a configurable latency. With no responder, every command gets an empty reply.
+ *
+ * Files uploaded with uploadData are kept in memory. execCommand understands the
+ * commands used to load them, "mktemp <template>", "gpascii -i<file>" and "rm -f <file>", separated by ';',
+ * and passes each line of the file to the responder as gpascii would.
+ *
+ * It is used to measure the protocol and parsing layers without network noise
+ * and to run programs on machines without a Power PMAC.
+ */
+class MockTransport : public Transport {
+
+  public:
+    MockTransport(MockResponder responder = NULL, void *userData = NULL, double latencySecs = 0.0);
+    void setLatency(double latencySecs);
+    virtual SSHDriverStatus connectTransport();
+    virtual SSHDriverStatus disconnectTransport();
+    virtual SSHDriverStatus uploadData(const char *remotePath, const char *data, size_t length, int timeout);
+    virtual SSHDriverStatus execCommand(const char *command, std::string& output, int& exitStatus, int timeout);
+    virtual ~MockTransport();
+
+  protected:
+    virtual ssize_t channelWrite(const char *buffer, size_t bufferSize);
+    virtual ssize_t channelRead(char *buffer, size_t bufferSize);
+    virtual int channelFlush();
+
+  private:
+    typedef struct s_MockChunk
+    {
+      double due;       /* Time at which the bytes can be read */
+      std::string bytes;
+    } MockChunk;
+
+    MockResponder responder_;
+    void *userData_;
+    double latencySecs_;
+    bool gpascii_;
+    std::string line_;
+    std::deque<MockChunk> output_;
+    std::string reply_;
+    std::map<std::string, std::string> files_;
+    unsigned long tempFiles_;   /* Number of files made by mktemp, which names them */
+
+    void send(const std::string& bytes, double due);
+    void processLine(double due);
+    int loadFile(const std::string& path, std::string& output);
+    int makeTempFile(const std::string& pattern, std::string& output);
+};
+
+#endif
@@ -0,0 +1,304 @@
+/********************************************
+ *  parameterBackup.cpp
+ *
+ *  Backup of the motor, coordinate system,
+ *  encoder table and system settings of a
+ *  Power PMAC to a file, and their restore.
+ *
+ ********************************************/
+
+/**
+ * @file parameterBackup.cpp
+ * @brief C++ source file for the PowerPMACcontrol_ns::ParameterBackup class.
+ */
+
+#include "parameterBackup.h"
+#include "PowerPMACcontrol.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <fstream>
+
+namespace PowerPMACcontrol_ns
+{
+
+/// Motor settings saved by default: addresses, scaling, limits, moves and servo gains
+static const char *const defaultMotorSettings[] = {
+  "ServoCtrl", "pEnc", "pEnc2", "pDac", "pAmpEnable", "pAmpFault", "AmpFaultLevel", "pLimits", "PosSf", "Pos2Sf",
+  "MaxPos", "MinPos", "MaxSpeed", "InvAmax", "InvDmax", "InvJmax", "JogSpeed", "JogTa", "JogTs", "HomeVel",
+  "HomeOffset", "AbortTa", "AbortTs", "FatalFeLimit", "WarnFeLimit", "InPosBand", "InPosTime", "Servo.Kp",
+  "Servo.Kvfb", "Servo.Kvff", "Servo.Kaff", "Servo.Kfff", "Servo.Ki", "Servo.MaxInt", "Servo.SwZvInt",
+  "Servo.MaxPosErr", "Servo.BreakPosErr", "Servo.Kbreak", "Servo.OutDbOn", "Servo.OutDbOff"
+};
+
+/// Coordinate system settings saved by default
+static const char *const defaultCoordSettings[] = {
+  "Ta", "Td", "Ts", "Tm", "FeedTime", "MaxFeedRate", "SegMoveTime", "TimeBaseSlew"
+};
+
+/// Encoder conversion table settings saved by default
+static const char *const defaultEncTableSettings[] = {
+  "type", "pEnc", "pEnc1", "index1", "index2", "index3", "index4", "index5", "index6", "MaxDelta", "ScaleFactor"
+};
+
+/// System settings saved by default
+static const char *const defaultSysSettings[] = {
+  "MaxMotors", "MaxCoords", "BgSleepTime"
+};
+
+/**
+ * Constructor for the backup, with the default settings of all the motors and coordinate systems
+ * and of as many encoder table entries as motors.
+ */
+ParameterBackup::ParameterBackup()
+{
+  firstMotor_ = 0;
+  lastMotor_ = FROM_CONTROLLER;
+  firstCoord_ = 0;
+  lastCoord_ = FROM_CONTROLLER;
+  firstEncTable_ = 0;
+  lastEncTable_ = FROM_CONTROLLER;
+  motorSettings_.assign(defaultMotorSettings,
+                        defaultMotorSettings + sizeof(defaultMotorSettings) / sizeof(defaultMotorSettings[0]));
+  coordSettings_.assign(defaultCoordSettings,
+                        defaultCoordSettings + sizeof(defaultCoordSettings) / sizeof(defaultCoordSettings[0]));
+  encTableSettings_.assign(defaultEncTableSettings,
+                           defaultEncTableSettings + sizeof(defaultEncTableSettings) / sizeof(defaultEncTableSettings[0]));
+  sysSettings_.assign(defaultSysSettings, defaultSysSettings + sizeof(defaultSysSettings) / sizeof(defaultSysSettings[0]));
+}
+
+/**
+ * Set the motors whose settings are saved.
+ *
+ * @param first - The first motor.
+ * @param last - The last motor, or FROM_CONTROLLER for Sys.MaxMotors - 1. If less than first, no motor is saved.
+ */
+void ParameterBackup::setMotors(int first, int last)
+{
+  firstMotor_ = first;
+  lastMotor_ = last;
+}
+
+/**
+ * Set the coordinate systems whose settings are saved.
+ *
+ * @param first - The first coordinate system.
+ * @param last - The last coordinate system, or FROM_CONTROLLER for Sys.MaxCoords - 1. If less than first, none is saved.
+ */
+void ParameterBackup::setCoords(int first, int last)
+{
+  firstCoord_ = first;
+  lastCoord_ = last;
+}
+
+/**
+ * Set the encoder conversion table entries whose settings are saved.
+ *
+ * @param first - The first entry.
+ * @param last - The last entry, or FROM_CONTROLLER for Sys.MaxMotors - 1, one entry per motor.
+ * If less than first, no entry is saved.
+ */
+void ParameterBackup::setEncTables(int first, int last)
+{
+  firstEncTable_ = first;
+  lastEncTable_ = last;
+}
+
+/**
+ * Set the elements saved for each motor, such as "JogSpeed" or "Servo.Kp".
+ */
+void ParameterBackup::setMotorSettings(const std::vector<std::string>& settings)
+{
+  motorSettings_ = settings;
+}
+
+/**
+ * Set the elements saved for each coordinate system.
+ */
+void ParameterBackup::setCoordSettings(const std::vector<std::string>& settings)
+{
+  coordSettings_ = settings;
+}
+
+/**
+ * Set the elements saved for each encoder conversion table entry.
+ */
+void ParameterBackup::setEncTableSettings(const std::vector<std::string>& settings)
+{
+  encTableSettings_ = settings;
+}
+
+/**
+ * Set the elements of Sys which are saved, such as "MaxMotors".
+ */
+void ParameterBackup::setSysSettings(const std::vector<std::string>& settings)
+{
+  sysSettings_ = settings;
+}
+
+/**
+ * Get the names of the settings saved, in the order of a backup file: Sys, then the motors,
+ * the coordinate systems and the encoder table.
+ *
+ * @param ppmac - The connection, which gives the ranges set to FROM_CONTROLLER.
+ * @param names - The names, such as "Motor[1].JogSpeed".
+ * @return - PPMACcontrolNoError(0), or an error of PowerPMACcontrol_getVariables
+ * if the ranges cannot be read from the controller.
+ */
+int ParameterBackup::getNames(PowerPMACcontrol& ppmac, std::vector<std::string>& names) const
+{
+  names.clear();
+  int lastMotor = lastMotor_;
+  int lastCoord = lastCoord_;
+  int lastEncTable = lastEncTable_;
+  if (lastMotor < 0 || lastCoord < 0 || lastEncTable < 0)
+  {
+    std::vector<std::string> maxNames;
+    std::vector<std::string> maxValues;
+    maxNames.push_back("Sys.MaxMotors");
+    maxNames.push_back("Sys.MaxCoords");
+    int ret = ppmac.PowerPMACcontrol_getVariables(maxNames, maxValues);
+    if (ret != PowerPMACcontrol::PPMACcontrolNoError)
+    {
+      return ret;
+    }
+    int maxMotors = atoi(maxValues[0].c_str());
+    int maxCoords = atoi(maxValues[1].c_str());
+    lastMotor = (lastMotor < 0) ? maxMotors - 1 : lastMotor;
+    lastCoord = (lastCoord < 0) ? maxCoords - 1 : lastCoord;
+    lastEncTable = (lastEncTable < 0) ? maxMotors - 1 : lastEncTable;
+  }
+  for (size_t i = 0; i < sysSettings_.size(); i++)
+  {
+    names.push_back("Sys." + sysSettings_[i]);
+  }
+  addNames("Motor", firstMotor_, lastMotor, motorSettings_, names);
+  addNames("Coord", firstCoord_, lastCoord, coordSettings_, names);
+  addNames("EncTable", firstEncTable_, lastEncTable, encTableSettings_, names);
+  return PowerPMACcontrol::PPMACcontrolNoError;
+}
+
+/**
+ * Add the names of the settings of a range of a structure, none if last is less than first.
+ */
+void ParameterBackup::addNames(const char *structure, int first, int last, const std::vector<std::string>& settings,
+                               std::vector<std::string>& names)
+{
+  char prefix[64];
+  for (int index = first; index <= last; index++)
+  {
+    sprintf(prefix, "%s[%d].", structure, index);
+    for (size_t i = 0; i < settings.size(); i++)
+    {
+      names.push_back(prefix + settings[i]);
+    }
+  }
+}
+
+/**
+ * Read the settings from the controller and save them to a file.
+ *
+ * @param ppmac - The connection.
+ * @param filename - The backup file, replaced if it exists.
+ * @return - PPMACcontrolNoError(0), an error of PowerPMACcontrol_getVariables, for example if a setting
+ * does not exist on the controller, or an error of writeFile.
+ */
+int ParameterBackup::backup(PowerPMACcontrol& ppmac, const char *filename) const
+{
+  std::vector<std::string> names;
+  int ret = getNames(ppmac, names);
+  if (ret != PowerPMACcontrol::PPMACcontrolNoError)
+  {
+    return ret;
+  }
+  std::vector<std::string> values;
+  ret = ppmac.PowerPMACcontrol_getVariables(names, values);
+  if (ret != PowerPMACcontrol::PPMACcontrolNoError)
+  {
+    return ret;
+  }
+  return writeFile(filename, names, values);
+}
+
+/**
+ * Write the settings of a backup file to the controller, in the order of the file.
+ *
+ * @param ppmac - The connection.
+ * @param filename - The backup file.
+ * @return - PPMACcontrolNoError(0), an error of readFile, or an error of PowerPMACcontrol_setVariables.
+ */
+int ParameterBackup::restore(PowerPMACcontrol& ppmac, const char *filename) const
+{
+  std::vector<std::string> names;
+  std::vector<std::string> values;
+  int ret = readFile(filename, names, values);
+  if (ret != PowerPMACcontrol::PPMACcontrolNoError)
+  {
+    return ret;
+  }
+  return ppmac.PowerPMACcontrol_setVariables(names, values);
+}
+
+/**
+ * Read the settings of a backup file.
+ *
+ * @param filename - The backup file.
+ * @param names - The names of the settings.
+ * @param values - The values, in the order of the names.
+ * @return - PPMACcontrolNoError(0), PPMACcontrolFileOpenError (-234), or PPMACcontrolFileReadError (-235)
+ * if a line other than a comment or a blank line is not "name=value".
+ */
+int ParameterBackup::readFile(const char *filename, std::vector<std::string>& names, std::vector<std::string>& values)
+{
+  names.clear();
+  values.clear();
+  std::ifstream file(filename);
+  if (!file.is_open())
+  {
+    return PowerPMACcontrol::PPMACcontrolFileOpenError;
+  }
+  std::string line;
+  while (getline(file, line))
+  {
+    size_t start = line.find_first_not_of(" \t");
+    if (start == std::string::npos || line[start] == '#')
+    {
+      continue;
+    }
+    size_t end = line.find_last_not_of(" \t\r");
+    size_t equals = line.find('=', start);
+    if (equals == std::string::npos || equals == start || equals >= end)
+    {
+      return PowerPMACcontrol::PPMACcontrolFileReadError;
+    }
+    names.push_back(line.substr(start, equals - start));
+    values.push_back(line.substr(equals + 1, end - equals));
+  }
+  return file.bad() ? PowerPMACcontrol::PPMACcontrolFileReadError : PowerPMACcontrol::PPMACcontrolNoError;
+}
+
+/**
+ * Write settings to a backup file.
+ *
+ * @param filename - The backup file, replaced if it exists.
+ * @param names - The names of the settings.
+ * @param values - The values, in the order of the names.
+ * @return - PPMACcontrolNoError(0), PPMACcontrolFileOpenError (-234), or PPMACcontrolFileWriteError (-251).
+ */
+int ParameterBackup::writeFile(const char *filename, const std::vector<std::string>& names,
+                               const std::vector<std::string>& values)
+{
+  std::ofstream file(filename, std::ios::out | std::ios::trunc);
+  if (!file.is_open())
+  {
+    return PowerPMACcontrol::PPMACcontrolFileOpenError;
+  }
+  file << "# PowerPMACcontrol parameter backup, " << names.size() << " settings\n";
+  for (size_t i = 0; i < names.size() && i < values.size(); i++)
+  {
+    file << names[i] << '=' << values[i] << '\n';
+  }
+  file.close();
+  return file.fail() ? PowerPMACcontrol::PPMACcontrolFileWriteError : PowerPMACcontrol::PPMACcontrolNoError;
+}
+
+}
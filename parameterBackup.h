@@ -0,0 +1,76 @@
+/**
+ * @file parameterBackup.h
+ * @brief Header file for the PowerPMACcontrol_ns::ParameterBackup class
+ *
+ * ParameterBackup saves the settings of the motors, coordinate systems, encoder
+ * conversion table and system of a Power PMAC to a file, and writes them back.
+ */
+
+#ifndef PARAMETERBACKUP_H
+#define PARAMETERBACKUP_H
+
+/* Might need to define WIN32 for MinGW */
+#if defined(_WIN32) && !defined(WIN32)
+#define WIN32
+#endif
+
+#include <string>
+#include <vector>
+
+namespace PowerPMACcontrol_ns
+{
+
+class PowerPMACcontrol;
+
+/**
+ * Backs up and restores the settings of a Power PMAC.
+ *
+ * The settings are the elements named by the setting lists, such as "JogSpeed" or "Servo.Kp",
+ * of each Motor[], Coord[] and EncTable[] in the ranges set, and the Sys elements of their list.
+ * They are read and written with PowerPMACcontrol_getVariables and PowerPMACcontrol_setVariables,
+ * many to a command, so backing up hundreds of motors takes seconds.
+ *
+ * A backup file has a line "name=value" per setting, the value as replied by Power PMAC,
+ * after a comment line starting with '#'. It can also be downloaded as a program.
+ */
+class ParameterBackup
+{
+public:
+  ParameterBackup();
+
+  void setMotors(int first, int last);
+  void setCoords(int first, int last);
+  void setEncTables(int first, int last);
+  void setMotorSettings(const std::vector<std::string>& settings);
+  void setCoordSettings(const std::vector<std::string>& settings);
+  void setEncTableSettings(const std::vector<std::string>& settings);
+  void setSysSettings(const std::vector<std::string>& settings);
+  int getNames(PowerPMACcontrol& ppmac, std::vector<std::string>& names) const;
+  int backup(PowerPMACcontrol& ppmac, const char *filename) const;
+  int restore(PowerPMACcontrol& ppmac, const char *filename) const;
+
+  static int readFile(const char *filename, std::vector<std::string>& names, std::vector<std::string>& values);
+  static int writeFile(const char *filename, const std::vector<std::string>& names,
+                       const std::vector<std::string>& values);
+
+  static const int FROM_CONTROLLER = -1;   ///< Last index of a range taken from Sys.MaxMotors or Sys.MaxCoords
+
+private:
+  int firstMotor_;
+  int lastMotor_;
+  int firstCoord_;
+  int lastCoord_;
+  int firstEncTable_;
+  int lastEncTable_;
+  std::vector<std::string> motorSettings_;
+  std::vector<std::string> coordSettings_;
+  std::vector<std::string> encTableSettings_;
+  std::vector<std::string> sysSettings_;
+
+  static void addNames(const char *structure, int first, int last, const std::vector<std::string>& settings,
+                       std::vector<std::string>& names);
+};
+
+}
+
+#endif
@@ -0,0 +1,271 @@
+/********************************************
+ *  parameterDiff.cpp
+ *
+ *  Comparison of the settings in a parameter
+ *  file with those of a running Power PMAC.
+ *
+ ********************************************/
+
+/**
+ * @file parameterDiff.cpp
+ * @brief C++ source file for the PowerPMACcontrol_ns::ParameterDiff class.
+ */
+
+#include "parameterDiff.h"
+#include "parameterBackup.h"
+#include "PowerPMACcontrol.h"
+#include <stdlib.h>
+#include <ctype.h>
+#include <math.h>
+
+namespace PowerPMACcontrol_ns
+{
+
+/// State of ParameterDiff::compare shared with diffValues on the I/O thread
+struct DiffContext
+{
+  const ParameterDiff *diff;
+  const std::vector<std::string> *names;      ///< The names of the settings
+  const std::vector<std::string> *expected;   ///< Their expected values
+  const std::vector<size_t> *pending;         ///< The settings read by this pass
+  std::vector<size_t> retry;                  ///< The settings not read because one before them on their line failed
+  ParameterDiffSink sink;
+  void *userData;
+  size_t compared;
+  size_t different;
+};
+
+/**
+ * Compare the values of a packed line with those expected and report the differences.
+ */
+static void diffValues(size_t first, size_t count, const std::vector<std::string>& values, int result, void *userData)
+{
+  DiffContext *context = (DiffContext *)userData;
+  ParameterDifference difference;
+  for (size_t i = 0; i < count; i++)
+  {
+    size_t index = (*context->pending)[first + i];
+    difference.name = (*context->names)[index];
+    difference.expected = (*context->expected)[index];
+    if (i < values.size())
+    {
+      context->compared++;
+      if (context->diff->equal(difference.expected, values[i]))
+      {
+        continue;
+      }
+      difference.actual = values[i];
+      difference.result = PowerPMACcontrol::PPMACcontrolNoError;
+    }
+    else if (i > values.size() && result <= -1 && result >= -99)
+    {
+      // Power PMAC stopped at the setting before, so this one is read again
+      context->retry.push_back(index);
+      continue;
+    }
+    else
+    {
+      difference.actual.clear();
+      difference.result = result;
+    }
+    context->different++;
+    context->sink(difference, context->userData);
+  }
+}
+
+/**
+ * Constructor for the comparison.
+ *
+ * @param absoluteTolerance - The largest difference between equal numbers.
+ * @param relativeTolerance - The largest difference between equal numbers, as a fraction of the larger of them.
+ */
+ParameterDiff::ParameterDiff(double absoluteTolerance, double relativeTolerance)
+{
+  absoluteTolerance_ = absoluteTolerance;
+  relativeTolerance_ = relativeTolerance;
+}
+
+/**
+ * Set the tolerance of the comparison of numbers. Numbers are equal if they are within
+ * either tolerance; with both 0 they must be equal exactly.
+ *
+ * @param absoluteTolerance - The largest difference between equal numbers.
+ * @param relativeTolerance - The largest difference between equal numbers, as a fraction of the larger of them.
+ */
+void ParameterDiff::setTolerance(double absoluteTolerance, double relativeTolerance)
+{
+  absoluteTolerance_ = absoluteTolerance;
+  relativeTolerance_ = relativeTolerance;
+}
+
+/**
+ * Compare the settings of a parameter file with the controller.
+ *
+ * @param ppmac - The connection.
+ * @param filename - The parameter file, as written by ParameterBackup.
+ * @param sink - Called with each setting which differs or cannot be read.
+ * @param userData - Passed to the sink.
+ * @param compared - The number of settings read and compared.
+ * @param different - The number of settings passed to the sink.
+ * @return - PPMACcontrolNoError(0), an error of ParameterBackup::readFile, or the same as
+ * compare(ppmac, names, expected, ...).
+ */
+int ParameterDiff::compare(PowerPMACcontrol& ppmac, const char *filename, ParameterDiffSink sink, void *userData,
+                           size_t& compared, size_t& different) const
+{
+  compared = 0;
+  different = 0;
+  std::vector<std::string> names;
+  std::vector<std::string> expected;
+  int ret = ParameterBackup::readFile(filename, names, expected);
+  if (ret != PowerPMACcontrol::PPMACcontrolNoError)
+  {
+    return ret;
+  }
+  return compare(ppmac, names, expected, sink, userData, compared, different);
+}
+
+/**
+ * Compare settings with the controller.
+ *
+ * The differences are passed to the sink in the order of the names, except that a setting on the
+ * same command as one which does not exist is read again afterwards, and so reported later.
+ *
+ * @param ppmac - The connection.
+ * @param names - The names of the settings, such as "Motor[1].JogSpeed".
+ * @param expected - The expected values, in the order of the names.
+ * @param sink - Called with each setting which differs or cannot be read.
+ * @param userData - Passed to the sink.
+ * @param compared - The number of settings read and compared.
+ * @param different - The number of settings passed to the sink.
+ * @return - PPMACcontrolNoError(0) if all the settings are read, whether or not they differ,
+ * PPMACcontrolInvalidParamError (-242) if there are not as many values as names or sink is NULL,
+ * or the first error of PowerPMACcontrol_getVariables. A setting which Power PMAC rejects is passed
+ * to the sink with its error and the others are still compared; after an SSH driver error
+ * the settings not yet read are not.
+ */
+int ParameterDiff::compare(PowerPMACcontrol& ppmac, const std::vector<std::string>& names,
+                           const std::vector<std::string>& expected, ParameterDiffSink sink, void *userData,
+                           size_t& compared, size_t& different) const
+{
+  compared = 0;
+  different = 0;
+  if (names.size() != expected.size() || sink == NULL)
+  {
+    return PowerPMACcontrol::PPMACcontrolInvalidParamError;
+  }
+  std::vector<size_t> pending(names.size());
+  for (size_t i = 0; i < pending.size(); i++)
+  {
+    pending[i] = i;
+  }
+  DiffContext context;
+  context.diff = this;
+  context.names = &names;
+  context.expected = &expected;
+  context.sink = sink;
+  context.userData = userData;
+  context.compared = 0;
+  context.different = 0;
+  int ret = PowerPMACcontrol::PPMACcontrolNoError;
+  while (!pending.empty())
+  {
+    std::vector<std::string> passNames(pending.size());
+    for (size_t i = 0; i < pending.size(); i++)
+    {
+      passNames[i] = names[pending[i]];
+    }
+    context.pending = &pending;
+    context.retry.clear();
+    int passRet = ppmac.PowerPMACcontrol_getVariables(passNames, diffValues, &context);
+    if (ret == PowerPMACcontrol::PPMACcontrolNoError)
+    {
+      ret = passRet;
+    }
+    if (passRet != PowerPMACcontrol::PPMACcontrolNoError && !(passRet <= -1 && passRet >= -99) &&
+        passRet != PowerPMACcontrol::PPMACcontrolPMACUnexpectedReplyError)
+    {
+      // The connection failed, so the rest cannot be read
+      ret = passRet;
+      break;
+    }
+    // Each pass reports at least the setting which stopped its line, so the retries get fewer
+    pending.swap(context.retry);
+  }
+  compared = context.compared;
+  different = context.different;
+  return ret;
+}
+
+/**
+ * Check if a value read from the controller is the one expected.
+ *
+ * @param expected - The expected value.
+ * @param actual - The value read.
+ * @return - true if both are numbers within the tolerance, or are the same text ignoring case.
+ */
+bool ParameterDiff::equal(const std::string& expected, const std::string& actual) const
+{
+  double expectedValue;
+  double actualValue;
+  if (parseNumber(expected, expectedValue) && parseNumber(actual, actualValue))
+  {
+    double difference = fabs(expectedValue - actualValue);
+    double larger = (fabs(expectedValue) > fabs(actualValue)) ? fabs(expectedValue) : fabs(actualValue);
+    return difference <= absoluteTolerance_ || difference <= relativeTolerance_ * larger;
+  }
+  if (expected.length() != actual.length())
+  {
+    return false;
+  }
+  for (size_t i = 0; i < expected.length(); i++)
+  {
+    if (tolower((unsigned char)expected[i]) != tolower((unsigned char)actual[i]))
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * Read a number, decimal or hexadecimal starting with '$' as Power PMAC writes addresses.
+ *
+ * @param text - The text, which must hold nothing but the number.
+ * @param value - The number.
+ * @return - true if the text is a number.
+ */
+bool ParameterDiff::parseNumber(const std::string& text, double& value)
+{
+  if (text.empty())
+  {
+    return false;
+  }
+  if (text[0] == '$')
+  {
+    if (text.length() == 1)
+    {
+      return false;
+    }
+    value = 0.0;
+    for (size_t i = 1; i < text.length(); i++)
+    {
+      if (!isxdigit((unsigned char)text[i]))
+      {
+        return false;
+      }
+      int digit = isdigit((unsigned char)text[i]) ? text[i] - '0' : tolower((unsigned char)text[i]) - 'a' + 10;
+      value = value * 16.0 + digit;
+    }
+    return true;
+  }
+  if (isspace((unsigned char)text[0]))
+  {
+    return false;
+  }
+  char *end;
+  value = strtod(text.c_str(), &end);
+  return end == text.c_str() + text.length();
+}
+
+}
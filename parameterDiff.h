@@ -0,0 +1,76 @@
+/**
+ * @file parameterDiff.h
+ * @brief Header file for the PowerPMACcontrol_ns::ParameterDiff class
+ *
+ * ParameterDiff compares the settings saved in a parameter file with those of a
+ * running Power PMAC, reporting each difference as soon as its value is read.
+ */
+
+#ifndef PARAMETERDIFF_H
+#define PARAMETERDIFF_H
+
+/* Might need to define WIN32 for MinGW */
+#if defined(_WIN32) && !defined(WIN32)
+#define WIN32
+#endif
+
+#include <string>
+#include <vector>
+#include <stddef.h>
+
+namespace PowerPMACcontrol_ns
+{
+
+class PowerPMACcontrol;
+
+/**
+ * @brief A setting whose value on the controller is not the one expected.
+ */
+struct ParameterDifference
+{
+  std::string name;             ///< The name of the setting, such as "Motor[1].JogSpeed"
+  std::string expected;         ///< The value in the parameter file
+  std::string actual;           ///< The value on the controller, empty if it could not be read
+  int result;                   ///< PPMACcontrolNoError (0), or the error which stopped the setting being read
+};
+
+/**
+ * @brief Receives the differences found by ParameterDiff::compare.
+ *
+ * Called on the I/O thread of the connection as the values are read, so it should not block for long.
+ */
+typedef void (*ParameterDiffSink)(const ParameterDifference& difference, void *userData);
+
+/**
+ * Compares settings with those of a Power PMAC.
+ *
+ * Only the settings named are read, with PowerPMACcontrol_getVariables, many to a command,
+ * and each is compared as soon as its line is answered. Values which are both numbers, decimal
+ * or hexadecimal starting with '$', are equal if they differ by no more than the tolerance;
+ * other values are compared as text, ignoring case.
+ *
+ * A file is read with ParameterBackup::readFile, so a backup file can be compared with the
+ * controller it came from, or with the others of a fleet before they are run.
+ */
+class ParameterDiff
+{
+public:
+  ParameterDiff(double absoluteTolerance = 0.0, double relativeTolerance = 0.0);
+
+  void setTolerance(double absoluteTolerance, double relativeTolerance);
+  int compare(PowerPMACcontrol& ppmac, const char *filename, ParameterDiffSink sink, void *userData,
+              size_t& compared, size_t& different) const;
+  int compare(PowerPMACcontrol& ppmac, const std::vector<std::string>& names, const std::vector<std::string>& expected,
+              ParameterDiffSink sink, void *userData, size_t& compared, size_t& different) const;
+  bool equal(const std::string& expected, const std::string& actual) const;
+
+  static bool parseNumber(const std::string& text, double& value);
+
+private:
+  double absoluteTolerance_;
+  double relativeTolerance_;
+};
+
+}
+
+#endif
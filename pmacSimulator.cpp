@@ -0,0 +1,963 @@
+/********************************************
+ *  pmacSimulator.cpp
+ *
+ *  Emulation of gpascii on a Power PMAC, used
+ *  through a MockTransport to run and load test
+ *  the library without a controller.
+ *
+ ********************************************/
+
+#include "pmacSimulator.h"
+#include "mockTransport.h"
+#include "PowerPMACcontrol.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include <sstream>
+
+using namespace PowerPMACcontrol_ns;
+
+/* Errors replied by gpascii */
+#define SIM_ERROR_ILLEGAL_CMD        20
+#define SIM_ERROR_ILLEGAL_PARAMETER  21
+
+/* Target of a jog without a soft limit */
+#define SIM_NO_LIMIT 1e30
+
+#define SIM_VERSION "2.5.4.0"
+
+/// Default value of an element which has not been written
+typedef struct s_SimDefault
+{
+  const char *name;
+  double value;
+} SimDefault;
+
+static const SimDefault motorDefaults[] = {
+  {"jogspeed", 32.0},
+  {"jogta", 10.0},
+  {"jogts", 0.0},
+  {"homevel", 32.0},
+  {"servoctrl", 1.0},
+};
+
+/* Values chosen so that the task usage calculated by PowerPMACcontrol is realistic */
+static const SimDefault sysDefaults[] = {
+  {"sys.servoperiod", 0.442},
+  {"sys.phaseoverservoperiod", 0.25},
+  {"sys.cputemp", 45.0},
+  {"sys.fltrphasetime", 4.5},
+  {"sys.fltrservotime", 30.0},
+  {"sys.fltrrtinttime", 20.0},
+  {"sys.fltrbgtime", 100.0},
+  {"sys.bgsleeptime", 1000.0},
+  {"sys.phasedeltatime", 110.6},
+  {"sys.servodeltatime", 442.4},
+  {"sys.rtintdeltatime", 442.4},
+  {"sys.bgdeltatime", 1500.0},
+  {"sys.maxmotors", 9.0},
+  {"sys.maxcoords", 9.0},
+};
+
+static PmacSimulator sharedSimulator;
+
+static std::string toLower(const std::string& text)
+{
+  std::string lower(text);
+  for (size_t i = 0; i < lower.size(); i++){
+    lower[i] = (char)tolower((unsigned char)lower[i]);
+  }
+  return lower;
+}
+
+static std::string formatValue(double value)
+{
+  // As few digits as read back as the same double
+  char buff[64];
+  for (int precision = 10; precision <= 17; precision++){
+    sprintf(buff, "%.*g", precision, value);
+    if (strtod(buff, NULL) == value){
+      break;
+    }
+  }
+  return buff;
+}
+
+static std::string formatStatus(uint64_t status)
+{
+  char buff[32];
+  sprintf(buff, "$%08X%08X", (unsigned int)(status >> 32), (unsigned int)(status & 0xFFFFFFFF));
+  return buff;
+}
+
+/**
+ * Parse "name[index].field" where name is given in lower case.
+ *
+ * @return - 0, SIM_ERROR_ILLEGAL_CMD if the text is not of this form,
+ * or SIM_ERROR_ILLEGAL_PARAMETER if the index is out of range.
+ */
+static int parseElement(const std::string& text, const char *name, int max, int& index, std::string& field)
+{
+  size_t length = strlen(name);
+  if (text.compare(0, length, name) != 0 || text.size() <= length || text[length] != '['){
+    return SIM_ERROR_ILLEGAL_CMD;
+  }
+  char *end;
+  long n = strtol(text.c_str() + length + 1, &end, 10);
+  if (end == text.c_str() + length + 1 || *end != ']' || end[1] != '.' || end[2] == '\0'){
+    return SIM_ERROR_ILLEGAL_CMD;
+  }
+  if (n < 0 || n > max){
+    return SIM_ERROR_ILLEGAL_PARAMETER;
+  }
+  index = (int)n;
+  field = end + 2;
+  return 0;
+}
+
+/**
+ * Get the highest number of the variables named by a letter, such as 'p' for P-variables.
+ *
+ * @return - The highest number, or -1 if the letter does not name variables.
+ */
+static long variableMax(char letter)
+{
+  switch (letter){
+  case 'p': return SIM_MAX_PVAR;
+  case 'q': return SIM_MAX_QVAR;
+  case 'm': return SIM_MAX_MVAR;
+  case 'l': return SIM_MAX_LVAR;
+  default:  return -1;
+  }
+}
+
+/**
+ * Parse a range of variables "xfirst..last", such as "p100..199", given in lower case.
+ *
+ * @return - true if the text is a range, whether or not its numbers are valid.
+ */
+static bool parseVariableRange(const std::string& text, long& first, long& last)
+{
+  if (text.size() < 5 || variableMax(text[0]) < 0 || !isdigit((unsigned char)text[1])){
+    return false;
+  }
+  char *end;
+  first = strtol(text.c_str() + 1, &end, 10);
+  if (end[0] != '.' || end[1] != '.' || !isdigit((unsigned char)end[2])){
+    return false;
+  }
+  last = strtol(end + 2, &end, 10);
+  return *end == '\0';
+}
+
+/**
+ * Constructor for the simulator. The controller starts as after a reset.
+ */
+PmacSimulator::PmacSimulator()
+{
+#ifdef WIN32
+  InitializeCriticalSection(&lock_);
+#else
+  pthread_mutex_init(&lock_, NULL);
+#endif
+  reset();
+}
+
+/**
+ * Destructor, cleanup.
+ */
+PmacSimulator::~PmacSimulator()
+{
+#ifdef WIN32
+  DeleteCriticalSection(&lock_);
+#else
+  pthread_mutex_destroy(&lock_);
+#endif
+}
+
+/**
+ * MockResponder which passes each line to the PmacSimulator given as userData.
+ */
+void PmacSimulator::responder(const std::string& line, std::string& reply, void *userData)
+{
+  ((PmacSimulator *)userData)->respond(line, reply);
+}
+
+/**
+ * A MockTransport to the shared simulator with a buffer opened by "open" of its own,
+ * as each gpascii process on the Power PMAC has, so that programs can be downloaded
+ * over several connections at once.
+ */
+class SimTransport : public MockTransport {
+
+  public:
+    SimTransport(PmacSimulator *simulator, double latencySecs)
+      : MockTransport(sessionResponder, this, latencySecs), simulator_(simulator)
+    {
+    }
+
+    /**
+     * Start a new gpascii session, with no buffer open.
+     */
+    virtual SSHDriverStatus connectTransport()
+    {
+      openBuffer_.clear();
+      return MockTransport::connectTransport();
+    }
+
+  private:
+    PmacSimulator *simulator_;
+    std::string openBuffer_;
+
+    static void sessionResponder(const std::string& line, std::string& reply, void *userData)
+    {
+      SimTransport *transport = (SimTransport *)userData;
+      transport->simulator_->respond(line, reply, transport->openBuffer_);
+    }
+};
+
+/**
+ * Get the simulator shared by the "sim://" transports.
+ */
+PmacSimulator *PmacSimulator::getShared()
+{
+  return &sharedSimulator;
+}
+
+/**
+ * Create a MockTransport connected to the shared simulator, with a session of its own.
+ *
+ * @param options - The part of the host name after "sim://": empty, or the reply latency in microseconds.
+ * @return - The new transport, which the caller must delete.
+ */
+Transport *PmacSimulator::createTransport(const char *options)
+{
+  double latencySecs = atof(options) / 1e6;
+  if (latencySecs < 0.0){
+    latencySecs = 0.0;
+  }
+  return new SimTransport(&sharedSimulator, latencySecs);
+}
+
+/**
+ * Return the controller to its state at power on: motors stopped at 0 and
+ * not homed, no program running, P-variables 0. Downloaded buffers are kept.
+ */
+void PmacSimulator::reset()
+{
+  variables_.clear();
+  motors_.clear();
+  coords_.clear();
+  openBuffer_.clear();
+  for (size_t i = 0; i < sizeof(sysDefaults)/sizeof(sysDefaults[0]); i++){
+    variables_[sysDefaults[i].name] = sysDefaults[i].value;
+  }
+  startTime_ = getMonotonicTimeSecs();
+  now_ = startTime_;
+}
+
+void PmacSimulator::lock()
+{
+#ifdef WIN32
+  EnterCriticalSection(&lock_);
+#else
+  pthread_mutex_lock(&lock_);
+#endif
+}
+
+void PmacSimulator::unlock()
+{
+#ifdef WIN32
+  LeaveCriticalSection(&lock_);
+#else
+  pthread_mutex_unlock(&lock_);
+#endif
+}
+
+/**
+ * Reply to a line written to gpascii, in the session of the simulator itself.
+ *
+ * @param line - The line, without the newline.
+ * @param reply - Set to the outputs of the statements, separated by newlines, followed by
+ * the error which stopped the line, if any.
+ */
+void PmacSimulator::respond(const std::string& line, std::string& reply)
+{
+  respond(line, reply, openBuffer_);
+}
+
+/**
+ * Reply to a line written to gpascii in a session.
+ *
+ * @param line - The line, without the newline.
+ * @param reply - Set to the outputs of the statements, separated by newlines, followed by
+ * the error which stopped the line, if any.
+ * @param openBuffer - The buffer opened by "open" in the session, or empty.
+ */
+void PmacSimulator::respond(const std::string& line, std::string& reply, std::string& openBuffer)
+{
+  lock();
+  now_ = getMonotonicTimeSecs();
+  reply.clear();
+
+  std::vector<std::string> tokens;
+  std::istringstream stream(line);
+  std::string token;
+  while (stream >> token){
+    tokens.push_back(token);
+  }
+
+  // Lines between open and close are stored in the buffer, not executed
+  if (!openBuffer.empty()){
+    if (tokens.size() == 1 && toLower(tokens[0]) == "close"){
+      openBuffer.clear();
+    } else {
+      buffers_[openBuffer].push_back(line);
+    }
+    unlock();
+    return;
+  }
+
+  for (size_t i = 0; i < tokens.size(); i++){
+    std::string lower = toLower(tokens[i]);
+    std::string output;
+    int error = 0;
+    if (lower == "enable" || lower == "disable"){
+      int plc = -1;
+      if (i + 2 < tokens.size() && toLower(tokens[i+1]) == "plc"){
+        char *end;
+        long n = strtol(tokens[i+2].c_str(), &end, 10);
+        if (*end == '\0' && end != tokens[i+2].c_str()){
+          plc = (int)n;
+        }
+      }
+      if (plc < 0 || plc > SIM_MAX_PLC){
+        error = SIM_ERROR_ILLEGAL_PARAMETER;
+      } else {
+        char name[64];
+        double value = (lower == "enable") ? 1.0 : 0.0;
+        sprintf(name, "plc[%d].active", plc);
+        variables_[name] = value;
+        sprintf(name, "plc[%d].running", plc);
+        variables_[name] = value;
+        i += 2;
+      }
+    } else if (lower == "open"){
+      if (i + 1 >= tokens.size()){
+        error = SIM_ERROR_ILLEGAL_CMD;
+      } else {
+        // The rest of the line names the buffer, for example "open prog 1" opens prog1
+        std::string name;
+        for (i++; i < tokens.size(); i++){
+          name += toLower(tokens[i]);
+        }
+        if (buffers_.find(name) == buffers_.end()){
+          bufferNames_.push_back(name);
+        }
+        buffers_[name].clear();
+        openBuffer = name;
+      }
+    } else if (lower == "list"){
+      // The rest of the line names the buffer, and the lines stored in it are the output
+      std::string name;
+      for (i++; i < tokens.size(); i++){
+        name += toLower(tokens[i]);
+      }
+      std::map<std::string, std::vector<std::string> >::const_iterator buffer = buffers_.find(name);
+      if (buffer == buffers_.end()){
+        error = SIM_ERROR_ILLEGAL_PARAMETER;
+      } else {
+        for (size_t j = 0; j < buffer->second.size(); j++){
+          if (j > 0){
+            output += "\r\n";
+          }
+          output += buffer->second[j];
+        }
+      }
+    } else {
+      error = statement(tokens[i], output);
+    }
+    if (error != 0){
+      char message[320];
+      sprintf(message, "stdin:1:1: error #%d: %s: %.250s", error,
+              (error == SIM_ERROR_ILLEGAL_CMD) ? "ILLEGAL CMD" : "ILLEGAL PARAMETER", tokens[i < tokens.size() ? i : tokens.size() - 1].c_str());
+      output = message;
+    }
+    if (!output.empty()){
+      if (!reply.empty()){
+        reply += "\r\n";
+      }
+      reply += output;
+    }
+    if (error != 0){
+      break;
+    }
+  }
+  unlock();
+}
+
+/**
+ * Execute one statement.
+ *
+ * @param text - The statement, without spaces.
+ * @param output - Set to the output of the statement, empty if it has none.
+ * @return - 0, or the number of the error replied by gpascii.
+ */
+int PmacSimulator::statement(const std::string& text, std::string& output)
+{
+  std::string lower = toLower(text);
+  if (lower[0] == '#'){
+    return motorCommand(lower, output);
+  }
+  if (lower[0] == '&'){
+    return coordCommand(lower, output);
+  }
+  if (lower == "?"){
+    output = "$00000000";
+    return 0;
+  }
+  if (lower == "vers"){
+    output = SIM_VERSION;
+    return 0;
+  }
+  if (lower == "buffer"){
+    if (bufferNames_.empty()){
+      output = "Buffer is empty";
+    }
+    for (size_t i = 0; i < bufferNames_.size(); i++){
+      char buff[320];
+      sprintf(buff, "%.250s lines:%lu", bufferNames_[i].c_str(), (unsigned long)buffers_[bufferNames_[i]].size());
+      if (!output.empty()){
+        output += "\r\n";
+      }
+      output += buff;
+    }
+    return 0;
+  }
+  if (lower == "$$$***"){
+    bufferNames_.clear();
+    buffers_.clear();
+    reset();
+    return 0;
+  }
+  if (lower == "$$$"){
+    reset();
+    return 0;
+  }
+  if (lower == "save" || lower == "close"){
+    return 0;
+  }
+
+  size_t equals = lower.find('=');
+  long first;
+  long last;
+  if (parseVariableRange(lower.substr(0, equals), first, last)){
+    // Each variable of the range is read, or set to the same value
+    if (first > last || last > variableMax(lower[0])){
+      return SIM_ERROR_ILLEGAL_PARAMETER;
+    }
+    double value = 0.0;
+    if (equals != std::string::npos){
+      int error = evaluate(lower.substr(equals + 1), value);
+      if (error != 0){
+        return error;
+      }
+    }
+    char name[32];
+    for (long n = first; n <= last; n++){
+      sprintf(name, "%c%ld", lower[0], n);
+      if (equals != std::string::npos){
+        variables_[name] = value;
+        continue;
+      }
+      std::map<std::string, double>::iterator it = variables_.find(name);
+      if (n > first){
+        output += "\r\n";
+      }
+      output += formatValue((it != variables_.end()) ? it->second : 0.0);
+    }
+    return 0;
+  }
+  if (equals != std::string::npos){
+    double value;
+    int error = evaluate(lower.substr(equals + 1), value);
+    if (error == 0){
+      error = writeVariable(lower.substr(0, equals), value);
+    }
+    return error;
+  }
+  double value;
+  int error = readVariable(lower, value);
+  if (error == 0){
+    output = formatValue(value);
+  }
+  return error;
+}
+
+/**
+ * Read a variable or a data structure element.
+ *
+ * @param name - The name in lower case.
+ * @param value - Set to the value.
+ * @return - 0, or the number of the error replied by gpascii.
+ */
+int PmacSimulator::readVariable(const std::string& name, double& value)
+{
+  int index;
+  std::string field;
+  if (name.size() > 1 && variableMax(name[0]) >= 0 && isdigit((unsigned char)name[1])){
+    char *end;
+    long n = strtol(name.c_str() + 1, &end, 10);
+    if (*end != '\0'){
+      return SIM_ERROR_ILLEGAL_CMD;
+    }
+    if (n > variableMax(name[0])){
+      return SIM_ERROR_ILLEGAL_PARAMETER;
+    }
+  } else if (name == "sys.time"){
+    value = now_ - startTime_;
+    return 0;
+  } else if (name.compare(0, 4, "sys.") == 0 && name.size() > 4){
+    // Any element of Sys can be read; those not listed in sysDefaults are 0
+  } else if (parseElement(name, "motor", SIM_MAX_MOTOR, index, field) == 0){
+    if (field == "pos" || field == "actpos"){
+      SimMotor& m = motor(index);
+      update(m);
+      value = m.pos;
+      return 0;
+    }
+    std::map<std::string, double>::iterator it = variables_.find(name);
+    if (it != variables_.end()){
+      value = it->second;
+      return 0;
+    }
+    value = 0.0;
+    for (size_t i = 0; i < sizeof(motorDefaults)/sizeof(motorDefaults[0]); i++){
+      if (field == motorDefaults[i].name){
+        value = motorDefaults[i].value;
+      }
+    }
+    return 0;
+  } else if (parseElement(name, "coord", SIM_MAX_COORD, index, field) == 0){
+    if (field == "progactive" || field == "progrunning"){
+      value = coord(index).running ? 1.0 : 0.0;
+      return 0;
+    }
+  } else if (parseElement(name, "plc", SIM_MAX_PLC, index, field) == 0 ||
+             parseElement(name, "enctable", SIM_MAX_ENCTABLE, index, field) == 0 ||
+             parseElement(name, "comptable", SIM_MAX_COMPTABLE, index, field) == 0){
+    // Stored like any other element
+  } else {
+    // Distinguish an index out of range from an unknown name
+    const char *structures[] = {"motor", "coord", "plc", "enctable", "comptable"};
+    const int max[] = {SIM_MAX_MOTOR, SIM_MAX_COORD, SIM_MAX_PLC, SIM_MAX_ENCTABLE, SIM_MAX_COMPTABLE};
+    for (int i = 0; i < 5; i++){
+      if (parseElement(name, structures[i], max[i], index, field) == SIM_ERROR_ILLEGAL_PARAMETER){
+        return SIM_ERROR_ILLEGAL_PARAMETER;
+      }
+    }
+    return SIM_ERROR_ILLEGAL_CMD;
+  }
+  std::map<std::string, double>::iterator it = variables_.find(name);
+  value = (it != variables_.end()) ? it->second : 0.0;
+  return 0;
+}
+
+/**
+ * Write a variable or a data structure element.
+ *
+ * @param name - The name in lower case.
+ * @param value - The new value.
+ * @return - 0, or the number of the error replied by gpascii.
+ */
+int PmacSimulator::writeVariable(const std::string& name, double value)
+{
+  double current;
+  int error = readVariable(name, current);
+  if (error != 0){
+    return error;
+  }
+  if (name == "sys.time"){
+    return SIM_ERROR_ILLEGAL_PARAMETER;
+  }
+  int index;
+  std::string field;
+  if (parseElement(name, "motor", SIM_MAX_MOTOR, index, field) == 0 && (field == "pos" || field == "actpos")){
+    SimMotor& m = motor(index);
+    update(m);
+    m.pos = value;
+    m.moving = false;
+    m.homing = false;
+    return 0;
+  }
+  if (parseElement(name, "coord", SIM_MAX_COORD, index, field) == 0 && (field == "progactive" || field == "progrunning")){
+    return SIM_ERROR_ILLEGAL_PARAMETER;
+  }
+  variables_[name] = value;
+  return 0;
+}
+
+/**
+ * Get the value of a number or of a variable.
+ *
+ * @param text - A number, or the name of a variable in lower case.
+ * @param value - Set to the value.
+ * @return - 0, or the number of the error replied by gpascii.
+ */
+int PmacSimulator::evaluate(const std::string& text, double& value)
+{
+  if (text.empty()){
+    return SIM_ERROR_ILLEGAL_PARAMETER;
+  }
+  char *end;
+  value = strtod(text.c_str(), &end);
+  if (*end == '\0'){
+    return 0;
+  }
+  return (readVariable(text, value) == 0) ? 0 : SIM_ERROR_ILLEGAL_PARAMETER;
+}
+
+/**
+ * Parse the motor or coordinate system numbers after the '#' or '&': "n", "n..m" or "*".
+ *
+ * @param text - The statement.
+ * @param pos - Position after the '#' or '&', set to the position after the numbers.
+ * @param max - Highest number allowed.
+ * @param indexes - Set to the numbers, or empty for "*".
+ * @param all - Set to true for "*".
+ * @return - true, or false if the numbers are not valid.
+ */
+bool PmacSimulator::parseRange(const std::string& text, size_t& pos, int max, std::vector<int>& indexes, bool& all)
+{
+  indexes.clear();
+  all = false;
+  if (pos < text.size() && text[pos] == '*'){
+    all = true;
+    pos++;
+    return true;
+  }
+  char *end;
+  const char *start = text.c_str() + pos;
+  long first = strtol(start, &end, 10);
+  if (end == start || first < 0){
+    return false;
+  }
+  long last = first;
+  if (end[0] == '.' && end[1] == '.'){
+    const char *second = end + 2;
+    last = strtol(second, &end, 10);
+    if (end == second || last < first){
+      return false;
+    }
+  }
+  if (last > max){
+    return false;
+  }
+  for (long n = first; n <= last; n++){
+    indexes.push_back((int)n);
+  }
+  pos = end - text.c_str();
+  return true;
+}
+
+/**
+ * Execute a motor command: #n, #n..m or #* followed by the command.
+ */
+int PmacSimulator::motorCommand(const std::string& text, std::string& output)
+{
+  size_t pos = 1;
+  std::vector<int> indexes;
+  bool all;
+  if (!parseRange(text, pos, SIM_MAX_MOTOR, indexes, all)){
+    return SIM_ERROR_ILLEGAL_PARAMETER;
+  }
+  if (all){
+    for (std::map<int, SimMotor>::iterator it = motors_.begin(); it != motors_.end(); ++it){
+      indexes.push_back(it->first);
+    }
+  }
+  std::string command = text.substr(pos);
+  if (command.empty()){
+    return 0;
+  }
+
+  bool query = (command == "p" || command == "v" || command == "f" || command == "?");
+  if (query && all){
+    return SIM_ERROR_ILLEGAL_CMD;
+  }
+  double value = 0.0;
+  if (command.size() > 2 && command[0] == 'j' && (command[1] == '=' || command[1] == '^')){
+    if (evaluate(command.substr(2), value) != 0){
+      return SIM_ERROR_ILLEGAL_PARAMETER;
+    }
+  } else if (!query && command != "k" && command != "hm" && command != "j/" && command != "j+" && command != "j-"){
+    return SIM_ERROR_ILLEGAL_CMD;
+  }
+
+  for (size_t i = 0; i < indexes.size(); i++){
+    int n = indexes[i];
+    char name[64];
+    if (query){
+      std::string item;
+      SimMotor& m = motor(n);
+      update(m);
+      if (command == "p"){
+        item = formatValue(m.pos);
+      } else if (command == "v"){
+        double velocity = m.moving ? m.velocity / 1000.0 : 0.0;
+        item = formatValue(m.target < m.pos ? -velocity : velocity);
+      } else if (command == "f"){
+        item = "0";
+      } else {
+        item = formatStatus(motorStatus(n));
+      }
+      if (i > 0){
+        output += " ";
+      }
+      output += item;
+    } else if (command == "k"){
+      SimMotor& m = motor(n);
+      update(m);
+      m.moving = false;
+      m.homing = false;
+      m.enabled = false;
+    } else if (command == "j/"){
+      SimMotor& m = motor(n);
+      update(m);
+      m.moving = false;
+      m.homing = false;
+      m.enabled = true;
+    } else {
+      double speed;
+      sprintf(name, "motor[%d].jogspeed", n);
+      readVariable(name, speed);
+      double target;
+      if (command == "j+"){
+        target = SIM_NO_LIMIT;
+      } else if (command == "j-"){
+        target = -SIM_NO_LIMIT;
+      } else if (command == "hm"){
+        sprintf(name, "motor[%d].homevel", n);
+        readVariable(name, speed);
+        target = 0.0;
+      } else if (command[1] == '^'){
+        SimMotor& m = motor(n);
+        update(m);
+        target = m.pos + value;
+      } else {
+        target = value;
+      }
+      startMove(n, target, speed, command == "hm");
+    }
+  }
+  return 0;
+}
+
+/**
+ * Execute a coordinate system command: &n, &n..m or &* followed by the command.
+ */
+int PmacSimulator::coordCommand(const std::string& text, std::string& output)
+{
+  size_t pos = 1;
+  std::vector<int> indexes;
+  bool all;
+  if (!parseRange(text, pos, SIM_MAX_COORD, indexes, all)){
+    return SIM_ERROR_ILLEGAL_PARAMETER;
+  }
+  if (all){
+    for (std::map<int, SimCoord>::iterator it = coords_.begin(); it != coords_.end(); ++it){
+      indexes.push_back(it->first);
+    }
+  }
+  std::string command = text.substr(pos);
+  if (command.empty()){
+    return 0;
+  }
+  if (command == "?"){
+    if (all){
+      return SIM_ERROR_ILLEGAL_CMD;
+    }
+    for (size_t i = 0; i < indexes.size(); i++){
+      if (i > 0){
+        output += " ";
+      }
+      output += formatStatus(coordStatus(indexes[i]));
+    }
+    return 0;
+  }
+  if (command == "a" || command == "q"){
+    for (size_t i = 0; i < indexes.size(); i++){
+      coord(indexes[i]).running = false;
+    }
+    return 0;
+  }
+
+  // bN selects a program and may be followed by r
+  int program = -1;
+  if (command[0] == 'b'){
+    char *end;
+    long n = strtol(command.c_str() + 1, &end, 10);
+    if (end == command.c_str() + 1){
+      return SIM_ERROR_ILLEGAL_PARAMETER;
+    }
+    char name[64];
+    sprintf(name, "prog%ld", n);
+    if (buffers_.find(name) == buffers_.end()){
+      return SIM_ERROR_ILLEGAL_PARAMETER;
+    }
+    program = (int)n;
+    command = end;
+  }
+  if (!command.empty() && command != "r"){
+    return SIM_ERROR_ILLEGAL_CMD;
+  }
+  for (size_t i = 0; i < indexes.size(); i++){
+    SimCoord& c = coord(indexes[i]);
+    if (program >= 0){
+      c.program = program;
+    }
+    if (command == "r"){
+      c.running = true;
+    }
+  }
+  return 0;
+}
+
+PmacSimulator::SimMotor& PmacSimulator::motor(int n)
+{
+  std::map<int, SimMotor>::iterator it = motors_.find(n);
+  if (it == motors_.end()){
+    SimMotor m;
+    m.pos = 0.0;
+    m.time = now_;
+    m.velocity = 0.0;
+    m.target = 0.0;
+    m.moving = false;
+    m.enabled = true;
+    m.homing = false;
+    m.homeComplete = false;
+    m.limit = 0;
+    m.targetLimit = 0;
+    it = motors_.insert(std::make_pair(n, m)).first;
+  }
+  return it->second;
+}
+
+PmacSimulator::SimCoord& PmacSimulator::coord(int n)
+{
+  std::map<int, SimCoord>::iterator it = coords_.find(n);
+  if (it == coords_.end()){
+    SimCoord c;
+    c.program = 0;
+    c.running = false;
+    it = coords_.insert(std::make_pair(n, c)).first;
+  }
+  return it->second;
+}
+
+/**
+ * Move the motor to its position at the current time.
+ */
+void PmacSimulator::update(SimMotor& m)
+{
+  if (m.moving){
+    double step = m.velocity * (now_ - m.time);
+    double remaining = m.target - m.pos;
+    if (fabs(remaining) <= step){
+      m.pos = m.target;
+      m.moving = false;
+      m.limit = m.targetLimit;
+      if (m.homing){
+        m.homing = false;
+        m.homeComplete = true;
+      }
+    } else {
+      m.pos += (remaining > 0) ? step : -step;
+    }
+  }
+  m.time = now_;
+}
+
+/**
+ * Start a move of motor n, which stops at the soft limits.
+ *
+ * @param n - Motor number.
+ * @param target - End of the move.
+ * @param unitsPerMs - Speed, as Motor[n].JogSpeed. The move is immediate if not positive.
+ * @param homing - true for a homing move, which sets the home complete bit at the end.
+ */
+void PmacSimulator::startMove(int n, double target, double unitsPerMs, bool homing)
+{
+  char name[64];
+  double maxpos, minpos;
+  sprintf(name, "motor[%d].maxpos", n);
+  readVariable(name, maxpos);
+  sprintf(name, "motor[%d].minpos", n);
+  readVariable(name, minpos);
+
+  SimMotor& m = motor(n);
+  update(m);
+  m.targetLimit = 0;
+  if (maxpos > minpos){
+    if (target >= maxpos){
+      target = maxpos;
+      m.targetLimit = 1;
+    } else if (target <= minpos){
+      target = minpos;
+      m.targetLimit = -1;
+    }
+  }
+  m.limit = 0;
+  m.target = target;
+  m.velocity = fabs(unitsPerMs) * 1000.0;
+  m.enabled = true;
+  m.homing = homing;
+  if (homing){
+    m.homeComplete = false;
+  }
+  m.moving = true;
+  if (m.velocity <= 0.0){
+    m.pos = target;
+  }
+  update(m);
+}
+
+uint64_t PmacSimulator::motorStatus(int n)
+{
+  SimMotor& m = motor(n);
+  update(m);
+  uint64_t status = 0;
+  if (m.homing){
+    status |= SIM_MOTOR_HOME_IN_PROGRESS;
+  }
+  if (m.limit < 0){
+    status |= SIM_MOTOR_SOFT_MINUS_LIMIT;
+  }
+  if (m.limit > 0){
+    status |= SIM_MOTOR_SOFT_PLUS_LIMIT;
+  }
+  if (m.homeComplete){
+    status |= SIM_MOTOR_HOME_COMPLETE;
+  }
+  if (!m.moving){
+    status |= SIM_MOTOR_DES_VEL_ZERO;
+  }
+  if (m.enabled){
+    status |= SIM_MOTOR_CLOSED_LOOP | SIM_MOTOR_AMP_ENA;
+    if (!m.moving){
+      status |= SIM_MOTOR_IN_POS;
+    }
+  }
+  return status;
+}
+
+uint64_t PmacSimulator::coordStatus(int n)
+{
+  uint64_t status = 0;
+  if (coord(n).running){
+    status |= SIM_COORD_PROG_ACTIVE | SIM_COORD_PROG_RUNNING;
+  }
+  return status;
+}
@@ -0,0 +1,136 @@
+/* Might need to define WIN32 for MinGW */
+#if defined(_WIN32) && !defined(WIN32)
+#define WIN32
+#endif
+
+#ifndef pmacSimulator_H
+#define pmacSimulator_H
+
+#ifdef WIN32
+# include <winsock2.h>
+#else
+# include <pthread.h>
+#endif
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <vector>
+
+class Transport;
+
+/* Highest index of each data structure accepted by the simulator */
+#define SIM_MAX_MOTOR   255
+#define SIM_MAX_COORD   127
+#define SIM_MAX_PLC     31
+#define SIM_MAX_ENCTABLE 767
+#define SIM_MAX_COMPTABLE 255
+#define SIM_MAX_PVAR    65535
+#define SIM_MAX_QVAR    8191
+#define SIM_MAX_MVAR    16383
+#define SIM_MAX_LVAR    8191
+
+/* Bits of the motor status (#n?) set by the simulator. The first word is in the upper 32 bits */
+#define SIM_MOTOR_HOME_IN_PROGRESS  ((uint64_t)1 << 62)
+#define SIM_MOTOR_SOFT_MINUS_LIMIT  ((uint64_t)1 << 55)
+#define SIM_MOTOR_SOFT_PLUS_LIMIT   ((uint64_t)1 << 54)
+#define SIM_MOTOR_HOME_COMPLETE     ((uint64_t)1 << 47)
+#define SIM_MOTOR_DES_VEL_ZERO      ((uint64_t)1 << 46)
+#define SIM_MOTOR_CLOSED_LOOP       ((uint64_t)1 << 45)
+#define SIM_MOTOR_AMP_ENA           ((uint64_t)1 << 44)
+#define SIM_MOTOR_IN_POS            ((uint64_t)1 << 43)
+
+/* Bits of the coordinate system status (&n?) set by the simulator */
+#define SIM_COORD_PROG_ACTIVE       ((uint64_t)1 << 31)
+#define SIM_COORD_PROG_RUNNING      ((uint64_t)1 << 30)
+
+/**
+ * The PmacSimulator class emulates the replies of gpascii -2 on a Power PMAC, so the
+ * library can be run and load tested on any machine. It is plugged into a MockTransport
+ * as its responder, which provides the echo, the ACK after each reply and the latency.
+ *
+ * It understands:
+ *      - Motor[n].*, Coord[n].*, Plc[n].*, EncTable[n].*, CompTable[n].*, Sys.* and P-, Q-, M- and L-variables,
+ *        read and written. A range of variables, such as P100..199, is read one value per line, or set to one value.
+ *        Any element of Motor[], Coord[], Plc[], EncTable[] and CompTable[] can be written; Motor[n].Pos, Sys.Time,
+ *        Coord[n].ProgActive and Coord[n].ProgRunning follow the simulated state.
+ *      - #n, #n..m and #* followed by p, v, f, ?, k, hm, j/, j+, j-, j=pos and j^dist.
+ *        The motors move at Motor[n].JogSpeed (units per ms) and stop at Motor[n].MaxPos and
+ *        Motor[n].MinPos when MaxPos is greater than MinPos.
+ *      - &n, &n..m and &* followed by ?, bN, r, q and a.
+ *      - ?, vers, buffer, enable plc n, disable plc n, open ... close, list ..., $$$ and save.
+ *      .
+ * Several statements separated by spaces can be sent on one line; their replies are
+ * separated by a newline, as gpascii does. Anything else is rejected with an error.
+ *
+ * All the transports created by Transport::create for "sim://" share one simulator, so
+ * the main connection, the safety channel and several PowerPMACcontrol objects see the
+ * same controller. Each transport is a session with its own open buffer, as each gpascii
+ * process is. The replies are made under a lock.
+ */
+class PmacSimulator {
+
+  public:
+    PmacSimulator();
+    void respond(const std::string& line, std::string& reply);
+    void respond(const std::string& line, std::string& reply, std::string& openBuffer);
+    void reset();
+    virtual ~PmacSimulator();
+
+    static void responder(const std::string& line, std::string& reply, void *userData);
+    static PmacSimulator *getShared();
+    static Transport *createTransport(const char *options);
+
+  private:
+    typedef struct s_SimMotor
+    {
+      double pos;         /* Position at time */
+      double time;        /* Time of the last update */
+      double velocity;    /* Speed of the move in units per second */
+      double target;      /* End of the move */
+      bool moving;
+      bool enabled;       /* Closed loop */
+      bool homing;
+      bool homeComplete;
+      int limit;          /* -1 or 1 if the move stopped at a soft limit */
+      int targetLimit;    /* Soft limit at the end of the move in progress, 0 if none */
+    } SimMotor;
+
+    typedef struct s_SimCoord
+    {
+      int program;        /* Program of the last 'b' command */
+      bool running;
+    } SimCoord;
+
+    std::map<std::string, double> variables_;
+    std::map<int, SimMotor> motors_;
+    std::map<int, SimCoord> coords_;
+    std::vector<std::string> bufferNames_;
+    std::map<std::string, std::vector<std::string> > buffers_;
+    std::string openBuffer_;
+    double startTime_;
+    double now_;
+
+#ifdef WIN32
+    CRITICAL_SECTION lock_;
+#else
+    pthread_mutex_t lock_;
+#endif
+
+    void lock();
+    void unlock();
+    int statement(const std::string& text, std::string& output);
+    int readVariable(const std::string& name, double& value);
+    int writeVariable(const std::string& name, double value);
+    int evaluate(const std::string& text, double& value);
+    int motorCommand(const std::string& text, std::string& output);
+    int coordCommand(const std::string& text, std::string& output);
+    SimMotor& motor(int n);
+    SimCoord& coord(int n);
+    void update(SimMotor& m);
+    void startMove(int n, double target, double unitsPerMs, bool homing);
+    uint64_t motorStatus(int n);
+    uint64_t coordStatus(int n);
+    bool parseRange(const std::string& text, size_t& pos, int max, std::vector<int>& indexes, bool& all);
+};
+
+#endif
@@ -0,0 +1,100 @@
+/*
+ * @file powerPMACDiff.cpp
+ *
+ * Compare a parameter file, such as one written by ParameterBackup, with a Power PMAC and print
+ * each setting which differs as soon as it is read:
+ *
+ *   powerPMACDiff -ip <host> -file <parameter file> [-abstol <tolerance>] [-reltol <tolerance>]
+ *
+ * Numbers are equal if they differ by no more than either tolerance, 0 by default. As diff does,
+ * the exit status is 0 if the settings are the same, 1 if some differ and 2 if there was an error.
+ */
+
+#include "PowerPMACcontrol.h"
+#include "parameterDiff.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include "argParser.h"
+
+using namespace PowerPMACcontrol_ns;
+
+/// Print a setting which differs, or cannot be read
+static void printDifference(const ParameterDifference& difference, void *userData)
+{
+	if (difference.result == PowerPMACcontrol::PPMACcontrolNoError)
+	{
+		printf("%s: file %s, controller %s\n", difference.name.c_str(), difference.expected.c_str(),
+			   difference.actual.c_str());
+	}
+	else
+	{
+		printf("%s: file %s, error %d reading the controller\n", difference.name.c_str(), difference.expected.c_str(),
+			   difference.result);
+	}
+	fflush(stdout);
+}
+
+int main(int argc, char *argv[])
+{
+	// Get connection parameters from the command line arguments
+	// Default values are defined in argParser.h
+	argParser args(argc, argv);
+
+	std::string u_ipaddr 	= args.getIp();
+	std::string u_user 		= args.getUser();
+	std::string u_passw		= args.getPassw();
+	std::string u_port		= args.getPort();
+	bool 		u_nominus2	= args.getNominus2();
+
+	std::string filename;
+	double abstol = 0.0;
+	double reltol = 0.0;
+	for (int i = 1; i + 1 < argc; i++)
+	{
+		if (strcmp(argv[i], "-file") == 0)
+		{
+			filename = argv[i+1];
+		}
+		else if (strcmp(argv[i], "-abstol") == 0)
+		{
+			abstol = atof(argv[i+1]);
+		}
+		else if (strcmp(argv[i], "-reltol") == 0)
+		{
+			reltol = atof(argv[i+1]);
+		}
+	}
+	if (filename.empty())
+	{
+		printf("Usage: %s [-ip host] [-user user] [-passw password] [-port port] [-nominus2]\n"
+			   "       -file <parameter file> [-abstol tolerance] [-reltol tolerance]\n", argv[0]);
+		return 2;
+	}
+
+	PowerPMACcontrol ppmaccomm;
+	int ret = ppmaccomm.PowerPMACcontrol_connect(u_ipaddr.c_str(), u_user.c_str(), u_passw.c_str(), u_port.c_str(), u_nominus2);
+	if (ret != PowerPMACcontrol::PPMACcontrolNoError)
+	{
+		printf("Error %d connecting to Power PMAC at %s\n", ret, u_ipaddr.c_str());
+		return 2;
+	}
+
+	ParameterDiff diff(abstol, reltol);
+	size_t compared;
+	size_t different;
+	double start = getMonotonicTimeSecs();
+	ret = diff.compare(ppmaccomm, filename.c_str(), printDifference, NULL, compared, different);
+	double elapsed = getMonotonicTimeSecs() - start;
+	ppmaccomm.PowerPMACcontrol_disconnect();
+
+	printf("%s: %lu settings compared in %.3f s, %lu different\n", u_ipaddr.c_str(), (unsigned long)compared, elapsed,
+		   (unsigned long)different);
+	if (ret != PowerPMACcontrol::PPMACcontrolNoError && !(ret <= -1 && ret >= -99))
+	{
+		printf("Error %d comparing %s\n", ret, filename.c_str());
+		return 2;
+	}
+	return (different > 0) ? 1 : 0;
+}
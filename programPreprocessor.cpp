@@ -0,0 +1,341 @@
+/********************************************
+ *  programPreprocessor.cpp
+ *
+ *  Removal of comments and whitespace from
+ *  programs, joining of short lines and
+ *  checks of their structure before download.
+ *
+ ********************************************/
+
+/**
+ * @file programPreprocessor.cpp
+ * @brief C++ source file for the PowerPMACcontrol_ns::ProgramPreprocessor class.
+ */
+
+#include "programPreprocessor.h"
+#include "PowerPMACcontrol.h"
+#include <string.h>
+#include <ctype.h>
+
+namespace PowerPMACcontrol_ns
+{
+
+/// First words of the lines which are never joined to others: control statements, move modes
+/// and move parameters, which apply to the moves after them, and dwells and delays
+static const char *const unmergedWords[] = {
+  "open", "close", "if", "else", "while", "do", "switch", "case", "default", "for", "break",
+  "continue", "goto", "gosub", "callsub", "call", "sub", "return", "stop", "halt", "frax",
+  "linear", "lin", "rapid", "rpd", "circle", "pvt", "spline", "abs", "inc", "normal", "cc",
+  "ccmode", "tsel", "tm", "ta", "ts", "td", "f", "pset", "home", "homez", "jog", "dwell", "delay",
+  "pause", "wait"
+};
+
+/// Letters of the axes of a coordinate system, which start a move when alone
+static const char axisLetters[] = "abcuvwxyz";
+
+/**
+ * Constructor for the preprocessor.
+ *
+ * @param options - The steps to take, PreprocessOption values combined with '|'.
+ * @param maxLineLength - The longest line made by joining lines.
+ */
+ProgramPreprocessor::ProgramPreprocessor(int options, size_t maxLineLength)
+{
+  options_ = options;
+  maxLineLength_ = maxLineLength;
+}
+
+/**
+ * Preprocess a program.
+ *
+ * @param program - The program, as it would be in a file.
+ * @param length - The number of characters in the program.
+ * @param output - The program after preprocessing, each line ended by a newline.
+ * @param lineNumbers - The number in the program, from 1, of the first line making up each line of the output.
+ * @param errorLine - The number of the line found wrong by PreprocessCheckStructure, or 0.
+ * @return - PPMACcontrolNoError(0), or PPMACcontrolProgramSyntaxError (-250) if PreprocessCheckStructure
+ * finds unbalanced brackets or quotes, an 'open' inside an open buffer or a 'close' outside one.
+ */
+int ProgramPreprocessor::process(const char *program, size_t length, std::string& output, std::vector<int>& lineNumbers,
+                                 int& errorLine) const
+{
+  output.clear();
+  lineNumbers.clear();
+  errorLine = 0;
+
+  bool blockComment = false;
+  bool open = false;
+  int braces = 0;
+  int openLine = 0;
+  bool pendingMergeable = false;  // The last line of the output may be joined to
+  std::string line;
+  std::string code;
+  const char *start = program;
+  const char *end = program + length;
+  int lineNumber = 0;
+  while (start < end)
+  {
+    const char *newline = (const char *)memchr(start, '\n', end - start);
+    size_t lineLength = (newline == NULL) ? end - start : newline - start;
+    lineNumber++;
+    line.assign(start, lineLength);
+    start += lineLength + 1;
+    if (!line.empty() && line[line.length()-1] == '\r')
+    {
+      line.erase(line.length()-1);
+    }
+
+    // The code of the line, without comments, whether or not they are sent
+    code.clear();
+    bool hasComment = blockComment;
+    bool quoted = false;
+    for (size_t i = 0; i < line.length(); i++)
+    {
+      char c = line[i];
+      if (blockComment)
+      {
+        if (c == '*' && i + 1 < line.length() && line[i+1] == '/')
+        {
+          blockComment = false;
+          i++;
+        }
+      }
+      else if (quoted)
+      {
+        code += c;
+        quoted = (c != '"');
+      }
+      else if (c == '/' && i + 1 < line.length() && line[i+1] == '/')
+      {
+        hasComment = true;
+        break;
+      }
+      else if (c == '/' && i + 1 < line.length() && line[i+1] == '*')
+      {
+        hasComment = true;
+        blockComment = true;
+        code += ' ';
+        i++;
+      }
+      else
+      {
+        code += c;
+        quoted = (c == '"');
+      }
+    }
+
+    if (options_ & PreprocessCheckStructure)
+    {
+      bool wasOpen = open;
+      if (quoted || !checkLine(code, open, braces))
+      {
+        errorLine = lineNumber;
+        return PowerPMACcontrol::PPMACcontrolProgramSyntaxError;
+      }
+      if (open && !wasOpen)
+      {
+        openLine = lineNumber;
+      }
+    }
+
+    std::string text = (options_ & PreprocessStripComments) ? code : line;
+    if (options_ & PreprocessStripWhitespace)
+    {
+      // Squeeze the spaces outside strings and trim the ends
+      std::string squeezed;
+      bool inString = false;
+      for (size_t i = 0; i < text.length(); i++)
+      {
+        char c = text[i];
+        if (!inString && (c == ' ' || c == '\t'))
+        {
+          if (!squeezed.empty() && squeezed[squeezed.length()-1] != ' ')
+          {
+            squeezed += ' ';
+          }
+          continue;
+        }
+        if (c == '"')
+        {
+          inString = !inString;
+        }
+        squeezed += c;
+      }
+      if (!squeezed.empty() && squeezed[squeezed.length()-1] == ' ')
+      {
+        squeezed.erase(squeezed.length()-1);
+      }
+      text.swap(squeezed);
+    }
+    if (text.empty())
+    {
+      continue;
+    }
+
+    bool mergeable = (options_ & PreprocessMergeLines) && !(hasComment && !(options_ & PreprocessStripComments)) &&
+                     isMergeable(text);
+    if (mergeable && pendingMergeable)
+    {
+      // Join to the last line of the output, replacing its newline by a space
+      size_t lastStart = output.rfind('\n', output.length() - 2);
+      lastStart = (lastStart == std::string::npos) ? 0 : lastStart + 1;
+      if (output.length() - 1 - lastStart + 1 + text.length() <= maxLineLength_)
+      {
+        output[output.length()-1] = ' ';
+        output += text;
+        output += '\n';
+        continue;
+      }
+    }
+    output += text;
+    output += '\n';
+    lineNumbers.push_back(lineNumber);
+    pendingMergeable = mergeable;
+  }
+
+  if ((options_ & PreprocessCheckStructure) && (blockComment || braces != 0))
+  {
+    // An unterminated comment or block, reported where its buffer was opened
+    errorLine = (openLine > 0) ? openLine : lineNumber;
+    return PowerPMACcontrol::PPMACcontrolProgramSyntaxError;
+  }
+  return PowerPMACcontrol::PPMACcontrolNoError;
+}
+
+/**
+ * Check if a line, without comments and with squeezed spaces, can be joined to the lines around it.
+ *
+ * Only a plain assignment, name=expression or name op= expression without spaces, is joined, as
+ * running assignments in turn on one line does the same as on separate lines. Moves are not: axis
+ * moves on one line are made together as one move.
+ */
+bool ProgramPreprocessor::isMergeable(const std::string& line)
+{
+  if (line.find_first_of(" {}:\";#") != std::string::npos)
+  {
+    return false;
+  }
+  size_t wordEnd = 0;
+  while (wordEnd < line.length() && isalpha((unsigned char)line[wordEnd]))
+  {
+    wordEnd++;
+  }
+  std::string word = line.substr(0, wordEnd);
+  for (size_t i = 0; i < word.length(); i++)
+  {
+    word[i] = (char)tolower((unsigned char)word[i]);
+  }
+  if (word.empty() || (word.length() == 1 && strchr(axisLetters, word[0]) != NULL))
+  {
+    return false;
+  }
+  for (size_t i = 0; i < sizeof(unmergedWords) / sizeof(unmergedWords[0]); i++)
+  {
+    if (word == unmergedWords[i])
+    {
+      return false;
+    }
+  }
+  // The name, such as P100, Motor[1].JogSpeed or Coord[P1].Tm, then = or an operator and =
+  size_t nameEnd = line.find_first_not_of("ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789_.[]");
+  if (nameEnd == std::string::npos)
+  {
+    return false;
+  }
+  size_t equals = nameEnd;
+  if (line[equals] != '=' && strchr("+-*/%&|^", line[equals]) != NULL)
+  {
+    equals++;
+  }
+  return equals < line.length() && line[equals] == '=' && equals + 1 < line.length() && line[equals+1] != '=';
+}
+
+/**
+ * Check the brackets and quotes of a line and follow the open buffer.
+ *
+ * @param code - The line without comments.
+ * @param open - true while a buffer is open, updated by 'open' and 'close'.
+ * @param braces - The depth of braces in the open buffer, updated.
+ * @return - false if the line is wrong.
+ */
+bool ProgramPreprocessor::checkLine(const std::string& code, bool& open, int& braces)
+{
+  size_t first = code.find_first_not_of(" \t");
+  if (first == std::string::npos)
+  {
+    return true;
+  }
+  size_t wordEnd = first;
+  while (wordEnd < code.length() && isalpha((unsigned char)code[wordEnd]))
+  {
+    wordEnd++;
+  }
+  std::string word = code.substr(first, wordEnd - first);
+  for (size_t i = 0; i < word.length(); i++)
+  {
+    word[i] = (char)tolower((unsigned char)word[i]);
+  }
+  bool alone = (code.find_first_not_of(" \t", wordEnd) == std::string::npos);
+  if (word == "open" && !alone)
+  {
+    if (open)
+    {
+      return false;
+    }
+    open = true;
+    braces = 0;
+    return true;
+  }
+  if (word == "close" && alone)
+  {
+    if (!open || braces != 0)
+    {
+      return false;
+    }
+    open = false;
+    return true;
+  }
+
+  // Parentheses and square brackets close on the same line, braces within the buffer
+  std::string stack;
+  bool quoted = false;
+  for (size_t i = 0; i < code.length(); i++)
+  {
+    char c = code[i];
+    if (c == '"')
+    {
+      quoted = !quoted;
+    }
+    else if (quoted)
+    {
+      continue;
+    }
+    else if (c == '(' || c == '[')
+    {
+      stack += c;
+    }
+    else if (c == ')' || c == ']')
+    {
+      if (stack.empty() || stack[stack.length()-1] != ((c == ')') ? '(' : '['))
+      {
+        return false;
+      }
+      stack.erase(stack.length()-1);
+    }
+    else if (c == '{' || c == '}')
+    {
+      if (!stack.empty())
+      {
+        return false;
+      }
+      braces += (c == '{') ? 1 : -1;
+      if (braces < 0)
+      {
+        return false;
+      }
+    }
+  }
+  return stack.empty() && !quoted;
+}
+
+}
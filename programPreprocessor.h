@@ -0,0 +1,72 @@
+/**
+ * @file programPreprocessor.h
+ * @brief Header file for the PowerPMACcontrol_ns::ProgramPreprocessor class
+ *
+ * ProgramPreprocessor shrinks a program before it is downloaded, so that fewer
+ * lines, and so fewer round trips, and fewer bytes are sent to the Power PMAC.
+ */
+
+#ifndef PROGRAMPREPROCESSOR_H
+#define PROGRAMPREPROCESSOR_H
+
+/* Might need to define WIN32 for MinGW */
+#if defined(_WIN32) && !defined(WIN32)
+#define WIN32
+#endif
+
+#include <string>
+#include <vector>
+#include <stddef.h>
+
+namespace PowerPMACcontrol_ns
+{
+
+/**
+ * Steps of the preprocessing of a program, combined with '|'.
+ */
+enum PreprocessOption
+{
+  PreprocessNone = 0,                   ///< Send the program as it is
+  PreprocessStripComments = 1,          ///< Remove // and / * * / comments
+  PreprocessStripWhitespace = 2,        ///< Remove indentation and trailing spaces and squeeze runs of spaces; drop blank lines
+  PreprocessMergeLines = 4,             ///< Join lines of plain assignments, separated by a space, up to the line length
+  PreprocessCheckStructure = 8,         ///< Check brackets, quotes and open/close before sending anything
+  PreprocessAll = 15                    ///< All of the above
+};
+
+/**
+ * Rewrites a program as fewer, shorter lines with the same meaning.
+ *
+ * Lines are only joined when each is a plain assignment, such as P1=P2+1 or Motor[1].JogSpeed=10,
+ * without spaces: moves are kept on lines of their own, as axis moves on one line are made together,
+ * as are move modes, move parameters such as tm, dwells and delays, which take effect in order with
+ * the moves. So are lines which start with open, close, a control statement (if, else, while,
+ * switch, case, goto, call, return, ...) or a preprocessor directive, or contain braces, a label,
+ * a string or a comment.
+ * gpascii runs the statements of a line in turn and stops at the first error, as it does
+ * for separate lines, but the error is then reported for the whole joined line.
+ */
+class ProgramPreprocessor
+{
+public:
+  ProgramPreprocessor(int options = PreprocessAll, size_t maxLineLength = DEFAULT_MAX_LINE_LENGTH);
+
+  int process(const char *program, size_t length, std::string& output, std::vector<int>& lineNumbers,
+              int& errorLine) const;
+
+  /// Longest line made by joining lines, unless another is given. It is well short of the command buffer of
+  /// gpascii (GPASCII_COMMAND_BUFFER_LENGTH) because an error is reported for the whole joined line, so a
+  /// shorter line points closer to the statement which failed
+  static const size_t DEFAULT_MAX_LINE_LENGTH = 255;
+
+private:
+  int options_;
+  size_t maxLineLength_;
+
+  static bool isMergeable(const std::string& line);
+  static bool checkLine(const std::string& code, bool& open, int& braces);
+};
+
+}
+
+#endif
@@ -0,0 +1,750 @@
+/********************************************
+ *  projectDeployer.cpp
+ *
+ *  Download of the files of a project in
+ *  the order of their dependencies, over
+ *  several connections at once.
+ *
+ ********************************************/
+
+/**
+ * @file projectDeployer.cpp
+ * @brief C++ source file for the PowerPMACcontrol_ns::ProjectDeployer class.
+ */
+
+#include "projectDeployer.h"
+#include "PowerPMACcontrol.h"
+#include "atomicOps.h"
+#include <stdio.h>
+#include <ctype.h>
+#include <fstream>
+#include <sstream>
+#ifndef WIN32
+#include <errno.h>
+#endif
+
+namespace PowerPMACcontrol_ns
+{
+
+/**
+ * States of a deployment worker, changed with atomic operations by the worker and the deployer
+ */
+enum DeployWorkerState
+{
+  DeployWorkerBusy = 0,         ///< Connecting or downloading a file
+  DeployWorkerFinished = 1,     ///< Done, waiting for the deployer to take the result
+  DeployWorkerIdle = 2          ///< Waiting for a file
+};
+
+/**
+ * A connection of a deployment and the thread which downloads files over it.
+ *
+ * The deployer hands a file to an idle worker by setting file and posting the work semaphore.
+ * The worker downloads it, sets the result, marks itself finished and posts the done semaphore
+ * shared by all the workers.
+ */
+struct DeployWorker
+{
+  const char *host;
+  const char *user;
+  const char *pwd;
+  const char *port;
+  bool nominus2;
+  int downloadWindow;
+  double startTime;             ///< Start of the deployment, for the times of the results
+
+  PowerPMACcontrol *ppmac;
+  int connectResult;
+  volatile long state;          ///< One of the DeployWorkerState values
+  bool stop;
+  size_t file;
+  std::string path;
+  int result;
+  int errorLine;
+  double fileStart;
+  double fileSeconds;
+  bool started;
+
+#ifdef WIN32
+  HANDLE ghWork;
+  HANDLE ghDone;
+  HANDLE ghThread;
+#else
+  sem_t sem_work;
+  bool semWorkCreated;          ///< sem_work is destroyed whether or not the thread started
+  sem_t *sem_done;
+  pthread_t threadId;
+#endif
+};
+
+#ifdef WIN32
+static DWORD WINAPI deployThread(LPVOID arg);
+#else
+static void *deployThread(void *arg);
+#endif
+
+/**
+ * Connect, then download each file handed to the worker until told to stop.
+ */
+static void runDeployWorker(DeployWorker *worker)
+{
+  worker->connectResult = worker->ppmac->PowerPMACcontrol_connect(worker->host, worker->user, worker->pwd,
+                                                                  worker->port, worker->nominus2);
+  if (worker->connectResult == PowerPMACcontrol::PPMACcontrolNoError && worker->downloadWindow > 1)
+  {
+    worker->ppmac->PowerPMACcontrol_setDownloadWindow(worker->downloadWindow);
+  }
+  while (true)
+  {
+    atomicCompareAndSwapLong(&worker->state, DeployWorkerBusy, DeployWorkerFinished);
+#ifdef WIN32
+    ReleaseSemaphore(worker->ghDone, 1, NULL);
+    WaitForSingleObject(worker->ghWork, INFINITE);
+#else
+    sem_post(worker->sem_done);
+    while (sem_wait(&worker->sem_work) != 0 && errno == EINTR)
+    {
+    }
+#endif
+    if (worker->stop)
+    {
+      break;
+    }
+    worker->errorLine = 0;
+    double start = getMonotonicTimeSecs();
+    worker->result = worker->ppmac->PowerPMACcontrol_progDownload(worker->path, worker->errorLine);
+    worker->fileStart = start - worker->startTime;
+    worker->fileSeconds = getMonotonicTimeSecs() - start;
+  }
+  worker->ppmac->PowerPMACcontrol_disconnect();
+}
+
+#ifdef WIN32
+static DWORD WINAPI deployThread(LPVOID arg)
+{
+  runDeployWorker((DeployWorker *)arg);
+  return 0;
+}
+#else
+static void *deployThread(void *arg)
+{
+  runDeployWorker((DeployWorker *)arg);
+  return NULL;
+}
+#endif
+
+/**
+ * Constructor for the deployer, with no files.
+ */
+ProjectDeployer::ProjectDeployer()
+{
+  resolved_ = false;
+  downloadWindow_ = 1;
+}
+
+/**
+ * Add the files listed in a manifest.
+ *
+ * @param filename - Name of the manifest. The paths in it are relative to its directory.
+ * @return - PPMACcontrolNoError(0), PPMACcontrolFileOpenError (-234) if the manifest cannot be opened,
+ * PPMACcontrolFileReadError (-235) if it cannot be read, or PPMACcontrolManifestError (-248) if a
+ * file is listed twice.
+ */
+int ProjectDeployer::readManifest(const char *filename)
+{
+  std::ifstream manifest(filename);
+  if (!manifest.is_open())
+  {
+    return PowerPMACcontrol::PPMACcontrolFileOpenError;
+  }
+  std::string directory(filename);
+  size_t slash = directory.find_last_of("/\\");
+  directory = (slash == std::string::npos) ? "" : directory.substr(0, slash + 1);
+
+  std::string line;
+  while (getline(manifest, line))
+  {
+    size_t comment = line.find('#');
+    if (comment != std::string::npos)
+    {
+      line.erase(comment);
+    }
+    size_t colon = line.find(':');
+    std::istringstream paths(line.substr(0, colon));
+    std::string path;
+    if (!(paths >> path))
+    {
+      continue;
+    }
+    std::vector<std::string> after;
+    if (colon != std::string::npos)
+    {
+      std::istringstream names(line.substr(colon + 1));
+      std::string name;
+      while (names >> name)
+      {
+        after.push_back(directory + name);
+      }
+    }
+    int ret = addFile(directory + path, after);
+    if (ret != PowerPMACcontrol::PPMACcontrolNoError)
+    {
+      return ret;
+    }
+  }
+  return manifest.bad() ? PowerPMACcontrol::PPMACcontrolFileReadError : PowerPMACcontrol::PPMACcontrolNoError;
+}
+
+/**
+ * Add a file to the project.
+ *
+ * @param path - Path of the file.
+ * @param after - Paths of the files which must be downloaded before it. They may be added later.
+ * @return - PPMACcontrolNoError(0), or PPMACcontrolManifestError (-248) if the file was already added.
+ */
+int ProjectDeployer::addFile(const std::string& path, const std::vector<std::string>& after)
+{
+  if (index_.find(path) != index_.end())
+  {
+    return PowerPMACcontrol::PPMACcontrolManifestError;
+  }
+  ProjectFile file;
+  file.path = path;
+  file.after = after;
+  index_[path] = files_.size();
+  files_.push_back(file);
+  resolved_ = false;
+  return PowerPMACcontrol::PPMACcontrolNoError;
+}
+
+/**
+ * Find the dependencies of the files, given and declared, and an order which keeps them.
+ * Called by deploy if it has not been called since the last file was added.
+ *
+ * @param order - The paths of the files in the order of a download over one connection.
+ * Files which do not depend on each other keep the order in which they were added.
+ * @return - PPMACcontrolNoError(0), PPMACcontrolFileOpenError (-234) if a file cannot be opened,
+ * or PPMACcontrolManifestError (-248) if a file follows a file which is not in the project
+ * or the dependencies form a cycle.
+ */
+int ProjectDeployer::resolve(std::vector<std::string>& order)
+{
+  static const char *functionName = "ProjectDeployer::resolve";
+  order.clear();
+  order_.clear();
+  resolved_ = false;
+
+  std::vector<std::set<std::string> > used(files_.size());
+  std::map<std::string, size_t> declarations;
+  for (size_t i = 0; i < files_.size(); i++)
+  {
+    ProjectFile& file = files_[i];
+    file.dependencies.clear();
+    for (size_t j = 0; j < file.after.size(); j++)
+    {
+      std::map<std::string, size_t>::const_iterator it = index_.find(file.after[j]);
+      if (it == index_.end() || it->second == i)
+      {
+        debugPrint_ppmaccomm("%s : %s follows %s, which is not in the project\n", functionName,
+                             file.path.c_str(), file.after[j].c_str());
+        return PowerPMACcontrol::PPMACcontrolManifestError;
+      }
+      file.dependencies.insert(it->second);
+    }
+
+    std::ifstream stream(file.path.c_str());
+    if (!stream.is_open())
+    {
+      debugPrint_ppmaccomm("%s : unable to open the file %s\n", functionName, file.path.c_str());
+      return PowerPMACcontrol::PPMACcontrolFileOpenError;
+    }
+    std::ostringstream text;
+    text << stream.rdbuf();
+    std::set<std::string> declared;
+    scanNames(text.str(), declared, used[i]);
+    // A name declared twice belongs to the first file, where the controller first sees it
+    for (std::set<std::string>::const_iterator it = declared.begin(); it != declared.end(); ++it)
+    {
+      declarations.insert(std::make_pair(*it, i));
+    }
+  }
+  for (size_t i = 0; i < files_.size(); i++)
+  {
+    for (std::set<std::string>::const_iterator it = used[i].begin(); it != used[i].end(); ++it)
+    {
+      std::map<std::string, size_t>::const_iterator declaration = declarations.find(*it);
+      if (declaration != declarations.end() && declaration->second != i)
+      {
+        files_[i].dependencies.insert(declaration->second);
+      }
+    }
+  }
+
+  // Take the first file, in the order added, whose dependencies are all taken
+  std::vector<bool> taken(files_.size(), false);
+  while (order_.size() < files_.size())
+  {
+    size_t next = files_.size();
+    for (size_t i = 0; i < files_.size() && next == files_.size(); i++)
+    {
+      if (taken[i])
+      {
+        continue;
+      }
+      bool ready = true;
+      for (std::set<size_t>::const_iterator it = files_[i].dependencies.begin(); it != files_[i].dependencies.end() && ready; ++it)
+      {
+        ready = taken[*it];
+      }
+      if (ready)
+      {
+        next = i;
+      }
+    }
+    if (next == files_.size())
+    {
+      debugPrint_ppmaccomm("%s : The dependencies of the files form a cycle\n", functionName);
+      order_.clear();
+      return PowerPMACcontrol::PPMACcontrolManifestError;
+    }
+    taken[next] = true;
+    order_.push_back(next);
+    order.push_back(files_[next].path);
+  }
+  resolved_ = true;
+  return PowerPMACcontrol::PPMACcontrolNoError;
+}
+
+/**
+ * Get the files which a file follows, as found by resolve.
+ *
+ * @param path - Path of the file, as added.
+ * @param dependencies - The paths of the files it follows, empty if it is not in the project.
+ */
+void ProjectDeployer::getDependencies(const std::string& path, std::vector<std::string>& dependencies) const
+{
+  dependencies.clear();
+  std::map<std::string, size_t>::const_iterator it = index_.find(path);
+  if (it == index_.end())
+  {
+    return;
+  }
+  const std::set<size_t>& indexes = files_[it->second].dependencies;
+  for (std::set<size_t>::const_iterator i = indexes.begin(); i != indexes.end(); ++i)
+  {
+    dependencies.push_back(files_[*i].path);
+  }
+}
+
+/**
+ * Set the number of program lines kept in flight on each connection, as PowerPMACcontrol_setDownloadWindow.
+ *
+ * @param lines - 1 to wait for the reply to each line, the default, up to 256.
+ */
+void ProjectDeployer::setDownloadWindow(int lines)
+{
+  downloadWindow_ = lines;
+}
+
+/**
+ * Find the names declared and used by a program file.
+ *
+ * A name is declared by global, csglobal and ptr statements, by \#define and by opening a
+ * subprogram, PLC or program with a name rather than a number. Every other name in the file
+ * counts as used. Comments are left out. Names are returned in lower case, as Power PMAC
+ * does not tell cases apart.
+ *
+ * @param text - The program file.
+ * @param declared - The names declared are added to it.
+ * @param used - The names used are added to it.
+ */
+void ProjectDeployer::scanNames(const std::string& text, std::set<std::string>& declared, std::set<std::string>& used)
+{
+  bool blockComment = false;
+  std::vector<std::string> tokens;
+  size_t lineStart = 0;
+  while (lineStart < text.length())
+  {
+    size_t lineEnd = text.find('\n', lineStart);
+    if (lineEnd == std::string::npos)
+    {
+      lineEnd = text.length();
+    }
+    // Split the line into names, numbers and single characters
+    tokens.clear();
+    size_t i = lineStart;
+    while (i < lineEnd)
+    {
+      char c = text[i];
+      if (blockComment)
+      {
+        if (c == '*' && i + 1 < lineEnd && text[i+1] == '/')
+        {
+          blockComment = false;
+          i++;
+        }
+        i++;
+      }
+      else if (c == '/' && i + 1 < lineEnd && text[i+1] == '/')
+      {
+        break;
+      }
+      else if (c == '/' && i + 1 < lineEnd && text[i+1] == '*')
+      {
+        blockComment = true;
+        i += 2;
+      }
+      else if (c == '"')
+      {
+        size_t quote = text.find('"', i + 1);
+        i = (quote == std::string::npos || quote > lineEnd) ? lineEnd : quote + 1;
+      }
+      else if (isalnum((unsigned char)c) || c == '_')
+      {
+        size_t start = i;
+        while (i < lineEnd && (isalnum((unsigned char)text[i]) || text[i] == '_'))
+        {
+          i++;
+        }
+        std::string token = text.substr(start, i - start);
+        for (size_t j = 0; j < token.length(); j++)
+        {
+          token[j] = (char)tolower((unsigned char)token[j]);
+        }
+        tokens.push_back(token);
+      }
+      else
+      {
+        if (!isspace((unsigned char)c))
+        {
+          tokens.push_back(std::string(1, c));
+        }
+        i++;
+      }
+    }
+    lineStart = lineEnd + 1;
+    if (tokens.empty())
+    {
+      continue;
+    }
+
+    std::set<size_t> declarations;
+    if (tokens[0] == "global" || tokens[0] == "csglobal" || tokens[0] == "ptr")
+    {
+      // The first name and each name after a comma outside brackets
+      int depth = 0;
+      bool expectName = true;
+      for (size_t j = 1; j < tokens.size(); j++)
+      {
+        const std::string& token = tokens[j];
+        if (token == "(" || token == "[")
+          depth++;
+        else if ((token == ")" || token == "]") && depth > 0)
+          depth--;
+        else if (token == "," && depth == 0)
+          expectName = true;
+        else if (token == ";")
+          break;
+        else if (expectName && isalpha((unsigned char)token[0]))
+        {
+          declarations.insert(j);
+          expectName = false;
+        }
+        else
+          expectName = false;
+      }
+    }
+    else if (tokens.size() >= 3 && tokens[0] == "#" && tokens[1] == "define")
+    {
+      declarations.insert(2);
+    }
+    else if (tokens.size() >= 3 && tokens[0] == "open" && isalpha((unsigned char)tokens[2][0]))
+    {
+      declarations.insert(2);
+    }
+    for (size_t j = 0; j < tokens.size(); j++)
+    {
+      if (declarations.count(j) > 0)
+        declared.insert(tokens[j]);
+      else if (isalpha((unsigned char)tokens[j][0]) || tokens[j][0] == '_')
+        used.insert(tokens[j]);
+    }
+  }
+}
+
+/**
+ * Download the files of the project, each after the files it depends on, over several connections.
+ *
+ * Each connection is a PowerPMACcontrol of its own, connected by a thread of its own. A file is
+ * handed to an idle connection as soon as the files it depends on have been downloaded, in the
+ * order found by resolve. The connections are closed before returning.
+ *
+ * @param host - Host name or IP address of the Power PMAC, as for PowerPMACcontrol_connect
+ * @param user - User name
+ * @param pwd - Password
+ * @param port - Port number
+ * @param nominus2 - As for PowerPMACcontrol_connect
+ * @param channels - The number of connections, 1 to MAX_CHANNELS. No more are opened than there are files.
+ * @param results - The outcome of each file, in the order the files were added.
+ * @return - PPMACcontrolNoError(0) if every file was downloaded. If not, the error of the first file
+ * which failed in the download order, the error of resolve, PPMACcontrolInvalidParamError (-242)
+ * if channels is out of range, or the error of PowerPMACcontrol_connect if no connection could be made.
+ */
+int ProjectDeployer::deploy(const char *host, const char *user, const char *pwd, const char *port, bool nominus2,
+                            int channels, std::vector<DeployFileResult>& results)
+{
+  static const char *functionName = "ProjectDeployer::deploy";
+  results.clear();
+  if (channels < 1 || channels > MAX_CHANNELS)
+  {
+    return PowerPMACcontrol::PPMACcontrolInvalidParamError;
+  }
+  if (!resolved_)
+  {
+    std::vector<std::string> order;
+    int ret = resolve(order);
+    if (ret != PowerPMACcontrol::PPMACcontrolNoError)
+    {
+      return ret;
+    }
+  }
+  results.resize(files_.size());
+  for (size_t i = 0; i < files_.size(); i++)
+  {
+    results[i].path = files_[i].path;
+    results[i].result = PowerPMACcontrol::PPMACcontrolDependencyError;
+    results[i].errorLine = 0;
+    results[i].channel = -1;
+    results[i].startSecs = 0.0;
+    results[i].seconds = 0.0;
+  }
+  if (files_.empty())
+  {
+    return PowerPMACcontrol::PPMACcontrolNoError;
+  }
+  if ((size_t)channels > files_.size())
+  {
+    channels = (int)files_.size();
+  }
+
+  // Start the workers, each of which connects and then reports itself finished
+  std::vector<DeployWorker> workers(channels);
+#ifdef WIN32
+  HANDLE ghDone = CreateSemaphore(NULL, 0, LONG_MAX, NULL);
+  if (ghDone == NULL)
+  {
+    return PowerPMACcontrol::PPMACcontrolSemaphoreError;
+  }
+#else
+  sem_t sem_done;
+  if (sem_init(&sem_done, 0, 0) != 0)
+  {
+    return PowerPMACcontrol::PPMACcontrolSemaphoreError;
+  }
+#endif
+  int started = 0;
+  for (int i = 0; i < channels; i++)
+  {
+    DeployWorker& worker = workers[i];
+    worker.host = host;
+    worker.user = user;
+    worker.pwd = pwd;
+    worker.port = port;
+    worker.nominus2 = nominus2;
+    worker.downloadWindow = downloadWindow_;
+    worker.startTime = 0.0;
+    worker.ppmac = new PowerPMACcontrol();
+    worker.connectResult = PowerPMACcontrol::PPMACcontrolNoError;
+    worker.state = DeployWorkerBusy;
+    worker.stop = false;
+    worker.file = 0;
+    worker.result = PowerPMACcontrol::PPMACcontrolNoError;
+#ifdef WIN32
+    worker.ghDone = ghDone;
+    worker.ghWork = CreateSemaphore(NULL, 0, LONG_MAX, NULL);
+    worker.ghThread = (worker.ghWork == NULL) ? NULL : CreateThread(NULL, 0, deployThread, &worker, 0, NULL);
+    worker.started = (worker.ghThread != NULL);
+#else
+    worker.sem_done = &sem_done;
+    worker.semWorkCreated = (sem_init(&worker.sem_work, 0, 0) == 0);
+    worker.started = (worker.semWorkCreated &&
+                      pthread_create(&worker.threadId, NULL, deployThread, &worker) == 0);
+#endif
+    if (worker.started)
+    {
+      started++;
+    }
+  }
+  for (int i = 0; i < started; i++)
+  {
+#ifdef WIN32
+    WaitForSingleObject(ghDone, INFINITE);
+#else
+    while (sem_wait(&sem_done) != 0 && errno == EINTR)
+    {
+    }
+#endif
+  }
+
+  int ret = PowerPMACcontrol::PPMACcontrolSemaphoreError;
+  std::vector<DeployWorker *> idle;
+  for (int i = 0; i < channels; i++)
+  {
+    if (!workers[i].started)
+    {
+      continue;
+    }
+    // The worker has finished connecting, whether or not it could
+    atomicCompareAndSwapLong(&workers[i].state, DeployWorkerFinished, DeployWorkerIdle);
+    if (workers[i].connectResult == PowerPMACcontrol::PPMACcontrolNoError)
+    {
+      idle.push_back(&workers[i]);
+    }
+    else
+    {
+      debugPrint_ppmaccomm("%s : Connection %d failed with %d\n", functionName, i, workers[i].connectResult);
+      ret = workers[i].connectResult;
+    }
+  }
+
+  if (!idle.empty())
+  {
+    double startTime = getMonotonicTimeSecs();
+    for (int i = 0; i < channels; i++)
+    {
+      workers[i].startTime = startTime;
+    }
+    // 0: waiting, 1: downloading, 2: done, 3: failed or not downloaded
+    std::vector<int> states(files_.size(), 0);
+    size_t remaining = files_.size();
+    int running = 0;
+    while (remaining > 0)
+    {
+      // Hand the files whose dependencies are done to the idle workers, in the resolved order
+      for (size_t k = 0; k < order_.size() && !idle.empty(); k++)
+      {
+        size_t i = order_[k];
+        if (states[i] != 0)
+        {
+          continue;
+        }
+        bool ready = true;
+        bool failed = false;
+        for (std::set<size_t>::const_iterator it = files_[i].dependencies.begin(); it != files_[i].dependencies.end(); ++it)
+        {
+          ready = ready && (states[*it] == 2);
+          failed = failed || (states[*it] == 3);
+        }
+        if (failed)
+        {
+          // Its dependents are skipped in turn, as they come later in the order
+          states[i] = 3;
+          remaining--;
+          continue;
+        }
+        if (!ready)
+        {
+          continue;
+        }
+        DeployWorker *worker = idle.back();
+        idle.pop_back();
+        worker->file = i;
+        worker->path = files_[i].path;
+        worker->state = DeployWorkerBusy;
+        states[i] = 1;
+        running++;
+        results[i].channel = (int)(worker - &workers[0]);
+#ifdef WIN32
+        ReleaseSemaphore(worker->ghWork, 1, NULL);
+#else
+        sem_post(&worker->sem_work);
+#endif
+      }
+      if (running == 0)
+      {
+        // Every file left depends on a file which failed
+        for (size_t i = 0; i < files_.size(); i++)
+        {
+          if (states[i] == 0)
+          {
+            states[i] = 3;
+            remaining--;
+          }
+        }
+        break;
+      }
+
+#ifdef WIN32
+      WaitForSingleObject(ghDone, INFINITE);
+#else
+      while (sem_wait(&sem_done) != 0 && errno == EINTR)
+      {
+      }
+#endif
+      for (int w = 0; w < channels; w++)
+      {
+        DeployWorker& worker = workers[w];
+        if (!atomicCompareAndSwapLong(&worker.state, DeployWorkerFinished, DeployWorkerIdle))
+        {
+          continue;
+        }
+        DeployFileResult& result = results[worker.file];
+        result.result = worker.result;
+        result.errorLine = worker.errorLine;
+        result.startSecs = worker.fileStart;
+        result.seconds = worker.fileSeconds;
+        states[worker.file] = (worker.result == PowerPMACcontrol::PPMACcontrolNoError) ? 2 : 3;
+        debugPrint_ppmaccomm("%s : %s downloaded on connection %d in %f s with %d\n", functionName,
+                             worker.path.c_str(), w, worker.fileSeconds, worker.result);
+        remaining--;
+        running--;
+        idle.push_back(&worker);
+      }
+    }
+
+    ret = PowerPMACcontrol::PPMACcontrolNoError;
+    for (size_t k = 0; k < order_.size(); k++)
+    {
+      int result = results[order_[k]].result;
+      if (result != PowerPMACcontrol::PPMACcontrolNoError && result != PowerPMACcontrol::PPMACcontrolDependencyError)
+      {
+        ret = result;
+        break;
+      }
+    }
+  }
+
+  // Stop the workers, which disconnect
+  for (int i = 0; i < channels; i++)
+  {
+    DeployWorker& worker = workers[i];
+    if (worker.started)
+    {
+      worker.stop = true;
+#ifdef WIN32
+      ReleaseSemaphore(worker.ghWork, 1, NULL);
+      WaitForSingleObject(worker.ghThread, INFINITE);
+      CloseHandle(worker.ghThread);
+#else
+      sem_post(&worker.sem_work);
+      pthread_join(worker.threadId, NULL);
+#endif
+    }
+#ifdef WIN32
+    if (worker.ghWork != NULL)
+      CloseHandle(worker.ghWork);
+#else
+    if (worker.semWorkCreated)
+      sem_destroy(&worker.sem_work);
+#endif
+    delete worker.ppmac;
+  }
+#ifdef WIN32
+  CloseHandle(ghDone);
+#else
+  sem_destroy(&sem_done);
+#endif
+  return ret;
+}
+
+}
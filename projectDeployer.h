@@ -0,0 +1,94 @@
+/**
+ * @file projectDeployer.h
+ * @brief Header file for the PowerPMACcontrol_ns::ProjectDeployer class
+ *
+ * ProjectDeployer downloads the files of a project, given in a manifest, in the
+ * order of their dependencies and over several connections at once.
+ */
+
+#ifndef PROJECTDEPLOYER_H
+#define PROJECTDEPLOYER_H
+
+/* Might need to define WIN32 for MinGW */
+#if defined(_WIN32) && !defined(WIN32)
+#define WIN32
+#endif
+
+#include <string>
+#include <vector>
+#include <set>
+#include <map>
+
+namespace PowerPMACcontrol_ns
+{
+
+/**
+ * The outcome of the download of one file of a project.
+ */
+struct DeployFileResult
+{
+  std::string path;       ///< Path of the file
+  int result;             ///< Value returned by PowerPMACcontrol_progDownload, or PPMACcontrolDependencyError (-249)
+  int errorLine;          ///< The number of the line which failed, or 0
+  int channel;            ///< Index of the connection which downloaded the file, or -1 if it was not downloaded
+  double startSecs;       ///< Start of the download, in seconds from the start of the deployment
+  double seconds;         ///< Time taken by the download
+};
+
+/**
+ * Downloads the program files of a project to one Power PMAC.
+ *
+ * The files and the files each one must follow are listed in a manifest, one file per line:
+ * @code
+ * # Global definitions first
+ * globals.pmh
+ * kinematics.pmc : globals.pmh
+ * plc/startup.plc
+ * @endcode
+ * Paths are relative to the directory of the manifest. Text after '#' is a comment, and the
+ * names after ':' are files of the manifest which must be downloaded first.
+ *
+ * Further dependencies are found in the files themselves: a file which uses a name declared by
+ * another file, with global, csglobal, ptr or \#define, or a subprogram or PLC opened by name,
+ * follows that file. Files which do not depend on each other are downloaded at the same time,
+ * each over a connection of its own, so a project takes about the time of its longest chain of
+ * dependent files rather than the sum of all of them.
+ *
+ * A file is not downloaded if a file it depends on fails.
+ */
+class ProjectDeployer
+{
+public:
+  ProjectDeployer();
+
+  int readManifest(const char *filename);
+  int addFile(const std::string& path, const std::vector<std::string>& after);
+  int resolve(std::vector<std::string>& order);
+  void getDependencies(const std::string& path, std::vector<std::string>& dependencies) const;
+  void setDownloadWindow(int lines);
+  int deploy(const char *host, const char *user, const char *pwd, const char *port, bool nominus2,
+             int channels, std::vector<DeployFileResult>& results);
+
+  static void scanNames(const std::string& text, std::set<std::string>& declared, std::set<std::string>& used);
+
+  static const int MAX_CHANNELS = 16;   ///< Highest number of connections of a deployment
+
+private:
+  /// A file of the manifest
+  struct ProjectFile
+  {
+    std::string path;
+    std::vector<std::string> after;     ///< Dependencies given in the manifest
+    std::set<size_t> dependencies;      ///< Indexes of the files it follows, given and found
+  };
+
+  std::vector<ProjectFile> files_;
+  std::map<std::string, size_t> index_;
+  std::vector<size_t> order_;           ///< Indexes of the files in an order which keeps the dependencies
+  bool resolved_;
+  int downloadWindow_;
+};
+
+}
+
+#endif
@@ -0,0 +1,165 @@
+/********************************************
+ *  protocolHelpers.cpp
+ *
+ *  Parsing of the replies of the Power PMAC:
+ *  splitting, error numbers and status words.
+ *
+ ********************************************/
+
+/**
+ * @file protocolHelpers.cpp
+ * @brief C++ source file for the helpers which parse the replies of the Power PMAC.
+ */
+
+#include "protocolHelpers.h"
+#include <sstream>
+#include <stdio.h>
+
+namespace PowerPMACcontrol_ns
+{
+
+/**
+ * @brief Checks if a string has a "error #". 
+ * 
+ * This function can be used to check a reply string from the Power PMAC if it reports any error. 
+ * 
+ * @param s - The string to be checked.
+ * @return Error number found in the string. If no error is found in the string, 0.
+ */
+int check_PowerPMAC_error(const std::string s){
+  static const char *functionName = "check_PowerPMAC_error";
+
+
+  std::string error_str("error #");
+  size_t index = s.find(error_str);
+  if (index == std::string::npos)
+  {
+    debugPrint_ppmaccomm("%s : No error\n", functionName);
+    return 0;       //No error
+  }
+
+  //get error number
+  std::string s2 = s.substr(index + error_str.length());
+  size_t index2 = s2.find(":");      //get index of ':'
+
+  if (index2 == std::string::npos)
+  {
+    debugPrint_ppmaccomm("%s : No error (couldn't find ':').\n", functionName);
+    return 0;       //No error
+  }
+
+  std::string numstring = s2.substr(0, index2);
+  debugPrint_ppmaccomm("%s : numstring is %s\n", functionName, numstring.c_str());
+
+  int error_number;
+
+  std::istringstream(numstring) >> error_number;
+
+  return error_number;
+
+}
+
+/**
+ * @brief Split a string by a specified separator. 
+ * 
+ * The split strings are set in the strings parameter. 
+ * 
+ * @param s - The string to be split.
+ * @param separator - Separator to be used to split the string
+ * @param strings - String items after the input string s is split
+ * @return If successful, PPMACcontrolNoError(0), if not, PPMACcontrolSplitterError(-237).
+ */
+int splitit(std::string s, std::string separator, std::vector<std::string> &strings){
+  static const char *functionName = "splitit";
+  if (strings.size() > 0)
+    strings.clear();
+
+  if (s.length() < 1)
+    return PowerPMACcontrol::PPMACcontrolNoError;
+
+  size_t start_index;
+  size_t end_index;
+
+  start_index = s.find_first_not_of(separator);
+  end_index = s.find_first_of(separator, start_index);
+  debugPrint_ppmaccomm("%s : start_index = %d\n", functionName, start_index);
+  debugPrint_ppmaccomm("%s : end_index = %d\n", functionName, end_index);
+  try{
+  while(start_index != std::string::npos)
+  {
+    if (end_index != std::string::npos)
+    {
+      debugPrint_ppmaccomm("%s : item (%s) found\n", functionName, s.substr(start_index, end_index-start_index).c_str());
+      strings.push_back(s.substr(start_index, end_index-start_index));
+    }
+    else
+    {
+      strings.push_back(s.substr(start_index, std::string::npos));
+      debugPrint_ppmaccomm("%s : item (%s) found\n", functionName, s.substr(start_index, end_index-start_index).c_str());
+      break;
+    }
+    start_index = s.find_first_not_of(separator, end_index);
+    end_index = s.find_first_of(separator, start_index);
+
+  }
+  }
+  catch(...)
+  {
+    strings.clear();
+    return PowerPMACcontrol::PPMACcontrolSplitterError;
+  }
+  return PowerPMACcontrol::PPMACcontrolNoError;
+}
+
+/**
+ * @brief Decode a 32 bit status word as replied to the "?" command.
+ *
+ * @param word - The status word, "$" followed by 8 hexadecimal digits.
+ * @param status - The decoded status
+ * @return If successful, PPMACcontrolNoError(0), if not, PPMACcontrolPMACUnexpectedReplyError(-231).
+ */
+int decodeStatus32(const std::string& word, uint32_t& status){
+  if (word.length() != 9)
+  {
+    return PowerPMACcontrol::PPMACcontrolPMACUnexpectedReplyError;
+  }
+  char cstatus[16] = "";
+  word.copy(cstatus, 8, 1);
+  if (sscanf(cstatus, "%8x", &status) != 1 )
+    return PowerPMACcontrol::PPMACcontrolPMACUnexpectedReplyError;
+  return PowerPMACcontrol::PPMACcontrolNoError;
+}
+
+/**
+ * @brief Decode a 64 bit status word as replied to the "#n?" and "&n?" commands.
+ *
+ * @param word - The status word, "$" followed by 16 hexadecimal digits.
+ * @param status - The decoded status
+ * @return If successful, PPMACcontrolNoError(0), if not, PPMACcontrolPMACUnexpectedReplyError(-231).
+ */
+int decodeStatus64(const std::string& word, uint64_t& status){
+  if (word.length() != 17)
+  {
+    return PowerPMACcontrol::PPMACcontrolPMACUnexpectedReplyError;
+  }
+  char cstatus_h[16] = "";
+  char cstatus_l[16] = "";
+
+  word.copy(cstatus_h, 8, 1);
+  word.copy(cstatus_l, 8, 9);
+
+  uint32_t h;
+  uint32_t l;
+
+  if (sscanf(cstatus_h, "%8x", &h) != 1 )
+    return PowerPMACcontrol::PPMACcontrolPMACUnexpectedReplyError;
+
+  if (sscanf(cstatus_l, "%8x", &l) != 1 )
+    return PowerPMACcontrol::PPMACcontrolPMACUnexpectedReplyError;
+
+  status = (((uint64_t)h)<<32) | ((uint64_t)l);
+
+  return PowerPMACcontrol::PPMACcontrolNoError;
+}
+
+}
@@ -0,0 +1,27 @@
+/**
+ * @file protocolHelpers.h
+ * @brief Helpers which parse the replies of the Power PMAC
+ *
+ * These are used by PowerPMACcontrol on every reply, and timed on their own by
+ * test/protocol_bench_test.cpp. They are not part of the PowerPMACcontrol interface.
+ * trim_right_copy stays in PowerPMACcontrol.h, where applications have always been able to call it.
+ */
+
+#ifndef PROTOCOLHELPERS_H
+#define PROTOCOLHELPERS_H
+
+#include <string>
+#include <vector>
+#include "PowerPMACcontrol.h"
+
+namespace PowerPMACcontrol_ns
+{
+
+int splitit(std::string s, std::string separator, std::vector<std::string> &strings);
+int check_PowerPMAC_error(const std::string s);
+int decodeStatus32(const std::string& word, uint32_t& status);
+int decodeStatus64(const std::string& word, uint64_t& status);
+
+}
+
+#endif
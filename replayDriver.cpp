@@ -0,0 +1,232 @@
+/********************************************
+ *  replayDriver.cpp
+ *
+ *  Plays back a session log recorded by the
+ *  SessionRecorder in place of an SSH
+ *  connection.
+ *
+ ********************************************/
+
+#include "replayDriver.h"
+#include "sessionRecorder.h"
+#include <string.h>
+
+/**
+ * Constructor for the replay driver.
+ *
+ * @param filename - Session log written by the SessionRecorder.
+ * @param speed - 1.0 to return the received bytes with their original timing,
+ * 2.0 for twice as fast and so on, or 0 to return them as fast as possible.
+ */
+ReplayDriver::ReplayDriver(const char *filename, double speed)
+{
+  strncpy(filename_, filename, 255);
+  filename_[255] = '\0';
+  speed_ = speed;
+  next_ = 0;
+  consumed_ = 0;
+  lastTime_ = 0.0;
+  mismatches_ = 0;
+}
+
+/**
+ * Load the session log and read the welcome lines from it,
+ * as SSHDriver does from the shell.
+ *
+ * @return - Success(SSHDriverSuccess), or SSHDriverError if the log could not be read.
+ */
+SSHDriverStatus ReplayDriver::connectTransport()
+{
+  if (!load()){
+    return SSHDriverError;
+  }
+  next_ = 0;
+  consumed_ = 0;
+  mismatches_ = 0;
+  lastTime_ = currentTimeSecs();
+  connected_ = 1;
+  readWelcome();
+  return SSHDriverSuccess;
+}
+
+/**
+ * Stop the replay.
+ *
+ * @return - Success.
+ */
+SSHDriverStatus ReplayDriver::disconnectTransport()
+{
+  connected_ = 0;
+  return SSHDriverSuccess;
+}
+
+/**
+ * Get the number of writes which did not match the bytes recorded as sent.
+ */
+unsigned long ReplayDriver::getMismatches() const
+{
+  return mismatches_;
+}
+
+/**
+ * Check whether every record of the log has been played back.
+ */
+bool ReplayDriver::isFinished() const
+{
+  return next_ >= records_.size();
+}
+
+/**
+ * Destructor, cleanup.
+ */
+ReplayDriver::~ReplayDriver()
+{
+}
+
+/**
+ * Take the next record sent from the log. Received records which were not read are skipped.
+ *
+ * @param buffer - The bytes to write.
+ * @param bufferSize - The number of bytes to write.
+ * @return - bufferSize, or -1 if there are no more records sent in the log.
+ */
+ssize_t ReplayDriver::channelWrite(const char *buffer, size_t bufferSize)
+{
+  while (next_ < records_.size() && records_[next_].type != SessionRecordSent){
+    next_++;
+  }
+  consumed_ = 0;
+  if (next_ >= records_.size()){
+    return -1;
+  }
+  const ReplayRecord& record = records_[next_];
+  if (record.length != bufferSize || memcmp(&data_[record.offset], buffer, bufferSize) != 0){
+    mismatches_++;
+  }
+  next_++;
+  // The replies are timed from the write
+  lastTime_ = currentTimeSecs();
+  return (ssize_t)bufferSize;
+}
+
+/**
+ * Return the bytes of the next record received, once it is due.
+ *
+ * @param buffer - A buffer to hold the bytes.
+ * @param bufferSize - The maximum number of bytes to read.
+ * @return - The number of bytes read, or 0 if the next record is not due or is not a received record.
+ */
+ssize_t ReplayDriver::channelRead(char *buffer, size_t bufferSize)
+{
+  if (next_ >= records_.size() || records_[next_].type != SessionRecordReceived){
+    return 0;
+  }
+  const ReplayRecord& record = records_[next_];
+  if (consumed_ == 0){
+    double now = currentTimeSecs();
+    if (speed_ > 0.0){
+      double due = lastTime_ + record.delay / speed_;
+      if (now < due){
+        return 0;
+      }
+      // Keep the original spacing of the records, even if this one was read late
+      lastTime_ = due;
+    } else {
+      lastTime_ = now;
+    }
+  }
+  size_t bytes = record.length - consumed_;
+  if (bytes > bufferSize){
+    bytes = bufferSize;
+  }
+  memcpy(buffer, &data_[record.offset + consumed_], bytes);
+  consumed_ += bytes;
+  if (consumed_ == record.length){
+    next_++;
+    consumed_ = 0;
+  }
+  return (ssize_t)bytes;
+}
+
+/**
+ * Nothing is buffered, so there is nothing to flush.
+ */
+int ReplayDriver::channelFlush()
+{
+  return 0;
+}
+
+/**
+ * Read the whole session log into memory.
+ *
+ * @return - true if the log was read, false if it could not be opened or is not a session log.
+ */
+bool ReplayDriver::load()
+{
+  records_.clear();
+  data_.clear();
+  FILE *file = fopen(filename_, "rb");
+  if (file == NULL){
+    return false;
+  }
+  // The lengths in the records are checked against the size, so that a corrupt one allocates nothing
+  long fileSize = -1;
+  if (fseek(file, 0, SEEK_END) == 0){
+    fileSize = ftell(file);
+  }
+  if (fileSize < 0 || fseek(file, 0, SEEK_SET) != 0){
+    fclose(file);
+    return false;
+  }
+  char magic[SESSION_LOG_MAGIC_LENGTH];
+  if (fread(magic, 1, SESSION_LOG_MAGIC_LENGTH, file) != SESSION_LOG_MAGIC_LENGTH
+      || memcmp(magic, SESSION_LOG_MAGIC, SESSION_LOG_MAGIC_LENGTH) != 0
+      || fgetc(file) != SESSION_LOG_VERSION){
+    fclose(file);
+    return false;
+  }
+
+  bool valid = true;
+  int type;
+  while (valid && (type = fgetc(file)) != EOF){
+    unsigned long values[2];
+    for (int i = 0; i < 2 && valid; i++){
+      values[i] = 0;
+      int shift = 0;
+      int c;
+      do {
+        c = fgetc(file);
+        if (c == EOF || shift >= (int)(sizeof(unsigned long) * 8)){
+          valid = false;
+          break;
+        }
+        values[i] |= (unsigned long)(c & 0x7F) << shift;
+        shift += 7;
+      } while (c & 0x80);
+    }
+    if (!valid){
+      break;
+    }
+    ReplayRecord record;
+    record.type = type;
+    record.delay = values[0] / 1e6;
+    record.offset = data_.size();
+    record.length = values[1];
+    if (values[1] > (unsigned long)(fileSize - ftell(file))){
+      valid = false;
+      break;
+    }
+    data_.resize(record.offset + record.length);
+    if (record.length > 0 && fread(&data_[record.offset], 1, record.length, file) != record.length){
+      valid = false;
+      break;
+    }
+    records_.push_back(record);
+  }
+  fclose(file);
+  // A log cut short, for example by a crash, is played back up to the last complete record
+  if (!valid){
+    data_.resize(records_.empty() ? 0 : records_.back().offset + records_.back().length);
+  }
+  return true;
+}
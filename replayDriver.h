@@ -0,0 +1,56 @@
+/* Might need to define WIN32 for MinGW */
+#if defined(_WIN32) && !defined(WIN32)
+#define WIN32
+#endif
+
+#ifndef replayDriver_H
+#define replayDriver_H
+
+#include "transport.h"
+#include <vector>
+
+/**
+ * The ReplayDriver class plays back a session log written by the SessionRecorder
+ * in place of an SSH connection. Bytes written are checked against the bytes
+ * recorded as sent, and the bytes recorded as received after them are returned
+ * by the reads, either with their original timing or as fast as possible.
+ * The read and write logic of Transport is used unchanged, so a recorded session
+ * can be replayed through PowerPMACcontrol without a controller.
+ */
+class ReplayDriver : public Transport {
+
+  public:
+    ReplayDriver(const char *filename, double speed);
+    virtual SSHDriverStatus connectTransport();
+    virtual SSHDriverStatus disconnectTransport();
+    unsigned long getMismatches() const;
+    bool isFinished() const;
+    virtual ~ReplayDriver();
+
+  protected:
+    virtual ssize_t channelWrite(const char *buffer, size_t bufferSize);
+    virtual ssize_t channelRead(char *buffer, size_t bufferSize);
+    virtual int channelFlush();
+
+  private:
+    typedef struct s_ReplayRecord
+    {
+      int type;
+      double delay;     /* Seconds after the previous record */
+      size_t offset;    /* Start of the bytes in data_ */
+      size_t length;
+    } ReplayRecord;
+
+    char filename_[256];
+    double speed_;
+    std::vector<ReplayRecord> records_;
+    std::vector<char> data_;
+    size_t next_;
+    size_t consumed_;
+    double lastTime_;
+    unsigned long mismatches_;
+
+    bool load();
+};
+
+#endif
@@ -0,0 +1,238 @@
+/********************************************
+ *  requestQueue.cpp
+ *
+ *  Lock-free multi-producer queue with
+ *  priority lanes which feeds the I/O thread
+ *  of a connection to the Power PMAC.
+ *
+ ********************************************/
+
+/**
+ * @file requestQueue.cpp
+ * @brief C++ source file for the PowerPMACcontrol_ns::RequestQueue class.
+ */
+
+#include "requestQueue.h"
+
+namespace PowerPMACcontrol_ns
+{
+
+/**
+ * Constructor for the request queue. The queue is initially empty.
+ */
+RequestQueue::RequestQueue()
+{
+  submitted_ = NULL;
+  normalServedWhileBulkWaiting_ = 0;
+#ifdef WIN32
+  InitializeCriticalSection(&lock_);
+#else
+  pthread_mutex_init(&lock_, NULL);
+#endif
+  for (int lane = 0; lane < RequestPriorityLevels; lane++)
+  {
+    statistics_.lanes[lane].depth = 0;
+  }
+  resetStatistics();
+}
+
+/**
+ * Destructor for the request queue. Requests still waiting are not owned by the queue.
+ */
+RequestQueue::~RequestQueue()
+{
+#ifdef WIN32
+  DeleteCriticalSection(&lock_);
+#else
+  pthread_mutex_destroy(&lock_);
+#endif
+}
+
+void RequestQueue::lock()
+{
+#ifdef WIN32
+  EnterCriticalSection(&lock_);
+#else
+  pthread_mutex_lock(&lock_);
+#endif
+}
+
+void RequestQueue::unlock()
+{
+#ifdef WIN32
+  LeaveCriticalSection(&lock_);
+#else
+  pthread_mutex_unlock(&lock_);
+#endif
+}
+
+/**
+ * Submit a request. May be called from any thread, and never blocks.
+ *
+ * The priority and enqueue time of the request must be set before it is pushed.
+ *
+ * @param request - The request to be queued. It must stay valid until it is popped.
+ */
+void RequestQueue::push(QueuedRequest *request)
+{
+  if (request->priority < 0 || request->priority >= RequestPriorityLevels)
+  {
+    request->priority = RequestPriorityNormal;
+  }
+
+  QueuedRequest *head;
+  do
+  {
+    head = submitted_;
+    request->next = head;
+  } while (!atomicCompareAndSwapPointer((void *volatile *)&submitted_, head, request));
+}
+
+/**
+ * Move all submitted requests into their lanes in arrival order.
+ * Must only be called by the consumer.
+ */
+void RequestQueue::takeSubmitted()
+{
+  QueuedRequest *stack = (QueuedRequest *)atomicExchangePointer((void *volatile *)&submitted_, NULL);
+  if (stack == NULL)
+    return;
+
+  // The stack holds the newest request first, so reverse it
+  QueuedRequest *ordered = NULL;
+  while (stack != NULL)
+  {
+    QueuedRequest *next = stack->next;
+    stack->next = ordered;
+    ordered = stack;
+    stack = next;
+  }
+  while (ordered != NULL)
+  {
+    QueuedRequest *next = ordered->next;
+    ordered->next = NULL;
+    lanes_[ordered->priority].push_back(ordered);
+    ordered = next;
+  }
+}
+
+/**
+ * Remove and return the request which should be served next.
+ * Must only be called by the consumer.
+ *
+ * @return The next request, or NULL if no request is waiting.
+ */
+QueuedRequest *RequestQueue::pop()
+{
+  takeSubmitted();
+
+  lock();
+  for (int lane = 0; lane < RequestPriorityLevels; lane++)
+  {
+    int depth = (int)lanes_[lane].size();
+    if (depth > statistics_.lanes[lane].maxDepth)
+      statistics_.lanes[lane].maxDepth = depth;
+  }
+  QueuedRequest *next = nextRequest();
+  for (int lane = 0; lane < RequestPriorityLevels; lane++)
+  {
+    statistics_.lanes[lane].depth = (int)lanes_[lane].size();
+  }
+  unlock();
+  return next;
+}
+
+/**
+ * Remove and return the request which should be served next, or NULL if nobody is waiting.
+ * Must be called by the consumer with the lock held.
+ */
+QueuedRequest *RequestQueue::nextRequest()
+{
+  QueuedRequest *next = NULL;
+  if (!lanes_[RequestPrioritySafety].empty())
+  {
+    next = lanes_[RequestPrioritySafety].front();
+    lanes_[RequestPrioritySafety].pop_front();
+    return next;
+  }
+
+  bool bulkWaiting = !lanes_[RequestPriorityBulk].empty();
+  if (!lanes_[RequestPriorityNormal].empty()
+      && (!bulkWaiting || normalServedWhileBulkWaiting_ < BULK_STARVATION_LIMIT))
+  {
+    next = lanes_[RequestPriorityNormal].front();
+    lanes_[RequestPriorityNormal].pop_front();
+    if (bulkWaiting)
+      normalServedWhileBulkWaiting_++;
+    return next;
+  }
+
+  if (bulkWaiting)
+  {
+    next = lanes_[RequestPriorityBulk].front();
+    lanes_[RequestPriorityBulk].pop_front();
+    normalServedWhileBulkWaiting_ = 0;
+  }
+  return next;
+}
+
+/**
+ * Update the statistics for a request which has been given a turn.
+ *
+ * @param priority - Lane of the request
+ * @param waitSecs - Time the request spent waiting in the queue
+ */
+void RequestQueue::recordTurn(int priority, double waitSecs)
+{
+  lock();
+  RequestQueueLaneStatistics& lane = statistics_.lanes[priority];
+  lane.requests++;
+  lane.totalWaitSecs += waitSecs;
+  if (waitSecs > lane.maxWaitSecs)
+    lane.maxWaitSecs = waitSecs;
+  unlock();
+}
+
+/**
+ * Update the statistics for a request whose caller stopped waiting before it was given a turn.
+ *
+ * @param priority - Lane of the request
+ */
+void RequestQueue::recordTimeout(int priority)
+{
+  lock();
+  statistics_.lanes[priority].timeouts++;
+  unlock();
+}
+
+/**
+ * Get the statistics of each lane, including the number of requests waiting
+ * when the consumer last took a request.
+ *
+ * @param statistics - Copy of the statistics
+ */
+void RequestQueue::getStatistics(RequestQueueStatistics& statistics)
+{
+  lock();
+  statistics = statistics_;
+  unlock();
+}
+
+/**
+ * Clear the accumulated statistics.
+ */
+void RequestQueue::resetStatistics()
+{
+  lock();
+  for (int lane = 0; lane < RequestPriorityLevels; lane++)
+  {
+    statistics_.lanes[lane].requests = 0;
+    statistics_.lanes[lane].timeouts = 0;
+    statistics_.lanes[lane].maxDepth = statistics_.lanes[lane].depth;
+    statistics_.lanes[lane].totalWaitSecs = 0.0;
+    statistics_.lanes[lane].maxWaitSecs = 0.0;
+  }
+  unlock();
+}
+
+}
@@ -0,0 +1,126 @@
+/**
+ * @file requestQueue.h
+ * @brief Header file for the PowerPMACcontrol_ns::RequestQueue class
+ *
+ * The RequestQueue holds the requests waiting for the I/O thread which owns
+ * the connection to the Power PMAC. Requests are served in the order they
+ * arrive within each priority lane, and higher priority lanes are served first.
+ */
+
+#ifndef REQUESTQUEUE_H
+#define REQUESTQUEUE_H
+
+/* Might need to define WIN32 for MinGW */
+#if defined(_WIN32) && !defined(WIN32)
+#define WIN32
+#endif
+
+#include <deque>
+#include "atomicOps.h"
+
+#ifdef WIN32
+# include <winsock2.h>
+#else
+# include <pthread.h>
+#endif
+
+namespace PowerPMACcontrol_ns
+{
+
+/**
+ * Priority lanes of the request queue. Lower values are served first.
+ */
+enum RequestPriority
+{
+  RequestPrioritySafety = 0,    ///< Stop and abort commands
+  RequestPriorityNormal = 1,    ///< Ordinary commands and queries
+  RequestPriorityBulk = 2,      ///< Program downloads and other long transfers
+  RequestPriorityLevels = 3     ///< Number of priority lanes
+};
+
+typedef enum e_RequestQueueStatus
+{
+  RequestQueueSuccess,
+  RequestQueueTimeout,      /* Timed out waiting for a turn */
+  RequestQueueError         /* Error submitting or waiting for a request */
+} RequestQueueStatus;
+
+/**
+ * @brief Statistics of one priority lane of the request queue
+ */
+struct RequestQueueLaneStatistics
+{
+  unsigned long requests;   ///< Number of requests which were given a turn
+  unsigned long timeouts;   ///< Number of requests which timed out while waiting
+  int depth;                ///< Number of requests waiting now
+  int maxDepth;             ///< Largest number of requests waiting at the same time
+  double totalWaitSecs;     ///< Total time spent waiting by requests given a turn
+  double maxWaitSecs;       ///< Longest time spent waiting by a request given a turn
+};
+
+/**
+ * @brief Statistics of the request queue, one entry per priority lane
+ */
+struct RequestQueueStatistics
+{
+  RequestQueueLaneStatistics lanes[RequestPriorityLevels];  ///< Indexed by RequestPriority
+};
+
+/**
+ * @brief Link and scheduling fields of a request waiting in the RequestQueue
+ */
+struct QueuedRequest
+{
+  QueuedRequest *next;      ///< Link in the submission stack, owned by the queue
+  int priority;             ///< One of the RequestPriority values
+  double enqueueTime;       ///< Monotonic time of submission in seconds
+};
+
+/**
+ * @class RequestQueue
+ * @brief Multi-producer, single-consumer queue of requests with priority lanes.
+ *
+ * Any thread may push a request. Pushing is lock-free: requests are linked onto
+ * a submission stack with a compare-and-swap. Only the consumer, the I/O thread
+ * which owns the connection, may pop. It takes the whole stack at once, restores
+ * the arrival order and sorts the requests into their lanes, so requests within a
+ * lane are served strictly in order.
+ *
+ * The safety lane is always served first. To stop bulk transfers from being starved,
+ * a waiting bulk request is served after BULK_STARVATION_LIMIT consecutive normal requests.
+ */
+class RequestQueue {
+  public:
+    RequestQueue();
+    virtual ~RequestQueue();
+    void push(QueuedRequest *request);
+    QueuedRequest *pop();
+    void recordTurn(int priority, double waitSecs);
+    void recordTimeout(int priority);
+    void getStatistics(RequestQueueStatistics& statistics);
+    void resetStatistics();
+
+  private:
+    QueuedRequest *volatile submitted_;
+    std::deque<QueuedRequest *> lanes_[RequestPriorityLevels];
+    int normalServedWhileBulkWaiting_;
+    RequestQueueStatistics statistics_;
+
+    // Guards the statistics only, never taken when pushing
+#ifdef WIN32
+    CRITICAL_SECTION lock_;
+#else
+    pthread_mutex_t lock_;
+#endif
+
+    static const int BULK_STARVATION_LIMIT = 4;
+
+    void lock();
+    void unlock();
+    void takeSubmitted();
+    QueuedRequest *nextRequest();
+};
+
+}
+
+#endif
@@ -0,0 +1,116 @@
+/********************************************
+ *  sessionRecorder.cpp
+ *
+ *  Records the bytes sent and received on an
+ *  SSH channel to a binary log file, which
+ *  the ReplayDriver can play back.
+ *
+ ********************************************/
+
+#include "sessionRecorder.h"
+
+/**
+ * Constructor for the recorder. No file is open.
+ */
+SessionRecorder::SessionRecorder()
+{
+  file_ = NULL;
+  lastTime_ = 0.0;
+  bytesRecorded_ = 0;
+}
+
+/**
+ * Create the log file and write its header. Any file already open is closed first.
+ *
+ * @param filename - Name of the log file, overwritten if it exists.
+ * @return - true if the file was created.
+ */
+bool SessionRecorder::open(const char *filename)
+{
+  close();
+  file_ = fopen(filename, "wb");
+  if (file_ == NULL){
+    return false;
+  }
+  fwrite(SESSION_LOG_MAGIC, 1, SESSION_LOG_MAGIC_LENGTH, file_);
+  fputc(SESSION_LOG_VERSION, file_);
+  // The first record is timed from here
+  lastTime_ = -1.0;
+  bytesRecorded_ = 0;
+  return true;
+}
+
+/**
+ * Append a record to the log. Does nothing if no file is open.
+ *
+ * @param type - SessionRecordSent or SessionRecordReceived.
+ * @param buffer - The bytes sent or received.
+ * @param bufferSize - The number of bytes.
+ * @param timeSecs - Monotonic time at which the bytes were sent or received.
+ */
+void SessionRecorder::record(int type, const char *buffer, size_t bufferSize, double timeSecs)
+{
+  if (file_ == NULL){
+    return;
+  }
+  if (lastTime_ < 0.0){
+    lastTime_ = timeSecs;
+  }
+  double delta = timeSecs - lastTime_;
+  unsigned long micros = (delta > 0.0) ? (unsigned long)(delta * 1e6) : 0;
+  // Advance by the recorded amount so rounding does not accumulate
+  lastTime_ += micros / 1e6;
+
+  fputc(type, file_);
+  writeVarint(micros);
+  writeVarint((unsigned long)bufferSize);
+  fwrite(buffer, 1, bufferSize, file_);
+  bytesRecorded_ += bufferSize;
+}
+
+/**
+ * Flush and close the log file.
+ */
+void SessionRecorder::close()
+{
+  if (file_ != NULL){
+    fclose(file_);
+    file_ = NULL;
+  }
+}
+
+/**
+ * Check whether a log file is open.
+ */
+bool SessionRecorder::isOpen() const
+{
+  return file_ != NULL;
+}
+
+/**
+ * Get the number of bytes sent and received which have been recorded since the file was opened.
+ */
+unsigned long SessionRecorder::getBytesRecorded() const
+{
+  return bytesRecorded_;
+}
+
+/**
+ * Destructor, closes the log file.
+ */
+SessionRecorder::~SessionRecorder()
+{
+  close();
+}
+
+/**
+ * Write an unsigned value as a varint.
+ */
+void SessionRecorder::writeVarint(unsigned long value)
+{
+  while (value >= 0x80){
+    fputc((int)((value & 0x7F) | 0x80), file_);
+    value >>= 7;
+  }
+  fputc((int)value, file_);
+}
@@ -0,0 +1,61 @@
+/* Might need to define WIN32 for MinGW */
+#if defined(_WIN32) && !defined(WIN32)
+#define WIN32
+#endif
+
+#ifndef sessionRecorder_H
+#define sessionRecorder_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+/**
+ * Session log file format
+ *
+ * The file starts with the 8 byte magic string "PPMACSES" and a version byte.
+ * Each record that follows is:
+ *      - 1 byte type, SessionRecordSent or SessionRecordReceived
+ *      - time since the previous record (or since the file was opened) in us, as a varint
+ *      - number of bytes, as a varint
+ *      - the bytes
+ *
+ * A varint holds 7 bits per byte, least significant first, with the top bit set
+ * on every byte except the last.
+ */
+#define SESSION_LOG_MAGIC "PPMACSES"
+#define SESSION_LOG_MAGIC_LENGTH 8
+#define SESSION_LOG_VERSION 1
+
+typedef enum e_SessionRecordType
+{
+  SessionRecordSent = 'W',      /* Bytes written to the channel */
+  SessionRecordReceived = 'R'   /* Bytes read from the channel */
+} SessionRecordType;
+
+/**
+ * The SessionRecorder class writes every chunk of bytes sent and received
+ * on an SSH channel, with monotonic timestamps, to a compact binary log file.
+ * The log can be fed back to PowerPMACcontrol by the ReplayDriver.
+ *
+ * A recorder is used by one driver, so it is not locked.
+ */
+class SessionRecorder {
+
+  public:
+    SessionRecorder();
+    bool open(const char *filename);
+    void record(int type, const char *buffer, size_t bufferSize, double timeSecs);
+    void close();
+    bool isOpen() const;
+    unsigned long getBytesRecorded() const;
+    virtual ~SessionRecorder();
+
+  private:
+    FILE *file_;
+    double lastTime_;
+    unsigned long bytesRecorded_;
+
+    void writeVarint(unsigned long value);
+};
+
+#endif
@@ -0,0 +1,111 @@
+/*
+ * @file backup_test.cpp
+ *
+ * Back up and restore the settings of the simulated Power PMAC (sim://) with ParameterBackup and
+ * check the names saved, the file, the values restored and that the batched reads are faster than
+ * reading each setting with PowerPMACcontrol_getVariable.
+ */
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include "PowerPMACcontrol.h"
+#include "parameterBackup.h"
+#include "argParser.h"
+#include "testCheck.h"
+
+using namespace PowerPMACcontrol_ns;
+
+#define NUM_MOTORS	64
+#define NUM_COORDS	16
+#define SINGLE_READS	200
+
+int main(int argc, char *argv[])
+{
+	argParser args(argc, argv);
+	std::string u_ipaddr = args.getIp();
+	if (u_ipaddr.compare(0, 6, "sim://") != 0)
+	{
+		u_ipaddr = "sim://500";
+	}
+
+	PowerPMACcontrol ppmaccomm;
+	check("connect", ppmaccomm.PowerPMACcontrol_connect(u_ipaddr.c_str(), "root", "deltatau") == 0);
+
+	ParameterBackup defaults;
+	std::vector<std::string> names;
+	check("getNames takes the ranges from the controller", defaults.getNames(ppmaccomm, names) == 0 &&
+		  names.size() == 3 + 9 * 40 + 9 * 8 + 9 * 11 && names[0] == "Sys.MaxMotors" &&
+		  names[3] == "Motor[0].ServoCtrl" && names.back() == "EncTable[8].ScaleFactor");
+
+	ParameterBackup backup;
+	backup.setMotors(1, NUM_MOTORS);
+	backup.setCoords(1, NUM_COORDS);
+	backup.setEncTables(1, NUM_MOTORS);
+	check("getNames of the ranges set", backup.getNames(ppmaccomm, names) == 0 &&
+		  names.size() == 3 + NUM_MOTORS * 40 + NUM_COORDS * 8 + NUM_MOTORS * 11 && names[3] == "Motor[1].ServoCtrl");
+
+	// Give each motor gains of its own
+	std::vector<std::string> gainNames;
+	std::vector<std::string> gains;
+	char text[64];
+	for (int motor = 1; motor <= NUM_MOTORS; motor++)
+	{
+		sprintf(text, "Motor[%d].Servo.Kp", motor);
+		gainNames.push_back(text);
+		sprintf(text, "%g", motor * 1.5);
+		gains.push_back(text);
+	}
+	check("setVariables", ppmaccomm.PowerPMACcontrol_setVariables(gainNames, gains) == 0);
+
+	double start = getMonotonicTimeSecs();
+	int ret = backup.backup(ppmaccomm, "backup_test.cfg");
+	double batched = getMonotonicTimeSecs() - start;
+	check("backup", ret == 0);
+	std::vector<std::string> savedNames;
+	std::vector<std::string> savedValues;
+	check("readFile", ParameterBackup::readFile("backup_test.cfg", savedNames, savedValues) == 0 &&
+		  savedNames == names && savedValues.size() == names.size());
+	bool saved = true;
+	for (size_t i = 0; i < savedNames.size(); i++)
+	{
+		if (savedNames[i] == "Motor[10].Servo.Kp")
+		{
+			saved = savedValues[i] == "15";
+		}
+	}
+	check("the values are saved", saved);
+
+	start = getMonotonicTimeSecs();
+	bool ok = true;
+	for (int i = 0; i < SINGLE_READS; i++)
+	{
+		double value;
+		ok = ok && ppmaccomm.PowerPMACcontrol_getVariable(names[i], value) == 0;
+	}
+	double single = (getMonotonicTimeSecs() - start) * names.size() / SINGLE_READS;
+	printf("%lu settings: backup %.3f s, %.3f s estimated for single reads\n", (unsigned long)names.size(), batched, single);
+	check("backup is faster than single reads", ok && batched * 5 < single);
+
+	std::vector<std::string> zeros(gainNames.size(), "0");
+	ppmaccomm.PowerPMACcontrol_setVariables(gainNames, zeros);
+	check("restore", backup.restore(ppmaccomm, "backup_test.cfg") == 0);
+	std::vector<std::string> values;
+	check("the values are restored", ppmaccomm.PowerPMACcontrol_getVariables(gainNames, values) == 0 && values == gains);
+
+	ParameterBackup outOfRange;
+	outOfRange.setMotors(250, 260);
+	check("a setting the controller rejects fails the backup", outOfRange.backup(ppmaccomm, "backup_test.cfg") == -21);
+	FILE *file = fopen("backup_test.cfg", "w");
+	fputs("# Comment\nMotor[1].JogSpeed=10\nMotor[1].JogTa\n", file);
+	fclose(file);
+	check("readFile rejects a line without a value", ParameterBackup::readFile("backup_test.cfg", savedNames, savedValues) ==
+		  PowerPMACcontrol::PPMACcontrolFileReadError);
+	remove("backup_test.cfg");
+	check("restore of a missing file", backup.restore(ppmaccomm, "backup_test.cfg") == PowerPMACcontrol::PPMACcontrolFileOpenError);
+
+	ppmaccomm.PowerPMACcontrol_disconnect();
+	printf("%d failures\n", failures);
+	return failures;
+}
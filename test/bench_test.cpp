@@ -0,0 +1,277 @@
+/*
+ * @file bench_test.cpp
+ *
+ * Throughput and latency benchmarks of the PowerPMACcontrol API, run by "make bench".
+ * Every scenario performs a fixed number of operations after a short warm-up, so runs can be
+ * compared between builds and machines:
+ *      - getVariable:      read one P-variable,
+ *      - positions_N:      axesGetCurrentPositions of 1, 32 and 256 motors,
+ *      - status_poll:      one polling cycle of global, 32 motor and coordinate system status,
+ *      - contended_N:      getGlobalStatus from 4 and 16 threads sharing the connection,
+ *      - download_N:       progDownload of a program of 1k, 10k and 100k lines,
+ *      - download_N_wW:    progDownload of 10k and 100k lines with W lines in flight.
+ *
+ * Each scenario prints one line of JSON with the number of operations, operations per second,
+ * the 50th and 99th percentile latency of an operation in microseconds and the CPU time of the
+ * process per operation in microseconds. The download latency is not measured per line and is
+ * printed as null. The CPU time includes the simulator when the sim:// transport is used.
+ *
+ * Usage: bench_test [-ip <host>] [-keydir <directory of loopback_sshd.sh> -port <port> -user <user>]
+ * The default host is the simulator, sim://; -ip sim://200 adds a reply latency of 200 us.
+ * With -keydir the loopback sshd of loopback_sshd.sh is used, as in loopback_test.
+ */
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <string.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include "PowerPMACcontrol.h"
+#include "argParser.h"
+
+using namespace PowerPMACcontrol_ns;
+
+#define WARMUP_OPS			100
+#define MAX_THREADS			16
+#define DOWNLOAD_FILE		"bench.pmc"
+
+static PowerPMACcontrol *ppmaccomm;
+static std::string host;
+
+/// Operation to measure; returns the PowerPMACcontrol error code
+typedef int (*BenchOperation)();
+
+/// Process CPU time (user and system) in seconds
+static double getCpuSecs()
+{
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+/// Percentile of sorted latencies in microseconds, or -1 if there are none
+static double percentileUs(const std::vector<double>& sorted, double percentile)
+{
+	if (sorted.empty())
+	{
+		return -1.0;
+	}
+	size_t index = (size_t)(percentile / 100.0 * (sorted.size() - 1) + 0.5);
+	return sorted[index] * 1e6;
+}
+
+static void printResult(const char *scenario, int threads, long ops, int errors, double elapsed, double cpuSecs,
+		std::vector<double>& latencies)
+{
+	std::sort(latencies.begin(), latencies.end());
+	char p50[32] = "null", p99[32] = "null";
+	if (!latencies.empty())
+	{
+		sprintf(p50, "%.1f", percentileUs(latencies, 50));
+		sprintf(p99, "%.1f", percentileUs(latencies, 99));
+	}
+	printf("{\"scenario\":\"%s\",\"transport\":\"%s\",\"threads\":%d,\"ops\":%ld,\"errors\":%d,"
+			"\"seconds\":%.3f,\"ops_per_sec\":%.1f,\"p50_us\":%s,\"p99_us\":%s,\"cpu_us_per_op\":%.2f}\n",
+			scenario, host.c_str(), threads, ops, errors, elapsed, ops / elapsed, p50, p99, cpuSecs / ops * 1e6);
+	fflush(stdout);
+}
+
+static int readVariable()
+{
+	double value;
+	return ppmaccomm->PowerPMACcontrol_getVariable("P100", value);
+}
+
+static int readPositions(int motors)
+{
+	static std::vector<double> positions;
+	return ppmaccomm->PowerPMACcontrol_axesGetCurrentPositions(0, motors - 1, positions);
+}
+
+static int readPositions1() { return readPositions(1); }
+static int readPositions32() { return readPositions(32); }
+static int readPositions256() { return readPositions(256); }
+
+static int pollStatus()
+{
+	static std::vector<uint64_t> motorStatus;
+	uint32_t globalStatus;
+	uint64_t coordStatus;
+	int ret = ppmaccomm->PowerPMACcontrol_getGlobalStatus(globalStatus);
+	if (ret == PowerPMACcontrol::PPMACcontrolNoError)
+		ret = ppmaccomm->PowerPMACcontrol_getMultiMotorStatus(0, 31, motorStatus);
+	if (ret == PowerPMACcontrol::PPMACcontrolNoError)
+		ret = ppmaccomm->PowerPMACcontrol_getCoordStatus(1, coordStatus);
+	return ret;
+}
+
+static int readGlobalStatus()
+{
+	uint32_t status;
+	return ppmaccomm->PowerPMACcontrol_getGlobalStatus(status);
+}
+
+/// Run an operation a number of times from one thread
+static void runSerial(const char *scenario, BenchOperation operation, long ops)
+{
+	std::vector<double> latencies;
+	latencies.reserve(ops);
+	for (int i = 0; i < WARMUP_OPS; i++)
+	{
+		operation();
+	}
+	int errors = 0;
+	double cpuStart = getCpuSecs();
+	double start = getMonotonicTimeSecs();
+	for (long i = 0; i < ops; i++)
+	{
+		double opStart = getMonotonicTimeSecs();
+		if (operation() != PowerPMACcontrol::PPMACcontrolNoError)
+			errors++;
+		latencies.push_back(getMonotonicTimeSecs() - opStart);
+	}
+	double elapsed = getMonotonicTimeSecs() - start;
+	printResult(scenario, 1, ops, errors, elapsed, getCpuSecs() - cpuStart, latencies);
+}
+
+typedef struct
+{
+	BenchOperation operation;
+	long ops;
+	int errors;
+	std::vector<double> latencies;
+} ThreadContext;
+
+void *runThread(void *arg)
+{
+	ThreadContext *context = (ThreadContext *)arg;
+	context->latencies.reserve(context->ops);
+	for (long i = 0; i < context->ops; i++)
+	{
+		double opStart = getMonotonicTimeSecs();
+		if (context->operation() != PowerPMACcontrol::PPMACcontrolNoError)
+			context->errors++;
+		context->latencies.push_back(getMonotonicTimeSecs() - opStart);
+	}
+	return 0;
+}
+
+/// Run an operation from a number of threads at once, each doing opsPerThread of them
+static void runContended(const char *scenario, BenchOperation operation, int numThreads, long opsPerThread)
+{
+	pthread_t threads[MAX_THREADS];
+	ThreadContext contexts[MAX_THREADS];
+	for (int i = 0; i < WARMUP_OPS; i++)
+	{
+		operation();
+	}
+	double cpuStart = getCpuSecs();
+	double start = getMonotonicTimeSecs();
+	for (int i = 0; i < numThreads; i++)
+	{
+		contexts[i].operation = operation;
+		contexts[i].ops = opsPerThread;
+		contexts[i].errors = 0;
+		pthread_create(&threads[i], NULL, &runThread, &contexts[i]);
+	}
+	std::vector<double> latencies;
+	int errors = 0;
+	for (int i = 0; i < numThreads; i++)
+	{
+		pthread_join(threads[i], NULL);
+		latencies.insert(latencies.end(), contexts[i].latencies.begin(), contexts[i].latencies.end());
+		errors += contexts[i].errors;
+	}
+	double elapsed = getMonotonicTimeSecs() - start;
+	printResult(scenario, numThreads, numThreads * opsPerThread, errors, elapsed, getCpuSecs() - cpuStart, latencies);
+}
+
+/// Download a generated motion program with a window of lines in flight; the operations are the lines of the file
+static void runDownload(const char *scenario, long lines, int window)
+{
+	FILE *prog = fopen(DOWNLOAD_FILE, "w");
+	if (prog == NULL)
+	{
+		printf("Cannot write %s\n", DOWNLOAD_FILE);
+		return;
+	}
+	fprintf(prog, "open prog 10\n");
+	for (long i = 0; i < lines - 2; i++)
+	{
+		fprintf(prog, "X%ld Y%ld\n", i, -i);
+	}
+	fprintf(prog, "close\n");
+	fclose(prog);
+
+	std::vector<double> latencies;
+	ppmaccomm->PowerPMACcontrol_setDownloadWindow(window);
+	double cpuStart = getCpuSecs();
+	double start = getMonotonicTimeSecs();
+	int ret = ppmaccomm->PowerPMACcontrol_progDownload(DOWNLOAD_FILE);
+	double elapsed = getMonotonicTimeSecs() - start;
+	printResult(scenario, 1, lines, (ret == PowerPMACcontrol::PPMACcontrolNoError) ? 0 : 1, elapsed,
+			getCpuSecs() - cpuStart, latencies);
+	remove(DOWNLOAD_FILE);
+}
+
+int main(int argc, char *argv[])
+{
+	// Get connection parameters from the command line arguments
+	// Default values are defined in argParser.h
+	argParser args(argc, argv);
+	host = args.getIp();
+	std::string keydir;
+	for (int i = 1; i + 1 < argc; i++)
+	{
+		if (strcmp(argv[i], "-keydir") == 0)
+		{
+			keydir = argv[i+1];
+		}
+	}
+
+	ppmaccomm = new PowerPMACcontrol();
+	int estatus;
+	if (!keydir.empty())
+	{
+		SSHDriver *driver = new SSHDriver("127.0.0.1");
+		driver->setUsername(args.getUser().c_str());
+		driver->setPort(args.getPort().c_str());
+		driver->setKeyFiles((keydir + "/id_ecdsa.pub").c_str(), (keydir + "/id_ecdsa").c_str());
+		host = "loopback";
+		estatus = ppmaccomm->PowerPMACcontrol_connectTransport(driver);
+	}
+	else
+	{
+		if (host == DEFAULT_IPADDR)
+		{
+			host = "sim://";
+		}
+		estatus = ppmaccomm->PowerPMACcontrol_connect(host.c_str(), args.getUser().c_str(), args.getPassw().c_str(),
+				args.getPort().c_str(), args.getNominus2());
+	}
+	if (estatus != 0)
+	{
+		printf("Error %d connecting to %s\n", estatus, host.c_str());
+		delete ppmaccomm;
+		return 1;
+	}
+
+	runSerial("getVariable", &readVariable, 10000);
+	runSerial("positions_1", &readPositions1, 10000);
+	runSerial("positions_32", &readPositions32, 5000);
+	runSerial("positions_256", &readPositions256, 2000);
+	runSerial("status_poll", &pollStatus, 5000);
+	runContended("contended_4", &readGlobalStatus, 4, 2500);
+	runContended("contended_16", &readGlobalStatus, 16, 625);
+	runDownload("download_1k", 1000, 1);
+	runDownload("download_10k", 10000, 1);
+	runDownload("download_100k", 100000, 1);
+	runDownload("download_10k_w32", 10000, 32);
+	runDownload("download_100k_w32", 100000, 32);
+
+	ppmaccomm->PowerPMACcontrol_disconnect();
+	delete ppmaccomm;
+	return 0;
+}
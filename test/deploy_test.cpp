@@ -0,0 +1,200 @@
+/*
+ * @file deploy_test.cpp
+ *
+ * Deploy a project of program files to the simulated Power PMAC (sim://) with ProjectDeployer
+ * and check the dependencies found, the order of the downloads, the handling of failures and that
+ * several connections are faster than one. The time of each file is printed as a line of JSON.
+ */
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include "PowerPMACcontrol.h"
+#include "projectDeployer.h"
+#include "argParser.h"
+#include "testCheck.h"
+
+using namespace PowerPMACcontrol_ns;
+
+#define NUM_PLCS	6
+#define PLC_LINES	50
+#define CHANNELS	4
+
+static void writeFile(const char *name, const std::string& text)
+{
+	FILE *file = fopen(name, "w");
+	fputs(text.c_str(), file);
+	fclose(file);
+}
+
+static bool dependsOn(ProjectDeployer& deployer, const std::string& path, const std::string& dependency)
+{
+	std::vector<std::string> dependencies;
+	deployer.getDependencies(path, dependencies);
+	for (size_t i = 0; i < dependencies.size(); i++)
+	{
+		if (dependencies[i] == dependency)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+static int position(const std::vector<std::string>& order, const std::string& path)
+{
+	for (size_t i = 0; i < order.size(); i++)
+	{
+		if (order[i] == path)
+		{
+			return (int)i;
+		}
+	}
+	return -1;
+}
+
+static void printResults(const char *deployment, const std::vector<DeployFileResult>& results)
+{
+	for (size_t i = 0; i < results.size(); i++)
+	{
+		printf("{\"deployment\":\"%s\",\"file\":\"%s\",\"result\":%d,\"channel\":%d,\"start_s\":%.4f,\"seconds\":%.4f}\n",
+				deployment, results[i].path.c_str(), results[i].result, results[i].channel,
+				results[i].startSecs, results[i].seconds);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	argParser args(argc, argv);
+	std::string u_ipaddr = args.getIp();
+	if (u_ipaddr.compare(0, 6, "sim://") != 0)
+	{
+		u_ipaddr = "sim://500";
+	}
+
+	std::set<std::string> declared, used;
+	ProjectDeployer::scanNames("global Counter, Limits(4), Gain = 2 // global NotThis\n"
+			"ptr Pos->Motor[1].ActPos;\n#define SPEED 10\nopen subprog Helper\n/* Counter2 */ call Other\n",
+			declared, used);
+	check("scanNames finds the declarations", declared.size() == 6 && declared.count("counter") && declared.count("limits") &&
+		  declared.count("gain") && declared.count("pos") && declared.count("speed") && declared.count("helper"));
+	check("scanNames finds the names used", used.count("other") && used.count("motor") && !used.count("notthis") &&
+		  !used.count("counter2") && !used.count("counter"));
+
+	writeFile("deploy_test_globals.pmc", "open plc 1\nglobal deployCounter, deployLimit(4)\nclose\n");
+	writeFile("deploy_test_helper.pmc", "open subprog deployHelper\ndeployCounter=deployCounter+1\nclose\n");
+	writeFile("deploy_test_main.pmc", "open prog 20\ncall deployHelper\nX10\nclose\n");
+	std::string manifest = "# Test project\ndeploy_test_main.pmc\ndeploy_test_helper.pmc\ndeploy_test_globals.pmc\n";
+	char name[64];
+	for (int plc = 2; plc < 2 + NUM_PLCS; plc++)
+	{
+		std::string text;
+		char line[64];
+		sprintf(line, "open plc %d\n", plc);
+		text += line;
+		for (int i = 0; i < PLC_LINES; i++)
+		{
+			sprintf(line, "P%d=%d\n", plc * 100 + i, i);
+			text += line;
+		}
+		text += "close\n";
+		sprintf(name, "deploy_test_plc%d.pmc", plc);
+		writeFile(name, text);
+		manifest += name;
+		manifest += "\n";
+	}
+	writeFile("deploy_test_last.pmc", "open plc 10\nP1000=1\nclose\n");
+	manifest += "deploy_test_last.pmc : deploy_test_plc2.pmc   # after plc 2\n";
+	writeFile("deploy_test.manifest", manifest);
+
+	ProjectDeployer deployer;
+	check("readManifest", deployer.readManifest("deploy_test.manifest") == 0);
+	std::vector<std::string> order;
+	check("resolve", deployer.resolve(order) == 0 && order.size() == NUM_PLCS + 4);
+	check("a file follows the file declaring the globals it uses",
+		  dependsOn(deployer, "deploy_test_helper.pmc", "deploy_test_globals.pmc"));
+	check("a file follows the file opening the subprogram it calls",
+		  dependsOn(deployer, "deploy_test_main.pmc", "deploy_test_helper.pmc"));
+	check("a file follows the files given in the manifest",
+		  dependsOn(deployer, "deploy_test_last.pmc", "deploy_test_plc2.pmc"));
+	check("independent files have no dependencies",
+		  !dependsOn(deployer, "deploy_test_plc3.pmc", "deploy_test_globals.pmc"));
+	check("order keeps the dependencies",
+		  position(order, "deploy_test_globals.pmc") < position(order, "deploy_test_helper.pmc") &&
+		  position(order, "deploy_test_helper.pmc") < position(order, "deploy_test_main.pmc") &&
+		  position(order, "deploy_test_plc2.pmc") < position(order, "deploy_test_last.pmc"));
+
+	std::vector<DeployFileResult> results;
+	double start = getMonotonicTimeSecs();
+	int ret = deployer.deploy(u_ipaddr.c_str(), "root", "deltatau", "22", false, 1, results);
+	double serial = getMonotonicTimeSecs() - start;
+	printResults("serial", results);
+	check("deploy over one connection", ret == 0 && results.size() == NUM_PLCS + 4);
+
+	start = getMonotonicTimeSecs();
+	ret = deployer.deploy(u_ipaddr.c_str(), "root", "deltatau", "22", false, CHANNELS, results);
+	double parallel = getMonotonicTimeSecs() - start;
+	printResults("parallel", results);
+	bool ok = (ret == 0);
+	bool channels = false;
+	for (size_t i = 0; i < results.size(); i++)
+	{
+		ok = ok && results[i].result == 0 && results[i].channel >= 0 && results[i].seconds > 0;
+		channels = channels || results[i].channel > 0;
+	}
+	check("deploy over several connections", ok && channels);
+	// Results are in the order of the manifest
+	check("a file starts after the files it follows end",
+		  results[0].startSecs >= results[1].startSecs + results[1].seconds &&
+		  results[1].startSecs >= results[2].startSecs + results[2].seconds);
+	printf("serial %.3f s, parallel %.3f s over %d connections\n", serial, parallel, CHANNELS);
+	check("several connections are faster than one", parallel < serial * 0.7);
+
+	PowerPMACcontrol ppmaccomm;
+	std::string reply;
+	ok = ppmaccomm.PowerPMACcontrol_connect(u_ipaddr.c_str(), "root", "deltatau") == 0 &&
+		 ppmaccomm.PowerPMACcontrol_sendCommand("buffer", reply) == 0;
+	for (int plc = 2; plc < 2 + NUM_PLCS; plc++)
+	{
+		sprintf(name, "plc%d lines:%d", plc, PLC_LINES);
+		ok = ok && reply.find(name) != std::string::npos;
+	}
+	check("the programs downloaded at the same time are complete", ok);
+	ppmaccomm.PowerPMACcontrol_disconnect();
+
+	writeFile("deploy_test_globals.pmc", "global deployCounter\n");
+	ret = deployer.deploy(u_ipaddr.c_str(), "root", "deltatau", "22", false, CHANNELS, results);
+	check("a failed file is reported", ret == -20 && results[2].result == -20 && results[2].errorLine == 1);
+	check("the files depending on a failed file are not downloaded",
+		  results[1].result == PowerPMACcontrol::PPMACcontrolDependencyError && results[1].channel == -1 &&
+		  results[0].result == PowerPMACcontrol::PPMACcontrolDependencyError);
+	check("the other files are downloaded", results[3].result == 0 && results[NUM_PLCS + 3].result == 0);
+
+	ProjectDeployer cycle;
+	std::vector<std::string> after(1, "deploy_test_plc3.pmc");
+	cycle.addFile("deploy_test_plc2.pmc", after);
+	after[0] = "deploy_test_plc2.pmc";
+	cycle.addFile("deploy_test_plc3.pmc", after);
+	check("a dependency cycle is rejected", cycle.resolve(order) == PowerPMACcontrol::PPMACcontrolManifestError);
+	ProjectDeployer unknown;
+	after[0] = "deploy_test_missing.pmc";
+	unknown.addFile("deploy_test_plc2.pmc", after);
+	check("an unknown dependency is rejected", unknown.resolve(order) == PowerPMACcontrol::PPMACcontrolManifestError);
+	check("a file listed twice is rejected", unknown.addFile("deploy_test_plc2.pmc", std::vector<std::string>()) ==
+		  PowerPMACcontrol::PPMACcontrolManifestError);
+
+	remove("deploy_test.manifest");
+	remove("deploy_test_globals.pmc");
+	remove("deploy_test_helper.pmc");
+	remove("deploy_test_main.pmc");
+	remove("deploy_test_last.pmc");
+	for (int plc = 2; plc < 2 + NUM_PLCS; plc++)
+	{
+		sprintf(name, "deploy_test_plc%d.pmc", plc);
+		remove(name);
+	}
+
+	printf("%d failures\n", failures);
+	return failures;
+}
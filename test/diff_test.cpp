@@ -0,0 +1,159 @@
+/*
+ * @file diff_test.cpp
+ *
+ * Compare parameter files with the simulated Power PMAC (sim://) using ParameterDiff and check
+ * the differences reported, the tolerance of numbers, the settings which cannot be read and that
+ * the differences are reported while the values are still being read.
+ */
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include "PowerPMACcontrol.h"
+#include "parameterBackup.h"
+#include "parameterDiff.h"
+#include "argParser.h"
+#include "testCheck.h"
+
+using namespace PowerPMACcontrol_ns;
+
+#define NUM_MOTORS	64
+
+/// The differences reported and when the first of them came
+struct Differences
+{
+	std::vector<ParameterDifference> list;
+	double firstTime;
+};
+
+static void collectDifference(const ParameterDifference& difference, void *userData)
+{
+	Differences *differences = (Differences *)userData;
+	if (differences->list.empty())
+	{
+		differences->firstTime = getMonotonicTimeSecs();
+	}
+	differences->list.push_back(difference);
+}
+
+/// Count the lines passed to a VariableBatchSink and the values in them
+static void countValues(size_t first, size_t count, const std::vector<std::string>& values, int result, void *userData)
+{
+	size_t *counts = (size_t *)userData;
+	counts[0]++;
+	counts[1] += values.size();
+}
+
+int main(int argc, char *argv[])
+{
+	argParser args(argc, argv);
+	std::string u_ipaddr = args.getIp();
+	if (u_ipaddr.compare(0, 6, "sim://") != 0)
+	{
+		u_ipaddr = "sim://500";
+	}
+
+	ParameterDiff exact;
+	double value;
+	check("parseNumber", ParameterDiff::parseNumber("-1.5e3", value) && value == -1500 &&
+		  ParameterDiff::parseNumber("$1F", value) && value == 31 && !ParameterDiff::parseNumber("$", value) &&
+		  !ParameterDiff::parseNumber("1.5x", value) && !ParameterDiff::parseNumber(" 1", value) &&
+		  !ParameterDiff::parseNumber("", value));
+	check("equal numbers", exact.equal("1.5", "1.50") && exact.equal("$1F", "31") && !exact.equal("1.5", "1.5000001"));
+	check("equal text ignores case", exact.equal("Acc24E3[0].Chan[0].ServoCapt.a", "ACC24E3[0].CHAN[0].SERVOCAPT.A") &&
+		  !exact.equal("Sys.Ddata[0]", "Sys.Ddata[1]"));
+	ParameterDiff tolerant(0.001, 0.0);
+	check("absolute tolerance", tolerant.equal("1.5", "1.5000001") && !tolerant.equal("1.5", "1.502"));
+	tolerant.setTolerance(0.0, 0.01);
+	check("relative tolerance", tolerant.equal("1000", "1009") && !tolerant.equal("1000", "1011") &&
+		  !tolerant.equal("0", "0.001"));
+
+	PowerPMACcontrol ppmaccomm;
+	check("connect", ppmaccomm.PowerPMACcontrol_connect(u_ipaddr.c_str(), "root", "deltatau") == 0);
+
+	std::vector<std::string> gainNames;
+	std::vector<std::string> gains;
+	char text[64];
+	for (int motor = 1; motor <= NUM_MOTORS; motor++)
+	{
+		sprintf(text, "Motor[%d].Servo.Kp", motor);
+		gainNames.push_back(text);
+		sprintf(text, "%g", motor * 1.5);
+		gains.push_back(text);
+	}
+	check("setVariables", ppmaccomm.PowerPMACcontrol_setVariables(gainNames, gains) == 0);
+
+	size_t counts[2] = {0, 0};
+	check("getVariables with a sink", ppmaccomm.PowerPMACcontrol_getVariables(gainNames, countValues, counts) == 0 &&
+		  counts[0] >= 2 && counts[1] == gainNames.size());
+	check("getVariables without a sink", ppmaccomm.PowerPMACcontrol_getVariables(gainNames, NULL, NULL) ==
+		  PowerPMACcontrol::PPMACcontrolInvalidParamError);
+
+	ParameterBackup backup;
+	backup.setMotors(1, NUM_MOTORS);
+	backup.setCoords(1, 8);
+	backup.setEncTables(1, NUM_MOTORS);
+	check("backup", backup.backup(ppmaccomm, "diff_test.cfg") == 0);
+
+	size_t compared;
+	size_t different;
+	Differences differences;
+	check("no differences with the controller backed up",
+		  exact.compare(ppmaccomm, "diff_test.cfg", collectDifference, &differences, compared, different) == 0 &&
+		  compared > 3000 && different == 0 && differences.list.empty());
+	size_t settings = compared;
+
+	std::vector<std::string> changedNames;
+	std::vector<std::string> changedValues;
+	changedNames.push_back("Motor[3].Servo.Kp");
+	changedValues.push_back("4.5001");
+	changedNames.push_back("Motor[60].Servo.Kp");
+	changedValues.push_back("7");
+	check("change two gains", ppmaccomm.PowerPMACcontrol_setVariables(changedNames, changedValues) == 0);
+	double start = getMonotonicTimeSecs();
+	int ret = exact.compare(ppmaccomm, "diff_test.cfg", collectDifference, &differences, compared, different);
+	double end = getMonotonicTimeSecs();
+	check("the changes are reported", ret == 0 && compared == settings && different == 2 && differences.list.size() == 2 &&
+		  differences.list[0].name == "Motor[3].Servo.Kp" && differences.list[0].expected == "4.5" &&
+		  differences.list[0].actual == "4.5001" && differences.list[0].result == 0 &&
+		  differences.list[1].name == "Motor[60].Servo.Kp" && differences.list[1].actual == "7");
+	printf("%lu settings compared in %.3f s, first difference after %.3f s\n", (unsigned long)compared, end - start,
+		   differences.firstTime - start);
+	check("the first difference is reported while the rest are read", differences.firstTime - start < (end - start) / 2);
+
+	differences.list.clear();
+	ParameterDiff loose(0.001, 0.0);
+	check("a change within the tolerance is not reported",
+		  loose.compare(ppmaccomm, "diff_test.cfg", collectDifference, &differences, compared, different) == 0 &&
+		  different == 1 && differences.list.size() == 1 && differences.list[0].name == "Motor[60].Servo.Kp");
+
+	// A setting which does not exist stops the others on its line, which are read again
+	std::vector<std::string> names(gainNames);
+	std::vector<std::string> expected(gains);
+	names.insert(names.begin() + 10, "Motor[300].Servo.Kp");
+	expected.insert(expected.begin() + 10, "1");
+	names.push_back("Motor[301].Servo.Kp");
+	expected.push_back("1");
+	differences.list.clear();
+	ret = exact.compare(ppmaccomm, names, expected, collectDifference, &differences, compared, different);
+	bool reported = differences.list.size() == 4;
+	for (size_t i = 0; reported && i < differences.list.size(); i++)
+	{
+		const ParameterDifference& difference = differences.list[i];
+		reported = (difference.name.compare(0, 8, "Motor[30") == 0) ? difference.result == -21 && difference.actual.empty() :
+				   difference.result == 0;
+	}
+	check("the settings which cannot be read are reported and the rest compared", ret == -21 &&
+		  compared == gainNames.size() && different == 4 && reported);
+	check("compare with fewer values than names", exact.compare(ppmaccomm, names, gains, collectDifference, &differences,
+		  compared, different) == PowerPMACcontrol::PPMACcontrolInvalidParamError);
+
+	remove("diff_test.cfg");
+	check("compare with a missing file", exact.compare(ppmaccomm, "diff_test.cfg", collectDifference, &differences,
+		  compared, different) == PowerPMACcontrol::PPMACcontrolFileOpenError);
+
+	ppmaccomm.PowerPMACcontrol_disconnect();
+	printf("%d failures\n", failures);
+	return failures;
+}
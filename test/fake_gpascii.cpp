@@ -0,0 +1,95 @@
+/*
+ * @file fake_gpascii.cpp
+ *
+ * Stand-in for the shell and gpascii on a Power PMAC, replying with the simulator (pmacSimulator.h).
+ * It is run by the loopback sshd of loopback_sshd.sh as the command of every SSH session, so the
+ * real SSHDriver connection can be measured on localhost. The terminal of the session echoes the
+ * input; with -echo the program echoes it instead, so it can be run through a pipe:// transport.
+ *
+ * Usage: fake_gpascii [-echo] [-latency <microseconds>]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include "pmacSimulator.h"
+
+#define PROMPT	"root@ppmac:/opt/ppmac# "
+
+int main(int argc, char *argv[])
+{
+	bool echo = false;
+	int latency_us = 0;
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-echo") == 0)
+		{
+			echo = true;
+		}
+		else if (strcmp(argv[i], "-latency") == 0 && i + 1 < argc)
+		{
+			latency_us = atoi(argv[++i]);
+		}
+	}
+	// The terminal turns each newline into CR LF, a pipe does not
+	const char *newline = echo ? "\r\n" : "\n";
+
+	PmacSimulator simulator;
+	bool gpascii = false;
+	char line[4096];
+	printf("Welcome to the loopback Power PMAC%s" PROMPT, newline);
+	fflush(stdout);
+	while (fgets(line, sizeof(line), stdin) != NULL)
+	{
+		if (echo)
+		{
+			std::string copy(line);
+			if (!copy.empty() && copy[copy.size()-1] == '\n')
+			{
+				copy.erase(copy.size()-1);
+				copy += "\r\n";
+			}
+			fputs(copy.c_str(), stdout);
+		}
+		line[strcspn(line, "\r\n")] = '\0';
+		if (strcmp(line, "exit") == 0)
+		{
+			break;
+		}
+		if (!gpascii)
+		{
+			if (strncmp(line, "gpascii", 7) == 0)
+			{
+				gpascii = true;
+				printf("STDIN Open for ASCII Input%s", newline);
+			}
+			else
+			{
+				printf(PROMPT);
+			}
+		}
+		else if (strcmp(line, "echo7") == 0)
+		{
+			printf("%s", newline);
+		}
+		else
+		{
+			if (latency_us > 0)
+			{
+				usleep(latency_us);
+			}
+			std::string reply;
+			simulator.respond(line, reply);
+			if (!reply.empty())
+			{
+				// gpascii rings the bell before an error
+				printf("%s%s%s", (reply.find("error #") != std::string::npos) ? "\a" : "", reply.c_str(), newline);
+			}
+			putchar(0x06);
+		}
+		fflush(stdout);
+	}
+	return 0;
+}
@@ -0,0 +1,79 @@
+#!/bin/sh
+#
+# Start or stop an OpenSSH sshd on localhost which runs fake_gpascii for every session,
+# so loopback_test can measure the real SSH connection without a Power PMAC.
+#
+# The sshd runs as the current user on a high port with a throwaway host key. Sessions are
+# authorized by a throwaway key pair, written with the configuration, the log and the pid file
+# to LOOPBACK_DIR, which is removed by stop.
+#
+# Usage: loopback_sshd.sh start|stop
+# Environment:
+#     LOOPBACK_DIR      working directory (default /tmp/ppmac_loopback)
+#     LOOPBACK_PORT     port of the sshd (default 2222)
+#     LOOPBACK_LATENCY  reply latency of fake_gpascii in microseconds (default 0)
+#     SSHD              sshd executable (default /usr/sbin/sshd)
+
+DIR=${LOOPBACK_DIR:-/tmp/ppmac_loopback}
+PORT=${LOOPBACK_PORT:-2222}
+LATENCY=${LOOPBACK_LATENCY:-0}
+SSHD=${SSHD:-/usr/sbin/sshd}
+FAKE=$(cd "$(dirname "$0")" && pwd)/fake_gpascii
+
+case "$1" in
+start)
+	if [ ! -x "$SSHD" ]; then
+		echo "$SSHD not found, set SSHD to the sshd executable" >&2
+		exit 1
+	fi
+	if [ ! -x "$FAKE" ]; then
+		echo "$FAKE not found, run make test first" >&2
+		exit 1
+	fi
+	rm -rf "$DIR"
+	mkdir -p "$DIR" || exit 1
+	chmod 700 "$DIR"
+	# ECDSA keys are supported by libssh2 1.9 and by recent OpenSSH without extra options.
+	# The private key is written in PEM format, which every libssh2 backend can read.
+	ssh-keygen -q -t ecdsa -b 256 -N "" -f "$DIR/ssh_host_ecdsa_key" || exit 1
+	ssh-keygen -q -t ecdsa -b 256 -N "" -m PEM -f "$DIR/id_ecdsa" || exit 1
+	cp "$DIR/id_ecdsa.pub" "$DIR/authorized_keys"
+	chmod 600 "$DIR/authorized_keys"
+	cat > "$DIR/sshd_config" <<EOF
+Port $PORT
+ListenAddress 127.0.0.1
+HostKey $DIR/ssh_host_ecdsa_key
+PidFile $DIR/sshd.pid
+AuthorizedKeysFile $DIR/authorized_keys
+PubkeyAuthentication yes
+PasswordAuthentication no
+ChallengeResponseAuthentication no
+UsePAM no
+StrictModes no
+PermitRootLogin yes
+ForceCommand $FAKE -latency $LATENCY
+EOF
+	# sshd must be started with its full path
+	"$SSHD" -f "$DIR/sshd_config" -E "$DIR/sshd.log" || { cat "$DIR/sshd.log" >&2; exit 1; }
+	# Wait for the listening socket
+	for i in 1 2 3 4 5 6 7 8 9 10; do
+		[ -f "$DIR/sshd.pid" ] && break
+		sleep 0.2
+	done
+	if [ ! -f "$DIR/sshd.pid" ]; then
+		echo "sshd did not start, see $DIR/sshd.log" >&2
+		exit 1
+	fi
+	echo "sshd listening on 127.0.0.1:$PORT, keys in $DIR"
+	;;
+stop)
+	if [ -f "$DIR/sshd.pid" ]; then
+		kill "$(cat "$DIR/sshd.pid")"
+	fi
+	rm -rf "$DIR"
+	;;
+*)
+	echo "Usage: $0 start|stop" >&2
+	exit 1
+	;;
+esac
@@ -0,0 +1,121 @@
+/*
+ * @file loopback_test.cpp
+ *
+ * Measure the SSH connection on localhost against the loopback sshd started by loopback_sshd.sh,
+ * which runs fake_gpascii for each session. The real SSHDriver path (handshake, key authorization,
+ * pty and shell) is timed without a Power PMAC, so transport regressions show up on any machine:
+ *      - the time to connect and start gpascii,
+ *      - the round trip time of a status query,
+ *      - the throughput of a program download.
+ *
+ * Usage: loopback_test [-port <port>] [-user <user>] [-keydir <directory of loopback_sshd.sh>]
+ * Run "make loopback" to start the sshd, run this test and stop the sshd.
+ */
+
+#include <iostream>
+#include <string>
+#include <string.h>
+#include "PowerPMACcontrol.h"
+#include "argParser.h"
+
+using namespace PowerPMACcontrol_ns;
+
+#define DEFAULT_KEYDIR		"/tmp/ppmac_loopback"
+#define NUM_CONNECTS		10
+#define NUM_QUERIES			2000
+#define DOWNLOAD_LINES		2000
+#define DOWNLOAD_FILE		"loopback_test.pmc"
+
+static std::string keydir = DEFAULT_KEYDIR;
+static std::string u_user;
+static std::string u_port;
+
+/// Create an SSH transport authorized by the key of the loopback sshd
+static SSHDriver *createDriver()
+{
+	SSHDriver *driver = new SSHDriver("127.0.0.1");
+	driver->setUsername(u_user.c_str());
+	driver->setPort(u_port.c_str());
+	driver->setKeyFiles((keydir + "/id_ecdsa.pub").c_str(), (keydir + "/id_ecdsa").c_str());
+	return driver;
+}
+
+int main(int argc, char *argv[])
+{
+	// Get connection parameters from the command line arguments
+	// Default values are defined in argParser.h
+	argParser args(argc, argv);
+	u_user = args.getUser();
+	u_port = args.getPort();
+	for (int i = 1; i + 1 < argc; i++)
+	{
+		if (strcmp(argv[i], "-keydir") == 0)
+		{
+			keydir = argv[i+1];
+		}
+	}
+
+	PowerPMACcontrol *ppmaccomm = new PowerPMACcontrol();
+
+	double minSecs = 1e9, maxSecs = 0.0, totalSecs = 0.0;
+	for (int i = 0; i < NUM_CONNECTS; i++)
+	{
+		double start = getMonotonicTimeSecs();
+		int estatus = ppmaccomm->PowerPMACcontrol_connectTransport(createDriver());
+		double elapsed = getMonotonicTimeSecs() - start;
+		if (estatus != 0)
+		{
+			printf("Error %d connecting to the loopback sshd on port %s\n", estatus, u_port.c_str());
+			delete ppmaccomm;
+			return 1;
+		}
+		totalSecs += elapsed;
+		minSecs = (elapsed < minSecs) ? elapsed : minSecs;
+		maxSecs = (elapsed > maxSecs) ? elapsed : maxSecs;
+		if (i < NUM_CONNECTS - 1)
+		{
+			ppmaccomm->PowerPMACcontrol_disconnect();
+		}
+	}
+	printf("connect:   mean %8.3f ms  min %8.3f ms  max %8.3f ms  (%d connections)\n",
+			totalSecs / NUM_CONNECTS * 1000.0, minSecs * 1000.0, maxSecs * 1000.0, NUM_CONNECTS);
+
+	uint32_t status;
+	int errors = 0;
+	ppmaccomm->PowerPMACcontrol_resetCommandMetrics();
+	double start = getMonotonicTimeSecs();
+	for (int i = 0; i < NUM_QUERIES; i++)
+	{
+		if (ppmaccomm->PowerPMACcontrol_getGlobalStatus(status) != 0)
+		{
+			errors++;
+		}
+	}
+	double elapsed = getMonotonicTimeSecs() - start;
+	static CommandMetricsSnapshot metrics;
+	ppmaccomm->PowerPMACcontrol_getCommandMetrics(metrics);
+	const LatencyHistogramSnapshot& rtt = metrics.histograms[CommandClassQuery][CommandPhaseTotal];
+	printf("query rtt: p50 %8.3f ms  p99 %8.3f ms  max %8.3f ms  %.0f queries/s  (%d errors)\n",
+			rtt.getPercentileSecs(50) * 1000.0, rtt.getPercentileSecs(99) * 1000.0, rtt.getMaxSecs() * 1000.0,
+			NUM_QUERIES / elapsed, errors);
+
+	FILE *prog = fopen(DOWNLOAD_FILE, "w");
+	size_t bytes = 0;
+	bytes += fprintf(prog, "open prog 10\n");
+	for (int i = 0; i < DOWNLOAD_LINES; i++)
+	{
+		bytes += fprintf(prog, "X%d Y%d\n", i, -i);
+	}
+	bytes += fprintf(prog, "close\n");
+	fclose(prog);
+	start = getMonotonicTimeSecs();
+	int ret = ppmaccomm->PowerPMACcontrol_progDownload(DOWNLOAD_FILE);
+	elapsed = getMonotonicTimeSecs() - start;
+	remove(DOWNLOAD_FILE);
+	printf("download:  %8.3f s  %.0f lines/s  %.1f kB/s  (ret %d)\n",
+			elapsed, (DOWNLOAD_LINES + 2) / elapsed, bytes / elapsed / 1000.0, ret);
+
+	ppmaccomm->PowerPMACcontrol_disconnect();
+	delete ppmaccomm;
+	return (errors == 0 && ret == 0) ? 0 : 1;
+}
@@ -0,0 +1,299 @@
+/*
+ * @file protocol_bench_test.cpp
+ *
+ * Microbenchmarks of the helpers which parse every reply and build every command:
+ * splitit, check_PowerPMAC_error, trim_right_copy, CommandBuilder and the status word decoders.
+ * They run on corpora of realistic replies, without a connection:
+ *      - scalar:           short replies to single variables and "?",
+ *      - motor_status_256: the reply to "#0..255?",
+ *      - buffer_listing:   a 1000 line motion program as listed by "list prog",
+ *      - error:            error replies from gpascii.
+ *
+ * Each helper and corpus prints one line of JSON with the time and the number of heap allocations
+ * and bytes allocated per call. Allocations are counted by replacing the global operator new,
+ * so changes to the parsing path can be compared by allocation count as well as by time.
+ *
+ * The formatting of doubles by CommandBuilder is compared with the printf formats it replaced,
+ * "%f" and "%.2f", and with "%.17g", on positions, gains and table values. Each format prints the
+ * time per value, the mean length and the fraction of values read back exactly.
+ * Run by "make bench".
+ */
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <new>
+#include <stdlib.h>
+#include <math.h>
+#include "PowerPMACcontrol.h"
+#include "protocolHelpers.h"
+
+using namespace PowerPMACcontrol_ns;
+
+#define LISTING_LINES	1000
+
+static unsigned long allocations = 0;
+static unsigned long allocatedBytes = 0;
+
+void *operator new(size_t size)
+{
+	allocations++;
+	allocatedBytes += size;
+	void *p = malloc(size ? size : 1);
+	if (p == NULL)
+	{
+		throw std::bad_alloc();
+	}
+	return p;
+}
+
+void operator delete(void *p) throw()
+{
+	free(p);
+}
+
+/// Result of a helper, kept so the compiler cannot drop the calls
+static volatile unsigned long sink;
+
+/// Corpus of replies; each call of a helper uses the next one in turn
+typedef struct
+{
+	const char *name;
+	std::vector<std::string> replies;
+} Corpus;
+
+/// Time calls of a helper and count their allocations
+class ProtocolBench
+{
+public:
+	typedef void (*Helper)(const std::string& reply);
+
+	static void run(const char *helper, const Corpus& corpus, Helper function, long iterations)
+	{
+		size_t count = corpus.replies.size();
+		for (long i = 0; i < iterations / 10 + 1; i++)
+		{
+			function(corpus.replies[i % count]);
+		}
+		unsigned long startAllocations = allocations;
+		unsigned long startBytes = allocatedBytes;
+		double start = getMonotonicTimeSecs();
+		for (long i = 0; i < iterations; i++)
+		{
+			function(corpus.replies[i % count]);
+		}
+		double elapsed = getMonotonicTimeSecs() - start;
+		printf("{\"helper\":\"%s\",\"corpus\":\"%s\",\"iterations\":%ld,\"ns_per_op\":%.1f,"
+				"\"allocs_per_op\":%.2f,\"bytes_per_op\":%.1f}\n",
+				helper, corpus.name, iterations, elapsed / iterations * 1e9,
+				(double)(allocations - startAllocations) / iterations,
+				(double)(allocatedBytes - startBytes) / iterations);
+		fflush(stdout);
+	}
+
+	static void splitSpaces(const std::string& reply)
+	{
+		std::vector<std::string> strings;
+		splitit(reply, " \n\r", strings);
+		sink += strings.size();
+	}
+
+	static void splitLines(const std::string& reply)
+	{
+		std::vector<std::string> strings;
+		splitit(reply, "\r\n", strings);
+		sink += strings.size();
+	}
+
+	static void checkError(const std::string& reply)
+	{
+		sink += check_PowerPMAC_error(reply);
+	}
+
+	static void trimRight(const std::string& reply)
+	{
+		sink += trim_right_copy(reply).length();
+	}
+
+	static void decode32(const std::string& reply)
+	{
+		uint32_t status;
+		sink += decodeStatus32(reply, status) + status;
+	}
+
+	static void decode64(const std::string& reply)
+	{
+		uint64_t status;
+		sink += decodeStatus64(reply, status) + status;
+	}
+
+	/// The reply to "#0..255?" as getMultiMotorStatus decodes it
+	static void decodeMultiStatus(const std::string& reply)
+	{
+		std::vector<std::string> words;
+		splitit(reply, " ", words);
+		for (size_t i = 0; i < words.size(); i++)
+		{
+			uint64_t status;
+			sink += decodeStatus64(words[i], status) + status;
+		}
+	}
+
+	static void buildQuery(const std::string& name)
+	{
+		CommandBuilder cmd;
+		cmd.append(name).append('\n');
+		sink += cmd.length();
+	}
+
+	static void buildDouble(const std::string& name)
+	{
+		CommandBuilder cmd;
+		cmd.append(name).append('=').append(1234.5678).append('\n');
+		sink += cmd.length();
+	}
+
+	static void buildInt(const std::string& name)
+	{
+		CommandBuilder cmd;
+		cmd.append(name).append('=').append(42).append('\n');
+		sink += cmd.length();
+	}
+};
+
+typedef int (*Formatter)(char *buffer, double value);
+
+static int formatFixed(char *buffer, double value)
+{
+	return sprintf(buffer, "%f", value);
+}
+
+static int formatFixed2(char *buffer, double value)
+{
+	return sprintf(buffer, "%.2f", value);
+}
+
+static int format17g(char *buffer, double value)
+{
+	return sprintf(buffer, "%.17g", value);
+}
+
+/// Time a format of doubles and check how many values it writes exactly
+static void runFormat(const char *format, const char *corpus, const std::vector<double>& values, Formatter function,
+					  long iterations)
+{
+	char buffer[64];
+	size_t count = values.size();
+	size_t exact = 0;
+	size_t length = 0;
+	for (size_t i = 0; i < count; i++)
+	{
+		length += function(buffer, values[i]);
+		exact += (strtod(buffer, NULL) == values[i]) ? 1 : 0;
+	}
+	double start = getMonotonicTimeSecs();
+	for (long i = 0; i < iterations; i++)
+	{
+		sink += function(buffer, values[i % count]);
+	}
+	double elapsed = getMonotonicTimeSecs() - start;
+	printf("{\"format\":\"%s\",\"corpus\":\"%s\",\"iterations\":%ld,\"ns_per_op\":%.1f,"
+			"\"mean_length\":%.1f,\"exact\":%.3f}\n",
+			format, corpus, iterations, elapsed / iterations * 1e9, (double)length / count, (double)exact / count);
+	fflush(stdout);
+}
+
+int main(int argc, char *argv[])
+{
+	Corpus scalar = {"scalar", std::vector<std::string>()};
+	scalar.replies.push_back("0");
+	scalar.replies.push_back("1.5");
+	scalar.replies.push_back("-123.456789012");
+	scalar.replies.push_back("$812345678");
+	scalar.replies.push_back("2.5.4.0");
+
+	Corpus motorStatus = {"motor_status_256", std::vector<std::string>()};
+	std::string words;
+	char word[32];
+	for (int i = 0; i < 256; i++)
+	{
+		sprintf(word, "%s$%08X%08X", (i > 0) ? " " : "", 0x00800000u | (unsigned)i, 0x0C000000u);
+		words += word;
+	}
+	motorStatus.replies.push_back(words);
+
+	Corpus listing = {"buffer_listing", std::vector<std::string>()};
+	std::string lines = "open prog 10\r\n";
+	char line[64];
+	for (int i = 0; i < LISTING_LINES; i++)
+	{
+		sprintf(line, "X%d.%03d Y-%d.%03d F100\r\n", i, i % 1000, i, (i * 7) % 1000);
+		lines += line;
+	}
+	lines += "close\r\n";
+	listing.replies.push_back(lines);
+
+	Corpus errors = {"error", std::vector<std::string>()};
+	errors.replies.push_back("\astdin:1:1: error #20: ILLEGAL CMD: foo");
+	errors.replies.push_back("\astdin:1:1: error #21: ILLEGAL PARAMETER: Motor[999].JogSpeed");
+	errors.replies.push_back("\astdin:12:3: error #1: PROGRAM RUNNING: open prog 10");
+
+	Corpus names = {"variable_names", std::vector<std::string>()};
+	names.replies.push_back("P100");
+	names.replies.push_back("Motor[12].JogSpeed");
+	names.replies.push_back("Coord[3].Tm");
+	names.replies.push_back("Sys.ServoPeriod");
+
+	Corpus globalStatus = {"global_status", std::vector<std::string>()};
+	globalStatus.replies.push_back("$812345678");
+	Corpus singleStatus = {"motor_status", std::vector<std::string>()};
+	singleStatus.replies.push_back("$008000000C000000");
+
+	// Every reply passes through trim_right_copy with its trailing CR LF
+	Corpus trimScalar = scalar, trimMotorStatus = motorStatus, trimListing = listing, trimErrors = errors;
+	Corpus *trimmed[] = {&trimScalar, &trimMotorStatus, &trimListing, &trimErrors};
+	for (size_t i = 0; i < sizeof(trimmed) / sizeof(trimmed[0]); i++)
+	{
+		for (size_t j = 0; j < trimmed[i]->replies.size(); j++)
+		{
+			trimmed[i]->replies[j] += "\r\n";
+		}
+	}
+
+	ProtocolBench::run("splitit", scalar, &ProtocolBench::splitSpaces, 1000000);
+	ProtocolBench::run("splitit", motorStatus, &ProtocolBench::splitSpaces, 10000);
+	ProtocolBench::run("splitit", listing, &ProtocolBench::splitLines, 1000);
+	ProtocolBench::run("check_PowerPMAC_error", scalar, &ProtocolBench::checkError, 1000000);
+	ProtocolBench::run("check_PowerPMAC_error", motorStatus, &ProtocolBench::checkError, 100000);
+	ProtocolBench::run("check_PowerPMAC_error", listing, &ProtocolBench::checkError, 10000);
+	ProtocolBench::run("check_PowerPMAC_error", errors, &ProtocolBench::checkError, 1000000);
+	ProtocolBench::run("trim_right_copy", trimScalar, &ProtocolBench::trimRight, 1000000);
+	ProtocolBench::run("trim_right_copy", trimMotorStatus, &ProtocolBench::trimRight, 100000);
+	ProtocolBench::run("trim_right_copy", trimListing, &ProtocolBench::trimRight, 10000);
+	ProtocolBench::run("trim_right_copy", trimErrors, &ProtocolBench::trimRight, 1000000);
+	ProtocolBench::run("CommandBuilder", names, &ProtocolBench::buildQuery, 1000000);
+	ProtocolBench::run("CommandBuilder_double", names, &ProtocolBench::buildDouble, 1000000);
+	ProtocolBench::run("CommandBuilder_int", names, &ProtocolBench::buildInt, 1000000);
+	ProtocolBench::run("decodeStatus32", globalStatus, &ProtocolBench::decode32, 1000000);
+	ProtocolBench::run("decodeStatus64", singleStatus, &ProtocolBench::decode64, 1000000);
+	ProtocolBench::run("decodeMultiStatus", motorStatus, &ProtocolBench::decodeMultiStatus, 10000);
+
+	// Positions in counts with sub-count parts, servo gains, and compensation table values
+	std::vector<double> positions, gains, table;
+	for (int i = 0; i < 1000; i++)
+	{
+		positions.push_back(i * 137.0 + (i % 8) * 0.125 + (i % 3) * 0.001);
+		gains.push_back(0.01 * (i % 100 + 1));
+		table.push_back(sin(i * 0.001) * 1e-3);
+	}
+	const char *corpora[] = {"positions", "gains", "table"};
+	std::vector<double> *corpusValues[] = {&positions, &gains, &table};
+	for (int i = 0; i < 3; i++)
+	{
+		runFormat("%f", corpora[i], *corpusValues[i], formatFixed, 1000000);
+		runFormat("%.2f", corpora[i], *corpusValues[i], formatFixed2, 1000000);
+		runFormat("%.17g", corpora[i], *corpusValues[i], format17g, 1000000);
+		runFormat("CommandBuilder", corpora[i], *corpusValues[i], CommandBuilder::formatDouble, 1000000);
+	}
+	return 0;
+}
@@ -0,0 +1,116 @@
+/*
+ * @file replay_test.cpp
+ *
+ * Connect to the Power PMAC with recording on and send a fixed sequence of commands,
+ * then disconnect and play the session log back twice: with the original timing and
+ * as fast as possible. The replies and the time taken are printed for each run, and the
+ * replays report any command which differed from the recording.
+ * A log whose only record claims 4 GB of data is also played back, which must not allocate it.
+ */
+
+#include <iostream>
+#include <string>
+#include "PowerPMACcontrol.h"
+#include "argParser.h"
+#include "sessionRecorder.h"
+
+using namespace PowerPMACcontrol_ns;
+
+#define LOG_FILE	"replay_test.log"
+#define CORRUPT_LOG_FILE	"replay_test_corrupt.log"
+
+/// Send the same commands in each run and print the replies
+static void runCommands(PowerPMACcontrol *ppmaccomm)
+{
+	static const char *commands[] = {"Sys.Time", "Sys.ServoPeriod", "#1p", "P1=5", "P1", "NotAVariable"};
+	std::string reply;
+	double start = getMonotonicTimeSecs();
+	for (size_t i = 0; i < sizeof(commands)/sizeof(commands[0]); i++)
+	{
+		int ret = ppmaccomm->PowerPMACcontrol_sendCommand(commands[i], reply);
+		printf("  %-16s ret %4d reply [%s]\n", commands[i], ret, reply.c_str());
+	}
+	uint32_t status;
+	for (int i = 0; i < 100; i++)
+	{
+		ppmaccomm->PowerPMACcontrol_getGlobalStatus(status);
+	}
+	printf("  took %.3f s\n", getMonotonicTimeSecs() - start);
+}
+
+static void replay(double speed)
+{
+	PowerPMACcontrol *ppmaccomm = new PowerPMACcontrol();
+	printf("Replay at speed %.1f:\n", speed);
+	int estatus = ppmaccomm->PowerPMACcontrol_connectReplay(LOG_FILE, speed);
+	if (estatus != 0)
+	{
+		printf("Error %d replaying %s\n", estatus, LOG_FILE);
+	}
+	else
+	{
+		runCommands(ppmaccomm);
+		unsigned long mismatches;
+		bool finished;
+		ppmaccomm->PowerPMACcontrol_getReplayStatus(mismatches, finished);
+		printf("  %lu mismatches, %s\n", mismatches, finished ? "finished" : "not finished");
+		ppmaccomm->PowerPMACcontrol_disconnect();
+	}
+	delete ppmaccomm;
+}
+
+/// Play back a log with a length larger than the file, as a corrupt or truncated log has
+static void replayCorrupt()
+{
+	static const unsigned char record[] = {0, 0, 0xFF, 0xFF, 0xFF, 0xFF, 0x0F, 'P', '1'};
+	FILE *file = fopen(CORRUPT_LOG_FILE, "wb");
+	if (file == NULL)
+	{
+		printf("Error creating %s\n", CORRUPT_LOG_FILE);
+		return;
+	}
+	fwrite(SESSION_LOG_MAGIC, 1, SESSION_LOG_MAGIC_LENGTH, file);
+	fputc(SESSION_LOG_VERSION, file);
+	fwrite(record, 1, sizeof(record), file);
+	fclose(file);
+
+	PowerPMACcontrol *ppmaccomm = new PowerPMACcontrol();
+	int estatus = ppmaccomm->PowerPMACcontrol_connectReplay(CORRUPT_LOG_FILE, 0.0);
+	printf("Replay of a log with a corrupt length: ret %d\n", estatus);
+	ppmaccomm->PowerPMACcontrol_disconnect();
+	delete ppmaccomm;
+	remove(CORRUPT_LOG_FILE);
+}
+
+int main(int argc, char *argv[])
+{
+	// Get connection parameters from the command line arguments
+	// Default values are defined in argParser.h
+	argParser args(argc, argv);
+
+	std::string u_ipaddr 	= args.getIp();
+	std::string u_user 		= args.getUser();
+	std::string u_passw		= args.getPassw();
+	std::string u_port		= args.getPort();
+	bool 		u_nominus2	= args.getNominus2();
+
+	replayCorrupt();
+
+	PowerPMACcontrol *ppmaccomm = new PowerPMACcontrol();
+	ppmaccomm->PowerPMACcontrol_setRecordFile(LOG_FILE);
+	int estatus = ppmaccomm->PowerPMACcontrol_connect( u_ipaddr.c_str(), u_user.c_str() , u_passw.c_str(), u_port.c_str(), u_nominus2);
+	if (estatus != 0)
+	{
+		printf("Error connecting to power pmac. exit:\n");
+		delete ppmaccomm;
+		return 0;
+	}
+	printf("Recording to %s:\n", LOG_FILE);
+	runCommands(ppmaccomm);
+	ppmaccomm->PowerPMACcontrol_disconnect();
+	delete ppmaccomm;
+
+	replay(1.0);
+	replay(0.0);
+	return 0;
+}
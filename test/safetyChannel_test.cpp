@@ -0,0 +1,164 @@
+/*
+ * @file safetyChannel_test.cpp
+ *
+ * Connect to the Power PMAC with the safety channel open and measure the latency of
+ * PowerPMACcontrol_abortAllMprogs while another thread keeps the main connection busy
+ * downloading a long motion program. The latency of a status query on the main connection
+ * is measured at the same time for comparison.
+ *
+ * The test program is downloaded to motion program 99 and every coordinate system is
+ * aborted repeatedly, so only run this on a controller which is not in use.
+ */
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <pthread.h>
+#include "PowerPMACcontrol.h"
+#include "argParser.h"
+
+using namespace PowerPMACcontrol_ns;
+
+#define TEST_PROGRAM_FILE	"safetyChannel_test.pmc"
+#define TEST_PROGRAM_LINES	5000
+#define NUM_MEASUREMENTS	50
+
+static PowerPMACcontrol *ppmaccomm;
+static volatile bool downloading = true;
+
+struct Latency
+{
+	double min, max, total;
+	int count, errors;
+};
+
+static void initLatency(Latency& latency)
+{
+	latency.min = 1e9;
+	latency.max = 0.0;
+	latency.total = 0.0;
+	latency.count = 0;
+	latency.errors = 0;
+}
+
+static void addLatency(Latency& latency, double secs, int status)
+{
+	if (status != PowerPMACcontrol::PPMACcontrolNoError)
+	{
+		latency.errors++;
+		return;
+	}
+	if (secs < latency.min) latency.min = secs;
+	if (secs > latency.max) latency.max = secs;
+	latency.total += secs;
+	latency.count++;
+}
+
+static void printLatency(const char *name, const Latency& latency)
+{
+	if (latency.count == 0)
+	{
+		printf("%-28s no successful calls, %d errors\n", name, latency.errors);
+		return;
+	}
+	printf("%-28s min %8.2f ms  mean %8.2f ms  max %8.2f ms  (%d calls, %d errors)\n", name,
+			latency.min*1000.0, latency.total/latency.count*1000.0, latency.max*1000.0,
+			latency.count, latency.errors);
+}
+
+static bool writeTestProgram()
+{
+	std::ofstream prog(TEST_PROGRAM_FILE);
+	if (!prog.is_open())
+		return false;
+	prog << "open prog 99" << std::endl;
+	for (int i = 0; i < TEST_PROGRAM_LINES; i++)
+	{
+		prog << "P1000=" << i << std::endl;
+	}
+	prog << "close" << std::endl;
+	return true;
+}
+
+void *downloadProgram(void *arg)
+{
+	while (downloading)
+	{
+		int ret = ppmaccomm->PowerPMACcontrol_progDownload(TEST_PROGRAM_FILE);
+		if (ret != PowerPMACcontrol::PPMACcontrolNoError)
+		{
+			printf("download error %d\n", ret);
+		}
+	}
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	// Get connection parameters from the command line arguments
+	// Default values are defined in argParser.h
+	argParser args(argc, argv);
+
+	std::string u_ipaddr 	= args.getIp();
+	std::string u_user 		= args.getUser();
+	std::string u_passw		= args.getPassw();
+	std::string u_port		= args.getPort();
+	bool 		u_nominus2	= args.getNominus2();
+
+	if (!writeTestProgram())
+	{
+		printf("Error writing %s. exit:\n", TEST_PROGRAM_FILE);
+		return 0;
+	}
+
+	ppmaccomm = new PowerPMACcontrol();
+	int estatus = ppmaccomm->PowerPMACcontrol_connect( u_ipaddr.c_str(), u_user.c_str() , u_passw.c_str(), u_port.c_str(), u_nominus2, true);
+	if (estatus != 0)
+	{
+		printf("Error connecting to power pmac with the safety channel (%d). exit:\n", estatus);
+		return 0;
+	}
+	else
+	{
+		printf("Connected OK. Safety channel open: %s\n", ppmaccomm->PowerPMACcontrol_isSafetyChannelOpen() ? "yes" : "no");
+	}
+
+	Latency abortLatency, statusLatency;
+	initLatency(abortLatency);
+	initLatency(statusLatency);
+
+	pthread_t downloadThread;
+	pthread_create(&downloadThread, NULL, &downloadProgram, NULL);
+	sleep(1);
+
+	for (int i = 0; i < NUM_MEASUREMENTS; i++)
+	{
+		double start = getMonotonicTimeSecs();
+		int ret = ppmaccomm->PowerPMACcontrol_abortAllMprogs();
+		addLatency(abortLatency, getMonotonicTimeSecs() - start, ret);
+
+		uint32_t status;
+		start = getMonotonicTimeSecs();
+		ret = ppmaccomm->PowerPMACcontrol_getGlobalStatus(status);
+		addLatency(statusLatency, getMonotonicTimeSecs() - start, ret);
+
+		usleep(100000);
+	}
+
+	downloading = false;
+	pthread_join(downloadThread, NULL);
+
+	printf("\nLatency during a concurrent download:\n");
+	printLatency("abortAllMprogs (safety)", abortLatency);
+	printLatency("getGlobalStatus (main)", statusLatency);
+
+	RequestQueueStatistics queueStats;
+	ppmaccomm->PowerPMACcontrol_getQueueStatistics(queueStats);
+	printf("\nRequest queue: normal max wait %.2f ms, bulk max wait %.2f ms\n",
+			queueStats.lanes[RequestPriorityNormal].maxWaitSecs*1000.0,
+			queueStats.lanes[RequestPriorityBulk].maxWaitSecs*1000.0);
+
+	ppmaccomm->PowerPMACcontrol_disconnect();
+	delete ppmaccomm;
+	return 0;
+}
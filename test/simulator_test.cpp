@@ -0,0 +1,462 @@
+/*
+ * @file simulator_test.cpp
+ *
+ * Run the PowerPMACcontrol API against the simulated Power PMAC (sim://) and check the results,
+ * so it runs on any machine without a controller.
+ */
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <math.h>
+#include <string.h>
+#include <pthread.h>
+#include "PowerPMACcontrol.h"
+#include "pmacSimulator.h"
+#include "argParser.h"
+#include "testCheck.h"
+
+using namespace PowerPMACcontrol_ns;
+
+#define NUM_THREADS	4
+#define NUM_WRITES	200
+
+static PowerPMACcontrol *ppmaccomm;
+static void uploadToString(const char *data, size_t length, void *userData)
+{
+	((std::string *)userData)->append(data, length);
+}
+
+/// Each thread writes and reads back its own P-variables
+void *writeVariables(void *arg)
+{
+	long thread = (long)arg;
+	for (int i = 0; i < NUM_WRITES; i++)
+	{
+		char name[32];
+		sprintf(name, "P%ld", 1000 * (thread + 1) + i);
+		double value = -1;
+		if (ppmaccomm->PowerPMACcontrol_setVariable(std::string(name), i * 0.5) != 0 ||
+			ppmaccomm->PowerPMACcontrol_getVariable(std::string(name), value) != 0 || value != i * 0.5)
+		{
+			return (void *)1;
+		}
+	}
+	return 0;
+}
+
+/// Arguments and result of downloadInBackground
+struct BackgroundDownload
+{
+	PowerPMACcontrol *ppmac;
+	std::string program;
+	volatile bool finished;
+	int result;
+};
+
+/// Download a program on its own thread, so that another command can be sent while it runs
+void *downloadInBackground(void *arg)
+{
+	BackgroundDownload *download = (BackgroundDownload *)arg;
+	int errorLine;
+	download->result = download->ppmac->PowerPMACcontrol_progDownload(download->program.data(), download->program.length(), errorLine);
+	download->finished = true;
+	return 0;
+}
+
+/// Each thread stops the task usage sampling, so that the stops overlap
+void *stopSampling(void *arg)
+{
+	return (void *)(long)ppmaccomm->PowerPMACcontrol_stopTaskUsageSampling();
+}
+
+int main(int argc, char *argv[])
+{
+	argParser args(argc, argv);
+	std::string u_ipaddr = args.getIp();
+	if (u_ipaddr.compare(0, 6, "sim://") != 0)
+	{
+		u_ipaddr = "sim://";
+	}
+
+	ppmaccomm = new PowerPMACcontrol();
+	int ret = ppmaccomm->PowerPMACcontrol_connect(u_ipaddr.c_str(), "root", "deltatau", "22", false, true);
+	check("connect with a safety channel", ret == 0 && ppmaccomm->PowerPMACcontrol_isSafetyChannelOpen());
+	if (ret != 0)
+	{
+		delete ppmaccomm;
+		return 1;
+	}
+
+	std::string reply;
+	check("sendCommand P1=5", ppmaccomm->PowerPMACcontrol_sendCommand("P1=5", reply) == 0);
+	check("sendCommand P1", ppmaccomm->PowerPMACcontrol_sendCommand("P1", reply) == 0 && reply == "5");
+	check("unknown command returns error 20", ppmaccomm->PowerPMACcontrol_sendCommand("NotAVariable", reply) == -20);
+	check("index out of range returns error 21", ppmaccomm->PowerPMACcontrol_sendCommand("Motor[1000].Pos", reply) == -21);
+
+	std::string vers;
+	check("getVers", ppmaccomm->PowerPMACcontrol_getVers(vers) == 0 && !vers.empty());
+	uint32_t globalStatus;
+	check("getGlobalStatus", ppmaccomm->PowerPMACcontrol_getGlobalStatus(globalStatus) == 0);
+
+	double d1, d2;
+	check("axisSetVelocity", ppmaccomm->PowerPMACcontrol_axisSetVelocity(1, 100) == 0);
+	check("axisGetVelocity", ppmaccomm->PowerPMACcontrol_axisGetVelocity(1, d1) == 0 && d1 == 100);
+	check("axisSetSoftwareLimits", ppmaccomm->PowerPMACcontrol_axisSetSoftwareLimits(1, 50, -50) == 0);
+	check("axisGetSoftwareLimits", ppmaccomm->PowerPMACcontrol_axisGetSoftwareLimits(1, d1, d2) == 0 && d1 == 50 && d2 == -50);
+
+	// Numbers are sent exactly, in as few digits as possible, and a command too long is not sent
+	CommandBuilder builder;
+	builder.append("#").append(1).append("j=").append(20.0025).append(' ').append(1000000.0).append(' ').append(0.1f);
+	check("CommandBuilder", builder.length() == 23 && strcmp(builder.c_str(), "#1j=20.0025 1000000 0.1") == 0 &&
+		  !builder.overflowed());
+	builder.append(std::string(CommandBuilder::CAPACITY, 'x'));
+	check("CommandBuilder leaves out text which does not fit", builder.overflowed() && builder.length() == 23 &&
+		  builder.append('x').length() == 23);
+	builder.clear();
+	check("CommandBuilder clear", builder.length() == 0 && !builder.overflowed() && builder.c_str()[0] == '\0');
+	check("setVariable writes doubles exactly", ppmaccomm->PowerPMACcontrol_setVariable("P2", 0.1 + 0.2) == 0 &&
+		  ppmaccomm->PowerPMACcontrol_getVariable("P2", d1) == 0 && d1 == 0.1 + 0.2);
+	check("setVariable of a name too long", ppmaccomm->PowerPMACcontrol_setVariable(std::string(2000, 'P'), 1) ==
+		  PowerPMACcontrol::PPMACcontrolCommandTooLongError);
+	check("axisMoveAbs to a fraction of a hundredth", ppmaccomm->PowerPMACcontrol_axisSetVelocity(1, 100) == 0 &&
+		  ppmaccomm->PowerPMACcontrol_axisMoveAbs(1, 0.004) == 0);
+	usleep(10000);
+	check("axisMoveAbs is not rounded", ppmaccomm->PowerPMACcontrol_axisGetCurrentPosition(1, d1) == 0 && d1 == 0.004);
+
+	// At 100 units per ms the moves take less than a millisecond
+	check("axisMoveAbs", ppmaccomm->PowerPMACcontrol_axisMoveAbs(1, 20) == 0);
+	usleep(10000);
+	check("axisGetCurrentPosition after a move", ppmaccomm->PowerPMACcontrol_axisGetCurrentPosition(1, d1) == 0 && d1 == 20);
+	check("axisMoveRel", ppmaccomm->PowerPMACcontrol_axisMoveRel(1, -5) == 0);
+	usleep(10000);
+	check("axisGetCurrentPosition after a relative move", ppmaccomm->PowerPMACcontrol_axisGetCurrentPosition(1, d1) == 0 && d1 == 15);
+	check("axisMovePositive", ppmaccomm->PowerPMACcontrol_axisMovePositive(1) == 0);
+	usleep(10000);
+	uint64_t status;
+	check("jog stops at the soft limit", ppmaccomm->PowerPMACcontrol_axisGetCurrentPosition(1, d1) == 0 && d1 == 50 &&
+		  ppmaccomm->PowerPMACcontrol_getMotorStatus(1, status) == 0 && (status & SIM_MOTOR_SOFT_PLUS_LIMIT) != 0);
+	check("axisDefCurrentPos", ppmaccomm->PowerPMACcontrol_axisDefCurrentPos(1, 3) == 0 &&
+		  ppmaccomm->PowerPMACcontrol_axisGetCurrentPosition(1, d1) == 0 && d1 == 3);
+	check("axisHome", ppmaccomm->PowerPMACcontrol_axisHome(1) == 0);
+	usleep(10000);
+	check("home complete", ppmaccomm->PowerPMACcontrol_getMotorStatus(1, status) == 0 && (status & SIM_MOTOR_HOME_COMPLETE) != 0);
+
+	// Slow motor 2 down so that it is still moving when stopped
+	ppmaccomm->PowerPMACcontrol_axisSetVelocity(2, 0.001);
+	ppmaccomm->PowerPMACcontrol_axisMoveAbs(2, 1000);
+	check("moving motor has no in position bit", ppmaccomm->PowerPMACcontrol_getMotorStatus(2, status) == 0 && (status & SIM_MOTOR_IN_POS) == 0);
+	check("axisStop", ppmaccomm->PowerPMACcontrol_axisStop(2) == 0 &&
+		  ppmaccomm->PowerPMACcontrol_getMotorStatus(2, status) == 0 && (status & SIM_MOTOR_IN_POS) != 0);
+	check("stopAllAxes on the safety channel kills the motors", ppmaccomm->PowerPMACcontrol_stopAllAxes() == 0 &&
+		  ppmaccomm->PowerPMACcontrol_getMotorStatus(1, status) == 0 && (status & SIM_MOTOR_AMP_ENA) == 0);
+	bool powered;
+	check("motorPowered", ppmaccomm->PowerPMACcontrol_motorPowered(1, powered) == 0 && powered);
+
+	std::vector<double> positions;
+	check("axesGetCurrentPositions", ppmaccomm->PowerPMACcontrol_axesGetCurrentPositions(1, 4, positions) == 0 && positions.size() == 4);
+	std::vector<uint64_t> statuses;
+	check("getMultiMotorStatus", ppmaccomm->PowerPMACcontrol_getMultiMotorStatus(1, 8, statuses) == 0 && statuses.size() == 8);
+
+	bool active, running;
+	check("enablePlc", ppmaccomm->PowerPMACcontrol_enablePlc(3) == 0 &&
+		  ppmaccomm->PowerPMACcontrol_plcState(3, active, running) == 0 && active && running);
+	check("disablePlc", ppmaccomm->PowerPMACcontrol_disablePlc(3) == 0 &&
+		  ppmaccomm->PowerPMACcontrol_plcState(3, active, running) == 0 && !active && !running);
+
+	FILE *prog = fopen("simulator_test.pmc", "w");
+	fprintf(prog, "open prog 7\nlinear\nX10\nclose\n");
+	fclose(prog);
+	int num;
+	std::vector<std::string> names;
+	check("progDownload", ppmaccomm->PowerPMACcontrol_progDownload("simulator_test.pmc") == 0);
+	check("getProgNames", ppmaccomm->PowerPMACcontrol_getProgNames(num, names) == 0 && num == 1 && names[0] == "prog7");
+	remove("simulator_test.pmc");
+
+	int sent, skipped;
+	prog = fopen("simulator_test.pmc", "w");
+	fprintf(prog, "open prog 8\nX1\nclose\nopen plc 4\nP10=1\nclose\n");
+	fclose(prog);
+	check("progDownloadIncremental sends new blocks",
+		  ppmaccomm->PowerPMACcontrol_progDownloadIncremental("simulator_test.pmc", sent, skipped) == 0 && sent == 2 && skipped == 0);
+	check("progDownloadIncremental skips unchanged blocks",
+		  ppmaccomm->PowerPMACcontrol_progDownloadIncremental("simulator_test.pmc", sent, skipped) == 0 && sent == 0 && skipped == 2);
+	prog = fopen("simulator_test.pmc", "w");
+	fprintf(prog, "open prog 8\nX1\nclose\nopen plc 4\nP10=2\nclose\n");
+	fclose(prog);
+	check("progDownloadIncremental sends changed blocks",
+		  ppmaccomm->PowerPMACcontrol_progDownloadIncremental("simulator_test.pmc", sent, skipped) == 0 && sent == 1 && skipped == 1);
+	check("clearDownloadCache", ppmaccomm->PowerPMACcontrol_clearDownloadCache() == 0 &&
+		  ppmaccomm->PowerPMACcontrol_progDownloadIncremental("simulator_test.pmc", sent, skipped) == 0 && sent == 2 && skipped == 0);
+	remove("simulator_test.pmc");
+
+	int errorLine;
+	check("setDownloadWindow rejects 0", ppmaccomm->PowerPMACcontrol_setDownloadWindow(0) != 0);
+	check("setDownloadWindow", ppmaccomm->PowerPMACcontrol_setDownloadWindow(16) == 0);
+	prog = fopen("simulator_test.pmc", "w");
+	fprintf(prog, "open prog 9\n");
+	for (int i = 0; i < 1000; i++)
+	{
+		fprintf(prog, "X%d\n", i);
+	}
+	fprintf(prog, "close\n");
+	fclose(prog);
+	check("windowed progDownload", ppmaccomm->PowerPMACcontrol_progDownload("simulator_test.pmc", errorLine) == 0 && errorLine == 0 &&
+		  ppmaccomm->PowerPMACcontrol_sendCommand("buffer", reply) == 0 && reply.find("prog9 lines:1000") != std::string::npos);
+	prog = fopen("simulator_test.pmc", "w");
+	fprintf(prog, "P1=1\nP2=2\n\nfoo\nP5=5\n");
+	fclose(prog);
+	check("windowed progDownload reports the failing line",
+		  ppmaccomm->PowerPMACcontrol_progDownload("simulator_test.pmc", errorLine) == -20 && errorLine == 4);
+	check("connection usable after a failed windowed download",
+		  ppmaccomm->PowerPMACcontrol_getVariable("P2", d1) == 0 && d1 == 2);
+	ppmaccomm->PowerPMACcontrol_setDownloadWindow(1);
+	check("progDownload reports the failing line",
+		  ppmaccomm->PowerPMACcontrol_progDownload("simulator_test.pmc", errorLine) == -20 && errorLine == 4);
+	remove("simulator_test.pmc");
+
+	const char program[] = "open prog 12\nX1\nX2\nclose";
+	check("progDownload from memory", ppmaccomm->PowerPMACcontrol_progDownload(program, strlen(program), errorLine) == 0 &&
+		  ppmaccomm->PowerPMACcontrol_sendCommand("buffer", reply) == 0 && reply.find("prog12 lines:2") != std::string::npos);
+	check("progDownload from memory reports the failing line",
+		  ppmaccomm->PowerPMACcontrol_progDownload("P1=1\r\nfoo\r\n", 11, errorLine) == -20 && errorLine == 2);
+	std::istringstream stream("open prog 13\nX1\nclose\n");
+	check("progDownload from a stream", ppmaccomm->PowerPMACcontrol_progDownload(stream, errorLine) == 0 &&
+		  ppmaccomm->PowerPMACcontrol_sendCommand("buffer", reply) == 0 && reply.find("prog13 lines:1") != std::string::npos);
+	std::vector<std::string> programLines;
+	programLines.push_back("open prog 14");
+	for (int i = 0; i < 100; i++)
+	{
+		programLines.push_back("X1");
+	}
+	programLines.push_back("close");
+	check("progDownloadLines", ppmaccomm->PowerPMACcontrol_progDownloadLines(programLines.begin(), programLines.end(), errorLine) == 0 &&
+		  ppmaccomm->PowerPMACcontrol_sendCommand("buffer", reply) == 0 && reply.find("prog14 lines:100") != std::string::npos);
+
+	check("setDownloadPreprocessing rejects unknown options", ppmaccomm->PowerPMACcontrol_setDownloadPreprocessing(16) != 0);
+	check("setDownloadPreprocessing", ppmaccomm->PowerPMACcontrol_setDownloadPreprocessing(PreprocessAll, 40) == 0);
+	const char commented[] = "// Test program\nopen prog 15\n  /* start\n     position */\n  X1   Y1\n  P1=1 // first\n\n"
+							 "  P2+=P1\n  if (P1 > 0) {\n    X4\n  }\nclose\n";
+	check("preprocessed progDownload joins the assignments",
+		  ppmaccomm->PowerPMACcontrol_progDownload(commented, strlen(commented), errorLine) == 0 &&
+		  ppmaccomm->PowerPMACcontrol_sendCommand("buffer", reply) == 0 && reply.find("prog15 lines:5") != std::string::npos);
+	// Moves on one line are made together, so one after the other they are not joined
+	const char moves[] = "open prog 19\nlinear\nabs\nX10\nY20\ndwell 100\nX0 Y0\nclose\n";
+	check("preprocessed progDownload keeps the moves apart",
+		  ppmaccomm->PowerPMACcontrol_progDownload(moves, strlen(moves), errorLine) == 0 &&
+		  ppmaccomm->PowerPMACcontrol_sendCommand("buffer", reply) == 0 && reply.find("prog19 lines:6") != std::string::npos);
+	const char twoMoves[] = "open prog 20\nX10\nY20\nclose\n";
+	check("preprocessed progDownload sends X10 and Y20 as two lines",
+		  ppmaccomm->PowerPMACcontrol_progDownload(twoMoves, strlen(twoMoves), errorLine) == 0 &&
+		  ppmaccomm->PowerPMACcontrol_sendCommand("buffer", reply) == 0 && reply.find("prog20 lines:2") != std::string::npos);
+	const char unbalanced[] = "open prog 16\nif (P1 > 0 {\nX1\n}\nclose\n";
+	check("preprocessing rejects unbalanced brackets",
+		  ppmaccomm->PowerPMACcontrol_progDownload(unbalanced, strlen(unbalanced), errorLine) ==
+		  PowerPMACcontrol::PPMACcontrolProgramSyntaxError && errorLine == 2 &&
+		  ppmaccomm->PowerPMACcontrol_sendCommand("buffer", reply) == 0 && reply.find("prog16") == std::string::npos);
+	const char nested[] = "open prog 16\nX1\nopen prog 17\nclose\n";
+	check("preprocessing rejects an open inside a buffer",
+		  ppmaccomm->PowerPMACcontrol_progDownload(nested, strlen(nested), errorLine) ==
+		  PowerPMACcontrol::PPMACcontrolProgramSyntaxError && errorLine == 3);
+	ppmaccomm->PowerPMACcontrol_setDownloadPreprocessing(PreprocessStripComments | PreprocessStripWhitespace);
+	const char failing[] = "P1=1\n// comment\n\n  P2=2\nfoo\nP3=3\n";
+	check("preprocessed progDownload reports the line in the program",
+		  ppmaccomm->PowerPMACcontrol_progDownload(failing, strlen(failing), errorLine) == -20 && errorLine == 5);
+	prog = fopen("simulator_test.pmc", "w");
+	fputs(failing, prog);
+	fclose(prog);
+	check("preprocessed progDownloadFile reports the line in the program",
+		  ppmaccomm->PowerPMACcontrol_progDownloadFile("simulator_test.pmc", errorLine) == -20 && errorLine == 5);
+	remove("simulator_test.pmc");
+	ppmaccomm->PowerPMACcontrol_setDownloadPreprocessing(PreprocessNone);
+
+	std::string listing;
+	char line[64];
+	check("progUpload", ppmaccomm->PowerPMACcontrol_progUpload("prog 14", uploadToString, &listing) == 0 &&
+		  listing.length() == 300 && listing.compare(0, 6, "X1\nX1\n") == 0);
+	std::string longProgram = "open prog 18\n";
+	for (int i = 0; i < 2000; i++)
+	{
+		sprintf(line, "X%d\n", i);
+		longProgram += line;
+	}
+	longProgram += "close\n";
+	listing.clear();
+	check("progUpload of a listing longer than a reply",
+		  ppmaccomm->PowerPMACcontrol_progDownload(longProgram.data(), longProgram.length(), errorLine) == 0 &&
+		  ppmaccomm->PowerPMACcontrol_progUpload("prog 18", uploadToString, &listing) == 0 && listing.length() > 5120 &&
+		  listing == longProgram.substr(13, longProgram.length() - 19));
+	std::ostringstream uploaded;
+	check("progUpload to a stream", ppmaccomm->PowerPMACcontrol_progUpload("PROG 12", uploaded) == 0 &&
+		  uploaded.str() == "X1\nX2\n");
+	check("progUpload to a file", ppmaccomm->PowerPMACcontrol_progUpload("prog 13", "simulator_test.pmc") == 0 &&
+		  (prog = fopen("simulator_test.pmc", "r")) != NULL && fgets(line, sizeof(line), prog) != NULL &&
+		  strcmp(line, "X1\n") == 0 && fgets(line, sizeof(line), prog) == NULL);
+	if (prog != NULL)
+	{
+		fclose(prog);
+	}
+	remove("simulator_test.pmc");
+	check("progUpload of a missing program", ppmaccomm->PowerPMACcontrol_progUpload("prog 99", uploaded) == -21 &&
+		  ppmaccomm->PowerPMACcontrol_getVariable("P2", d1) == 0 && d1 == 2);
+	check("progUpload rejects an empty name", ppmaccomm->PowerPMACcontrol_progUpload(" ", uploaded) ==
+		  PowerPMACcontrol::PPMACcontrolInvalidParamError);
+
+	prog = fopen("simulator_test.pmc", "w");
+	fprintf(prog, "open prog 11\n");
+	for (int i = 0; i < 1000; i++)
+	{
+		fprintf(prog, "X%d\n", i);
+	}
+	fclose(prog);
+	check("progDownloadFile adds the close", ppmaccomm->PowerPMACcontrol_progDownloadFile("simulator_test.pmc", errorLine) == 0 &&
+		  errorLine == 0 && ppmaccomm->PowerPMACcontrol_sendCommand("buffer", reply) == 0 &&
+		  reply.find("prog11 lines:1000") != std::string::npos);
+	prog = fopen("simulator_test.pmc", "w");
+	fprintf(prog, "P1=3\n\nfoo\nP4=4");
+	fclose(prog);
+	check("progDownloadFile reports the failing line",
+		  ppmaccomm->PowerPMACcontrol_progDownloadFile("simulator_test.pmc", errorLine) == -20 && errorLine == 3);
+	check("progDownloadFile loads the lines after the failing line",
+		  ppmaccomm->PowerPMACcontrol_getVariable("P4", d1) == 0 && d1 == 4);
+	remove("simulator_test.pmc");
+	check("progDownloadFile of a missing file", ppmaccomm->PowerPMACcontrol_progDownloadFile("simulator_test.pmc") ==
+		  PowerPMACcontrol::PPMACcontrolFileOpenError);
+	check("run a program", ppmaccomm->PowerPMACcontrol_sendCommand("&2b7r", reply) == 0 &&
+		  ppmaccomm->PowerPMACcontrol_mprogState(2, active, running) == 0 && active && running);
+	check("abortMprog", ppmaccomm->PowerPMACcontrol_abortMprog(2) == 0 &&
+		  ppmaccomm->PowerPMACcontrol_getCoordStatus(2, status) == 0 && (status & SIM_COORD_PROG_RUNNING) == 0);
+
+	check("getCPUTemperature", ppmaccomm->PowerPMACcontrol_getCPUTemperature(d1) == 0 && d1 > 0);
+	check("getRunningTime", ppmaccomm->PowerPMACcontrol_getRunningTime(d1) == 0 && d1 >= 0);
+	double phase, servo, rtint, bg, cpu;
+	check("getTaskUsage", ppmaccomm->PowerPMACcontrol_getTaskUsage(phase, servo, rtint, bg, cpu) == 0 && cpu > 0 && cpu < 100);
+
+	pthread_t threads[NUM_THREADS];
+	bool stopsPassed = true;
+	for (int round = 0; round < 20 && stopsPassed; round++)
+	{
+		stopsPassed = ppmaccomm->PowerPMACcontrol_startTaskUsageSampling(10, 100) == 0;
+		for (long i = 0; i < NUM_THREADS; i++)
+		{
+			pthread_create(&threads[i], NULL, stopSampling, NULL);
+		}
+		for (int i = 0; i < NUM_THREADS; i++)
+		{
+			void *result;
+			pthread_join(threads[i], &result);
+			stopsPassed = stopsPassed && result == 0;
+		}
+	}
+	// Left running, to be stopped by the destructor
+	check("stopTaskUsageSampling from several threads at once", stopsPassed &&
+		  ppmaccomm->PowerPMACcontrol_startTaskUsageSampling(10, 100) == 0);
+	std::vector<TaskUsageSample> samples;
+	double reconnectStart = getMonotonicTimeSecs();
+	ret = ppmaccomm->PowerPMACcontrol_connect(u_ipaddr.c_str(), "root", "deltatau", "22", false, true);
+	double reconnectSecs = getMonotonicTimeSecs() - reconnectStart;
+	usleep(100000);
+	check("reconnect while sampling keeps the sampling running", ret == 0 && reconnectSecs < 0.5 &&
+		  ppmaccomm->PowerPMACcontrol_getTaskUsageHistory(samples) == 0 && !samples.empty());
+
+	for (long i = 0; i < NUM_THREADS; i++)
+	{
+		pthread_create(&threads[i], NULL, writeVariables, (void *)i);
+	}
+	bool threadsPassed = true;
+	for (int i = 0; i < NUM_THREADS; i++)
+	{
+		void *result;
+		pthread_join(threads[i], &result);
+		if (result != 0)
+		{
+			threadsPassed = false;
+		}
+	}
+	check("P-variables written and read from several threads", threadsPassed);
+
+	// More variables than fit in one query or one line, with runs of equal values set by range
+	std::vector<double> table(1200);
+	for (size_t i = 0; i < table.size(); i++)
+	{
+		table[i] = (i % 100 < 40) ? 0 : i * 0.25 - 100;
+	}
+	std::vector<double> tableRead;
+	check("setVariableRange", ppmaccomm->PowerPMACcontrol_setVariableRange('P', 1000, table) == 0);
+	check("getVariableRange", ppmaccomm->PowerPMACcontrol_getVariableRange('P', 1000, (int)table.size(), tableRead) == 0 &&
+		  tableRead == table);
+	std::vector<double> qValues(3, 1.5);
+	qValues.push_back(-2);
+	check("Q-variable range", ppmaccomm->PowerPMACcontrol_setVariableRange('q', 10, qValues) == 0 &&
+		  ppmaccomm->PowerPMACcontrol_getVariableRange('Q', 10, 4, tableRead) == 0 && tableRead == qValues);
+	check("M- and L-variable ranges", ppmaccomm->PowerPMACcontrol_setVariableRange('M', 100, qValues) == 0 &&
+		  ppmaccomm->PowerPMACcontrol_setVariableRange('L', 100, table) == 0 &&
+		  ppmaccomm->PowerPMACcontrol_getVariableRange('L', 100, (int)table.size(), tableRead) == 0 && tableRead == table);
+	check("getVariableRange out of range", ppmaccomm->PowerPMACcontrol_getVariableRange('P', 65500, 100, tableRead) == -21);
+	check("getVariableRange of no variables", ppmaccomm->PowerPMACcontrol_getVariableRange('P', 1, 0, tableRead) == 0 &&
+		  tableRead.empty());
+	check("variable ranges reject other letters",
+		  ppmaccomm->PowerPMACcontrol_getVariableRange('X', 1, 10, tableRead) == PowerPMACcontrol::PPMACcontrolInvalidParamError &&
+		  ppmaccomm->PowerPMACcontrol_setVariableRange('I', 1, table) == PowerPMACcontrol::PPMACcontrolInvalidParamError);
+
+	// A compensation table whose values need all 17 digits to be read back the same
+	std::vector<double> compensation(100000);
+	for (size_t i = 0; i < compensation.size(); i++)
+	{
+		compensation[i] = sin(i * 0.001) * 1e-3;
+	}
+	check("setArray", ppmaccomm->PowerPMACcontrol_setArray("CompTable[1].Data", 0, compensation) == 0);
+	std::vector<std::string> entryNames;
+	std::vector<std::string> entryValues;
+	for (size_t i = 0; i < compensation.size(); i += 997)
+	{
+		char name[64];
+		sprintf(name, "CompTable[1].Data[%lu]", (unsigned long)i);
+		entryNames.push_back(name);
+	}
+	bool exact = ppmaccomm->PowerPMACcontrol_getVariables(entryNames, entryValues) == 0;
+	for (size_t i = 0; exact && i < entryValues.size(); i++)
+	{
+		exact = strtod(entryValues[i].c_str(), NULL) == compensation[i * 997];
+	}
+	check("setArray writes the values exactly", exact);
+	check("setArray from memory at an offset", ppmaccomm->PowerPMACcontrol_setArray("Sys.Ddata", 10, &compensation[5], 3) == 0 &&
+		  ppmaccomm->PowerPMACcontrol_getVariable("Sys.Ddata[12]", d1) == 0 && d1 == compensation[7]);
+	check("setArray of an array out of range", ppmaccomm->PowerPMACcontrol_setArray("CompTable[300].Data", 0, compensation) == -21);
+	check("setArray rejects an invalid array",
+		  ppmaccomm->PowerPMACcontrol_setArray("CompTable[1].Data[0]=", 0, compensation) == PowerPMACcontrol::PPMACcontrolInvalidParamError &&
+		  ppmaccomm->PowerPMACcontrol_setArray("Sys.Ddata", 0, NULL, 3) == PowerPMACcontrol::PPMACcontrolInvalidParamError);
+
+	// Without a safety channel a stop waits for the download in progress, which takes longer than the common timeout
+	PowerPMACcontrol *mainOnly = new PowerPMACcontrol();
+	BackgroundDownload download;
+	download.ppmac = mainOnly;
+	download.program = "open prog 21\n";
+	for (int i = 0; i < 10000; i++)
+	{
+		sprintf(line, "X%d\n", i);
+		download.program += line;
+	}
+	download.program += "close\n";
+	download.finished = false;
+	download.result = -1;
+	pthread_t downloadThread;
+	bool stopPassed = false;
+	if (mainOnly->PowerPMACcontrol_connect("sim://200", "root", "deltatau", "22", false, false) == 0 &&
+		pthread_create(&downloadThread, NULL, downloadInBackground, &download) == 0)
+	{
+		usleep(100000);
+		stopPassed = !download.finished && mainOnly->PowerPMACcontrol_stopAllAxes() == 0 && download.finished;
+		pthread_join(downloadThread, NULL);
+	}
+	check("stopAllAxes without a safety channel completes during a long download", stopPassed && download.result == 0);
+	delete mainOnly;
+
+	check("reset", ppmaccomm->PowerPMACcontrol_reset() == 0 &&
+		  ppmaccomm->PowerPMACcontrol_getVariable("P1", d1) == 0 && d1 == 0);
+	check("disconnect", ppmaccomm->PowerPMACcontrol_disconnect() == 0);
+	delete ppmaccomm;
+
+	printf("%d failures\n", failures);
+	return failures;
+}
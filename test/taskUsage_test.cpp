@@ -0,0 +1,68 @@
+/*
+ * @file taskUsage_test.cpp
+ *
+ * Connect to the Power PMAC, sample the CPU usage by the PMAC tasks in the background
+ * and print the statistics over the last 10 seconds once per second, so that intermittent
+ * overruns of the servo task can be observed without polling from the application.
+ */
+
+#include <iostream>
+#include <string>
+#include "PowerPMACcontrol.h"
+#include "argParser.h"
+
+using namespace PowerPMACcontrol_ns;
+
+static void printStatistic(const char *name, const TaskUsageStatistic& statistic)
+{
+	printf("%-16s min %8.3f  max %8.3f  mean %8.3f  p99 %8.3f\n",
+			name, statistic.min, statistic.max, statistic.mean, statistic.p99);
+}
+
+int main(int argc, char *argv[])
+{
+	// Get connection parameters from the command line arguments
+	// Default values are defined in argParser.h
+	argParser args(argc, argv);
+
+	std::string u_ipaddr 	= args.getIp();
+	std::string u_user 		= args.getUser();
+	std::string u_passw		= args.getPassw();
+	std::string u_port		= args.getPort();
+	bool 		u_nominus2	= args.getNominus2();
+
+	PowerPMACcontrol *ppmaccomm = new PowerPMACcontrol();
+	int estatus = ppmaccomm->PowerPMACcontrol_connect( u_ipaddr.c_str(), u_user.c_str() , u_passw.c_str(), u_port.c_str(), u_nominus2);
+	if (estatus != 0)
+	{
+	printf("Error connecting to power pmac. exit:\n");
+	return 0;
+	}
+	else
+	{
+		printf("Connected OK.\n");
+	}
+
+	// Sample at 20 Hz, keeping one minute of history
+	estatus = ppmaccomm->PowerPMACcontrol_startTaskUsageSampling(50, 1200);
+	printf("PowerPMACcontrol_startTaskUsageSampling returned %i.\n", estatus);
+
+	while (true)
+	{
+		sleep(1);
+		TaskUsageStatistics stats;
+		estatus = ppmaccomm->PowerPMACcontrol_getTaskUsageStatistics(10000, stats);
+		if (estatus != ppmaccomm->PPMACcontrolNoError)
+		{
+			printf("PowerPMACcontrol_getTaskUsageStatistics returned %i.\n", estatus);
+			continue;
+		}
+		printf("\n%d samples over %.1f s\n", stats.numSamples, stats.windowEnd - stats.windowStart);
+		printStatistic("Phase %", stats.phaseTaskUsage);
+		printStatistic("Servo %", stats.servoTaskUsage);
+		printStatistic("RT interrupt %", stats.rtIntTaskUsage);
+		printStatistic("Background %", stats.bgTaskUsage);
+		printStatistic("CPU %", stats.CPUUsage);
+		printStatistic("CPU temp C", stats.CPUTemperature);
+	}
+}
@@ -0,0 +1,27 @@
+/**
+ * @file testCheck.h
+ * @brief Checks shared by the tests which run against the simulated Power PMAC
+ *
+ * Each check prints PASS or FAIL with its name. A test prints the number of failures
+ * at the end and returns it as its exit status.
+ */
+
+#ifndef TESTCHECK_H_
+#define TESTCHECK_H_
+
+#include <stdio.h>
+
+/// Number of checks which have failed so far
+static int failures = 0;
+
+/// Print the result of a check and count it if it failed
+static void check(const char *name, bool passed)
+{
+	printf("%s  %s\n", passed ? "PASS" : "FAIL", name);
+	if (!passed)
+	{
+		failures++;
+	}
+}
+
+#endif
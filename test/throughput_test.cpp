@@ -0,0 +1,126 @@
+/*
+ * @file throughput_test.cpp
+ *
+ * Connect to the Power PMAC and measure the number of status queries completed per second
+ * when 1, 4, 16 and 32 threads share the connection. Each thread sends queries back to back,
+ * as the threads in multi_thread_test do. The request queue statistics are printed for each
+ * run to show how long the requests waited for the I/O thread, followed by the latency
+ * of each phase of the queries from the command metrics.
+ */
+
+#include <iostream>
+#include <string>
+#include <pthread.h>
+#include "PowerPMACcontrol.h"
+#include "argParser.h"
+
+using namespace PowerPMACcontrol_ns;
+
+#define RUN_SECONDS	5
+#define MAX_THREADS	32
+
+static PowerPMACcontrol *ppmaccomm;
+static volatile bool running;
+static int completed[MAX_THREADS];
+static int errors[MAX_THREADS];
+
+void *queryStatus(void *arg)
+{
+	long index = (long)arg;
+	uint32_t status;
+	while (running)
+	{
+		int ret = ppmaccomm->PowerPMACcontrol_getGlobalStatus(status);
+		if (ret == PowerPMACcontrol::PPMACcontrolNoError)
+			completed[index]++;
+		else
+			errors[index]++;
+	}
+	return 0;
+}
+
+static void printPhases()
+{
+	static const char *phaseNames[CommandPhaseCount] = {"queue wait", "write", "echo", "first byte", "ack", "total"};
+	static CommandMetricsSnapshot metrics;
+	ppmaccomm->PowerPMACcontrol_getCommandMetrics(metrics);
+	for (int phase = 0; phase < CommandPhaseCount; phase++)
+	{
+		const LatencyHistogramSnapshot& histogram = metrics.histograms[CommandClassQuery][phase];
+		printf("    %-10s  p50 %8.3f ms  p99 %8.3f ms  max %8.3f ms\n", phaseNames[phase],
+				histogram.getPercentileSecs(50)*1000.0, histogram.getPercentileSecs(99)*1000.0,
+				histogram.getMaxSecs()*1000.0);
+	}
+	const CommandClassCounters& counters = metrics.counters[CommandClassQuery];
+	printf("    %lu queries, %lu queue timeouts, %lu I/O timeouts, %lu PMAC errors, %lu other errors\n",
+			counters.requests, counters.queueTimeouts, counters.ioTimeouts, counters.pmacErrors, counters.otherErrors);
+}
+
+static void runThreads(int numThreads)
+{
+	pthread_t threads[MAX_THREADS];
+	ppmaccomm->PowerPMACcontrol_resetQueueStatistics();
+	ppmaccomm->PowerPMACcontrol_resetCommandMetrics();
+	running = true;
+	double start = getMonotonicTimeSecs();
+	for (long i = 0; i < numThreads; i++)
+	{
+		completed[i] = 0;
+		errors[i] = 0;
+		pthread_create(&threads[i], NULL, &queryStatus, (void *)i);
+	}
+	sleep(RUN_SECONDS);
+	running = false;
+
+	int totalCompleted = 0, totalErrors = 0;
+	for (int i = 0; i < numThreads; i++)
+	{
+		pthread_join(threads[i], NULL);
+		totalCompleted += completed[i];
+		totalErrors += errors[i];
+	}
+	double elapsed = getMonotonicTimeSecs() - start;
+
+	RequestQueueStatistics stats;
+	ppmaccomm->PowerPMACcontrol_getQueueStatistics(stats);
+	const RequestQueueLaneStatistics& lane = stats.lanes[RequestPriorityNormal];
+	printf("%2d threads: %8.1f queries/s  %d errors  mean wait %7.2f ms  max wait %7.2f ms  max depth %d\n",
+			numThreads, totalCompleted/elapsed, totalErrors,
+			(lane.requests > 0) ? lane.totalWaitSecs/lane.requests*1000.0 : 0.0,
+			lane.maxWaitSecs*1000.0, lane.maxDepth);
+	printPhases();
+}
+
+int main(int argc, char *argv[])
+{
+	// Get connection parameters from the command line arguments
+	// Default values are defined in argParser.h
+	argParser args(argc, argv);
+
+	std::string u_ipaddr 	= args.getIp();
+	std::string u_user 		= args.getUser();
+	std::string u_passw		= args.getPassw();
+	std::string u_port		= args.getPort();
+	bool 		u_nominus2	= args.getNominus2();
+
+	ppmaccomm = new PowerPMACcontrol();
+	int estatus = ppmaccomm->PowerPMACcontrol_connect( u_ipaddr.c_str(), u_user.c_str() , u_passw.c_str(), u_port.c_str(), u_nominus2);
+	if (estatus != 0)
+	{
+		printf("Error connecting to power pmac. exit:\n");
+		return 0;
+	}
+	else
+	{
+		printf("Connected OK.\n");
+	}
+
+	runThreads(1);
+	runThreads(4);
+	runThreads(16);
+	runThreads(32);
+
+	ppmaccomm->PowerPMACcontrol_disconnect();
+	delete ppmaccomm;
+	return 0;
+}
@@ -0,0 +1,101 @@
+/*
+ * @file trace_test.cpp
+ *
+ * Connect to the Power PMAC with the trace on and print each event to stdout with traceToFile.
+ * A few commands are sent, including one which Power PMAC rejects, and then 4 threads send status
+ * queries for a few seconds with a small trace buffer, so that some events are dropped.
+ * The time taken by the queries with the trace off and on is printed to show its cost.
+ */
+
+#include <iostream>
+#include <string>
+#include <pthread.h>
+#include "PowerPMACcontrol.h"
+#include "argParser.h"
+
+using namespace PowerPMACcontrol_ns;
+
+#define NUM_QUERIES	2000
+#define NUM_THREADS	4
+
+static PowerPMACcontrol *ppmaccomm;
+
+/// Sink which only counts the events
+static void countEvents(const TraceEvent& event, void *userData)
+{
+	(*(unsigned long *)userData)++;
+}
+
+void *queryStatus(void *arg)
+{
+	uint32_t status;
+	for (int i = 0; i < NUM_QUERIES; i++)
+	{
+		ppmaccomm->PowerPMACcontrol_getGlobalStatus(status);
+	}
+	return 0;
+}
+
+/// Send the queries from several threads and return the time taken in seconds
+static double runThreads()
+{
+	pthread_t threads[NUM_THREADS];
+	double start = getMonotonicTimeSecs();
+	for (int i = 0; i < NUM_THREADS; i++)
+	{
+		pthread_create(&threads[i], NULL, &queryStatus, NULL);
+	}
+	for (int i = 0; i < NUM_THREADS; i++)
+	{
+		pthread_join(threads[i], NULL);
+	}
+	return getMonotonicTimeSecs() - start;
+}
+
+int main(int argc, char *argv[])
+{
+	// Get connection parameters from the command line arguments
+	// Default values are defined in argParser.h
+	argParser args(argc, argv);
+
+	std::string u_ipaddr 	= args.getIp();
+	std::string u_user 		= args.getUser();
+	std::string u_passw		= args.getPassw();
+	std::string u_port		= args.getPort();
+	bool 		u_nominus2	= args.getNominus2();
+
+	ppmaccomm = new PowerPMACcontrol();
+	ppmaccomm->PowerPMACcontrol_startTrace(traceToFile, stdout);
+
+	int estatus = ppmaccomm->PowerPMACcontrol_connect( u_ipaddr.c_str(), u_user.c_str() , u_passw.c_str(), u_port.c_str(), u_nominus2);
+	if (estatus != 0)
+	{
+		printf("Error connecting to power pmac. exit:\n");
+		ppmaccomm->PowerPMACcontrol_stopTrace();
+		delete ppmaccomm;
+		return 0;
+	}
+
+	std::string reply;
+	ppmaccomm->PowerPMACcontrol_sendCommand("Sys.Time", reply);
+	ppmaccomm->PowerPMACcontrol_sendCommand("P1=1", reply);
+	ppmaccomm->PowerPMACcontrol_sendCommand("NotAVariable", reply);
+	ppmaccomm->PowerPMACcontrol_stopTrace();
+	printf("Trace stopped\n");
+
+	double offSecs = runThreads();
+
+	unsigned long events = 0;
+	ppmaccomm->PowerPMACcontrol_startTrace(countEvents, &events, 64, 50);
+	double onSecs = runThreads();
+	ppmaccomm->PowerPMACcontrol_stopTrace();
+
+	unsigned long dropped;
+	ppmaccomm->PowerPMACcontrol_getTraceDropped(dropped);
+	printf("%d queries: trace off %.3f s, trace on %.3f s, %lu events, %lu dropped\n",
+			NUM_QUERIES*NUM_THREADS, offSecs, onSecs, events, dropped);
+
+	ppmaccomm->PowerPMACcontrol_disconnect();
+	delete ppmaccomm;
+	return 0;
+}
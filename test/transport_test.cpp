@@ -0,0 +1,121 @@
+/*
+ * @file transport_test.cpp
+ *
+ * Send the same commands through each transport and print the replies and the time per status query:
+ * the mock:// transport, which acknowledges every command, a MockTransport with a responder and a latency
+ * of 1 ms, and an SSH connection to the Power PMAC given on the command line.
+ * The first two run without a Power PMAC, so the time of the protocol and parsing layers can be compared
+ * with the time on the network.
+ */
+
+#include <iostream>
+#include <string>
+#include <stdlib.h>
+#include "PowerPMACcontrol.h"
+#include "mockTransport.h"
+#include "argParser.h"
+
+using namespace PowerPMACcontrol_ns;
+
+#define NUM_QUERIES	1000
+
+/// Reply to the commands of this test like a Power PMAC with one P-variable
+static void respond(const std::string& line, std::string& reply, void *userData)
+{
+	double *p1 = (double *)userData;
+	if (line == "?")
+	{
+		reply = "$00000000";
+	}
+	else if (line.compare(0, 3, "P1=") == 0)
+	{
+		*p1 = atof(line.c_str() + 3);
+	}
+	else if (line == "P1")
+	{
+		char buff[64];
+		sprintf(buff, "P1=%g", *p1);
+		reply = buff;
+	}
+	else
+	{
+		reply = "stdin:1:1: error #20: ILLEGAL CMD: " + line;
+	}
+}
+
+/// Send the same commands in each run and print the replies and the time per status query
+static void runCommands(PowerPMACcontrol *ppmaccomm)
+{
+	static const char *commands[] = {"P1=5", "P1", "NotAVariable"};
+	std::string reply;
+	for (size_t i = 0; i < sizeof(commands)/sizeof(commands[0]); i++)
+	{
+		int ret = ppmaccomm->PowerPMACcontrol_sendCommand(commands[i], reply);
+		printf("  %-16s ret %4d reply [%s]\n", commands[i], ret, reply.c_str());
+	}
+	uint32_t status;
+	int errors = 0;
+	double start = getMonotonicTimeSecs();
+	for (int i = 0; i < NUM_QUERIES; i++)
+	{
+		if (ppmaccomm->PowerPMACcontrol_getGlobalStatus(status) != 0)
+		{
+			errors++;
+		}
+	}
+	double elapsed = getMonotonicTimeSecs() - start;
+	printf("  %d status queries, %d errors, %.1f us per query\n", NUM_QUERIES, errors, elapsed * 1e6 / NUM_QUERIES);
+	ppmaccomm->PowerPMACcontrol_disconnect();
+}
+
+int main(int argc, char *argv[])
+{
+	// Get connection parameters from the command line arguments
+	// Default values are defined in argParser.h
+	argParser args(argc, argv);
+
+	std::string u_ipaddr 	= args.getIp();
+	std::string u_user 		= args.getUser();
+	std::string u_passw		= args.getPassw();
+	std::string u_port		= args.getPort();
+	bool 		u_nominus2	= args.getNominus2();
+
+	PowerPMACcontrol *ppmaccomm = new PowerPMACcontrol();
+
+	printf("mock://\n");
+	int estatus = ppmaccomm->PowerPMACcontrol_connect("mock://", u_user.c_str(), u_passw.c_str(), u_port.c_str(), u_nominus2);
+	if (estatus != 0)
+	{
+		printf("  Error %d connecting\n", estatus);
+	}
+	else
+	{
+		runCommands(ppmaccomm);
+	}
+
+	printf("MockTransport with a responder and 1 ms latency\n");
+	double p1 = 0.0;
+	estatus = ppmaccomm->PowerPMACcontrol_connectTransport(new MockTransport(respond, &p1, 0.001), u_nominus2);
+	if (estatus != 0)
+	{
+		printf("  Error %d connecting\n", estatus);
+	}
+	else
+	{
+		runCommands(ppmaccomm);
+	}
+
+	printf("%s\n", u_ipaddr.c_str());
+	estatus = ppmaccomm->PowerPMACcontrol_connect(u_ipaddr.c_str(), u_user.c_str(), u_passw.c_str(), u_port.c_str(), u_nominus2);
+	if (estatus != 0)
+	{
+		printf("  Error %d connecting\n", estatus);
+	}
+	else
+	{
+		runCommands(ppmaccomm);
+	}
+
+	delete ppmaccomm;
+	return 0;
+}
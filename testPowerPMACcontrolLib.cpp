@@ -88,6 +88,8 @@ void testController (const char * u_ipaddr, const char * u_user, const char * u_
       cout << "21. getCPUTemperature(double&)" << endl;
       cout << "22. getRunningTime(double&)" << endl;
       cout << "23. isConnected()" << endl;
+      cout << "24. getTaskUsage(double&, double&, double&, double&, double&)" << endl;
+      cout << "25. abortAllMprogs()" << endl;
       cout << "Please enter your selection (0 to exit) : ";
       
       string str;
@@ -487,6 +489,26 @@ void testController (const char * u_ipaddr, const char * u_user, const char * u_
           			cout << "Connection problem" << endl;
           		break;
           	}
+          	case 24: /* getTaskUsage */
+          	{
+          		double phase, servo, rtInt, bg, cpu;
+          		estatus = ppmaccomm->PowerPMACcontrol_getTaskUsage(phase, servo, rtInt, bg, cpu);
+          		checkPMACerror(estatus);
+          		if (estatus == PowerPMACcontrol::PPMACcontrolNoError)
+          		{
+          			cout << "Phase task usage: " << phase << "%" << endl;
+          			cout << "Servo task usage: " << servo << "%" << endl;
+          			cout << "Real-time interrupt task usage: " << rtInt << "%" << endl;
+          			cout << "Background task usage: " << bg << "%" << endl;
+          			cout << "Total CPU usage by PMAC tasks: " << cpu << "%" << endl;
+          		}
+          		break;
+          	}
+          	case 25: /* abortAllMprogs */
+          		cout << "Aborting all motion programs" << endl;
+          		estatus = ppmaccomm->PowerPMACcontrol_abortAllMprogs();
+          		checkPMACerror(estatus);
+          		break;
              default:
              	cout << "Input value '" << str << "' was not recognised as a test case." << endl;
              break;
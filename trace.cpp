@@ -0,0 +1,369 @@
+/********************************************
+ *  trace.cpp
+ *
+ *  Runtime trace of the commands sent to
+ *  the Power PMAC, passed to a user sink by
+ *  a background thread.
+ *
+ ********************************************/
+
+/**
+ * @file trace.cpp
+ * @brief C++ source file for the PowerPMACcontrol_ns::Tracer class.
+ */
+
+#include "trace.h"
+#include "commandMetrics.h"
+#include "PowerPMACcontrol.h"
+#include <string.h>
+#ifndef WIN32
+#include <errno.h>
+#include <sched.h>
+#endif
+
+namespace PowerPMACcontrol_ns
+{
+
+/**
+ * Constructor for the tracer. Tracing is initially off and no buffer is allocated.
+ */
+Tracer::Tracer()
+{
+  enabled_ = false;
+  inFlight_ = 0;
+  dropped_ = 0;
+  slots_ = NULL;
+  mask_ = 0;
+  writePosition_ = 0;
+  readPosition_ = 0;
+  sink_ = NULL;
+  userData_ = NULL;
+  period_ms_ = 0;
+#ifdef WIN32
+  ghStopTrace = CreateSemaphore(NULL, 0, 1, NULL);
+  ghTraceThread = NULL;
+#else
+  sem_init(&sem_stopTrace, 0, 0);
+#endif
+}
+
+/**
+ * Destructor for the tracer. Events still in the buffer are passed to the sink first.
+ */
+Tracer::~Tracer()
+{
+  stop();
+  delete[] slots_;
+#ifdef WIN32
+  CloseHandle(ghStopTrace);
+#else
+  sem_destroy(&sem_stopTrace);
+#endif
+}
+
+/**
+ * Start tracing. Must not be called at the same time as stop.
+ *
+ * @param sink - Function called on the trace thread for each event
+ * @param userData - Passed to the sink with each event
+ * @param bufferLength - Number of events the buffer holds, rounded up to a power of two.
+ * Events recorded while the buffer is full are dropped.
+ * @param period_ms - Interval in ms at which the trace thread empties the buffer
+ * @return PPMACcontrolNoError(0), PPMACcontrolInvalidParamError(-242) if the sink is NULL or a length
+ * or period is not positive, or PPMACcontrolSoftwareError(-232) if the thread could not be created.
+ */
+int Tracer::start(TraceSink sink, void *userData, int bufferLength, int period_ms)
+{
+  static const char *functionName = "Tracer::start";
+  if (sink == NULL || bufferLength <= 0 || period_ms <= 0)
+    return PowerPMACcontrol::PPMACcontrolInvalidParamError;
+
+  stop();
+
+  unsigned long length = 1;
+  while (length < (unsigned long)bufferLength)
+    length <<= 1;
+  if (length != mask_ + 1 || slots_ == NULL)
+  {
+    delete[] slots_;
+    slots_ = new Slot[length];
+    mask_ = length - 1;
+  }
+  // The buffer is empty after stop, so the positions can start again from 0
+  for (unsigned long index = 0; index < length; index++)
+  {
+    slots_[index].sequence = (long)index;
+  }
+  writePosition_ = 0;
+  readPosition_ = 0;
+  dropped_ = 0;
+  sink_ = sink;
+  userData_ = userData;
+  period_ms_ = period_ms;
+
+#ifdef WIN32
+  ghTraceThread = CreateThread(NULL, 0, traceThread, this, 0, NULL);
+  if (ghTraceThread == NULL)
+#else
+  if (pthread_create(&traceThreadId, NULL, traceThread, this) != 0)
+#endif
+  {
+    debugPrint_ppmaccomm("%s : Error creating the trace thread\n", functionName);
+    return PowerPMACcontrol::PPMACcontrolSoftwareError;
+  }
+  enabled_ = true;
+  return PowerPMACcontrol::PPMACcontrolNoError;
+}
+
+/**
+ * Stop tracing. Events already recorded are passed to the sink before this returns.
+ */
+void Tracer::stop()
+{
+  if (!enabled_)
+    return;
+  enabled_ = false;
+
+  // Let threads which saw tracing on finish their events
+  while (inFlight_ != 0)
+  {
+#ifdef WIN32
+    Sleep(0);
+#else
+    sched_yield();
+#endif
+  }
+
+#ifdef WIN32
+  ReleaseSemaphore(ghStopTrace, 1, NULL);
+  WaitForSingleObject(ghTraceThread, INFINITE);
+  CloseHandle(ghTraceThread);
+  ghTraceThread = NULL;
+#else
+  sem_post(&sem_stopTrace);
+  pthread_join(traceThreadId, NULL);
+#endif
+}
+
+/**
+ * Get the number of events dropped because the buffer was full since tracing started.
+ */
+unsigned long Tracer::getDropped() const
+{
+  return (unsigned long)dropped_;
+}
+
+/**
+ * Claim the next slot of the buffer.
+ *
+ * @return The slot to fill in, or NULL if tracing is off or the buffer is full.
+ * If not NULL, endRecord must be called.
+ */
+Tracer::Slot *Tracer::beginRecord()
+{
+  atomicIncrement(&inFlight_);
+  if (!enabled_)
+  {
+    atomicDecrement(&inFlight_);
+    return NULL;
+  }
+
+  unsigned long position = (unsigned long)writePosition_;
+  while (true)
+  {
+    Slot& slot = slots_[position & mask_];
+    long difference = (long)((unsigned long)atomicLoadLong(&slot.sequence) - position);
+    if (difference == 0)
+    {
+      // The slot is free. Claim it if no other thread has.
+      if (atomicCompareAndSwapLong(&writePosition_, (long)position, (long)(position + 1)))
+      {
+        slot.event.time = getMonotonicTimeSecs();
+        return &slot;
+      }
+    }
+    else if (difference < 0)
+    {
+      // The trace thread has not emptied the slot yet
+      atomicIncrement(&dropped_);
+      atomicDecrement(&inFlight_);
+      return NULL;
+    }
+    position = (unsigned long)writePosition_;
+  }
+}
+
+/**
+ * Mark a slot claimed by beginRecord as complete, so that the trace thread can take it.
+ */
+void Tracer::endRecord(Slot *slot)
+{
+  unsigned long position = (unsigned long)slot->sequence;
+  // Full barrier, so the trace thread sees the whole event
+  atomicCompareAndSwapLong(&slot->sequence, (long)position, (long)(position + 1));
+  atomicDecrement(&inFlight_);
+}
+
+/**
+ * Copy a command into an event, replacing newlines with spaces and dropping trailing spaces.
+ */
+void Tracer::copyText(char *destination, const char *source)
+{
+  int length = 0;
+  if (source != NULL)
+  {
+    while (length < TRACE_TEXT_LENGTH - 1 && source[length] != '\0')
+    {
+      char c = source[length];
+      destination[length] = (c == '\n' || c == '\r') ? ' ' : c;
+      length++;
+    }
+  }
+  while (length > 0 && destination[length - 1] == ' ')
+    length--;
+  destination[length] = '\0';
+}
+
+/**
+ * Record a command written to the Power PMAC. May be called from any thread.
+ *
+ * @param channel - One of the TraceChannel values
+ * @param commandClass - One of the CommandClass values
+ * @param cmd - The command
+ * @param bytesWritten - Bytes of the command written
+ * @param bytesRead - Bytes of the reply read
+ * @param timing - Timestamps of the write and read, from SSHDriver::getTiming
+ * @param result - Return value of the command
+ */
+void Tracer::traceCommand(int channel, int commandClass, const char *cmd, size_t bytesWritten,
+                          size_t bytesRead, const SSHDriverTiming& timing, int result)
+{
+  Slot *slot = beginRecord();
+  if (slot == NULL)
+    return;
+  TraceEvent *event = &slot->event;
+  event->type = TraceEventCommand;
+  event->channel = channel;
+  event->commandClass = commandClass;
+  event->result = result;
+  event->bytesWritten = (unsigned int)bytesWritten;
+  event->bytesRead = (unsigned int)bytesRead;
+  event->timing = timing;
+  copyText(event->text, cmd);
+  endRecord(slot);
+}
+
+/**
+ * Record an event other than a command. May be called from any thread.
+ *
+ * @param type - One of the TraceEventType values
+ * @param channel - One of the TraceChannel values
+ * @param commandClass - CommandClass of the command the event concerns, or -1
+ * @param text - Host name or command the event concerns, may be NULL
+ * @param result - Error code, or PPMACcontrolNoError
+ */
+void Tracer::traceEvent(int type, int channel, int commandClass, const char *text, int result)
+{
+  Slot *slot = beginRecord();
+  if (slot == NULL)
+    return;
+  TraceEvent *event = &slot->event;
+  event->type = type;
+  event->channel = channel;
+  event->commandClass = commandClass;
+  event->result = result;
+  event->bytesWritten = 0;
+  event->bytesRead = 0;
+  memset(&event->timing, 0, sizeof(event->timing));
+  copyText(event->text, text);
+  endRecord(slot);
+}
+
+/**
+ * Pass the complete events in the buffer to the sink, oldest first. Only called on the trace thread.
+ */
+void Tracer::drain()
+{
+  while (true)
+  {
+    Slot& slot = slots_[readPosition_ & mask_];
+    // Full barrier, so the event is not read before its sequence number
+    long difference = (long)((unsigned long)atomicLoadLong(&slot.sequence) - (readPosition_ + 1));
+    if (difference != 0)
+      break;
+    // Copy the event so that the slot can be reused while the sink runs
+    TraceEvent event = slot.event;
+    atomicCompareAndSwapLong(&slot.sequence, (long)(readPosition_ + 1), (long)(readPosition_ + mask_ + 1));
+    readPosition_++;
+    sink_(event, userData_);
+  }
+}
+
+/**
+ * Body of the trace thread.
+ *
+ * Empties the buffer, then waits for the period or for the stop semaphore to be posted.
+ */
+#ifdef WIN32
+DWORD WINAPI Tracer::traceThread(LPVOID arg)
+#else
+void *Tracer::traceThread(void *arg)
+#endif
+{
+  Tracer *tracer = (Tracer *)arg;
+  while (true)
+  {
+    tracer->drain();
+#ifdef WIN32
+    if (WaitForSingleObject(tracer->ghStopTrace, tracer->period_ms_) == WAIT_OBJECT_0)
+      break;
+#else
+    struct timespec ts = getAbsTimeout(tracer->period_ms_);
+    int ret;
+    while ((ret = sem_timedwait(&tracer->sem_stopTrace, &ts)) != 0 && errno == EINTR)
+      ;
+    if (ret == 0)
+      break;
+#endif
+  }
+  // Events recorded before stop was called
+  tracer->drain();
+  return 0;
+}
+
+/**
+ * Sink which writes each event as a line of text.
+ *
+ * Commands show the time of each phase in ms: writing the command, reading its echo,
+ * waiting for the first byte of the reply and reading the rest of the reply.
+ *
+ * @param event - The trace event
+ * @param file - FILE pointer to write to, for example stderr
+ */
+void traceToFile(const TraceEvent& event, void *file)
+{
+  static const char *typeNames[] = {"command", "connect", "disconnect", "queue-timeout", "safety-fallback"};
+  static const char *classNames[CommandClassCount] = {"query", "set", "motor", "safety", "download"};
+  FILE *out = (FILE *)file;
+  const char *typeName = (event.type >= 0 && event.type <= TraceEventSafetyFallback) ? typeNames[event.type] : "unknown";
+  const char *channelName = (event.channel == TraceChannelSafety) ? "safety" : "main";
+
+  if (event.type == TraceEventCommand)
+  {
+    const SSHDriverTiming& timing = event.timing;
+    const char *className = (event.commandClass >= 0 && event.commandClass < CommandClassCount) ? classNames[event.commandClass] : "-";
+    double firstByte = (timing.firstByte > 0.0) ? timing.firstByte : timing.readEnd;
+    fprintf(out, "%.6f %s %s %s rc=%d wr=%u rd=%u write=%.3f echo=%.3f first=%.3f ack=%.3f [%s]\n",
+            event.time, typeName, channelName, className, event.result, event.bytesWritten, event.bytesRead,
+            (timing.writeEnd - timing.writeStart)*1000.0, (timing.echoEnd - timing.writeEnd)*1000.0,
+            (firstByte - timing.readStart)*1000.0, (timing.readEnd - firstByte)*1000.0, event.text);
+  }
+  else
+  {
+    fprintf(out, "%.6f %s %s %d rc=%d [%s]\n", event.time, typeName, channelName, event.commandClass,
+            event.result, event.text);
+  }
+  fflush(out);
+}
+
+}
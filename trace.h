@@ -0,0 +1,149 @@
+/**
+ * @file trace.h
+ * @brief Header file for the PowerPMACcontrol_ns::Tracer class
+ *
+ * The Tracer records binary trace events of the commands sent to the Power PMAC
+ * into a lock-free ring buffer. A background thread passes the events to a sink
+ * function provided by the user. Tracing is switched on and off at run time and
+ * costs a single test of a flag when it is off.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+/* Might need to define WIN32 for MinGW */
+#if defined(_WIN32) && !defined(WIN32)
+#define WIN32
+#endif
+
+#include <stdio.h>
+#include "libssh2Driver.h"
+#include "atomicOps.h"
+
+#ifdef WIN32
+# include <winsock2.h>
+#else
+# include <pthread.h>
+# include <semaphore.h>
+#endif
+
+///	Default number of events held by the trace buffer
+#define DEFAULT_TRACE_BUFFER_LENGTH 4096
+///	Default interval in ms at which the trace thread passes events to the sink
+#define DEFAULT_TRACE_PERIOD_MS 100
+
+namespace PowerPMACcontrol_ns
+{
+
+/**
+ * Types of trace event
+ */
+enum TraceEventType
+{
+  TraceEventCommand = 0,        ///< A command was written and its reply read
+  TraceEventConnect = 1,        ///< A connection was opened, or failed to open
+  TraceEventDisconnect = 2,     ///< The connection was closed
+  TraceEventQueueTimeout = 3,   ///< A request timed out waiting for the I/O thread
+  TraceEventSafetyFallback = 4  ///< The safety channel failed and the command was sent on the main connection
+};
+
+/**
+ * Channels a command can be sent on
+ */
+enum TraceChannel
+{
+  TraceChannelMain = 0,         ///< The main connection, used by the I/O thread
+  TraceChannelSafety = 1        ///< The safety channel reserved for stop and abort commands
+};
+
+/// Maximum length of the command text held by a trace event, including the terminating NUL
+#define TRACE_TEXT_LENGTH 80
+
+/**
+ * @brief A binary trace event
+ *
+ * All times are in seconds from the same monotonic clock as getMonotonicTimeSecs.
+ */
+struct TraceEvent
+{
+  double time;                  ///< Time the event was recorded
+  int type;                     ///< One of the TraceEventType values
+  int channel;                  ///< One of the TraceChannel values
+  int commandClass;             ///< CommandClass of the command, or -1
+  int result;                   ///< PPMACcontrolNoError or the error code
+  unsigned int bytesWritten;    ///< Bytes of the command written
+  unsigned int bytesRead;       ///< Bytes of the reply read
+  SSHDriverTiming timing;       ///< Timestamps of the write and read of a command
+  char text[TRACE_TEXT_LENGTH]; ///< Command text or host name, truncated and without newlines
+};
+
+/**
+ * Function called on the trace thread for each event, in the order the events were recorded.
+ * @param event - The trace event
+ * @param userData - The pointer passed to PowerPMACcontrol_startTrace
+ */
+typedef void (*TraceSink)(const TraceEvent& event, void *userData);
+
+void traceToFile(const TraceEvent& event, void *file);
+
+/**
+ * @class Tracer
+ * @brief Lock-free ring buffer of trace events and the thread which passes them to the sink.
+ *
+ * Any thread may record an event. A slot is claimed with a compare-and-swap on the write
+ * position and each slot has a sequence number which tells the trace thread when the
+ * event in it is complete. If the buffer is full, the event is dropped and counted.
+ */
+class Tracer {
+  public:
+    Tracer();
+    virtual ~Tracer();
+    int start(TraceSink sink, void *userData, int bufferLength, int period_ms);
+    void stop();
+    /// Test whether tracing is on. Callers test this before building an event.
+    inline bool isEnabled() const {return enabled_;};
+    unsigned long getDropped() const;
+
+    void traceCommand(int channel, int commandClass, const char *cmd, size_t bytesWritten,
+                      size_t bytesRead, const SSHDriverTiming& timing, int result);
+    void traceEvent(int type, int channel, int commandClass, const char *text, int result);
+
+  private:
+    struct Slot
+    {
+      volatile long sequence;
+      TraceEvent event;
+    };
+
+    volatile bool enabled_;
+    volatile long inFlight_;    // Threads between the enabled test and the end of a record
+    volatile long dropped_;
+
+    Slot *slots_;
+    unsigned long mask_;
+    volatile long writePosition_;
+    unsigned long readPosition_;
+
+    TraceSink sink_;
+    void *userData_;
+    int period_ms_;
+
+    Slot *beginRecord();
+    void endRecord(Slot *slot);
+    void drain();
+    static void copyText(char *destination, const char *source);
+
+#ifdef WIN32
+    static DWORD WINAPI traceThread(LPVOID arg);
+    HANDLE ghStopTrace;
+    HANDLE ghTraceThread;
+#else
+    static void *traceThread(void *arg);
+    sem_t sem_stopTrace;
+    pthread_t traceThreadId;
+#endif
+};
+
+}
+
+#endif
@@ -0,0 +1,503 @@
+/********************************************
+ *  transport.cpp
+ *
+ *  Read/write/flush logic shared by all the
+ *  transports between PowerPMACcontrol and
+ *  gpascii, and the selection of a transport
+ *  from the host name.
+ *
+ ********************************************/
+
+#include "transport.h"
+#include "libssh2Driver.h"
+#include "mockTransport.h"
+#include "pmacSimulator.h"
+#include "fdTransport.h"
+#include "replayDriver.h"
+#include "sessionRecorder.h"
+#include <string.h>
+
+/*
+ * Uncomment the DEBUG define and recompile for lots of
+ * driver debug messages.
+ */
+/* #define DEBUG 1 */
+
+#ifdef DEBUG
+#define debugPrint printf
+#else
+static void debugPrint(...){}
+#endif
+
+/**
+ * Constructor for the transport. Initializes internal variables.
+ */
+Transport::Transport()
+{
+  connected_ = 0;
+  recorder_ = NULL;
+  memset(&timing_, 0, sizeof(timing_));
+}
+
+/**
+ * Destructor, cleanup.
+ */
+Transport::~Transport()
+{
+}
+
+/**
+ * Create the transport for a host name given to PowerPMACcontrol_connect.
+ *
+ * @param host - One of
+ *      - mock:// for an in-process MockTransport which acknowledges every command
+ *      - sim:// for a MockTransport connected to the shared PmacSimulator, or sim://latency
+ *        with the reply latency in microseconds
+ *      - unix://path for an FdTransport connected to the Unix-domain socket at path
+ *      - pipe://command for an FdTransport connected to the standard input and output of command
+ *      - replay://filename for a ReplayDriver playing back a session log with its original timing
+ *      - any other name or IP address for an SSHDriver
+ * @return - The new transport, which the caller must delete.
+ */
+Transport *Transport::create(const char *host)
+{
+  if (strncmp(host, "mock://", 7) == 0){
+    return new MockTransport();
+  }
+  if (strncmp(host, "sim://", 6) == 0){
+    return PmacSimulator::createTransport(host + 6);
+  }
+  if (strncmp(host, "unix://", 7) == 0){
+    return new FdTransport(FdTransport::FdTransportUnixSocket, host + 7);
+  }
+  if (strncmp(host, "pipe://", 7) == 0){
+    return new FdTransport(FdTransport::FdTransportPipe, host + 7);
+  }
+  if (strncmp(host, "replay://", 9) == 0){
+    return new ReplayDriver(host + 9, 1.0);
+  }
+  return new SSHDriver(host);
+}
+
+/**
+ * Setup the username for the connection. Transports other than SSH
+ * do not log in, so only the length is checked.
+ *
+ * @param username - Username for the connection.
+ * @return - Success(SSHDriverSuccess) or failure(SSHDriverErrorInvalidParameter).
+ */
+SSHDriverStatus Transport::setUsername(const char *username)
+{
+  if (strlen(username) > 255)
+    return SSHDriverErrorInvalidParameter;
+  return SSHDriverSuccess;
+}
+
+/**
+ * Setup the password for the connection. Transports other than SSH
+ * do not log in, so only the length is checked.
+ *
+ * @param password - Password for the connection.
+ * @return - Success(SSHDriverSuccess) or failure(SSHDriverErrorInvalidParameter).
+ */
+SSHDriverStatus Transport::setPassword(const char *password)
+{
+  if (strlen(password) > 255)
+    return SSHDriverErrorInvalidParameter;
+  return SSHDriverSuccess;
+}
+
+/**
+ * Setup the port for the connection. Transports other than SSH
+ * do not use a port, so only the length is checked.
+ *
+ * @param port - Port for the connection.
+ * @return - Success(SSHDriverSuccess) or failure(SSHDriverErrorInvalidParameter).
+ */
+SSHDriverStatus Transport::setPort(const char *port)
+{
+  if (strlen(port) > 255)
+    return SSHDriverErrorInvalidParameter;
+  return SSHDriverSuccess;
+}
+
+/**
+ * Read the welcome line and the command line prompt sent by the shell
+ * once the connection is open.
+ */
+void Transport::readWelcome()
+{
+  // Here we should wait for the initial welcome line
+  char buffer[1024];
+  size_t bytes = 0;
+  read(buffer, 1024, &bytes, '\n', 1000);
+  // And the command line
+  read(buffer, 1024, &bytes, 0x20, 1000);
+}
+
+/**
+ * Flush the connection as best as possible.
+ *
+ * @return - Success or failure.
+ */
+SSHDriverStatus Transport::flush()
+{
+  char buff[2048];
+  static const char *functionName = "Transport::flush";
+  debugPrint("%s : Method called\n", functionName);
+
+  if (connected_ == 0){
+    debugPrint("%s : Not connected\n", functionName);
+    return SSHDriverErrorNoconn;
+  }
+
+  channelFlush();
+  ssize_t rc = receiveBytes(buff, 2048);
+  if (rc < 0){
+    return SSHDriverErrorNoconn;
+  }
+  return SSHDriverSuccess;
+}
+
+/**
+ * Write data to the connected channel.  A timeout should be
+ * specified in milliseconds.
+ *
+ * @param buffer - The string buffer to be written.
+ * @param bufferSize - The number of bytes to write.
+ * @param bytesWritten - The number of bytes that were written.
+ * @param timeout - A timeout in ms for the write.
+ * @return - Success(SSHDriverSuccess) if it succeeds to write. The possible error numbers are
+ *      - SSHDriverErrorNoconn if there is no connection. 
+ *      - SSHDriverErrorInvalidParameter if bufferSize is too large.
+ *      - SSHDriverErrorNobytes if no bytes were written.
+ *      - SSHDriverErrorWriteTimeout if timeout occurs
+ */
+SSHDriverStatus Transport::write(const char *buffer, size_t bufferSize, size_t *bytesWritten, int timeout)
+{
+  static const int CHAR_SIZE = 5120;
+  char input[CHAR_SIZE];
+  static const char *functionName = "Transport::write";
+  double stimesecs, ctimesecs, time_at_timeout;
+  
+  debugPrint("%s : Method called\n", functionName);
+  *bytesWritten = 0;
+
+  if (connected_ == 0){
+    debugPrint("%s : Not connected\n", functionName);
+    return SSHDriverErrorNoconn;
+  }
+
+  if (bufferSize > (CHAR_SIZE-1))
+  {
+      debugPrint("%s : Buffer size too large\n", functionName);
+      return SSHDriverErrorInvalidParameter;
+  }
+  
+  strncpy(input, buffer, bufferSize);
+  input[bufferSize] = 0;
+  flush();
+  debugPrint("%s : Writing => %s\n", functionName, input);
+
+  stimesecs = currentTimeSecs ();
+  time_at_timeout = stimesecs + timeout/1000.0;
+  timing_.writeStart = stimesecs;
+  ssize_t rc = sendBytes(buffer, bufferSize);
+  timing_.writeEnd = currentTimeSecs ();
+  timing_.echoEnd = timing_.writeEnd;
+  if (rc > 0){
+    debugPrint("%s : %d bytes written\n", functionName, rc);
+    *bytesWritten = rc;
+  } else {
+    debugPrint("%s : No bytes were written, libssh2 error (%d)\n", functionName, rc);
+    bytesWritten = 0;
+    return SSHDriverErrorNobytes;
+  }
+
+  // Now we need to read back the same number of bytes, to remove the written string from the buffer
+  int bytesToRead = *bytesWritten;
+  int bytes = 0;
+  char buff[CHAR_SIZE];
+  rc = 0;
+  int crCount = 0;
+    
+  // Count the number of \n characters sent
+  for (int index = 0; index < (int)*bytesWritten; index++){
+    if (buffer[index] == '\n'){
+      // CR, need to read back 1 extra character
+      crCount++;
+    }
+  }
+  ctimesecs = 0.0;
+  bytesToRead += crCount;
+  while ((bytesToRead > 0) && (ctimesecs < time_at_timeout)){
+    rc = receiveBytes(&buff[bytes], bytesToRead);
+    if (rc > 0){
+      bytes+=rc;
+      bytesToRead-=rc;
+    }
+    if (bytesToRead > 0){
+      ctimesecs = currentTimeSecs ();
+    }
+  }
+
+  buff[bytes] = '\0';
+  debugPrint("%s : Bytes =>\n", functionName);
+  for (int j = 0; j < bytes; j++){
+    debugPrint("[%d] ", buff[j]);
+  }
+  debugPrint("\n");
+
+  ctimesecs = currentTimeSecs ();
+  timing_.echoEnd = ctimesecs;
+  debugPrint("%s : Time taken for write => %ld ms\n", functionName, (long)((ctimesecs - stimesecs) * 1000) );
+  if (ctimesecs >= time_at_timeout){
+    return SSHDriverErrorWriteTimeout;
+  }
+
+  return SSHDriverSuccess;
+}
+
+/**
+ * Read data from the connected channel.  A timeout should be
+ * specified in milliseconds.  The read method will continue to
+ * read data from the channel until either the specified 
+ * terminator is read or the timeout is reached.
+ *
+ * @param buffer - A string buffer to hold the read data.
+ * @param bufferSize - The maximum number of bytes to read.
+ * @param bytesWritten - The number of bytes that have been read.
+ * @param readTerm - A terminator to use as a check for EOM (End Of Message).
+ * @param timeout - A timeout in ms for the read.
+ * @return - Success or failure.
+ */
+SSHDriverStatus Transport::read(char *buffer, size_t bufferSize, size_t *bytesRead, int readTerm, int timeout)
+{
+  static const char *functionName = "Transport::read";
+  double stimesecs, ctimesecs, time_at_timeout;  
+  
+  debugPrint("%s : Method called\n", functionName);
+  debugPrint("%s : Read terminator %d\n", functionName, readTerm);
+
+  if (connected_ == 0){
+    debugPrint("%s : Not connected\n", functionName);
+    return SSHDriverErrorNoconn;
+  }
+
+  ssize_t rc = 0;
+  int matched = 0;
+  int matchedindex = 0;
+  int lastCount = 0;
+  *bytesRead = 0;
+  ctimesecs = 0.0;
+  
+  stimesecs = currentTimeSecs ();
+  time_at_timeout = stimesecs + timeout/1000.0;
+  timing_.readStart = stimesecs;
+  timing_.firstByte = 0.0;
+  while ((matched == 0) && (ctimesecs < time_at_timeout)){
+    rc = receiveBytes(&buffer[*bytesRead], (bufferSize-*bytesRead));
+    if (rc > 0){
+      if (*bytesRead == 0){
+        timing_.firstByte = currentTimeSecs ();
+      }
+      *bytesRead+=rc;
+    }
+    for (int index = lastCount; index < (int)*bytesRead; index++){
+      // Match against output terminator
+      if (buffer[index] == readTerm){
+        matched = 1;
+        matchedindex = index;
+      }
+    }
+    lastCount = *bytesRead;
+    if (matched == 0){
+      ctimesecs = currentTimeSecs ();
+    }
+  }
+
+  buffer[matchedindex] = '\0';
+  debugPrint("%s : Bytes =>\n", functionName);
+  for (int j = 0; j < lastCount; j++){
+    debugPrint("[%d] ", buffer[j]);
+  }
+  debugPrint("\n");
+  debugPrint("%s : Matched %d\n", functionName, matched);
+
+  *bytesRead = lastCount;
+  debugPrint("%s : Line => %s", functionName, buffer);
+
+  ctimesecs = currentTimeSecs ();
+  timing_.readEnd = ctimesecs;
+  debugPrint("%s : Time taken for read => %ld ms\n", functionName,  (long)((ctimesecs - stimesecs) * 1000) );
+  if (ctimesecs >= time_at_timeout){
+    return SSHDriverErrorReadTimeout;
+  }
+
+  return SSHDriverSuccess;
+}
+
+/**
+ * Write all the bytes to the channel without reading back their echo, so that
+ * several commands can be in flight. The caller reads the echoes with the replies.
+ *
+ * @param buffer - The bytes to write.
+ * @param bufferSize - The number of bytes to write.
+ * @param timeout - A timeout in ms for the write.
+ * @return - Success(SSHDriverSuccess) if every byte was written. The possible error numbers are
+ *      - SSHDriverErrorNoconn if there is no connection.
+ *      - SSHDriverErrorNobytes if the channel failed.
+ *      - SSHDriverErrorWriteTimeout if timeout occurs
+ */
+SSHDriverStatus Transport::writeNoEcho(const char *buffer, size_t bufferSize, int timeout)
+{
+  static const char *functionName = "Transport::writeNoEcho";
+  if (connected_ == 0){
+    debugPrint("%s : Not connected\n", functionName);
+    return SSHDriverErrorNoconn;
+  }
+  double stimesecs = currentTimeSecs ();
+  double time_at_timeout = stimesecs + timeout/1000.0;
+  timing_.writeStart = stimesecs;
+  size_t written = 0;
+  while (written < bufferSize){
+    ssize_t rc = sendBytes(&buffer[written], bufferSize - written);
+    if (rc > 0){
+      written += rc;
+    } else if (rc < 0){
+      debugPrint("%s : Write failed (%d)\n", functionName, rc);
+      return SSHDriverErrorNobytes;
+    } else if (currentTimeSecs () >= time_at_timeout){
+      return SSHDriverErrorWriteTimeout;
+    }
+  }
+  timing_.writeEnd = currentTimeSecs ();
+  timing_.echoEnd = timing_.writeEnd;
+  return SSHDriverSuccess;
+}
+
+/**
+ * Read the bytes available from the channel, waiting for at least one to arrive.
+ *
+ * @param buffer - A buffer to hold the bytes.
+ * @param bufferSize - The maximum number of bytes to read.
+ * @param bytesRead - The number of bytes read.
+ * @param timeout - A timeout in ms for the first byte.
+ * @return - Success(SSHDriverSuccess) if bytes were read, SSHDriverErrorNoconn if there is no connection
+ * or SSHDriverErrorReadTimeout if none arrived in time.
+ */
+SSHDriverStatus Transport::readAvailable(char *buffer, size_t bufferSize, size_t *bytesRead, int timeout)
+{
+  static const char *functionName = "Transport::readAvailable";
+  *bytesRead = 0;
+  if (connected_ == 0){
+    debugPrint("%s : Not connected\n", functionName);
+    return SSHDriverErrorNoconn;
+  }
+  double time_at_timeout = currentTimeSecs () + timeout/1000.0;
+  while (true){
+    ssize_t rc = receiveBytes(buffer, bufferSize);
+    if (rc > 0){
+      *bytesRead = rc;
+      return SSHDriverSuccess;
+    }
+    if (currentTimeSecs () >= time_at_timeout){
+      return SSHDriverErrorReadTimeout;
+    }
+  }
+}
+
+/**
+ * Write a file on the controller. The transport does not support it unless overridden.
+ *
+ * @param remotePath - Path of the file on the controller, overwritten if it exists.
+ * @param data - The contents of the file.
+ * @param length - The number of bytes.
+ * @param timeout - A timeout in ms for each step of the transfer.
+ * @return - SSHDriverError.
+ */
+SSHDriverStatus Transport::uploadData(const char *remotePath, const char *data, size_t length, int timeout)
+{
+  return SSHDriverError;
+}
+
+/**
+ * Run a shell command on the controller, beside the gpascii session. The transport does
+ * not support it unless overridden.
+ *
+ * @param command - The command line, run by the shell of the user.
+ * @param output - The standard output of the command.
+ * @param exitStatus - The exit status of the command.
+ * @param timeout - A timeout in ms for each part of the output.
+ * @return - SSHDriverError.
+ */
+SSHDriverStatus Transport::execCommand(const char *command, std::string& output, int& exitStatus, int timeout)
+{
+  return SSHDriverError;
+}
+
+/**
+ * Record every byte written to and read from the channel from now on.
+ * The recorder is not owned by the driver and must outlive its use.
+ *
+ * @param recorder - An open recorder, or NULL to stop recording.
+ */
+void Transport::setRecorder(SessionRecorder *recorder)
+{
+  recorder_ = recorder;
+}
+
+/**
+ * Write bytes to the channel, recording them if a recorder is set.
+ */
+ssize_t Transport::sendBytes(const char *buffer, size_t bufferSize)
+{
+  ssize_t rc = channelWrite(buffer, bufferSize);
+  if (rc > 0 && recorder_ != NULL){
+    recorder_->record(SessionRecordSent, buffer, rc, currentTimeSecs());
+  }
+  return rc;
+}
+
+/**
+ * Read the bytes available from the channel, recording them if a recorder is set.
+ */
+ssize_t Transport::receiveBytes(char *buffer, size_t bufferSize)
+{
+  ssize_t rc = channelRead(buffer, bufferSize);
+  if (rc > 0 && recorder_ != NULL){
+    recorder_->record(SessionRecordReceived, buffer, rc, currentTimeSecs());
+  }
+  return rc;
+}
+
+/**
+ * Get the timestamps of the last write and read.
+ *
+ * @return - Reference to the timestamps, updated by each write and read.
+ */
+const SSHDriverTiming& Transport::getTiming() const
+{
+  return timing_;
+}
+
+double Transport::currentTimeSecs ()
+{
+#ifdef WIN32
+  static BOOL initialized = FALSE;
+  LARGE_INTEGER timeNow;
+  static LARGE_INTEGER proc_freq;
+
+  if (! initialized)
+  {
+    if (QueryPerformanceFrequency(&proc_freq)!=TRUE) printf("QueryPerformanceFrequency() failed\n");
+    initialized = TRUE;
+  }
+  QueryPerformanceCounter(&timeNow);
+  return((double) (((double)timeNow.QuadPart)/((double)proc_freq.QuadPart)));
+#else
+  struct timespec timeNow;
+  clock_gettime(CLOCK_MONOTONIC, &timeNow);
+  return((double)(timeNow.tv_sec + timeNow.tv_nsec/1E9));
+#endif
+}
@@ -0,0 +1,124 @@
+/* Might need to define WIN32 for MinGW */
+#if defined(_WIN32) && !defined(WIN32)
+#define WIN32
+#endif
+
+#ifndef transport_H
+#define transport_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <string>
+#ifdef WIN32
+# include <winsock2.h>
+#else
+# include <sys/types.h>
+#endif
+
+#if defined(_MSC_VER) && !defined(ssize_t)
+# include <BaseTsd.h>
+typedef SSIZE_T ssize_t;
+#endif
+
+class SessionRecorder;
+
+typedef enum e_SSHDriverStatus
+{
+  SSHDriverSuccess,
+  SSHDriverError,           /* SSH Generic error */
+  SSHDriverErrorNobytes,    /* SSH Zero bytes written */
+  SSHDriverErrorNoconn,     /* SSH Not connected */
+  SSHDriverErrorPassword,   /* SSH Authentication by password failed */
+  SSHDriverErrorPty,        /* SSH Failed requesting dumb pty */
+  SSHDriverErrorPublicKey,  /* SSH Authentication by public key failed */
+  SSHDriverErrorShell,      /* SSH Unable to request shell on allocated pty\ */
+  SSHDriverErrorSockfail,   /* SSH socket failed to connect */
+  SSHDriverErrorSshInit,    /* libssh2 initialization failed */
+  SSHDriverErrorSshSession, /* libssh2 failed to create a session instance */
+  SSHDriverErrorReadTimeout,  /* SSH read timed out */
+  SSHDriverErrorWriteTimeout, /* SSH write Timed out */
+  SSHDriverErrorUnknownHost,   /* Host unknown */
+  SSHDriverErrorInvalidParameter   /* Parameter Invalid */
+} SSHDriverStatus;
+
+/**
+ * Timestamps of the last write and read in seconds, from the same monotonic clock
+ * as the timeouts. They are used to measure where the time of a command is spent.
+ */
+typedef struct s_SSHDriverTiming
+{
+  double writeStart;  /* Before the bytes are written */
+  double writeEnd;    /* After the bytes have been written */
+  double echoEnd;     /* After the echo of the written bytes has been read back */
+  double readStart;   /* Start of the read */
+  double firstByte;   /* First byte of the reply received, 0 if nothing was received */
+  double readEnd;     /* Terminator received or the read timed out */
+} SSHDriverTiming;
+
+/**
+ * The Transport class is the interface between PowerPMACcontrol and the byte stream
+ * connected to gpascii. It implements the read/write/flush logic shared by all the
+ * transports: reading back the echo of each write, reading up to a terminator,
+ * the timestamps and the session recording. A transport provides the connection
+ * and the raw, non-blocking channel I/O. A transport which can reach the file system of
+ * the controller also provides uploadData and execCommand.
+ *
+ * The transports are:
+ *      - SSHDriver, an SSH connection made with libssh2
+ *      - MockTransport, an in-process stand-in for gpascii
+ *      - FdTransport, a Unix-domain socket or a pipe to a local program
+ *      - ReplayDriver, which plays back a recorded session
+ *
+ * Transport::create selects one from the host name given to PowerPMACcontrol_connect.
+ */
+class Transport {
+
+  public:
+    Transport();
+    virtual SSHDriverStatus setUsername(const char *username);
+    virtual SSHDriverStatus setPassword(const char *password);
+    virtual SSHDriverStatus setPort(const char *port);
+    virtual SSHDriverStatus connectTransport() = 0;
+    virtual SSHDriverStatus disconnectTransport() = 0;
+    SSHDriverStatus flush();
+    SSHDriverStatus write(const char *buffer, size_t bufferSize, size_t *bytesWritten, int timeout);
+    SSHDriverStatus read(char *buffer, size_t bufferSize, size_t *bytesRead, int readTerm, int timeout);
+    SSHDriverStatus writeNoEcho(const char *buffer, size_t bufferSize, int timeout);
+    SSHDriverStatus readAvailable(char *buffer, size_t bufferSize, size_t *bytesRead, int timeout);
+    virtual SSHDriverStatus uploadData(const char *remotePath, const char *data, size_t length, int timeout);
+    virtual SSHDriverStatus execCommand(const char *command, std::string& output, int& exitStatus, int timeout);
+    const SSHDriverTiming& getTiming() const;
+    void setRecorder(SessionRecorder *recorder);
+    virtual ~Transport();
+
+    static Transport *create(const char *host);
+
+  protected:
+    int connected_;
+
+    /**
+     * Write bytes to the channel.
+     * @return - The number of bytes written, 0 if the channel cannot take any now, or a negative value on error.
+     */
+    virtual ssize_t channelWrite(const char *buffer, size_t bufferSize) = 0;
+    /**
+     * Read the bytes available from the channel. May wait briefly but must not block.
+     * @return - The number of bytes read, 0 or a negative value if none were read.
+     */
+    virtual ssize_t channelRead(char *buffer, size_t bufferSize) = 0;
+    /**
+     * Discard any output which has not been read yet, if the channel can.
+     */
+    virtual int channelFlush() = 0;
+    void readWelcome();
+    double currentTimeSecs ();
+
+  private:
+    SSHDriverTiming timing_;
+    SessionRecorder *recorder_;
+
+    ssize_t sendBytes(const char *buffer, size_t bufferSize);
+    ssize_t receiveBytes(char *buffer, size_t bufferSize);
+};
+
+#endif